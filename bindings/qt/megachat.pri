@@ -13,11 +13,17 @@ SOURCES += megachatapi.cpp \
             base64url.cpp \
             chatClient.cpp \
             chatd.cpp \
+            chatdTrace.cpp \
+            chatServices.cpp \
+            sdkChatServices.cpp \
+            dbWriter.cpp \
+            msgSearchIndex.cpp \
             url.cpp \
             karereCommon.cpp \
             userAttrCache.cpp \
             base/logger.cpp \
             base/cservices.cpp \
+            base/timerWheel.cpp \
             net/websocketsIO.cpp \
             karereDbSchema.cpp \
             net/libwebsocketsIO.cpp \
@@ -33,12 +39,19 @@ HEADERS  += asyncTest-framework.h \
             chatClient.h \
             chatdICrypto.h \
             db.h \
+            dbWriter.h \
+            msgSearchIndex.h \
+            memberIndex.h \
+            sharedKeyCache.h \
             karereId.h \
             presenced.h \
             serverListProvider.h \
             autoHandle.h \
             chatCommon.h  \
             chatdMsg.h \
+            chatdTrace.h \
+            chatServices.h \
+            sdkChatServices.h \
             dummyCrypto.h  \
             megachatapi.h  \
             rtcCrypto.h \
@@ -62,6 +75,7 @@ HEADERS  += asyncTest-framework.h \
             base/cservices-thread.h \
             base/cservices.h \
             base/gcmpp.h \
+            base/histogram.h \
             base/logger.h \
             base/loggerFile.h \
             base/loggerConsole.h \
@@ -69,6 +83,10 @@ HEADERS  += asyncTest-framework.h \
             base/promise.h \
             base/services.h \
             base/timers.hpp \
+            base/timerWheel.h \
+            base/slotMap.h \
+            base/snapshotMap.h \
+            base/threadSafety.h \
             base/trackDelete.h \
             net/libwsIO.h \
             net/libwebsocketsIO.h \
@@ -82,6 +100,8 @@ HEADERS  += asyncTest-framework.h \
             rtcModule/messages.h \
             rtcModule/rtcmPrivate.h \
             rtcModule/rtcStats.h \
+            rtcModule/sampleBuffer.h \
+            rtcModule/statsPollPolicy.h \
             rtcModule/streamPlayer.h \
             rtcModule/webrtc.h \
             rtcModule/webrtcAdapter.h \
@@ -109,7 +129,8 @@ CONFIG(USE_WEBRTC) {
     SOURCES += rtcCrypto.cpp \
              rtcModule/webrtc.cpp \
              rtcModule/webrtcAdapter.cpp \
-             rtcModule/rtcStats.cpp
+             rtcModule/rtcStats.cpp \
+             rtcModule/sampleBuffer.cpp
 
 }
 else {
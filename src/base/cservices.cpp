@@ -2,9 +2,10 @@
 #include "gcm.h"
 #include <memory>
 #include <thread>
-#include <unordered_map>
 #include <assert.h>
 #include "cservices-thread.h"
+#include "slotMap.h"
+#include "threadSafety.h"
 #include <sys/time.h>
 
 extern "C"
@@ -95,69 +96,56 @@ MEGAIO_EXPORT int services_shutdown()
 //Handle store
 struct HandleItem
 {
-    unsigned short type;
-    void* ptr;
+    unsigned short type = 0;
+    void* ptr = nullptr;
+    HandleItem() {}
     HandleItem(unsigned short aType, void* aPtr):type(aType), ptr(aPtr){}
-    bool operator==(const HandleItem& other) const
-    {
-        return ((type == other.type) && (ptr == other.ptr));
-    }
 };
 
-std::unordered_map<megaHandle, HandleItem> gHandleStore;
-megaHandle gHandleCtr = 0;
-std::recursive_mutex timerMutex;
+// Handles are slot indexes tagged with the generation of the slot, see slotMap.h
+static karere::Mutex gHandleStoreMutex;
+static karere::SlotMap<HandleItem> gHandleStore KR_GUARDED_BY(gHandleStoreMutex);
 
 MEGAIO_EXPORT void* services_hstore_get_handle(unsigned short type, megaHandle handle)
 {
-    auto it = gHandleStore.find(handle);
-    if ((it == gHandleStore.end()) || (it->second.type != type))
+    karere::MutexLock lock(gHandleStoreMutex);
+    HandleItem* item = gHandleStore.get(handle);
+    if (!item || (item->type != type))
         return nullptr;
-    return it->second.ptr;
+    return item->ptr;
 }
 
 MEGAIO_EXPORT megaHandle services_hstore_add_handle(unsigned short type, void* ptr)
 {
-#ifndef NDEBUG
-    megaHandle old = gHandleCtr;
-#endif
-    megaHandle id = ++gHandleCtr;
-#ifndef NDEBUG
-    if (id < old)
+    karere::MutexLock lock(gHandleStoreMutex);
+    megaHandle id = gHandleStore.insert(HandleItem(type, ptr));
+    if (!id)
     {
-        fprintf(stderr, "ERROR: megaHandle id generator wrapped around\n");
+        fprintf(stderr, "ERROR: services_hstore_add_handle: Handle store is full (%zu handles)\n", gHandleStore.size());
         fflush(stderr);
         abort();
     }
-    bool inserted =
-#endif
-    gHandleStore.emplace(std::piecewise_construct,
-                         std::forward_as_tuple(id), std::forward_as_tuple(type, ptr))
-#ifndef NDEBUG
-    .second
-#endif
-    ;
-    assert(inserted);
     return id;
 }
 
 MEGAIO_EXPORT int services_hstore_remove_handle(unsigned short type, megaHandle handle)
 {
-    auto it = gHandleStore.find(handle);
-    if (it == gHandleStore.end())
+    karere::MutexLock lock(gHandleStoreMutex);
+    HandleItem* item = gHandleStore.get(handle);
+    if (!item)
     {
 #ifndef NDEBUG
         fprintf(stderr, "ERROR: services_hstore_remove_handle: Handle not found (id=%u, type=%d)\n", handle, type);
 #endif
         return 0;
     }
-    if (it->second.type != type)
+    if (item->type != type)
     {
-        fprintf(stderr, "ERROR: services_hstore_remove_handle: Handle found, but requested type %u does not match actual type %u\n", type, it->second.type);
+        fprintf(stderr, "ERROR: services_hstore_remove_handle: Handle found, but requested type %u does not match actual type %u\n", type, item->type);
         fflush(stderr);
         return 0;
     }
-    gHandleStore.erase(it);
+    gHandleStore.remove(handle);
     return 1;
 }
 
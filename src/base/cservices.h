@@ -76,7 +76,10 @@ MEGAIO_IMPEXP int services_shutdown();
 
 //Handle store
 
-typedef unsigned int megaHandle; //invalid handle value is 0
+/** Opaque to users, invalid handle value is 0. Internally, it's the index of
+ * the slot in the handle store (low 18 bits) and the generation of the slot
+ * (high 14 bits), so handles of removed items are detected as invalid */
+typedef unsigned int megaHandle;
 
 enum
 {
@@ -0,0 +1,133 @@
+#ifndef KARERE_HISTOGRAM_H
+#define KARERE_HISTOGRAM_H
+/**
+ * @file histogram.h
+ * @brief Lock-free latency histogram with power-of-two microsecond buckets.
+ * Recording is a couple of relaxed atomic increments, so it can be used from
+ * any thread, including hot paths, and read concurrently by another thread.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <stdint.h>
+
+namespace karere
+{
+class LatencyHistogram
+{
+public:
+    /** Bucket \c i holds samples in the range [2^(i-1), 2^i) microseconds,
+     * bucket 0 holds samples below 1us, and the last bucket is open-ended (> ~35 min) */
+    enum { kBucketCount = 32 };
+    typedef std::chrono::steady_clock Clock;
+
+    /** @brief Records the time elapsed since construction when going out of scope */
+    class Scope
+    {
+    protected:
+        LatencyHistogram& mHist;
+        Clock::time_point mStart;
+    public:
+        Scope(LatencyHistogram& hist): mHist(hist), mStart(Clock::now()) {}
+        ~Scope() { mHist.record(mStart); }
+    };
+
+protected:
+    std::atomic<uint64_t> mBuckets[kBucketCount];
+    std::atomic<uint64_t> mCount;
+    std::atomic<uint64_t> mSumUs;
+    std::atomic<uint64_t> mMaxUs;
+    static unsigned bucketOf(uint64_t us)
+    {
+        unsigned bucket = 0;
+        while (us && bucket < kBucketCount-1)
+        {
+            us >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
+
+public:
+    LatencyHistogram() { reset(); }
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+    void reset()
+    {
+        for (unsigned i = 0; i < kBucketCount; i++)
+            mBuckets[i].store(0, std::memory_order_relaxed);
+        mCount.store(0, std::memory_order_relaxed);
+        mSumUs.store(0, std::memory_order_relaxed);
+        mMaxUs.store(0, std::memory_order_relaxed);
+    }
+    void record(uint64_t us)
+    {
+        mBuckets[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+        mCount.fetch_add(1, std::memory_order_relaxed);
+        mSumUs.fetch_add(us, std::memory_order_relaxed);
+        uint64_t max = mMaxUs.load(std::memory_order_relaxed);
+        while (us > max && !mMaxUs.compare_exchange_weak(max, us, std::memory_order_relaxed));
+    }
+    void record(Clock::time_point start)
+    {
+        record((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - start).count());
+    }
+    uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+    uint64_t maxUs() const { return mMaxUs.load(std::memory_order_relaxed); }
+    uint64_t avgUs() const
+    {
+        uint64_t cnt = count();
+        return cnt ? mSumUs.load(std::memory_order_relaxed) / cnt : 0;
+    }
+    /** @brief Returns the upper bound of the bucket that contains the
+     * requested percentile (0-100), in microseconds, but not more than the
+     * max sample */
+    uint64_t percentileUs(unsigned pct) const
+    {
+        uint64_t total = count();
+        if (!total)
+            return 0;
+        uint64_t target = (total * pct + 99) / 100;
+        uint64_t acc = 0;
+        for (unsigned i = 0; i < kBucketCount; i++)
+        {
+            acc += mBuckets[i].load(std::memory_order_relaxed);
+            if (acc >= target)
+                return (i == kBucketCount-1) ? maxUs() : std::min((uint64_t)1 << i, maxUs());
+        }
+        return maxUs();
+    }
+    /** @brief Serializes the histogram as a JSON object. Only non-empty
+     * buckets are included, keyed by their upper bound in microseconds */
+    std::string toJson() const
+    {
+        std::string result;
+        result.reserve(256);
+        result.append("{\"count\":").append(std::to_string(count()))
+              .append(",\"avg\":").append(std::to_string(avgUs()))
+              .append(",\"p50\":").append(std::to_string(percentileUs(50)))
+              .append(",\"p90\":").append(std::to_string(percentileUs(90)))
+              .append(",\"p99\":").append(std::to_string(percentileUs(99)))
+              .append(",\"max\":").append(std::to_string(maxUs()))
+              .append(",\"buckets\":{");
+        bool first = true;
+        for (unsigned i = 0; i < kBucketCount; i++)
+        {
+            uint64_t val = mBuckets[i].load(std::memory_order_relaxed);
+            if (!val)
+                continue;
+            if (first)
+                first = false;
+            else
+                result+=',';
+            result.append("\"").append(std::to_string((uint64_t)1 << i))
+                  .append("\":").append(std::to_string(val));
+        }
+        result.append("}}");
+        return result;
+    }
+};
+}
+#endif
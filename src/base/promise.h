@@ -7,6 +7,8 @@
 #include <string>
 #include <utility>
 #include <memory>
+#include <new>
+#include <type_traits>
 #include <assert.h>
 
 /** @brief The name of the unhandled promise error handler. This handler is
@@ -137,13 +139,46 @@ public:
     virtual ~PromiseBase(){}
 };
 
+/** List of callbacks, optimized for the common case of a single callback per
+ * promise: the pointers to the first kInlineItems callbacks are stored in the
+ * list itself, and so is the first callback object, if it is not bigger than
+ * kInlineCbSize. The rest are allocated on the heap.
+ * Callbacks moved from another list (see addListMoveItems()) can be stored
+ * inline in that list, so the owner must keep it alive as long as this one.
+ */
 template <class C>
 class CallbackList
 {
+public:
+    enum { kInlineItems = 2, kInlineCbSize = 96 };
 protected:
-    std::vector<C*> items;
+    struct Item
+    {
+        C* cb;
+        bool isInline;
+    };
+    Item mInlineItems[kInlineItems];
+    std::vector<Item> mMoreItems;
+    int mCount = 0;
+    typename std::aligned_storage<kInlineCbSize>::type mInlineCb;
+    bool mInlineCbUsed = false;
+    Item& item(int idx)
+    {
+        assert((idx >= 0) && (idx < mCount));
+        return (idx < kInlineItems) ? mInlineItems[idx] : mMoreItems[idx - kInlineItems];
+    }
+    void pushItem(C* cb, bool isInline)
+    {
+        if (mCount < kInlineItems)
+            mInlineItems[mCount] = Item{cb, isInline};
+        else
+            mMoreItems.push_back(Item{cb, isInline});
+        mCount++;
+    }
 public:
     CallbackList(){}
+    CallbackList(const CallbackList&) = delete;
+    CallbackList& operator=(const CallbackList&) = delete;
 /**
  * Takes ownership of callback, copies the promise.
  * Accepts the callback as a smart pointer of type SP.
@@ -153,45 +188,72 @@ public:
     template<class SP>
     inline void push(SP& cb)
     {
-        items.push_back(cb.release());
+        if (mCount >= kInlineItems)
+            mMoreItems.reserve(mCount - kInlineItems + 1);
+        pushItem(cb.release(), false);
     }
-
-    inline C*& operator[](int idx)
+    /** Constructs a callback of type \c Cb in the list, inline if possible */
+    template<class Cb, class... Args>
+    inline void emplace(Args&&... args)
     {
-        assert((idx >= 0) && (idx < (int)items.size()));
-        return items[idx];
+        static_assert(std::is_base_of<C, Cb>::value, "Callback type must be inherited from the list's callback interface");
+        if (mCount >= kInlineItems)
+            mMoreItems.reserve(mCount - kInlineItems + 1);
+        if (!mInlineCbUsed && (sizeof(Cb) <= kInlineCbSize)
+            && (std::alignment_of<Cb>::value <= std::alignment_of<decltype(mInlineCb)>::value))
+        {
+            C* cb = new (&mInlineCb) Cb(std::forward<Args>(args)...);
+            mInlineCbUsed = true;
+            pushItem(cb, true);
+        }
+        else
+        {
+            pushItem(new Cb(std::forward<Args>(args)...), false);
+        }
     }
-    inline const C*& operator[](int idx) const
+    inline C*& operator[](int idx)
     {
-        assert((idx >= 0) && (idx < items.size()));
-        return items[idx];
+        return item(idx).cb;
     }
     inline C*& first()
     {
-        assert(!items.empty());
-        return items[0];
+        return item(0).cb;
     }
     inline int count() const
     {
-        return items.size();
+        return mCount;
     }
+    /** True if a callback is stored in this list's inline storage, even
+     * if it has been moved to another list */
+    bool hasInlineCb() const { return mInlineCbUsed; }
     inline void addListMoveItems(CallbackList& other)
     {
-        items.insert(items.end(), other.items.begin(), other.items.end());
-        other.clear();
+        for (int i = 0; i < other.mCount; i++)
+        {
+            Item& otherItem = other.item(i);
+            pushItem(otherItem.cb, otherItem.isInline);
+        }
+        other.mCount = 0;
+        other.mMoreItems.clear();
     }
     void clear()
     {
         static_assert(std::is_base_of<IVirtDtor, C>::value, "Callback type must be inherited from IVirtDtor");
-        for (auto it = items.begin(); it != items.end(); it++)
+        for (int i = 0; i < mCount; i++)
         {
-            delete ((IVirtDtor*)*it); //static_cast wont work here because there is no info that ICallback inherits from IVirtDtor
+            Item& cbItem = item(i);
+            IVirtDtor* cb = (IVirtDtor*)cbItem.cb; //static_cast wont work here because there is no info that ICallback inherits from IVirtDtor
+            if (cbItem.isInline)
+                cb->~IVirtDtor();
+            else
+                delete cb;
         }
-        items.clear();
+        mCount = 0;
+        mMoreItems.clear();
     }
     ~CallbackList()
     {
-        assert(items.empty());
+        assert(mCount == 0);
     }
 };
 
@@ -247,14 +309,6 @@ protected:
         FailCb(CB&& cb, const Promise<T>& next)
         :Callback<Error, CB, T>(std::forward<CB>(cb), next){}
     };
-/** Helper funtion to be able to deduce the callback type of the passed lambda and create and
-  * Callback object with that type. We cannot do that by directly calling the Callback constructor
-  */
-    template <class P, class CB, class TP>
-    ICallback<typename MaskVoid<P>::type>* createCb(CB&& cb, Promise<TP>& next)
-    {
-        return new Callback<typename MaskVoid<P>::type, CB, TP>(std::forward<CB>(cb), next);
-    }
 //===
     struct SharedObj
     {
@@ -262,6 +316,34 @@ protected:
         {
             CallbackList<ISuccessCb> mSuccessCbs;
             CallbackList<IFailCb> mFailCbs;
+            /** Lists whose callbacks were moved to these ones, and that store
+             * some of them inline */
+            CbLists* mAdopted = nullptr;
+            /** Moves the callbacks of \c other to these lists and takes
+             * ownership of \c other */
+            void adopt(CbLists* other)
+            {
+                mSuccessCbs.addListMoveItems(other->mSuccessCbs);
+                mFailCbs.addListMoveItems(other->mFailCbs);
+                if (!other->mSuccessCbs.hasInlineCb() && !other->mFailCbs.hasInlineCb()
+                    && !other->mAdopted)
+                {
+                    delete other;
+                    return;
+                }
+                CbLists* last = other;
+                while (last->mAdopted)
+                    last = last->mAdopted;
+                last->mAdopted = mAdopted;
+                mAdopted = other;
+            }
+            ~CbLists()
+            {
+                // destroy the callbacks before the lists that may store them
+                mSuccessCbs.clear();
+                mFailCbs.clear();
+                delete mAdopted;
+            }
         };
         int mRefCount;
         CbLists* mCbs;
@@ -294,12 +376,7 @@ protected:
         }
         ~SharedObj()
         {
-            if (mCbs)
-            {
-                mCbs->mSuccessCbs.clear();
-                mCbs->mFailCbs.clear();
-                delete mCbs;
-            }
+            delete mCbs;
         }
         inline CbLists& cbs()
         {
@@ -315,6 +392,9 @@ protected:
     template<typename Ret>
     struct RemovePromise<Promise<Ret> >
     {  typedef typename std::remove_const<Ret>::type Type;  };
+    template<typename Ret>
+    struct RemovePromise<const Promise<Ret> >
+    {  typedef typename std::remove_const<Ret>::type Type;  };
 
 //===
     struct CallCbHandleVoids
@@ -331,6 +411,46 @@ protected:
         template<class Out, class CbOut, class In, class CB, class=typename std::enable_if<std::is_same<In,_Void>::value && std::is_same<CbOut,void>::value, int>::type>
         static Promise<void> call(CB& cb, const _Void& /*val*/) { cb(); return _Void(); }
     };
+    /** Same as CallCbHandleVoids, for callbacks that return a value rather than
+     * a promise, to get the value without wrapping it in a promise */
+    struct CallValueCbHandleVoids
+    {
+        template<class CbOut, class In, class CB, class=typename std::enable_if<!std::is_same<In,_Void>::value && !std::is_same<CbOut, void>::value, int>::type>
+        static CbOut call(CB& cb, const In& val) {  return cb(val);  }
+
+        template<class CbOut, class In, class CB, class=typename std::enable_if<std::is_same<In,_Void>::value && !std::is_same<CbOut, void>::value, int>::type>
+        static CbOut call(CB& cb, const _Void& /*val*/) {  return cb();   }
+
+        template<class CbOut, class In, class CB, class=typename std::enable_if<!std::is_same<In,_Void>::value && std::is_same<CbOut,void>::value, int>::type>
+        static _Void call(CB& cb, const In& val){ cb(val); return _Void(); }
+
+        template<class CbOut, class In, class CB, class=typename std::enable_if<std::is_same<In,_Void>::value && std::is_same<CbOut,void>::value, int>::type>
+        static _Void call(CB& cb, const _Void& /*val*/) { cb(); return _Void(); }
+    };
+    /** Converts the exception being handled to an Error. Must be called from a catch block */
+    static Error currentExceptionToError()
+    {
+        try
+        {
+            throw;
+        }
+        catch(std::exception& e)
+        {
+            return Error(e.what(), kErrException);
+        }
+        catch(Error& e)
+        {
+            return e;
+        }
+        catch(const char* e)
+        {
+            return Error(e, kErrException);
+        }
+        catch(...)
+        {
+            return Error("(unknown exception type)", kErrException);
+        }
+    }
 //===
     void reset(SharedObj* other=NULL)
     {
@@ -410,7 +530,7 @@ public:
     const typename std::enable_if<!std::is_same<Ret, void>::value, Ret>::type& value() const
     {
         assert(mSharedObj);
-        auto master = mSharedObj->mMaster;
+        auto& master = mSharedObj->mMaster;
         if (master.mSharedObj)
         {
             assert(master.done());
@@ -450,71 +570,90 @@ protected:
         return ret;
     }
 
-/** Creates a wrapper function around a then() or fail() handler that handles exceptions and propagates
- * the result to resolve/reject chained promises. \c In is the type of the callback's parameter,
- * \c Out is its return type, \c CB is the type of the callback itself.
+/** Calls a then() or fail() handler, converting exceptions to a failed promise.
+ * \c In is the type of the callback's parameter, \c Out is the type of the
+ * promise it returns and \c RealOut is its actual return type.
+ */
+    template <typename In, typename Out, typename RealOut, class CB>
+    static Promise<Out> callCb(CB& cb, const In& arg)
+    {
+        try
+        {
+            return CallCbHandleVoids::template call<Out, RealOut, In>(cb, arg);
+        }
+        catch(...)
+        {
+            return currentExceptionToError();
+        }
+    }
+/** Calls a handler that returns a value of type \c Out (or void), and resolves
+ * the chaining promise \c next with it, without creating an intermediate promise
  */
     template <typename In, typename Out, typename RealOut, class CB>
-    ICallback<In>* createChainedCb(CB&& cb, Promise<Out>& next)
+    static void callCbAndResolve(CB& cb, const In& arg, Promise<Out>& next, std::true_type /*returns Out*/)
+    {
+        bool returned = false;
+        try
+        {
+            // the result is passed to resolve() as is, so it needs no default constructor
+            next.resolve(markReturned(CallValueCbHandleVoids::template call<RealOut, In>(cb, arg), returned));
+        }
+        catch(...)
+        {
+            if (returned) // thrown by resolve(), not by the handler
+                throw;
+            next.reject(currentExceptionToError());
+        }
+    }
+    template <class V>
+    static V&& markReturned(V&& val, bool& returned)
     {
+        returned = true;
+        return std::forward<V>(val);
+    }
+/** Calls a handler that returns a promise (or an Error), and connects that
+ * promise (actually its master) to the chaining promise \c next, returned
+ * earlier by then() or fail()
+ */
+    template <typename In, typename Out, typename RealOut, class CB>
+    static void callCbAndResolve(CB& cb, const In& arg, Promise<Out>& next, std::false_type /*returns a promise*/)
+    {
+        Promise<Out> promise(callCb<In, Out, RealOut>(cb, arg)); //the promise returned by the user callback
+        Promise<Out>& master = promise.getMaster(); //master is the promise that actually gets resolved, equivalent to the 'deferred' object
+        assert(!next.hasMaster());
+        next.mSharedObj->mMaster = master; //makes 'next' attach subsequently added callbacks to 'master'
+        assert(next.hasMaster());
+        // Move the callbacks and errbacks of 'next' to 'master'
+        if (!master.hasCallbacks())
+        {
+            master.mSharedObj->mCbs = next.mSharedObj->mCbs;
+        }
+        else if (next.hasCallbacks())
+        {
+            master.mSharedObj->mCbs->adopt(next.mSharedObj->mCbs);
+        }
+        next.mSharedObj->mCbs = nullptr;
+        //====
+        if (master.mSharedObj->mPending)
+            master.doPendingResolveOrFail();
+    }
+/** Adds to \c list a wrapper around a then() or fail() handler that handles
+ * exceptions and propagates the result to resolve/reject the chained promise
+ * \c next. \c In is the type of the callback's parameter, \c Out is the
+ * type of \c next, \c RealOut is the return type of the callback itself.
+ */
+    template <typename In, typename Out, typename RealOut, class CB, class L>
+    void addChainedCb(CB&& cb, Promise<Out>& next, L& list)
+    {
+        typedef typename std::remove_cv<typename std::remove_reference<RealOut>::type>::type PlainOut;
+        typedef std::integral_constant<bool, std::is_same<PlainOut, Out>::value> ReturnsValue;
         //cb must have the singature Promise<Out>(const In&)
-        return createCb<In>(
-            [cb](const In& result, ICallbackWithPromise<typename MaskVoid<In>::type, Out >& handler)
+        auto wrapper = [cb](const In& result, ICallbackWithPromise<typename MaskVoid<In>::type, Out>& handler)
             mutable->void
         {
-            Promise<Out>& next = handler.nextPromise; //the 'chaining' promise
-            Promise<Out> promise((_Empty())); //the promise returned by the user callback
-            try
-            {
-                promise = CallCbHandleVoids::template call<Out, RealOut, In>(cb, result);
-            }
-            catch(std::exception& e)
-            {
-                next.reject(Error(e.what(), kErrException));
-                return;
-            }
-            catch(Error& e)
-            {
-                next.reject(e);
-                return;
-            }
-            catch(const char* e)
-            {
-                next.reject(Error(e, kErrException));
-                return;
-            }
-            catch(...)
-            {
-                next.reject(Error("(unknown exception type)", kErrException));
-                return;
-            }
-
-// connect the promise returned by the user's callback (actually its master)
-// to the chaining promise, returned earlier by then() or fail()
-            Promise<Out>& master = promise.getMaster(); //master is the promise that actually gets resolved, equivalent to the 'deferred' object
-            assert(!next.hasMaster());
-            next.mSharedObj->mMaster = master; //makes 'next' attach subsequently added callbacks to 'master'
-            assert(next.hasMaster());
-            // Move the callbacks and errbacks of 'next' to 'master'
-            if (!master.hasCallbacks())
-            {
-                master.mSharedObj->mCbs = next.mSharedObj->mCbs;
-                next.mSharedObj->mCbs = nullptr;
-            }
-            else
-            {
-                auto& nextCbs = next.thenCbs();
-                if (nextCbs.count())
-                    master.thenCbs().addListMoveItems(nextCbs);
-
-                auto& nextEbs = next.failCbs();
-                if (nextEbs.count())
-                    master.failCbs().addListMoveItems(nextEbs);
-            }
-            //====
-            if (master.mSharedObj->mPending)
-                master.doPendingResolveOrFail();
-        }, next);
+            callCbAndResolve<In, Out, RealOut>(cb, result, handler.nextPromise, ReturnsValue());
+        };
+        list.template emplace<Callback<typename MaskVoid<In>::type, decltype(wrapper), Out> >(std::move(wrapper), next);
     }
 
 public:
@@ -534,21 +673,16 @@ public:
             return mSharedObj->mError;
 
         typedef typename RemovePromise<typename FuncTraits<F>::RetType>::Type Out;
-        Promise<Out> next;
-
-        std::unique_ptr<ISuccessCb> resolveCb(createChainedCb<typename MaskVoid<T>::type, Out,
-            typename FuncTraits<F>::RetType>(std::forward<F>(cb), next));
-
         if (mSharedObj->mResolved == kSucceeded)
         {
-            (*resolveCb)(mSharedObj->mResult);
-        }
-        else
-        {
-            assert((mSharedObj->mResolved == kNotResolved));
-            thenCbs().push(resolveCb);
+            // no need to chain, call the callback and return its promise
+            return callCb<typename MaskVoid<T>::type, Out, typename FuncTraits<F>::RetType>(cb, mSharedObj->mResult);
         }
 
+        assert((mSharedObj->mResolved == kNotResolved));
+        Promise<Out> next;
+        addChainedCb<typename MaskVoid<T>::type, Out, typename FuncTraits<F>::RetType>(
+            std::forward<F>(cb), next, thenCbs());
         return next;
     }
 /** Adds a handler to be executed in case the promise is rejected
@@ -569,23 +703,19 @@ public:
             return master.fail(std::forward<F>(eb));
 
         if (mSharedObj->mResolved == kSucceeded)
-            return mSharedObj->mResult; //don't call the errorback, just return the successful resolve value
-
-        Promise<T> next;
-        std::unique_ptr<IFailCb> failCb(createChainedCb<Error, T,
-            typename FuncTraits<F>::RetType>(std::forward<F>(eb), next));
+            return *this; //don't call the errorback, just return the successful resolve value
 
         if (mSharedObj->mResolved == kFailed)
         {
-            (*failCb)(mSharedObj->mError);
+            // no need to chain, call the errorback and return its promise
+            Promise<T> ret(callCb<Error, T, typename FuncTraits<F>::RetType>(eb, mSharedObj->mError));
             mSharedObj->mError.setHandled();
-        }
-        else
-        {
-            assert((mSharedObj->mResolved == kNotResolved));
-            failCbs().push(failCb);
+            return ret;
         }
 
+        assert((mSharedObj->mResolved == kNotResolved));
+        Promise<T> next;
+        addChainedCb<Error, T, typename FuncTraits<F>::RetType>(std::forward<F>(eb), next, failCbs());
         return next;
     }
     //val can be a by-value param, const& or &&
@@ -0,0 +1,155 @@
+#ifndef KARERE_SLOTMAP_H
+#define KARERE_SLOTMAP_H
+/**
+ * @file slotMap.h
+ * @brief Generational slot map, that maps 32-bit handles to values with O(1)
+ * insert, lookup and removal, and detects stale handles.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <utility>
+#include <assert.h>
+
+namespace karere
+{
+/** @brief Stores values in a vector of slots, and identifies them by a 32-bit
+ * handle made of the index of the slot (the \c IndexBits least significant
+ * bits) and the generation of the slot (the rest of the bits).
+ *
+ * The generation of a slot is incremented every time its value is removed,
+ * so a handle of a removed value doesn't match any value stored later in the
+ * same slot, until the generation wraps around. The generation is never zero,
+ * so zero is never a valid handle.
+ *
+ * To delay the wrap-around, free slots are reused in FIFO order, and only
+ * when there are at least \c kMinFree of them - until then, the map grows
+ * instead. This way, a slot is reused at most once every \c kMinFree removals,
+ * and a stale handle can't match a newer value before about
+ * kMinFree * kMaxGeneration (~67 million with the defaults) values have been
+ * added and removed.
+ *
+ * The map is not thread-safe, the owner must lock it.
+ * \c T must be default-constructible; removed values are reset to T().
+ */
+template <class T, unsigned IndexBits = 18, unsigned MinFree = 4096>
+class SlotMap
+{
+public:
+    typedef uint32_t Handle;
+    enum: uint32_t
+    {
+        kIndexBits = IndexBits,
+        kMaxSlots = (uint32_t)1 << IndexBits,
+        kIndexMask = kMaxSlots - 1,
+        kMaxGeneration = ((uint32_t)1 << (32 - IndexBits)) - 1,
+        kMinFree = MinFree,
+        kNoSlot = UINT32_MAX
+    };
+    static_assert(IndexBits > 0 && IndexBits < 32, "Both the index and the generation need at least one bit");
+    static_assert(MinFree < ((uint32_t)1 << IndexBits), "MinFree must be smaller than the max number of slots");
+
+protected:
+    struct Slot
+    {
+        T value;
+        uint32_t generation = 1;
+        /** Next slot in the free list, only valid if the slot is free */
+        uint32_t nextFree = kNoSlot;
+        bool used = false;
+    };
+    std::vector<Slot> mSlots;
+    uint32_t mFreeHead = kNoSlot;
+    uint32_t mFreeTail = kNoSlot;
+    uint32_t mFreeCount = 0;
+    size_t mSize = 0;
+    Slot* slotOf(Handle handle)
+    {
+        uint32_t index = handle & kIndexMask;
+        if (index >= mSlots.size())
+            return nullptr;
+        Slot& slot = mSlots[index];
+        return (slot.used && slot.generation == (handle >> IndexBits)) ? &slot : nullptr;
+    }
+    uint32_t allocSlot()
+    {
+        if (mFreeCount >= kMinFree || (mSlots.size() >= kMaxSlots && mFreeCount))
+        {
+            uint32_t index = mFreeHead;
+            mFreeHead = mSlots[index].nextFree;
+            if (mFreeHead == kNoSlot)
+                mFreeTail = kNoSlot;
+            mFreeCount--;
+            return index;
+        }
+        if (mSlots.size() >= kMaxSlots)
+            return kNoSlot;
+        mSlots.emplace_back();
+        return (uint32_t)(mSlots.size() - 1);
+    }
+
+public:
+    /** @brief Stores \c value in a slot
+     * @return The handle of the value, or 0 if all \c kMaxSlots slots are in use
+     */
+    template <class V>
+    Handle insert(V&& value)
+    {
+        uint32_t index = allocSlot();
+        if (index == kNoSlot)
+            return 0;
+
+        Slot& slot = mSlots[index];
+        assert(!slot.used);
+        slot.value = std::forward<V>(value);
+        slot.used = true;
+        mSize++;
+        return (slot.generation << IndexBits) | index;
+    }
+    /** @brief The value of the handle, or NULL if the handle is not valid or
+     * its value has been removed */
+    T* get(Handle handle)
+    {
+        Slot* slot = slotOf(handle);
+        return slot ? &slot->value : nullptr;
+    }
+    bool contains(Handle handle) { return slotOf(handle) != nullptr; }
+    /** @brief Removes the value of the handle
+     * @return false if the handle is not valid or its value was already removed
+     */
+    bool remove(Handle handle)
+    {
+        Slot* slot = slotOf(handle);
+        if (!slot)
+            return false;
+
+        slot->value = T();
+        slot->used = false;
+        slot->generation = (slot->generation >= kMaxGeneration) ? 1 : slot->generation + 1;
+        uint32_t index = handle & kIndexMask;
+        slot->nextFree = kNoSlot;
+        if (mFreeTail != kNoSlot)
+            mSlots[mFreeTail].nextFree = index;
+        else
+            mFreeHead = index;
+        mFreeTail = index;
+        mFreeCount++;
+        mSize--;
+        return true;
+    }
+    /** @brief Calls \c func(handle, value) for each value in the map */
+    template <class F>
+    void forEach(F&& func)
+    {
+        for (uint32_t i = 0; i < mSlots.size(); i++)
+        {
+            Slot& slot = mSlots[i];
+            if (slot.used)
+                func((slot.generation << IndexBits) | i, slot.value);
+        }
+    }
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+};
+}
+#endif
@@ -0,0 +1,159 @@
+#ifndef KARERE_SNAPSHOTMAP_H
+#define KARERE_SNAPSHOTMAP_H
+/**
+ * @file snapshotMap.h
+ * @brief Map of immutable values, written by one thread and read by others
+ * without locking, through versioned immutable snapshots (RCU-style).
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <algorithm>
+
+namespace karere
+{
+/** @brief Maps 64-bit keys (i.e. chatids) to immutable \c V objects.
+ *
+ * Every modification creates a new snapshot and publishes it atomically.
+ * Readers take a reference to the current snapshot with \c get(), and can use
+ * it for as long as they like, without locking and without blocking the
+ * writer. Snapshots and values are never modified once published.
+ *
+ * A snapshot is a sorted vector of buckets of at most \c 2*BucketSize items,
+ * and buckets are shared between snapshots, so a modification copies the
+ * bucket vector and a single bucket, not the whole map.
+ *
+ * Modifications must be done by a single thread (or under a lock), as they
+ * are read-copy-update: a concurrent modification would be lost.
+ */
+template <class V, size_t BucketSize = 32>
+class SnapshotMap
+{
+public:
+    typedef std::pair<uint64_t, std::shared_ptr<const V>> Item;
+    typedef std::vector<Item> Bucket;
+    class Snapshot
+    {
+    protected:
+        std::vector<std::shared_ptr<const Bucket>> mBuckets;
+        uint64_t mVersion = 0;
+        size_t mSize = 0;
+        // The bucket that contains \c key, or that it should be inserted into
+        size_t bucketFor(uint64_t key) const
+        {
+            // first bucket whose last key is >= key
+            auto it = std::lower_bound(mBuckets.begin(), mBuckets.end(), key,
+                [](const std::shared_ptr<const Bucket>& bucket, uint64_t k) { return bucket->back().first < k; });
+            return (it == mBuckets.end()) ? mBuckets.size() - 1 : it - mBuckets.begin();
+        }
+        static typename Bucket::const_iterator lowerBound(const Bucket& bucket, uint64_t key)
+        {
+            return std::lower_bound(bucket.begin(), bucket.end(), key,
+                [](const Item& item, uint64_t k) { return item.first < k; });
+        }
+        friend class SnapshotMap;
+    public:
+        /** Incremented with each modification */
+        uint64_t version() const { return mVersion; }
+        size_t size() const { return mSize; }
+        const V* find(uint64_t key) const
+        {
+            if (mBuckets.empty())
+                return nullptr;
+            auto& bucket = *mBuckets[bucketFor(key)];
+            auto it = lowerBound(bucket, key);
+            return (it != bucket.end() && it->first == key) ? it->second.get() : nullptr;
+        }
+        /** Calls \c func(key, value) for all items, in key order */
+        template <class F>
+        void forEach(F&& func) const
+        {
+            for (auto& bucket: mBuckets)
+                for (auto& item: *bucket)
+                    func(item.first, *item.second);
+        }
+    };
+protected:
+    // Only accessed via std::atomic_load/atomic_store
+    std::shared_ptr<const Snapshot> mCurrent;
+    std::shared_ptr<Snapshot> copyCurrent() const
+    {
+        auto ret = std::make_shared<Snapshot>(*get());
+        ret->mVersion++;
+        return ret;
+    }
+    void publish(std::shared_ptr<const Snapshot> snapshot)
+    {
+        std::atomic_store(&mCurrent, std::move(snapshot));
+    }
+public:
+    SnapshotMap(): mCurrent(std::make_shared<Snapshot>()) {}
+    /** @brief Returns the current snapshot. Can be called from any thread */
+    std::shared_ptr<const Snapshot> get() const { return std::atomic_load(&mCurrent); }
+    /** @brief Publishes a snapshot in which \c key maps to \c value */
+    void set(uint64_t key, std::shared_ptr<const V> value)
+    {
+        auto snapshot = copyCurrent();
+        auto& buckets = snapshot->mBuckets;
+        if (buckets.empty())
+        {
+            buckets.emplace_back(std::make_shared<Bucket>(1, Item(key, std::move(value))));
+            snapshot->mSize = 1;
+            publish(std::move(snapshot));
+            return;
+        }
+        size_t idx = snapshot->bucketFor(key);
+        auto bucket = std::make_shared<Bucket>(*buckets[idx]);
+        auto it = bucket->begin() + (Snapshot::lowerBound(*bucket, key) - bucket->cbegin());
+        if (it != bucket->end() && it->first == key)
+        {
+            it->second = std::move(value);
+        }
+        else
+        {
+            bucket->emplace(it, key, std::move(value));
+            snapshot->mSize++;
+        }
+        if (bucket->size() > 2 * BucketSize)
+        {
+            auto upper = std::make_shared<Bucket>(bucket->begin() + BucketSize, bucket->end());
+            bucket->resize(BucketSize);
+            buckets.insert(buckets.begin() + idx + 1, std::move(upper));
+        }
+        buckets[idx] = std::move(bucket);
+        publish(std::move(snapshot));
+    }
+    /** @brief Publishes a snapshot without \c key, if it is present */
+    void erase(uint64_t key)
+    {
+        auto current = get();
+        if (!current->find(key))
+            return;
+        auto snapshot = copyCurrent();
+        auto& buckets = snapshot->mBuckets;
+        size_t idx = snapshot->bucketFor(key);
+        if (buckets[idx]->size() == 1)
+        {
+            buckets.erase(buckets.begin() + idx);
+        }
+        else
+        {
+            auto bucket = std::make_shared<Bucket>(*buckets[idx]);
+            bucket->erase(bucket->begin() + (Snapshot::lowerBound(*bucket, key) - bucket->cbegin()));
+            buckets[idx] = std::move(bucket);
+        }
+        snapshot->mSize--;
+        publish(std::move(snapshot));
+    }
+    /** @brief Publishes an empty snapshot */
+    void clear()
+    {
+        auto snapshot = std::make_shared<Snapshot>();
+        snapshot->mVersion = get()->version() + 1;
+        publish(std::move(snapshot));
+    }
+};
+}
+#endif
@@ -0,0 +1,55 @@
+#ifndef KARERE_THREADSAFETY_H
+#define KARERE_THREADSAFETY_H
+/**
+ * @file threadSafety.h
+ * @brief Annotations for clang's thread safety analysis (-Wthread-safety),
+ * and a mutex that can be checked by it. With other compilers, the
+ * annotations expand to nothing.
+ */
+#include <mutex>
+
+#if defined(__clang__) && !defined(SWIG)
+    #define KR_THREAD_ANNOTATION(x) __attribute__((x))
+#else
+    #define KR_THREAD_ANNOTATION(x)
+#endif
+
+#define KR_CAPABILITY(x) KR_THREAD_ANNOTATION(capability(x))
+#define KR_SCOPED_CAPABILITY KR_THREAD_ANNOTATION(scoped_lockable)
+/** The member can only be accessed with the specified mutex locked */
+#define KR_GUARDED_BY(x) KR_THREAD_ANNOTATION(guarded_by(x))
+/** The data pointed to by the member is protected by the specified mutex */
+#define KR_PT_GUARDED_BY(x) KR_THREAD_ANNOTATION(pt_guarded_by(x))
+/** The function must be called with the specified mutex locked */
+#define KR_REQUIRES(...) KR_THREAD_ANNOTATION(requires_capability(__VA_ARGS__))
+/** The function locks the specified mutex, so it can't be called with it locked */
+#define KR_EXCLUDES(...) KR_THREAD_ANNOTATION(locks_excluded(__VA_ARGS__))
+#define KR_ACQUIRE(...) KR_THREAD_ANNOTATION(acquire_capability(__VA_ARGS__))
+#define KR_RELEASE(...) KR_THREAD_ANNOTATION(release_capability(__VA_ARGS__))
+#define KR_NO_THREAD_SAFETY_ANALYSIS KR_THREAD_ANNOTATION(no_thread_safety_analysis)
+
+namespace karere
+{
+/** @brief A std::mutex that the thread safety analysis knows about */
+class KR_CAPABILITY("mutex") Mutex
+{
+protected:
+    std::mutex mMutex;
+public:
+    void lock() KR_ACQUIRE() { mMutex.lock(); }
+    void unlock() KR_RELEASE() { mMutex.unlock(); }
+};
+
+/** @brief Equivalent of std::lock_guard for \c karere::Mutex */
+class KR_SCOPED_CAPABILITY MutexLock
+{
+protected:
+    Mutex& mMutex;
+public:
+    explicit MutexLock(Mutex& mutex) KR_ACQUIRE(mutex): mMutex(mutex) { mMutex.lock(); }
+    ~MutexLock() KR_RELEASE() { mMutex.unlock(); }
+    MutexLock(const MutexLock&) = delete;
+    MutexLock& operator=(const MutexLock&) = delete;
+};
+}
+#endif
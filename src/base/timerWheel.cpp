@@ -0,0 +1,247 @@
+#include "timerWheel.h"
+#include <chrono>
+#include <assert.h>
+
+namespace karere
+{
+uint64_t TimerWheel::steadyNowMs()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TimerWheel::TimerWheel(ArmFunc&& arm, ClockFunc clock)
+: mArm(std::move(arm)), mClock(clock)
+{
+    for (unsigned level = 0; level < kLevelCount; level++)
+    {
+        mLevelSize[level] = 0;
+        for (unsigned i = 0; i < kSlotCount; i++)
+            mSlots[level][i] = nullptr;
+    }
+    mCurrent = mClock();
+}
+
+TimerWheel::~TimerWheel()
+{
+    mHandles.forEach([](megaHandle, Entry* entry)
+    {
+        delete entry;
+    });
+}
+
+void TimerWheel::insert(Entry* entry)
+{
+    if (entry->expiry <= mCurrent)
+        entry->expiry = mCurrent + 1;
+
+    // the lowest level whose rotation can hold the delay
+    uint64_t delta = entry->expiry - mCurrent;
+    unsigned level = 0;
+    while (level < kLevelCount-1 && delta >= ((uint64_t)1 << (kSlotBits * (level+1))))
+        level++;
+
+    Entry** slot = &mSlots[level][(entry->expiry >> (kSlotBits * level)) & (kSlotCount-1)];
+    entry->slot = slot;
+    entry->prev = nullptr;
+    entry->next = *slot;
+    if (*slot)
+        (*slot)->prev = entry;
+    *slot = entry;
+    mLevelSize[level]++;
+    mSize++;
+}
+
+void TimerWheel::unlink(Entry* entry)
+{
+    assert(entry->slot);
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        *entry->slot = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+
+    unsigned level = (unsigned)((entry->slot - &mSlots[0][0]) / kSlotCount);
+    mLevelSize[level]--;
+    mSize--;
+    entry->slot = nullptr;
+    entry->prev = entry->next = nullptr;
+}
+
+void TimerWheel::cascade(unsigned level)
+{
+    Entry** slot = &mSlots[level][(mCurrent >> (kSlotBits * level)) & (kSlotCount-1)];
+    Entry* entry = *slot;
+    *slot = nullptr;
+    while (entry)
+    {
+        Entry* next = entry->next;
+        mLevelSize[level]--;
+        mSize--;
+        insert(entry);
+        entry = next;
+    }
+}
+
+void TimerWheel::collectDue(uint64_t now, std::vector<Entry*>& due)
+{
+    while (mCurrent < now)
+    {
+        if (!mLevelSize[0])
+        {
+            // nothing to expire until the next cascade, skip the empty slots
+            uint64_t boundary = ((mCurrent >> kSlotBits) + 1) << kSlotBits;
+            if (!mSize || boundary > now)
+            {
+                mCurrent = now;
+                break;
+            }
+            mCurrent = boundary - 1;
+        }
+
+        mCurrent++;
+        for (unsigned level = 1; level < kLevelCount; level++)
+        {
+            if (mCurrent & (((uint64_t)1 << (kSlotBits * level)) - 1))
+                break;
+            cascade(level);
+        }
+
+        Entry** slot = &mSlots[0][mCurrent & (kSlotCount-1)];
+        while (Entry* entry = *slot)
+        {
+            unlink(entry);
+            due.push_back(entry);
+        }
+    }
+}
+
+uint64_t TimerWheel::nextDeadline() const
+{
+    if (!mSize)
+        return UINT64_MAX;
+
+    uint64_t result = UINT64_MAX;
+    if (mLevelSize[0])
+    {
+        for (uint64_t tick = mCurrent + 1; tick <= mCurrent + kSlotCount; tick++)
+        {
+            if (mSlots[0][tick & (kSlotCount-1)])
+            {
+                result = tick;
+                break;
+            }
+        }
+    }
+    // timers in the upper levels are not due before their slot is cascaded
+    for (unsigned level = 1; level < kLevelCount; level++)
+    {
+        if (!mLevelSize[level])
+            continue;
+
+        unsigned shift = kSlotBits * level;
+        uint64_t boundary = ((mCurrent >> shift) + 1) << shift;
+        if (boundary < result)
+            result = boundary;
+        break;
+    }
+    return result;
+}
+
+void TimerWheel::rearm()
+{
+    uint64_t deadline = nextDeadline();
+    if (deadline >= mArmedAt)
+        return;
+
+    mArmedAt = deadline;
+    mArm(deadline);
+}
+
+megaHandle TimerWheel::add(Entry* entry, unsigned timeMs, bool repeat)
+{
+    MutexLock lock(mMutex);
+    uint64_t now = mClock();
+    if (!mSize && now > mCurrent)
+        mCurrent = now; // nothing to expire in between
+
+    // mCurrent may lag behind the clock until the OS timer fires
+    entry->expiry = ((now > mCurrent) ? now : mCurrent) + timeMs;
+    entry->period = repeat ? timeMs : 0;
+    entry->handle = mHandles.insert(entry);
+    assert(entry->handle); // more than SlotMap::kMaxSlots timers
+    insert(entry);
+    rearm();
+    return entry->handle;
+}
+
+bool TimerWheel::cancel(megaHandle handle)
+{
+    Entry* entry;
+    {
+        MutexLock lock(mMutex);
+        Entry** item = mHandles.get(handle);
+        if (!item)
+            return false;
+
+        entry = *item;
+        mHandles.remove(handle);
+        entry->canceled = true;
+        if (!entry->slot)
+            return true; // being expired, expire() will delete it
+
+        unlink(entry);
+    }
+    // the callback may own objects whose destructors use timers
+    delete entry;
+    return true;
+}
+
+void TimerWheel::expire(uint64_t now)
+{
+    std::vector<Entry*> due;
+    {
+        MutexLock lock(mMutex);
+        mArmedAt = UINT64_MAX; // the OS timer has fired
+        collectDue(now, due);
+    }
+
+    for (Entry* entry: due)
+    {
+        bool canceled;
+        {
+            MutexLock lock(mMutex);
+            canceled = entry->canceled;
+        }
+        if (!canceled)
+        {
+            entry->fire();
+        }
+
+        {
+            MutexLock lock(mMutex);
+            if (!entry->canceled)
+            {
+                if (entry->period)
+                {
+                    entry->expiry = mCurrent + entry->period;
+                    insert(entry);
+                    continue;
+                }
+                mHandles.remove(entry->handle);
+            }
+        }
+        delete entry;
+    }
+
+    MutexLock lock(mMutex);
+    rearm();
+}
+
+size_t TimerWheel::size()
+{
+    MutexLock lock(mMutex);
+    return mSize;
+}
+}
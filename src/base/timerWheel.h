@@ -0,0 +1,109 @@
+#ifndef KARERE_TIMERWHEEL_H
+#define KARERE_TIMERWHEEL_H
+/**
+ * @file timerWheel.h
+ * @brief Hierarchical timing wheel that multiplexes all the timers of an app
+ * message loop on a single OS timer. See timers.hpp for the public API.
+ */
+#include <stdint.h>
+#include <vector>
+#include <functional>
+#include "slotMap.h"
+#include "threadSafety.h"
+
+typedef unsigned int megaHandle; // as in cservices.h, invalid handle value is 0
+
+namespace karere
+{
+/** @brief Hashed hierarchical timing wheel (Varghese & Lauck) with a
+ * resolution of 1ms.
+ *
+ * Each of the \c kLevelCount levels has \c kSlotCount slots, and each slot of
+ * a level spans a whole rotation of the level below, so the wheel covers the
+ * whole range of \c unsigned millisecond delays. A timer is inserted in the
+ * lowest level that can hold its delay, and moved down (cascaded) when the
+ * lower level reaches the start of its slot. Insert and cancel are O(1), and
+ * all the timers due at a tick are expired in one batch.
+ *
+ * The wheel doesn't have a thread of its own. Instead, it asks the owner to
+ * (re)arm a single OS timer for the next deadline via the \c ArmFunc, and the
+ * owner must call \c expire() from the app thread when it fires.
+ *
+ * \c add() and \c cancel() can be called from any thread. Callbacks are run by
+ * \c expire(), without holding the internal lock, so they can add and cancel
+ * timers.
+ */
+class TimerWheel
+{
+public:
+    enum { kSlotBits = 8, kSlotCount = 1 << kSlotBits, kLevelCount = 4 };
+    /** @brief Called with the absolute time (as returned by the clock) when
+     * the next timer is due, if it's earlier than the current one */
+    typedef std::function<void(uint64_t deadline)> ArmFunc;
+    typedef uint64_t(*ClockFunc)();
+
+    struct Entry
+    {
+        Entry* prev = nullptr;
+        Entry* next = nullptr;
+        /** The slot list this entry is linked in, or NULL if it's being expired */
+        Entry** slot = nullptr;
+        uint64_t expiry = 0;
+        /** Period of an interval timer, zero for one-shot timers */
+        unsigned period = 0;
+        megaHandle handle = 0;
+        bool canceled = false;
+        virtual ~Entry() {}
+        virtual void fire() = 0;
+    };
+
+protected:
+    Mutex mMutex;
+    Entry* mSlots[kLevelCount][kSlotCount] KR_GUARDED_BY(mMutex);
+    unsigned mLevelSize[kLevelCount] KR_GUARDED_BY(mMutex);
+    size_t mSize KR_GUARDED_BY(mMutex) = 0;
+    /** The last tick processed by expire(). Timers are due after it */
+    uint64_t mCurrent KR_GUARDED_BY(mMutex);
+    /** The deadline the OS timer is armed for, or UINT64_MAX */
+    uint64_t mArmedAt KR_GUARDED_BY(mMutex) = UINT64_MAX;
+    /** Handle -> entry of all timers, including the ones being expired */
+    SlotMap<Entry*> mHandles KR_GUARDED_BY(mMutex);
+    ArmFunc mArm;
+    ClockFunc mClock;
+    void insert(Entry* entry) KR_REQUIRES(mMutex);
+    void unlink(Entry* entry) KR_REQUIRES(mMutex);
+    void cascade(unsigned level) KR_REQUIRES(mMutex);
+    void collectDue(uint64_t now, std::vector<Entry*>& due) KR_REQUIRES(mMutex);
+    uint64_t nextDeadline() const KR_REQUIRES(mMutex);
+    void rearm() KR_REQUIRES(mMutex);
+
+public:
+    /** @brief Milliseconds of a monotonic clock, the default time base */
+    static uint64_t steadyNowMs();
+    // the wheel is not shared while it's being constructed or destroyed
+    TimerWheel(ArmFunc&& arm, ClockFunc clock = &steadyNowMs) KR_NO_THREAD_SAFETY_ANALYSIS;
+    ~TimerWheel() KR_NO_THREAD_SAFETY_ANALYSIS;
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    /** @brief Takes ownership of \c entry and schedules it after \c timeMs
+     * @param repeat Whether it's an interval timer, i.e. it's rescheduled
+     * with the same period after each call, until it's canceled
+     * @return The handle of the timer, never zero
+     */
+    megaHandle add(Entry* entry, unsigned timeMs, bool repeat) KR_EXCLUDES(mMutex);
+    /** @brief Cancels the timer and destroys its callback. A timer being
+     * expired is not called anymore
+     * @return false if the handle is not valid, i.e. it's a one-shot timer that
+     * has already been called
+     */
+    bool cancel(megaHandle handle) KR_EXCLUDES(mMutex);
+    /** @brief Calls all the timers due at \c now, as returned by the clock,
+     * and re-arms the OS timer. Must be called from the app thread */
+    void expire(uint64_t now) KR_EXCLUDES(mMutex);
+    /** @brief Calls \c expire() with the current time */
+    void expire() { expire(mClock()); }
+    size_t size() KR_EXCLUDES(mMutex);
+};
+}
+#endif
@@ -23,118 +23,41 @@
  */
 #include "cservices.h"
 #include "gcmpp.h"
+#include "timerWheel.h"
 #include <memory>
+#include <type_traits>
 #include <assert.h>
-extern std::recursive_mutex timerMutex;
 
 namespace karere
 {
-struct TimerMsg: public megaMessage
-{
-    timerevent* timerEvent = nullptr;
-    bool canceled = false;
-    megaHandle handle;
-    TimerMsg(megaMessageFunc aFunc)
-        :megaMessage(aFunc),
-          handle(services_hstore_add_handle(MEGA_HTYPE_TIMER, this))
-    {}
-   ~TimerMsg()
-    {
-        services_hstore_remove_handle(MEGA_HTYPE_TIMER, handle);
-        if (timerEvent)
-        {
-            #ifndef USE_LIBWEBSOCKETS
-                event_free(timerEvent);
-            #else
-                uv_close((uv_handle_t *)timerEvent, [](uv_handle_t* handle)
-                {
-                    delete handle;
-                });
-            #endif
-        }
-    }
-};
+/** @brief Schedules \c entry on the timer wheel of the app message loop \c ctx
+ * (see timerWheel.h), where all the timers of a loop share a single OS timer.
+ * The wheel of a NULL \c ctx is created on first use, the others by
+ * \c initTimerWheel(). Provided by the app integration (karereCommon.cpp)
+ * @return The handle of the timer, or zero if \c ctx has no wheel
+ */
+megaHandle addAppTimer(TimerWheel::Entry *entry, unsigned time, bool repeat, void *ctx);
+/** @brief Cancels a timer of the wheel of \c ctx. Canceling after the wheel
+ * has been released is a no-op that returns \c false */
+bool cancelAppTimer(megaHandle handle, void *ctx);
+/** @brief Creates the timer wheel of the app message loop \c ctx, with its OS
+ * timer on the event loop of \c ctx */
+void initTimerWheel(void *ctx);
+/** @brief Destroys the timer wheel of \c ctx, with its pending timers, and
+ * frees its OS timer. Must be called once the loop of \c ctx has stopped and
+ * before its event loop is destroyed */
+void releaseTimerWheel(void *ctx);
 
-#ifdef USE_LIBWEBSOCKETS
-    void init_uv_timer(void *ctx, uv_timer_t *timer);
-#else
-    eventloop *get_ev_loop(void *ctx);
-#endif
-    
 template <int persist, class CB>
 inline megaHandle setTimer(CB&& callback, unsigned time, void *ctx)
 {
-    struct Msg: public TimerMsg
+    struct Entry: public TimerWheel::Entry
     {
-        CB cb;
-        void *appCtx;
-        Msg(CB&& aCb, megaMessageFunc cFunc)
-        :TimerMsg(cFunc), cb(aCb)
-        {}
-        unsigned time;
-        int loop;
+        typename std::decay<CB>::type cb;
+        Entry(CB&& aCb): cb(std::forward<CB>(aCb)) {}
+        virtual void fire() { cb(); }
     };
-    megaMessageFunc cfunc = persist
-        ? (megaMessageFunc) [](void* arg)
-          {
-              Msg* msg = static_cast<Msg*>(arg);
-              if (msg->canceled)
-                  return;
-              msg->cb();
-          }
-        : (megaMessageFunc) [](void* arg)
-          {
-              timerMutex.lock();
-              Msg* msg = static_cast<Msg*>(arg);
-              if (msg->canceled)
-              {
-                  timerMutex.unlock();
-                  return;
-              }
-              msg->cb();
-              if (msg->canceled)
-              {
-                  timerMutex.unlock();
-                  return;
-              }
-              delete msg;
-              timerMutex.unlock();
-          };
-
-    timerMutex.lock();
-    Msg* pMsg = new Msg(std::forward<CB>(callback), cfunc);
-    timerMutex.unlock();
-
-    pMsg->appCtx = ctx;
-    pMsg->time = time;
-    pMsg->loop = persist;
-    
-#ifndef USE_LIBWEBSOCKETS
-    pMsg->timerEvent = event_new(get_ev_loop(ctx), -1, persist,
-      [](evutil_socket_t fd, short what, void* evarg)
-      {
-            megaPostMessageToGui(evarg, ((Msg* )evarg)->appCtx);
-      }, pMsg);
-
-    struct timeval tv;
-    tv.tv_sec = time / 1000;
-    tv.tv_usec = (time % 1000)*1000;
-    evtimer_add(pMsg->timerEvent, &tv);
-#else
-    marshallCall([pMsg, ctx]()
-    {
-        pMsg->timerEvent = new uv_timer_t();
-        pMsg->timerEvent->data = pMsg;
-        init_uv_timer(ctx, pMsg->timerEvent);
-        uv_timer_start(pMsg->timerEvent,
-                       [](uv_timer_t* handle)
-                       {
-                           megaPostMessageToGui(handle->data, ((Msg*)handle->data)->appCtx);
-                       }, pMsg->time, pMsg->loop ? pMsg->time : 0);
-    }, ctx);
-#endif
-    
-    return pMsg->handle;
+    return addAppTimer(new Entry(std::forward<CB>(callback)), time, persist != 0, ctx);
 }
 /** Cancels a previously set timeout with setTimeout()
  * @return \c false if the handle is not valid. This can happen if the timeout
@@ -143,42 +66,8 @@ inline megaHandle setTimer(CB&& callback, unsigned time, void *ctx)
  */
 static inline bool cancelTimeout(megaHandle handle, void *ctx)
 {
-    timerMutex.lock();
-
     assert(handle);
-    TimerMsg* timer = static_cast<TimerMsg*>(services_hstore_get_handle(MEGA_HTYPE_TIMER, handle));
-    if (!timer)
-    {
-        timerMutex.unlock();
-        return false; //not valid anymore
-    }
-
-//we have to make sure that we delete the timer only after all possibly queued
-//timer messages in the app's message queue are processed. For this purpose,
-//we first stop the timer, and only then post a call to delete the timer.
-//That call should be processed after all timer messages
-    timer->canceled = true; //disable timer callback being called by possibly queued messages, and message freeing in one-shot timer handler
-
-    timerMutex.unlock();
-
-#ifndef USE_LIBWEBSOCKETS
-    event_del(timer->timerEvent); //only removed from message loop, doesn't delete the event struct
-#endif
-    
-    marshallCall([timer, ctx]()
-    {
-#ifdef USE_LIBWEBSOCKETS
-        uv_timer_stop(timer->timerEvent);
-
-        marshallCall([timer, ctx]()
-        {
-            delete timer;
-        }, ctx);
-#else
-        delete timer;   //also deletes the timerEvent
-#endif
-    }, ctx);
-    return true;
+    return cancelAppTimer(handle, ctx);
 }
 /** @brief Cancels a previously set timer with setInterval.
  * @return \c false if the handle is not valid.
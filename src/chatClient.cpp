@@ -68,8 +68,11 @@ std::string encodeFirstName(const std::string& first);
           appCtx(ctx),
           api(sdk, ctx),
           app(aApp),
+          mMsgSearch(db),
+          mDbWriter(db),
           contactList(new ContactList(*this)),
           chats(new ChatRoomList(*this)),
+          mServices(new SdkChatServices(api)),
           mPresencedClient(&api, this, *this, caps)
 {
 }
@@ -232,9 +235,74 @@ void Client::createDbSchema()
     db.commit();
 }
 
+// records not refreshed for longer than this are not loaded. The cached IPs are
+// verified by a DNS lookup in parallel to each connection anyway
+static const time_t kDnsCacheMaxAge = 7 * 24 * 3600;
+
+void Client::loadDnsCache()
+{
+    db.simpleQuery("create table if not exists dns_cache(host text not null primary key,"
+        " ipv4 text, ipv6 text, resolve_ts int, connect_ipv4_ts int, connect_ipv6_ts int,"
+        " rtt_ipv4 int default -1, rtt_ipv6 int default -1)");
+    db.query("delete from dns_cache where resolve_ts < ?", (int64_t)(time(NULL) - kDnsCacheMaxAge));
+
+    DNScache& cache = websocketIO->mDnsCache;
+    SqliteStmt stmt(db, "select host, ipv4, ipv6, resolve_ts, connect_ipv4_ts, connect_ipv6_ts,"
+        " rtt_ipv4, rtt_ipv6 from dns_cache");
+    int count = 0;
+    while (stmt.step())
+    {
+        std::string host = stmt.stringCol(0);
+        std::string ipv4, ipv6;
+        if (cache.get(host, ipv4, ipv6))
+            continue;   // resolved in this session, more up to date
+
+        DNScache::DNSrecord record;
+        record.ipv4 = stmt.stringCol(1);
+        record.ipv6 = stmt.stringCol(2);
+        record.resolveTs = stmt.int64Col(3);
+        record.connectIpv4Ts = stmt.int64Col(4);
+        record.connectIpv6Ts = stmt.int64Col(5);
+        record.connectIpv4Rtt = stmt.intCol(6);
+        record.connectIpv6Rtt = stmt.intCol(7);
+        cache.load(host, record);
+        count++;
+    }
+    KR_LOG_DEBUG("Loaded %d records of the DNS cache", count);
+
+    cache.setChangeCb([this](const std::string& host, const DNScache::DNSrecord* record)
+    {
+        if (!db.isOpen())
+            return;
+
+        try
+        {
+            if (!record)
+            {
+                db.query("delete from dns_cache where host = ?", host);
+                return;
+            }
+            db.query("insert or replace into dns_cache(host, ipv4, ipv6, resolve_ts, connect_ipv4_ts,"
+                " connect_ipv6_ts, rtt_ipv4, rtt_ipv6) values(?,?,?,?,?,?,?,?)",
+                host, record->ipv4, record->ipv6, (int64_t)record->resolveTs,
+                (int64_t)record->connectIpv4Ts, (int64_t)record->connectIpv6Ts,
+                record->connectIpv4Rtt, record->connectIpv6Rtt);
+        }
+        catch(std::exception& e)
+        {
+            KR_LOG_ERROR("Error saving the DNS cache: %s", e.what());
+        }
+    });
+}
+
+void Client::unloadDnsCache()
+{
+    websocketIO->mDnsCache.setChangeCb(nullptr);
+}
+
 void Client::heartbeat()
 {
-    if (db.isOpen())
+    if (db.isOpen() && !mDbWriter.isRunning()) // otherwise, the writer thread does it
     {
         db.timedCommit();
     }
@@ -384,6 +452,7 @@ void Client::saveDb()
     {
         if (db.isOpen())
         {
+            mDbWriter.flush();
             db.commit();
         }
     }
@@ -394,6 +463,106 @@ void Client::saveDb()
     }
 }
 
+bool Client::setMessageSearchEnabled(bool enable)
+{
+    if (!db.isOpen())
+        throw std::runtime_error("setMessageSearchEnabled: Local cache is not initialized");
+
+    if (!enable)
+    {
+        mDbWriter.setIdleTask(nullptr);
+        if (mMsgSearchTimer)
+        {
+            cancelTimeout(mMsgSearchTimer, appCtx);
+            mMsgSearchTimer = 0;
+        }
+        mMsgSearch.disable();
+        return true;
+    }
+
+    if (mMsgSearch.isEnabled())
+        return true;
+
+    mDbWriter.flush();
+    if (!mMsgSearch.enable())
+        return false;
+
+    startMsgSearchBackfill();
+    return true;
+}
+
+void Client::startMsgSearchBackfill()
+{
+    if (!mMsgSearch.needsBackfill())
+        return;
+
+    if (mDbWriter.isRunning())
+    {
+        mDbWriter.setIdleTask([this](SqliteDb& aDb)
+        {
+            return mMsgSearch.backfill(aDb);
+        });
+        return;
+    }
+
+    // No writer thread, index the history in small chunks from this thread
+    auto wptr = weakHandle();
+    mMsgSearchTimer = karere::setTimeout([this, wptr]()
+    {
+        if (wptr.deleted())
+            return;
+
+        mMsgSearchTimer = 0;
+        try
+        {
+            if (!mMsgSearch.backfill(db, MsgSearchIndex::kBackfillChunk / 5))
+                return;
+        }
+        catch(std::exception& e)
+        {
+            KR_LOG_ERROR("Error indexing history for message search: %s", e.what());
+            return;
+        }
+        startMsgSearchBackfill();
+    }, 100, appCtx);
+}
+
+promise::Promise<Client::SearchResults> Client::searchMessages(const std::string& text,
+    karere::Id chatid, unsigned offset, unsigned count)
+{
+    if (!db.isOpen())
+        return promise::Error("searchMessages: Local cache is not initialized");
+
+    if (!mMsgSearch.isWorkerRunning() && !mMsgSearch.startWorker(dbPath(mSid)))
+        return promise::Error("searchMessages: Can't open the local cache for reading");
+
+    // Promises are not thread-safe, so the worker only carries the id of the search
+    uint32_t searchId = ++mMsgSearchSeq;
+    auto pms = mMsgSearchPending[searchId];
+    auto wptr = weakHandle();
+    mMsgSearch.searchAsync(text, chatid, offset, count,
+    [this, wptr, searchId](std::vector<MsgSearchIndex::Result>&& results, const std::string& error)
+    {
+        auto shared = std::make_shared<std::vector<MsgSearchIndex::Result>>(std::move(results));
+        marshallCall([this, wptr, searchId, shared, error]()
+        {
+            if (wptr.deleted())
+                return;
+
+            auto it = mMsgSearchPending.find(searchId);
+            if (it == mMsgSearchPending.end())
+                return;
+            auto pms = it->second;
+            mMsgSearchPending.erase(it);
+            if (error.empty())
+                pms.resolve(shared);
+            else
+                pms.reject(error);
+        }, appCtx);
+    });
+    return pms;
+}
+
 promise::Promise<void> Client::pushReceived()
 {
     // if already sent SYNCs or we are not logged in right now...
@@ -455,6 +624,7 @@ promise::Promise<void> Client::initWithNewSession(const char* sid, const std::st
 
     mSid = sid;
     createDb();
+    loadDnsCache();
 
 // We have a complete snapshot of the SDK contact and chat list state.
 // Commit it with the accompanying scsn
@@ -477,6 +647,7 @@ promise::Promise<void> Client::initWithNewSession(const char* sid, const std::st
         if (wptr.deleted())
             return;
         loadContactListFromApi(*contactList);
+        mDbWriter.start();
         mChatdClient.reset(new chatd::Client(this, mMyHandle));
         assert(chats->empty());
         chats->onChatsUpdate(*chatList);
@@ -608,6 +779,12 @@ void Client::initWithDbSession(const char* sid)
         loadOwnKeysFromDb();
         contactList->loadFromDb();
         mContactsLoaded = true;
+        mDbWriter.start();
+        loadDnsCache();
+        if (mMsgSearch.load())
+        {
+            startMsgSearchBackfill();
+        }
         mChatdClient.reset(new chatd::Client(this, mMyHandle));
         chats->loadFromDb();
     }
@@ -795,6 +972,9 @@ void Client::onRequestFinish(::mega::MegaApi* /*apiObj*/, ::mega::MegaRequest *r
 void Client::wipeDb(const std::string& sid)
 {
     assert(!sid.empty());
+    unloadDnsCache();
+    mMsgSearch.stopWorker();
+    mDbWriter.stop();
     db.close();
     std::string path = dbPath(sid);
     remove(path.c_str());
@@ -1223,13 +1403,7 @@ void Client::onPresenceChange(Id userid, Presence pres)
     {
         contactList->onPresenceChanged(userid, pres);
     }
-    for (auto& item: *chats)
-    {
-        auto& chat = *item.second;
-        if (!chat.isGroup())
-            continue;
-        static_cast<GroupChatRoom&>(chat).updatePeerPresence(userid, pres);
-    }
+    chats->updatePeerPresence(userid, pres);
     app.onPresenceChanged(userid, pres, false);
 }
 void Client::onPresenceConfigChanged(const presenced::Config& state, bool pending)
@@ -1241,12 +1415,17 @@ void Client::onConnStateChange(presenced::Client::ConnState /*state*/)
 
 }
 
-void GroupChatRoom::updatePeerPresence(uint64_t userid, Presence pres)
+void ChatRoomList::updatePeerPresence(uint64_t userid, Presence pres)
 {
-    auto it = mPeers.find(userid);
-    if (it == mPeers.end())
+    auto entry = mMemberIndex.find(userid);
+    if (!entry)
         return;
-    it->second->mPresence = pres;
+
+    entry->presence = pres;
+    for (auto member: entry->members)
+    {
+        member->mPresence = pres;
+    }
 }
 
 void Client::notifyNetworkOffline()
@@ -1285,6 +1464,12 @@ void Client::terminate(bool deleteDb)
     disconnect();
     mUserAttrCache.reset();
 
+    if (mMsgSearchTimer)
+    {
+        cancelTimeout(mMsgSearchTimer, appCtx);
+        mMsgSearchTimer = 0;
+    }
+
     try
     {
         if (deleteDb && !mSid.empty())
@@ -1294,6 +1479,9 @@ void Client::terminate(bool deleteDb)
         else if (db.isOpen())
         {
             KR_LOG_INFO("Doing final COMMIT to database");
+            unloadDnsCache();
+            mMsgSearch.stopWorker();
+            mDbWriter.stop();
             db.commit();
             db.close();
         }
@@ -1752,6 +1940,13 @@ const std::string &PeerChatRoom::completeTitleString() const
     return mTitleString;
 }
 
+void GroupChatRoom::bumpMembersVersion()
+{
+    // members are only changed by the karere thread
+    static uint64_t lastVersion = 0;
+    mMembersVersion = ++lastVersion;
+}
+
 promise::Promise<void> GroupChatRoom::addMember(uint64_t userid, chatd::Priv priv, bool saveToDb)
 {
     assert(userid != parent.mKarereClient.myHandle());
@@ -1766,6 +1961,7 @@ promise::Promise<void> GroupChatRoom::addMember(uint64_t userid, chatd::Priv pri
         else
         {
             it->second->mPriv = priv;
+            bumpMembersVersion();
         }
     }
     else
@@ -1862,7 +2058,7 @@ void GroupChatRoom::deleteSelf()
             return;
         }
 
-        auto db = parent.mKarereClient.db;
+        auto& db = parent.mKarereClient.db;
         db.query("delete from chat_peers where chatid=?", mChatid);
         db.query("delete from chats where chatid=?", mChatid);
         delete this;
@@ -2100,7 +2296,7 @@ GroupChatRoom::GroupChatRoom(ChatRoomList& parent, const mega::MegaTextChat& aCh
     }
 
     //save to db
-    auto db = parent.mKarereClient.db;
+    auto& db = parent.mKarereClient.db;
     db.query("delete from chat_peers where chatid=?", mChatid);
     db.query(
         "insert or replace into chats(chatid, shard, peer, peer_priv, "
@@ -2328,7 +2524,7 @@ promise::Promise<void> GroupChatRoom::invite(uint64_t userid, chatd::Priv priv)
 void ChatRoom::init(chatd::Chat& chat, chatd::DbInterface*& dbIntf)
 {
     mChat = &chat;
-    dbIntf = new ChatdSqliteDb(*mChat, parent.mKarereClient.db);
+    dbIntf = new ChatdSqliteDb(*mChat, parent.mKarereClient.db, &parent.mKarereClient.mDbWriter);
     if (mAppChatHandler)
     {
         setAppChatHandler(mAppChatHandler);
@@ -2575,6 +2771,7 @@ bool GroupChatRoom::syncMembers(const mega::MegaTextChat& chat)
                      member->mPriv, it->second);
 
                 member->mPriv = it->second;
+                bumpMembersVersion();
                 parent.mKarereClient.db.query("update chat_peers set priv=? where chatid=? and userid=?", member->mPriv, mChatid, userid);
             }
             ourIt++;
@@ -2688,54 +2885,118 @@ bool GroupChatRoom::syncWithApi(const mega::MegaTextChat& chat)
 GroupChatRoom::Member::Member(GroupChatRoom& aRoom, const uint64_t& user, chatd::Priv aPriv)
 : mRoom(aRoom), mHandle(user), mPriv(aPriv), mName("\0", 1)
 {
-    mNameAttrCbHandle = mRoom.parent.mKarereClient.userAttrCache().getAttr(
-        user, USER_ATTR_FULLNAME, this,
-        [](Buffer* buf, void* userp)
+    mRoom.bumpMembersVersion();
+    // may call updateName() and updateEmail() synchronously, if the user's
+    // attributes are cached
+    mRoom.parent.addToMemberIndex(*this);
+}
+
+GroupChatRoom::Member::~Member()
+{
+    mRoom.bumpMembersVersion();
+    mRoom.parent.removeFromMemberIndex(*this);
+}
+
+void GroupChatRoom::Member::updateName(const std::string& name)
+{
+    mName = name;
+    mRoom.bumpMembersVersion();
+    if (mRoom.mAppChatHandler)
     {
-        auto self = static_cast<Member*>(userp);
-        if (buf && !buf->empty())
-        {
-            self->mName.assign(buf->buf(), buf->dataSize());
-        }
-        else
+        mRoom.mAppChatHandler->onMemberNameChanged(mHandle, mName);
+    }
+
+    if (!mNameResolved.done())
+    {
+        mNameResolved.resolve();
+    }
+    else if (mRoom.memberNamesResolved().done() && !mRoom.mHasTitle)
+    {
+        mRoom.makeTitleFromMemberNames();
+    }
+}
+
+void GroupChatRoom::Member::updateEmail(const std::string& email)
+{
+    mEmail = email;
+    mRoom.bumpMembersVersion();
+    if (mName.size() <= 1 && mRoom.memberNamesResolved().done() && !mRoom.mHasTitle)
+    {
+        mRoom.makeTitleFromMemberNames();
+    }
+}
+
+void ChatRoomList::addToMemberIndex(GroupChatRoom::Member& member)
+{
+    bool created;
+    auto& entry = mMemberIndex.add(member.mHandle, &member, created);
+    if (!created)
+    {
+        // the attributes are already subscribed, replay what we have received so far
+        member.mPresence = entry.presence;
+        if (!entry.name.empty())
         {
-            self->mName.assign("\0", 1);
+            member.updateName(entry.name);
         }
-        if (self->mRoom.mAppChatHandler)
+        if (!entry.email.empty())
         {
-            self->mRoom.mAppChatHandler->onMemberNameChanged(self->mHandle, self->mName);
+            member.updateEmail(entry.email);
         }
+        return;
+    }
 
-        if (!self->mNameResolved.done())
+    // One subscription per user instead of per member, so an attribute change
+    // is dispatched via the index to the rooms of the user
+    auto& cache = mKarereClient.userAttrCache();
+    entry.nameAttrCbHandle = cache.getAttr(member.mHandle, USER_ATTR_FULLNAME, &entry,
+        [](Buffer* buf, void* userp)
+    {
+        auto& entry = *static_cast<GroupMemberIndex::Entry*>(userp);
+        if (buf && !buf->empty())
         {
-            self->mNameResolved.resolve();
+            entry.name.assign(buf->buf(), buf->dataSize());
         }
-        else if (self->mRoom.memberNamesResolved().done() && !self->mRoom.mHasTitle)
+        else
         {
-            self->mRoom.makeTitleFromMemberNames();
+            entry.name.assign("\0", 1);
         }
+        // the member holds a reference to its room, which has one to the room list
+        auto& index = entry.members.front()->mRoom.parent.mMemberIndex;
+        std::string name = entry.name; // the entry may be destroyed by the callbacks
+        index.forEachMember(entry.userid, [&name](GroupChatRoom::Member* m)
+        {
+            m->updateName(name);
+        });
     });
 
-    mEmailAttrCbHandle = mRoom.parent.mKarereClient.userAttrCache().getAttr(
-        user, USER_ATTR_EMAIL, this,
+    entry.emailAttrCbHandle = cache.getAttr(member.mHandle, USER_ATTR_EMAIL, &entry,
         [](Buffer* buf, void* userp)
     {
-        auto self = static_cast<Member*>(userp);
-        if (buf && !buf->empty())
+        auto& entry = *static_cast<GroupMemberIndex::Entry*>(userp);
+        if (!buf || buf->empty())
+            return;
+
+        entry.email.assign(buf->buf(), buf->dataSize());
+        auto& index = entry.members.front()->mRoom.parent.mMemberIndex;
+        std::string email = entry.email;
+        index.forEachMember(entry.userid, [&email](GroupChatRoom::Member* m)
         {
-            self->mEmail.assign(buf->buf(), buf->dataSize());
-            if (self->mName.size() <= 1 && self->mRoom.memberNamesResolved().done() && !self->mRoom.mHasTitle)
-            {
-                self->mRoom.makeTitleFromMemberNames();
-            }
-        }
+            m->updateEmail(email);
+        });
     });
 }
 
-GroupChatRoom::Member::~Member()
+void ChatRoomList::removeFromMemberIndex(GroupChatRoom::Member& member)
 {
-    mRoom.parent.mKarereClient.userAttrCache().removeCb(mNameAttrCbHandle);
-    mRoom.parent.mKarereClient.userAttrCache().removeCb(mEmailAttrCbHandle);
+    auto entry = mMemberIndex.remove(member.mHandle, &member);
+    if (!entry)
+        return;
+
+    // last member of the user
+    auto& cache = mKarereClient.userAttrCache();
+    cache.removeCb(entry->nameAttrCbHandle);
+    cache.removeCb(entry->emailAttrCbHandle);
+    mMemberIndex.erase(member.mHandle);
 }
 
 promise::Promise<void> GroupChatRoom::Member::nameResolved() const
@@ -2746,6 +3007,8 @@ promise::Promise<void> GroupChatRoom::Member::nameResolved() const
 void Client::connectToChatd(bool isInBackground)
 {
     mChatdClient->setKeepaliveType(isInBackground);
+    // the shards are connected in parallel, but each one needs its URL first
+    mChatdClient->prefetchDns();
 
     for (auto& item: *chats)
     {
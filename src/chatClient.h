@@ -3,12 +3,16 @@
 
 #include "karereCommon.h"
 #include "sdkApi.h"
+#include "sdkChatServices.h"
 #include <memory>
 #include <map>
 #include <type_traits>
 #include <retryHandler.h>
 #include "userAttrCache.h"
 #include <db.h>
+#include "dbWriter.h"
+#include "msgSearchIndex.h"
+#include "memberIndex.h"
 #include "chatd.h"
 #include "presenced.h"
 #include "IGui.h"
@@ -272,13 +276,14 @@ public:
         GroupChatRoom& mRoom;
         uint64_t mHandle;
         chatd::Priv mPriv;
-        UserAttrCache::Handle mNameAttrCbHandle;
-        UserAttrCache::Handle mEmailAttrCbHandle;
         std::string mName;
         std::string mEmail;
         Presence mPresence;
-        void subscribeForNameChanges();
         promise::Promise<void> mNameResolved;
+        // called via ChatRoomList's member index, which holds the attribute
+        // subscriptions of all the members of the same user
+        void updateName(const std::string& name);
+        void updateEmail(const std::string& email);
     public:
         Member(GroupChatRoom& aRoom, const uint64_t& user, chatd::Priv aPriv);
         ~Member();
@@ -300,6 +305,7 @@ public:
         promise::Promise<void> nameResolved() const;
 
         friend class GroupChatRoom;
+        friend class ChatRoomList;
     };
     /**
      * @brief A map that holds all the members of a group chat room, keyed by the userid */
@@ -308,6 +314,10 @@ public:
     /** @cond PRIVATE */
     protected:
     MemberMap mPeers;
+    /** Changes whenever a member is added or removed, or its privilege, name
+     * or email changes. Unique across all rooms */
+    uint64_t mMembersVersion = 0;
+    void bumpMembersVersion();
     bool mHasTitle;
     std::string mEncryptedTitle; //holds the encrypted title until we create the strongvelope module
     IApp::IGroupChatListItem* mRoomGui;
@@ -318,7 +328,6 @@ public:
     void clearTitle();
     promise::Promise<void> addMember(uint64_t userid, chatd::Priv priv, bool saveToDb);
     bool removeMember(uint64_t userid);
-    void updatePeerPresence(uint64_t peer, Presence pres);
     virtual bool syncWithApi(const mega::MegaTextChat &chat);
     IApp::IGroupChatListItem* addAppItem();
     virtual IApp::IChatListItem* roomGui() { return mRoomGui; }
@@ -347,6 +356,11 @@ public:
     /** @brief Returns the map of the users in the chatroom, except our own user */
     const MemberMap& peers() const { return mPeers; }
 
+    /** @brief Returns a value that changes every time the members or their
+     * privileges, names or emails change, so that data derived from them can
+     * be cached. The value is unique across all rooms */
+    uint64_t membersVersion() const { return mMembersVersion; }
+
     /** @brief Returns whether the group chatroom has a title set. If not, then
       * its title string will be composed from the first names of the room members
       */
@@ -423,6 +437,22 @@ public:
     ~ChatRoomList();
     void loadFromDb();
     void onChatsUpdate(mega::MegaTextChatList& chats);
+    /** @brief Per-user state shared by all the group chat members of a user */
+    struct MemberIndexData
+    {
+        UserAttrCache::Handle nameAttrCbHandle;
+        UserAttrCache::Handle emailAttrCbHandle;
+        /** Last values received from the attribute cache, for members added later */
+        std::string name;
+        std::string email;
+        Presence presence;
+    };
+    typedef MemberIndex<GroupChatRoom::Member, MemberIndexData> GroupMemberIndex;
+    GroupMemberIndex mMemberIndex;
+    void addToMemberIndex(GroupChatRoom::Member& member);
+    void removeFromMemberIndex(GroupChatRoom::Member& member);
+    /** @brief Updates the presence of the user in all the group chats it's a member of */
+    void updatePeerPresence(uint64_t userid, Presence pres);
 /** @endcond PRIVATE */
 };
 
@@ -566,6 +596,7 @@ class Client: public rtcModule::IGlobalHandler,
 {
 public:
     enum ConnState { kDisconnected = 0, kConnecting, kConnected };
+    typedef std::shared_ptr<std::vector<MsgSearchIndex::Result>> SearchResults;
     enum InitState: uint8_t
     {
         /** The client has just been created. \c init() has not been called yet */
@@ -637,6 +668,8 @@ public:
     MyMegaApi api;              // MegaApi's instance
     IApp& app;                  // app's interface
     SqliteDb db;                // db-layer interface
+    MsgSearchIndex mMsgSearch;  // full-text index of the history, must outlive mDbWriter
+    DbWriter mDbWriter;         // write-behind queue for chatd writes to \c db
 
     std::unique_ptr<chatd::Client> mChatdClient;
 
@@ -658,6 +691,9 @@ public:
     std::unique_ptr<ChatRoomList> chats;
 
     megaHandle mSyncTimer = 0;              // to wait for reception of SYNCs
+    megaHandle mMsgSearchTimer = 0;         // to index existing history when there is no DbWriter thread
+    uint32_t mMsgSearchSeq = 0;             // id of the last search passed to the worker of mMsgSearch
+    std::map<uint32_t, promise::Promise<SearchResults>> mMsgSearchPending; // searches not yet completed
     int mSyncCount = -1;                     // to track if all chats returned SYNC
     promise::Promise<void> mSyncPromise;    // resolved only when up to date
 
@@ -669,6 +705,7 @@ protected:
     std::string mMyName = std::string("\0", 1);
     std::string mMyEmail;
     uint64_t mMyIdentity = 0; // seed for CLIENTID
+    std::unique_ptr<IChatServices> mServices; // API requests of the chat core, SdkChatServices by default
     std::unique_ptr<UserAttrCache> mUserAttrCache;
     UserAttrCache::Handle mOwnNameAttrHandle;
 
@@ -713,6 +750,11 @@ public:
     const std::string& myEmail() const { return mMyEmail; }
     uint64_t myIdentity() const { return mMyIdentity; }
     UserAttrCache& userAttrCache() const { return *mUserAttrCache; }
+    IChatServices& services() const { return *mServices; }
+    /** @brief Replaces the implementation of the API requests that the chat
+     * core makes, i.e. with a StubChatServices for benchmarking. Must be called
+     * before init(), as the requests in progress are not migrated */
+    void setServices(IChatServices* services) { mServices.reset(services); }
 
     ConnState connState() const { return mConnState; }
     bool connected() const { return mConnState == kConnected; }
@@ -843,6 +885,23 @@ public:
     void setCommitMode(bool commitEach);
     void saveDb();  // forces a commit
 
+    /** @brief Enables or disables the full-text search of messages. When enabled,
+     * messages already in the local history are indexed in background.
+     * The setting is persisted in the db
+     * @return false if the search could not be enabled (no FTS5 support in sqlite)
+     */
+    bool setMessageSearchEnabled(bool enable);
+    bool isMessageSearchEnabled() const { return mMsgSearch.isEnabled(); }
+
+    /** @brief Searches the local history of one or all chats.
+     * Only messages that have been decrypted and stored in the local cache
+     * are found. The query is run by a worker thread, and the promise is
+     * resolved in the app thread.
+     * @param chatid The chat to search in, or \c Id::inval() for all chats
+     */
+    promise::Promise<SearchResults> searchMessages(const std::string& text, karere::Id chatid,
+                                                   unsigned offset, unsigned count);
+
     bool isCallInProgress(karere::Id chatid = karere::Id::inval()) const;
 #ifndef KARERE_DISABLE_WEBRTC
     virtual rtcModule::ICallHandler* onCallIncoming(rtcModule::ICall& call, karere::AvFlags av);
@@ -857,6 +916,7 @@ public:
 protected:
     void heartbeat();
     void setInitState(InitState newState);
+    void startMsgSearchBackfill();
 
     // db-related methods
     std::string dbPath(const std::string& sid) const;
@@ -864,6 +924,10 @@ protected:
     void createDb();
     void wipeDb(const std::string& sid);
     void createDbSchema();
+    /** Loads the DNS cache of the websockets layer from the db, and keeps it
+     * persisted from now on, so that a warm start doesn't need to resolve */
+    void loadDnsCache();
+    void unloadDnsCache();
 
     // initialization of own handle/email/identity/keys/contacts...
     karere::Id getMyHandleFromDb();
@@ -0,0 +1,56 @@
+#include "chatServices.h"
+
+namespace karere
+{
+promise::Error StubChatServices::notFound(const std::string& what)
+{
+    mStats.notFound++;
+    return promise::Error(what+" not found", kErrNotFound, kErrTypeStub);
+}
+
+void StubChatServices::setUserAttr(Id user, unsigned attrType, const Buffer& data)
+{
+    mUserAttrs[std::make_pair(user, attrType)] = std::make_shared<Buffer>(data.buf(), data.dataSize());
+}
+
+void StubChatServices::setUserAttr(Id user, unsigned attrType, const std::string& data)
+{
+    mUserAttrs[std::make_pair(user, attrType)] = std::make_shared<Buffer>(data.data(), data.size());
+}
+
+void StubChatServices::removeUserAttr(Id user, unsigned attrType)
+{
+    mUserAttrs.erase(std::make_pair(user, attrType));
+}
+
+promise::Promise<std::shared_ptr<Buffer>> StubChatServices::fetchUserAttr(Id user, unsigned attrType)
+{
+    mStats.userAttrRequests++;
+    auto it = mUserAttrs.find(std::make_pair(user, attrType));
+    if (it == mUserAttrs.end())
+        return notFound("User attribute "+std::to_string(attrType)+" of "+user.toString());
+    // the caller may take over the buffer, so give it a copy
+    auto& data = *it->second;
+    return std::make_shared<Buffer>(data.buf(), data.dataSize());
+}
+
+promise::Promise<std::string> StubChatServices::fetchChatdUrl(Id chatid)
+{
+    mStats.chatdUrlRequests++;
+    auto it = mChatdUrls.find(chatid);
+    if (it != mChatdUrls.end())
+        return it->second;
+    if (mDefaultChatdUrl.empty())
+        return notFound("Chatd url of chat "+chatid.toString());
+    return mDefaultChatdUrl;
+}
+
+promise::Promise<std::string> StubChatServices::fetchRichPreview(const std::string& url)
+{
+    mStats.richPreviewRequests++;
+    auto it = mRichPreviews.find(url);
+    if (it == mRichPreviews.end())
+        return notFound("Rich preview of "+url);
+    return it->second;
+}
+}
@@ -0,0 +1,79 @@
+#ifndef CHATSERVICES_H
+#define CHATSERVICES_H
+/**
+ * @file chatServices.h
+ * @brief The API requests that the chat core (the chatd client and the user
+ * attribute cache) makes, abstracted from the Mega SDK.
+ *
+ * karere::Client uses SdkChatServices, which forwards them to MegaApi.
+ * StubChatServices serves them from memory, so that the core can be run and
+ * benchmarked without the SDK and without a server.
+ */
+#include <map>
+#include <memory>
+#include <string>
+#include "base/promise.h"
+#include "karereId.h"
+
+namespace karere
+{
+class IChatServices
+{
+public:
+    /** Error code of a request for something that doesn't exist. It has the
+     * same value as ::mega::API_ENOENT, so callers can check for it without
+     * the SDK */
+    enum { kErrNotFound = -9 };
+    /** Error type of the errors of the stub, SdkChatServices rejects with the
+     * ERRTYPE_MEGASDK errors of the SDK */
+    enum { kErrTypeStub = 0x3e9ac0de };
+
+    /** @brief Fetches a user attribute, in the same binary format as it is
+     * cached by UserAttrCache. \c attrType is one of the ::mega::MegaApi
+     * USER_ATTR_xxx codes, or USER_ATTR_RSA_PUBKEY / USER_ATTR_EMAIL.
+     * Composite attributes, i.e. USER_ATTR_FULLNAME, are not supported */
+    virtual promise::Promise<std::shared_ptr<Buffer>> fetchUserAttr(Id user, unsigned attrType) = 0;
+    /** @brief Fetches the url of the chatd shard that serves the chat */
+    virtual promise::Promise<std::string> fetchChatdUrl(Id chatid) = 0;
+    /** @brief Fetches the rich preview metadata (JSON) of an url */
+    virtual promise::Promise<std::string> fetchRichPreview(const std::string& url) = 0;
+    virtual ~IChatServices() {}
+};
+
+/** @brief In-memory implementation of IChatServices. Requests are resolved
+ * synchronously from the values that were set, and rejected with
+ * \c kErrNotFound if there is none */
+class StubChatServices: public IChatServices
+{
+public:
+    struct Stats
+    {
+        uint64_t userAttrRequests = 0;
+        uint64_t chatdUrlRequests = 0;
+        uint64_t richPreviewRequests = 0;
+        /** Requests that were rejected because there is no value set */
+        uint64_t notFound = 0;
+    };
+protected:
+    std::map<std::pair<Id, unsigned>, std::shared_ptr<Buffer>> mUserAttrs;
+    std::map<Id, std::string> mChatdUrls;
+    std::map<std::string, std::string> mRichPreviews;
+    std::string mDefaultChatdUrl;
+    Stats mStats;
+    promise::Error notFound(const std::string& what);
+public:
+    void setUserAttr(Id user, unsigned attrType, const Buffer& data);
+    void setUserAttr(Id user, unsigned attrType, const std::string& data);
+    void removeUserAttr(Id user, unsigned attrType);
+    void setChatdUrl(Id chatid, const std::string& url) { mChatdUrls[chatid] = url; }
+    /** @brief The url returned for the chats that don't have one set */
+    void setDefaultChatdUrl(const std::string& url) { mDefaultChatdUrl = url; }
+    void setRichPreview(const std::string& url, const std::string& json) { mRichPreviews[url] = json; }
+    const Stats& stats() const { return mStats; }
+
+    virtual promise::Promise<std::shared_ptr<Buffer>> fetchUserAttr(Id user, unsigned attrType);
+    virtual promise::Promise<std::string> fetchChatdUrl(Id chatid);
+    virtual promise::Promise<std::string> fetchRichPreview(const std::string& url);
+};
+}
+#endif
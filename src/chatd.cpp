@@ -47,6 +47,7 @@ using namespace karere;
 #define CALL_LISTENER(methodName,...)                                                           \
     do {                                                                                        \
       try {                                                                                     \
+          CommandStats::Scope statsScope_(mClient.mCommandStats, mClient.mCommandStats.listener);\
           CHATD_LOG_LISTENER_CALL("Calling Listener::" #methodName "()");                       \
           mListener->methodName(__VA_ARGS__);                                                   \
       } catch(std::exception& e) {                                                              \
@@ -57,6 +58,7 @@ using namespace karere;
 #define CALL_CRYPTO(methodName,...)                                                             \
     do {                                                                                        \
       try {                                                                                     \
+          CommandStats::Scope statsScope_(mClient.mCommandStats, mClient.mCommandStats.crypto);\
           CHATD_LOG_CRYPTO_CALL("Calling ICrypto::" #methodName "()");                          \
           mCrypto->methodName(__VA_ARGS__);                                                     \
       } catch(std::exception& e) {                                                              \
@@ -67,6 +69,7 @@ using namespace karere;
 #define CALL_DB(methodName,...)                                                           \
     do {                                                                                        \
       try {                                                                                     \
+          CommandStats::Scope statsScope_(mClient.mCommandStats, mClient.mCommandStats.db); \
           CHATD_LOG_DB_CALL("Calling DbInterface::" #methodName "()");                               \
           mDbInterface->methodName(__VA_ARGS__);                                                   \
       } catch(std::exception& e) {                                                              \
@@ -86,7 +89,7 @@ namespace chatd
 // there is no guarantee as to ordering
 
 Client::Client(karere::Client *client, Id userId)
-:mUserId(userId), mApi(&client->api), karereClient(client)
+:mUserId(userId), mHistPrefetcher(*this), mApi(&client->api), karereClient(client)
 {
     mRichPrevAttrCbHandle = karereClient->userAttrCache().getAttr(mUserId, ::mega::MegaApi::USER_ATTR_RICH_PREVIEWS, this,
        [](::Buffer *buf, void* userp)
@@ -175,8 +178,248 @@ Chat& Client::createChat(Id chatid, int shardNo, const std::string& url,
     // add chatid to the connection's chatids
     conn->mChatIds.insert(chatid);
     mChatForChatId.emplace(chatid, std::shared_ptr<Chat>(chat));
+    mChatsNotLoggedIn++;
     return *chat;
 }
+int Client::resolveDns(Connection& conn, const std::string& host, DnsCb&& cb)
+{
+    auto it = mPendingDns->find(host);
+    if (it != mPendingDns->end())
+    {
+        CHATD_LOG_DEBUG("Resolution of %s already in progress, waiting for it", host.c_str());
+        it->second.push_back(std::move(cb));
+        return 0;
+    }
+
+    (*mPendingDns)[host].push_back(std::move(cb));
+    auto start = karere::LatencyHistogram::Clock::now();
+    auto wptr = conn.weakHandle();
+    std::weak_ptr<PendingDnsMap> wpending = mPendingDns;
+    // wsResolveDNS() returns false on success
+    bool failed = conn.wsResolveDNS(karereClient->websocketIO, host.c_str(),
+    [this, wptr, wpending, host, start](int status, std::vector<std::string>& ipsv4, std::vector<std::string>& ipsv6)
+    {
+        auto pending = wpending.lock();
+        if (!pending)
+            return; // the client is gone, and so are the waiters
+
+        auto waitIt = pending->find(host);
+        if (waitIt == pending->end())
+            return;
+
+        std::vector<DnsCb> waiters;
+        waiters.swap(waitIt->second);
+        pending->erase(waitIt);
+        if (wptr.deleted())
+        {
+            // the connection that issued the request is gone, fail the
+            // waiters so that they retry instead of waiting forever
+            std::vector<std::string> none;
+            for (auto& waiter: waiters)
+            {
+                waiter(-1, none, none);
+            }
+            return;
+        }
+
+        mConnectStats.dns.record(start);
+        for (auto& waiter: waiters)
+        {
+            waiter(status, ipsv4, ipsv6);
+        }
+    });
+
+    if (failed)
+    {
+        mPendingDns->erase(host);
+        return -1;
+    }
+    return 0;
+}
+
+void Client::prefetchDns()
+{
+    for (auto& item: mConnections)
+    {
+        Connection& conn = *item.second;
+        if (conn.state() >= Connection::kStateResolving || !conn.mUrl.isValid())
+            continue;
+
+        const std::string& host = conn.mUrl.host;
+        std::string ipv4, ipv6;
+        if (mPendingDns->find(host) != mPendingDns->end() || conn.mDNScache.get(host, ipv4, ipv6))
+            continue;   // cached IPs are verified anyway by reconnect(), in parallel to the connection
+
+        CHATD_LOG_DEBUG("Prefetching DNS of shard %d: %s", conn.shardNo(), host.c_str());
+        DNScache& cache = conn.mDNScache;
+        resolveDns(conn, host, [&cache, host](int status, std::vector<std::string>& ipsv4, std::vector<std::string>& ipsv6)
+        {
+            if (status < 0 || (ipsv4.empty() && ipsv6.empty()))
+            {
+                CHATD_LOG_WARNING("DNS prefetch of %s failed", host.c_str());
+                return;
+            }
+
+            std::string cachedIpv4, cachedIpv6;
+            if (!cache.get(host, cachedIpv4, cachedIpv6))
+            {
+                cache.set(host, ipsv4.size() ? ipsv4.at(0) : "",
+                                ipsv6.size() ? ipsv6.at(0) : "");
+            }
+        });
+    }
+}
+
+std::string ConnectStats::toJson() const
+{
+    std::string result;
+    result.reserve(1024);
+    result.append("{\"url\":").append(url.toJson())
+          .append(",\"dns\":").append(dns.toJson())
+          .append(",\"connect\":").append(connect.toJson())
+          .append(",\"hello\":").append(hello.toJson())
+          .append(",\"join\":").append(join.toJson())
+          .append(",\"histDone\":").append(histDone.toJson())
+          .append(",\"shardReady\":").append(shardReady.toJson())
+          .append("}");
+    return result;
+}
+
+void CommandStats::recordRecv(uint8_t opcode, size_t bytes, karere::LatencyHistogram::Clock::time_point start)
+{
+    if (opcode >= kOpcodeCount)
+    {
+        unknownOpcodes++;
+        return;
+    }
+    recv[opcode].record(start);
+    recvBytes[opcode] += bytes;
+}
+
+void CommandStats::recordSend(int shard, uint8_t opcode, size_t bytes, karere::LatencyHistogram::Clock::time_point start)
+{
+    auto& shardStats = shards[shard];
+    shardStats.bytesOut += bytes;
+    shardStats.framesOut++;
+    if (opcode >= kOpcodeCount)
+    {
+        unknownOpcodes++;
+        return;
+    }
+    send[opcode].record(start);
+    sendBytes[opcode] += bytes;
+}
+
+void CommandStats::recordFrameIn(int shard, size_t bytes)
+{
+    auto& shardStats = shards[shard];
+    shardStats.bytesIn += bytes;
+    shardStats.framesIn++;
+}
+
+void CommandStats::reset()
+{
+    for (unsigned i = 0; i < kOpcodeCount; i++)
+    {
+        recv[i].reset();
+        recvBytes[i] = 0;
+        send[i].reset();
+        sendBytes[i] = 0;
+    }
+    unknownOpcodes = 0;
+    db.reset();
+    crypto.reset();
+    listener.reset();
+    shards.clear();
+}
+
+static void opcodeStatsToJson(std::string& result, const karere::LatencyHistogram* hists, const uint64_t* bytes)
+{
+    result+='{';
+    bool first = true;
+    for (unsigned i = 0; i < CommandStats::kOpcodeCount; i++)
+    {
+        if (!hists[i].count())
+            continue;
+        if (first)
+            first = false;
+        else
+            result+=',';
+        result.append("\"").append(Command::opcodeToStr(i))
+              .append("\":{\"bytes\":").append(std::to_string(bytes[i]))
+              .append(",\"time\":").append(hists[i].toJson())+='}';
+    }
+    result+='}';
+}
+
+std::string CommandStats::toJson() const
+{
+    std::string result;
+    result.reserve(4096);
+    result.append("{\"enabled\":").append(enabled ? "true" : "false")
+          .append(",\"recv\":");
+    opcodeStatsToJson(result, recv, recvBytes);
+    result.append(",\"send\":");
+    opcodeStatsToJson(result, send, sendBytes);
+    result.append(",\"unknownOpcodes\":").append(std::to_string(unknownOpcodes))
+          .append(",\"db\":").append(db.toJson())
+          .append(",\"crypto\":").append(crypto.toJson())
+          .append(",\"listener\":").append(listener.toJson())
+          .append(",\"shards\":{");
+    bool first = true;
+    for (auto& shard: shards)
+    {
+        if (first)
+            first = false;
+        else
+            result+=',';
+        result.append("\"").append(std::to_string(shard.first))
+              .append("\":{\"bytesIn\":").append(std::to_string(shard.second.bytesIn))
+              .append(",\"bytesOut\":").append(std::to_string(shard.second.bytesOut))
+              .append(",\"framesIn\":").append(std::to_string(shard.second.framesIn))
+              .append(",\"framesOut\":").append(std::to_string(shard.second.framesOut))+='}';
+    }
+    result.append("}}");
+    return result;
+}
+
+std::string Client::statsJson() const
+{
+    // the send queues are sampled, there is nothing to record while disabled
+    size_t sending = 0;
+    size_t maxSending = 0;
+    std::map<int, size_t> shardSending;
+    for (auto& item: mChatForChatId)
+    {
+        auto& chat = *item.second;
+        size_t size = chat.mSending.size();
+        sending += size;
+        shardSending[chat.connection().shardNo()] += size;
+        if (size > maxSending)
+            maxSending = size;
+    }
+    std::string result;
+    result.reserve(8192);
+    result.append("{\"commands\":").append(mCommandStats.toJson())
+          .append(",\"connect\":").append(mConnectStats.toJson())
+          .append(",\"sending\":{\"total\":").append(std::to_string(sending))
+          .append(",\"max\":").append(std::to_string(maxSending))
+          .append(",\"chats\":").append(std::to_string(mChatForChatId.size()))
+          .append(",\"shards\":{");
+    bool first = true;
+    for (auto& shard: shardSending)
+    {
+        if (first)
+            first = false;
+        else
+            result+=',';
+        result.append("\"").append(std::to_string(shard.first))
+              .append("\":").append(std::to_string(shard.second));
+    }
+    result.append("}}}");
+    return result;
+}
+
 void Client::sendKeepalive()
 {
     for (auto& conn: mConnections)
@@ -198,6 +441,25 @@ void Client::setKeepaliveType(bool isInBackground)
     mKeepaliveType = isInBackground ? OP_KEEPALIVEAWAY : OP_KEEPALIVE;
 }
 
+bool Client::setTraceFile(const std::string& path)
+{
+    if (mTrace.isOpen())
+    {
+        CHATD_LOG_INFO("Stopped recording trace: %llu frames, %llu bytes",
+            (unsigned long long)mTrace.frameCount(), (unsigned long long)mTrace.byteCount());
+        mTrace.close();
+    }
+    if (path.empty())
+        return true;
+    if (!mTrace.open(path))
+    {
+        CHATD_LOG_ERROR("Can't create trace file %s", path.c_str());
+        return false;
+    }
+    CHATD_LOG_INFO("Recording wire traffic to %s", path.c_str());
+    return true;
+}
+
 void Client::notifyUserIdle()
 {
     if (mKeepaliveType == OP_KEEPALIVEAWAY)
@@ -214,6 +476,7 @@ void Client::cancelTimers()
         cancelTimeout(*it, karereClient->appCtx);
    }
    mSeenTimers.clear();
+   mHistPrefetcher.cancelTimer();
 }
 
 void Client::notifyUserActive()
@@ -239,18 +502,7 @@ uint8_t Client::richLinkState() const
 
 bool Client::areAllChatsLoggedIn()
 {
-    bool allConnected = true;
-
-    for (map<Id, shared_ptr<Chat>>::iterator it = mChatForChatId.begin(); it != mChatForChatId.end(); it++)
-    {
-        Chat* chat = it->second.get();
-        if (chat->onlineState() != kChatStateOnline && !chat->isDisabled())
-        {
-            allConnected = false;
-            break;
-        }
-    }
-
+    bool allConnected = (mChatsNotLoggedIn == 0);
     if (allConnected)
     {
         CHATD_LOG_DEBUG("We are now logged in to all chats");
@@ -266,17 +518,18 @@ void Chat::connect()
     {
         mConnection.mState = Connection::kStateFetchingUrl;
         auto wptr = getDelTracker();
-        mClient.mApi->call(&::mega::MegaApi::getUrlChat, mChatId)
-        .then([wptr, this](ReqResult result)
+        auto start = karere::LatencyHistogram::Clock::now();
+        mClient.karereClient->services().fetchChatdUrl(mChatId)
+        .then([wptr, this, start](const std::string& url)
         {
             if (wptr.deleted())
             {
                 CHATD_LOG_DEBUG("Chatd URL request completed, but chatd client was deleted");
                 return;
             }
+            mClient.mConnectStats.url.record(start);
 
-            const char* url = result->getLink();
-            if (!url || !url[0])
+            if (url.empty())
             {
                 CHATID_LOG_ERROR("No chatd URL received from API");
                 return;
@@ -314,11 +567,27 @@ void Chat::disconnect()
     setOnlineState(kChatStateOffline);
 }
 
+void Chat::disable(bool state)
+{
+    if (state == mIsDisabled)
+        return;
+
+    mIsDisabled = state;
+    if (mOnlineState != kChatStateOnline)
+    {
+        if (state)
+            mClient.mChatsNotLoggedIn--;
+        else
+            mClient.mChatsNotLoggedIn++;
+    }
+}
+
 void Chat::login()
 {
     assert(mConnection.isOnline());
     mUserDump.clear();
     setOnlineState(kChatStateJoining);
+    mLoginTs = karere::LatencyHistogram::Clock::now();
     // In both cases (join/joinrangehist), don't block history messages being sent to app
     mServerOldHistCbEnabled = false;
 
@@ -336,10 +605,20 @@ Connection::Connection(Client& client, int shardNo)
   mDNScache(mChatdClient.karereClient->websocketIO->mDnsCache)
 {}
 
+void Connection::onAllChatsJoined()
+{
+    mChatdClient.mConnectStats.shardReady.record(mReconnectStart);
+    CHATDS_LOG_DEBUG("All chats of the shard are online, %lld ms after the reconnect started",
+        (long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+            karere::LatencyHistogram::Clock::now() - mReconnectStart).count());
+}
+
 void Connection::wsConnectCb()
 {
-    CHATDS_LOG_DEBUG("Chatd connected to %s", mTargetIp.c_str());
-    mDNScache.connectDone(mUrl.host, mTargetIp);
+    mTargetIp = wsConnectedIp();
+    CHATDS_LOG_DEBUG("Chatd connected to %s in %d ms", mTargetIp.c_str(), wsConnectRtt());
+    mChatdClient.mConnectStats.connect.record(mStageStart);
+    mDNScache.connectDone(mUrl.host, mTargetIp, wsConnectRtt());
     mState = kStateConnected;
     assert(!mConnectPromise.done());
     mConnectPromise.resolve();
@@ -358,6 +637,8 @@ void Connection::onSocketClose(int errcode, int errtype, const std::string& reas
 {
     CHATDS_LOG_WARNING("Socket close on IP %s. Reason: %s", mTargetIp.c_str(), reason.c_str());
     mHeartbeatEnabled = false;
+    mHelloPending = false;
+    mChatsJoining = 0;
     auto oldState = mState;
     mState = kStateDisconnected;
 
@@ -471,6 +752,7 @@ Promise<void> Connection::reconnect()
 #endif
             disconnect();
             mConnectPromise = Promise<void>();
+            mReconnectStart = karere::LatencyHistogram::Clock::now();
 
             string ipv4, ipv6;
             bool cachedIPs = mDNScache.get(mUrl.host, ipv4, ipv6);
@@ -485,7 +767,7 @@ Promise<void> Connection::reconnect()
                     chat.setOnlineState(kChatStateConnecting);
             }
 
-            int statusDNS = wsResolveDNS(mChatdClient.karereClient->websocketIO, mUrl.host.c_str(),
+            int statusDNS = mChatdClient.resolveDns(*this, mUrl.host,
                          [wptr, cachedIPs, this](int statusDNS, std::vector<std::string> &ipsv4, std::vector<std::string> &ipsv6)
             {
                 if (wptr.deleted())
@@ -577,6 +859,8 @@ Promise<void> Connection::reconnect()
                     return;
 
                 assert(isOnline());
+                mStageStart = karere::LatencyHistogram::Clock::now();
+                mHelloPending = true;
                 sendCommand(Command(OP_CLIENTID)+mChatdClient.karereClient->myIdentity());
                 mTsLastRecv = time(NULL);   // data has been received right now, since connection is established
                 mHeartbeatEnabled = true;
@@ -601,49 +885,23 @@ void Connection::disconnect()
 
 void Connection::doConnect()
 {
-    string ipv4, ipv6;
-    bool cachedIPs = mDNScache.get(mUrl.host, ipv4, ipv6);
+    string fallbackIp;
+    bool cachedIPs = mDNScache.getByPreference(mUrl.host, usingipv6, mTargetIp, fallbackIp);
     assert(cachedIPs);
-    mTargetIp = (usingipv6 && ipv6.size()) ? ipv6 : ipv4;
 
     mState = kStateConnecting;
-    CHATDS_LOG_DEBUG("Connecting to chatd using the IP: %s", mTargetIp.c_str());
+    mStageStart = karere::LatencyHistogram::Clock::now();
+    CHATDS_LOG_DEBUG("Connecting to chatd using the IP: %s (fallback: %s)", mTargetIp.c_str(), fallbackIp.c_str());
 
-    bool rt = wsConnect(mChatdClient.karereClient->websocketIO, mTargetIp.c_str(),
+    bool rt = wsConnectDualStack(mChatdClient.karereClient->websocketIO, mTargetIp, fallbackIp,
               mUrl.host.c_str(),
               mUrl.port,
               mUrl.path.c_str(),
               mUrl.isSecure);
 
-    if (!rt)    // immediate failure --> try the other IP family (if available)
+    if (!rt)    // immediate failure with both IP families
     {
         CHATDS_LOG_DEBUG("Connection to chatd failed using the IP: %s", mTargetIp.c_str());
-
-        string oldTargetIp = mTargetIp;
-        mTargetIp.clear();
-        if (oldTargetIp == ipv6 && ipv4.size())
-        {
-            mTargetIp = ipv4;
-        }
-        else if (oldTargetIp == ipv4 && ipv6.size())
-        {
-            mTargetIp = ipv6;
-        }
-
-        if (mTargetIp.size())
-        {
-            CHATDS_LOG_DEBUG("Retrying using the IP: %s", mTargetIp.c_str());
-            if (wsConnect(mChatdClient.karereClient->websocketIO, mTargetIp.c_str(),
-                                      mUrl.host.c_str(),
-                                      mUrl.port,
-                                      mUrl.path.c_str(),
-                                      mUrl.isSecure))
-            {
-                return;
-            }
-            CHATDS_LOG_DEBUG("Connection to chatd failed using the IP: %s", mTargetIp.c_str());
-        }
-
         onSocketClose(0, 0, "Websocket error on wsConnect (chatd)");
     }
 }
@@ -721,7 +979,17 @@ bool Connection::sendBuf(Buffer&& buf)
     if (!isOnline())
         return false;
 
+    auto& stats = mChatdClient.mCommandStats;
+    bool statsEnabled = stats.enabled;
+    karere::LatencyHistogram::Clock::time_point start;
+    if (statsEnabled)
+        start = karere::LatencyHistogram::Clock::now();
+
     bool rc = wsSendMessage(buf.buf(), buf.dataSize());
+    if (rc && mChatdClient.mTrace.isOpen())
+        mChatdClient.mTrace.record(kTraceSend, mShardNo, buf.buf(), buf.dataSize());
+    if (rc && statsEnabled && buf.dataSize())
+        stats.recordSend(mShardNo, buf.read<uint8_t>(0), buf.dataSize(), start);
     buf.free();
     return rc;
 }
@@ -881,13 +1149,17 @@ string KeyCommand::toString() const
 // rejoin all open chats after reconnection (this is mandatory)
 bool Connection::rejoinExistingChats()
 {
+    mChatsJoining = 0;
     for (auto& chatid: mChatIds)
     {
         try
         {
             Chat& chat = mChatdClient.chats(chatid);
             if (!chat.isDisabled())
+            {
+                mChatsJoining++;
                 chat.login();
+            }
         }
         catch(std::exception& e)
         {
@@ -918,6 +1190,10 @@ void Chat::onJoinRejected()
 
 void Chat::onDisconnect()
 {
+    if (mIsPrefetching)
+    {
+        mClient.mHistPrefetcher.onFetchAborted(*this);
+    }
     if (mServerOldHistCbEnabled && (mServerFetchState & kHistFetchingOldFromServer))
     {
         //app has been receiving old history from server, but we are now
@@ -930,6 +1206,12 @@ void Chat::onDisconnect()
 }
 
 HistSource Chat::getHistory(unsigned count)
+{
+    mClient.mHistPrefetcher.onUserFetch();
+    return doGetHistory(count);
+}
+
+HistSource Chat::doGetHistory(unsigned count)
 {
     if (isNotifyingOldHistFromServer())
     {
@@ -1149,6 +1431,10 @@ Idx Chat::getHistoryFromDb(unsigned count)
 void Connection::wsHandleMsgCb(char *data, size_t len)
 {
     mTsLastRecv = time(NULL);
+    if (mChatdClient.mTrace.isOpen())
+        mChatdClient.mTrace.record(kTraceRecv, mShardNo, data, len);
+    if (mChatdClient.mCommandStats.enabled)
+        mChatdClient.mCommandStats.recordFrameIn(mShardNo, len);
     execCommand(StaticBuffer(data, len));
 }
 
@@ -1157,6 +1443,8 @@ void Connection::wsHandleMsgCb(char *data, size_t len)
 // CHECK: is this assumption correct on all browsers and under all circumstances?
 void Connection::execCommand(const StaticBuffer& buf)
 {
+    // the handlers may delete this connection, but not the client
+    auto& stats = mChatdClient.mCommandStats;
     size_t pos = 0;
 //IMPORTANT: Increment pos before calling the command handler, because the handler may throw, in which
 //case the next iteration will not advance and will execute the same command again, resulting in
@@ -1165,6 +1453,11 @@ void Connection::execCommand(const StaticBuffer& buf)
     {
       char opcode = buf.buf()[pos];
       Id chatid;
+      size_t cmdStart = pos;
+      bool statsEnabled = stats.enabled;
+      karere::LatencyHistogram::Clock::time_point statsStart;
+      if (statsEnabled)
+          statsStart = karere::LatencyHistogram::Clock::now();
       try
       {
         pos++;
@@ -1232,6 +1525,10 @@ void Connection::execCommand(const StaticBuffer& buf)
                 std::unique_ptr<Message> msg(new Message(msgid, userid, ts, updated, msgdata, msglen, false, keyid));
                 msg->setEncrypted(Message::kEncryptedPending);
                 Chat& chat = mChatdClient.chats(chatid);
+                if (opcode == OP_OLDMSG && chat.mIsPrefetching)
+                {
+                    mChatdClient.mHistPrefetcher.onBytesReceived(mShardNo, msglen);
+                }
                 if (opcode == OP_MSGUPD)
                 {
                     chat.onMsgUpdated(msg.release());
@@ -1445,6 +1742,11 @@ void Connection::execCommand(const StaticBuffer& buf)
                 READ_32(clientid, 0);
                 mClientId = clientid;
                 CHATDS_LOG_DEBUG("recv CLIENTID - %x", clientid);
+                if (mHelloPending)
+                {
+                    mHelloPending = false;
+                    mChatdClient.mConnectStats.hello.record(mStageStart);
+                }
             }
             case OP_ECHO:
             {
@@ -1503,6 +1805,8 @@ void Connection::execCommand(const StaticBuffer& buf)
       {
             CHATDS_LOG_ERROR("%s: Exception while processing incoming %s: %s", ID_CSTR(chatid), Command::opcodeToStr(opcode), e.what());
       }
+      if (statsEnabled)
+          stats.recordRecv((uint8_t)opcode, pos - cmdStart, statsStart);
     }
 }
 
@@ -1561,7 +1865,12 @@ void Chat::onFetchHistDone()
         else
         {
             mServerFetchState = kHistNotFetching;
-            mNextHistFetchIdx = lownum()-1;
+            // A prefetch doesn't deliver the messages to the app, so they must
+            // remain pending for the next getHistory()
+            if (!mIsPrefetching || mServerOldHistCbEnabled)
+            {
+                mNextHistFetchIdx = lownum()-1;
+            }
         }
         if (mLastServerHistFetchCount <= 0)
         {
@@ -1596,12 +1905,17 @@ void Chat::onFetchHistDone()
             CALL_LISTENER(onUnreadChanged);
     }
 
+    if (mIsPrefetching)
+    {
+        mClient.mHistPrefetcher.onFetchDone(*this);
+    }
+
     // handle last text message fetching
     if (mLastTextMsg.isFetching())
     {
         assert(!mHaveAllHistory); //if we reach start of history, mLastTextMsg.state() will be set to kNone
         CHATID_LOG_DEBUG("No text message seen yet, fetching more history from server");
-        getHistory(initialHistoryFetchCount);
+        doGetHistory(initialHistoryFetchCount);
     }
 }
 
@@ -1798,16 +2112,15 @@ void Chat::requestRichLink(Message &message)
         auto wptr = weakHandle();
         karere::Id msgId = message.id();
         uint16_t updated = message.updated;
-        client().karereClient->api.call(&::mega::MegaApi::requestRichPreview, linkRequest.c_str())
-        .then([wptr, this, msgId, updated](ReqResult result)
+        client().karereClient->services().fetchRichPreview(linkRequest)
+        .then([wptr, this, msgId, updated, linkRequest](const std::string& requestText)
         {
             if (wptr.deleted())
                 return;
 
-            const char *requestText = result->getText();
-            if (!requestText || (strlen(requestText) == 0))
+            if (requestText.empty())
             {
-                CHATID_LOG_ERROR("requestRichLink: API request succeed, but returned an empty metadata for: %s", result->getLink());
+                CHATID_LOG_ERROR("requestRichLink: API request succeed, but returned an empty metadata for: %s", linkRequest.c_str());
                 return;
             }
 
@@ -2268,6 +2581,7 @@ Message* Chat::msgModify(Message& msg, const char* newdata, size_t newlen, void*
         // update original content+delta of the message being edited...
         msg.updated = age;
         msg.assign((void*)newdata, newlen);
+        msg.clearCachedPayload();
         // ...and also for all messages with same msgid in the sending queue , trying to avoid sending the original content
         int count = 0;
         for (auto& it: mSending)
@@ -2277,6 +2591,7 @@ Message* Chat::msgModify(Message& msg, const char* newdata, size_t newlen, void*
             {
                 item.msg->updated = age;
                 item.msg->assign((void*)newdata, newlen);
+                item.msg->clearCachedPayload();
                 count++;
             }
         }
@@ -2615,6 +2930,7 @@ void Chat::joinRangeHist(const ChatDbInfo& dbInfo)
 
 Client::~Client()
 {
+    setTraceFile(std::string());
     cancelTimers();
     karereClient->userAttrCache().removeCb(mRichPrevAttrCbHandle);
 }
@@ -3014,6 +3330,7 @@ void Chat::onMsgUpdated(Message* cipherMsg)
             histmsg.type = msg->type;
             histmsg.userid = msg->userid;
             histmsg.setEncrypted(msg->isEncrypted());
+            histmsg.clearCachedPayload();
             if (msg->type == Message::kMsgTruncate)
             {
                 histmsg.ts = msg->ts;   // truncates update the `ts` instead of `update`
@@ -3478,6 +3795,7 @@ bool Chat::msgIncomingAfterAdd(bool isNew, bool isLocal, Message& msg, Idx idx)
                 {
                     CALL_LISTENER(onHistoryDone, kHistSourceServer);
                 }
+                mClient.mHistPrefetcher.schedule();
             }
         }
     })
@@ -3652,6 +3970,10 @@ void Chat::onUserJoin(Id userid, Priv priv)
 
     if (mOnlineState == kChatStateJoining)
     {
+        if (mUserDump.empty()) // first JOIN of the initial dump
+        {
+            mClient.mConnectStats.join.record(mLoginTs);
+        }
         mUserDump.insert(userid);
     }
 
@@ -3690,8 +4012,15 @@ void Chat::onJoinComplete()
     }
     mUserDump.clear();
     mEncryptionHalted = false;
+    mClient.mConnectStats.histDone.record(mLoginTs);
     setOnlineState(kChatStateOnline);
+    if (mConnection.mChatsJoining && --mConnection.mChatsJoining == 0)
+    {
+        mConnection.onAllChatsJoined();
+    }
     flushOutputQueue(true); //flush encrypted messages
+    // leave room for the JOINRANGEHIST burst of the other chats before prefetching
+    mClient.mHistPrefetcher.schedule(kPrefetchStartDelay);
 
     if (mIsFirstJoin)
     {
@@ -3715,6 +4044,17 @@ void Chat::setOnlineState(ChatState state)
     if (state == mOnlineState)
         return;
 
+    if (!mIsDisabled)
+    {
+        if (state == kChatStateOnline)
+        {
+            mClient.mChatsNotLoggedIn--;
+        }
+        else if (mOnlineState == kChatStateOnline)
+        {
+            mClient.mChatsNotLoggedIn++;
+        }
+    }
     mOnlineState = state;
     CHATID_LOG_DEBUG("Online state changed to %s", chatStateToStr(mOnlineState));
     CALL_CRYPTO(onOnlineStateChange, state);
@@ -3722,6 +4062,7 @@ void Chat::setOnlineState(ChatState state)
 
     if (state == kChatStateOnline && mClient.areAllChatsLoggedIn())
     {
+        CHATD_LOG_INFO("Connect stats: %s", mClient.mConnectStats.toJson().c_str());
         mClient.karereClient->setCommitMode(true);
 
         if (!mClient.karereClient->mSyncPromise.done())
@@ -3910,6 +4251,25 @@ void Client::leave(Id chatid)
         CHATD_LOG_ERROR("Client::leave: Unknown chat %s", ID_CSTR(chatid));
         return;
     }
+    auto it = mChatForChatId.find(chatid);
+    if (it != mChatForChatId.end())
+    {
+        Chat& chat = *it->second;
+        if (chat.mIsPrefetching)
+        {
+            mHistPrefetcher.onFetchAborted(chat);
+        }
+        if (!chat.isDisabled() && chat.onlineState() != kChatStateOnline)
+        {
+            mChatsNotLoggedIn--;
+        }
+        Connection& shard = *conn->second;
+        if (chat.onlineState() == kChatStateJoining && shard.mChatsJoining
+            && --shard.mChatsJoining == 0)
+        {
+            shard.onAllChatsJoined();
+        }
+    }
     conn->second->mChatIds.erase(chatid);
     mConnectionForChatId.erase(conn);
     mChatForChatId.erase(chatid);
@@ -4126,4 +4486,165 @@ bool Message::isValidEmail(const string &buf)
     return regex_match(buf, regularExpresion);
 }
 
+void HistPrefetcher::setEnabled(bool enabled)
+{
+    mEnabled = enabled;
+    if (enabled)
+    {
+        schedule();
+    }
+    else
+    {
+        cancelTimer();
+    }
+}
+
+void HistPrefetcher::schedule(unsigned delayMs)
+{
+    if (!mEnabled)
+        return;
+
+    int64_t due = karere::timestampMs() + delayMs;
+    if (mTimer)
+    {
+        if (mTimerTs <= due)
+            return; // will run earlier anyway
+        cancelTimer();
+    }
+    mTimerTs = due;
+    mTimer = karere::setTimeout([this]()
+    {
+        mTimer = 0;
+        run();
+    }, delayMs, mClient.karereClient->appCtx);
+}
+
+void HistPrefetcher::cancelTimer()
+{
+    if (mTimer)
+    {
+        cancelTimeout(mTimer, mClient.karereClient->appCtx);
+        mTimer = 0;
+    }
+}
+
+void HistPrefetcher::onUserFetch()
+{
+    mPausedUntil = karere::timestampMs() + mConfig.pauseMs;
+}
+
+void HistPrefetcher::onFetchEnd(Chat& chat)
+{
+    assert(chat.mIsPrefetching);
+    chat.mIsPrefetching = false;
+    auto it = mConnStates.find(chat.connection().shardNo());
+    if (it != mConnStates.end() && it->second.inflight)
+    {
+        it->second.inflight--;
+    }
+    schedule();
+}
+
+void HistPrefetcher::onBytesReceived(int shardNo, size_t bytes)
+{
+    mConnStates[shardNo].tokens -= bytes;
+}
+
+HistPrefetcher::ConnState& HistPrefetcher::connState(int shardNo, int64_t now)
+{
+    auto& state = mConnStates[shardNo];
+    // allow a burst of one second worth of bytes
+    if (state.lastRefillTs)
+    {
+        state.tokens += (now - state.lastRefillTs) * mConfig.bytesPerSec / 1000;
+    }
+    else
+    {
+        state.tokens = mConfig.bytesPerSec;
+    }
+    if (state.tokens > mConfig.bytesPerSec)
+    {
+        state.tokens = mConfig.bytesPerSec;
+    }
+    state.lastRefillTs = now;
+    return state;
+}
+
+bool HistPrefetcher::isCandidate(const Chat& chat) const
+{
+    return !chat.isDisabled()
+        && !chat.mIsPrefetching
+        && chat.onlineState() == kChatStateOnline
+        && chat.connection().isOnline()
+        && !chat.mHaveAllHistory
+        && !chat.mHasMoreHistoryInDb            // older history from server goes to RAM
+        && chat.mServerFetchState == kHistNotFetching
+        && !chat.mServerOldHistCbEnabled        // the app is paging the history from server
+        && !chat.mLastTextMsg.isFetching()
+        && chat.size() < (Idx)mConfig.targetCount;
+}
+
+void HistPrefetcher::run()
+{
+    if (!mEnabled)
+        return;
+
+    // don't spend mobile data and battery while the app is in background
+    if (mClient.keepaliveType() == OP_KEEPALIVEAWAY)
+        return;
+
+    int64_t now = karere::timestampMs();
+    if (now < mPausedUntil)
+    {
+        schedule((unsigned)(mPausedUntil - now));
+        return;
+    }
+
+    std::vector<Chat*> candidates;
+    for (auto& item: mClient.mChatForChatId)
+    {
+        Chat& chat = *item.second;
+        if (isCandidate(chat))
+        {
+            candidates.push_back(&chat);
+        }
+    }
+    if (candidates.empty())
+        return;
+
+    // recently active chats first
+    std::sort(candidates.begin(), candidates.end(), [](Chat* a, Chat* b)
+    {
+        return a->lastMessageTs() > b->lastMessageTs();
+    });
+
+    unsigned retryMs = 0;
+    for (auto chat: candidates)
+    {
+        int shardNo = chat->connection().shardNo();
+        auto& state = connState(shardNo, now);
+        if (state.inflight >= mConfig.maxPerConnection)
+            continue; // rescheduled when a fetch completes
+
+        if (state.tokens < 0)
+        {
+            unsigned waitMs = (unsigned)(-state.tokens * 1000 / mConfig.bytesPerSec) + 1;
+            if (!retryMs || waitMs < retryMs)
+                retryMs = waitMs;
+            continue;
+        }
+
+        unsigned count = std::min(mConfig.batchSize, mConfig.targetCount - (unsigned)chat->size());
+        CHATD_LOG_DEBUG("%s: Prefetching %u messages of history (shard %d)",
+                        ID_CSTR(chat->chatId()), count, shardNo);
+        chat->mIsPrefetching = true;
+        state.inflight++;
+        chat->requestHistoryFromServer(-(int32_t)count);
+    }
+    if (retryMs)
+    {
+        schedule(retryMs);
+    }
+}
+
 } // end chatd namespace
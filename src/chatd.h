@@ -11,7 +11,9 @@
 #include <base/promise.h>
 #include <base/timers.hpp>
 #include <base/trackDelete.h>
+#include <base/histogram.h>
 #include "chatdMsg.h"
+#include "chatdTrace.h"
 #include "url.h"
 #include "net/websocketsIO.h"
 #include "userAttrCache.h"
@@ -69,6 +71,8 @@ enum HistSource
 enum { kSeenTimeout = 200 };
 /** Timeout to recv SYNC (Milliseconds)**/
 enum { kSyncTimeout = 2500 };
+/** Delay to start prefetching history after a chat is logged in (Milliseconds) **/
+enum { kPrefetchStartDelay = 2000 };
 enum { kProtocolVersion = 0x01 };
 enum { kMaxMsgSize = 120000 };  // (in bytes)
 
@@ -360,6 +364,12 @@ protected:
     megaHandle mEchoTimer = 0;
     promise::Promise<void> mConnectPromise;
     uint32_t mClientId = 0;
+    // start of the current reconnect attempt, and of its current stage, for ConnectStats
+    karere::LatencyHistogram::Clock::time_point mReconnectStart;
+    karere::LatencyHistogram::Clock::time_point mStageStart;
+    bool mHelloPending = false;
+    /// Number of chats rejoined after (re)connect that haven't completed their join yet
+    unsigned mChatsJoining = 0;
     Connection(Client& client, int shardNo);
     State state() { return mState; }
     
@@ -374,6 +384,7 @@ protected:
 // Destroys the buffer content
     bool sendBuf(Buffer&& buf);
     bool rejoinExistingChats();
+    void onAllChatsJoined();
     void resendPending();
     void join(karere::Id chatid);
     void hist(karere::Id chatid, long count);
@@ -596,7 +607,11 @@ protected:
     bool mServerOldHistCbEnabled = false;
     /** @brief Have reached the beggining of the history (not necessarily the end of it) */
     bool mHaveAllHistory = false;
+    /** @brief The current server history fetch was initiated by the HistPrefetcher */
+    bool mIsPrefetching = false;
     bool mIsDisabled = false;
+    /** @brief When the current JOIN/JOINRANGEHIST was sent, for ConnectStats */
+    karere::LatencyHistogram::Clock::time_point mLoginTs;
     Idx mNextHistFetchIdx = CHATD_IDX_INVALID;
     DbInterface* mDbInterface = nullptr;
     // last text message stuff
@@ -667,6 +682,7 @@ protected:
     void requestHistoryFromServer(int32_t count);
     Idx getHistoryFromDb(unsigned count);
     HistSource getHistoryFromDbOrServer(unsigned count);
+    HistSource doGetHistory(unsigned count);
     void onLastReceived(karere::Id msgid);
     void onLastSeen(karere::Id msgid);
     void handleLastReceivedSeen(karere::Id msgid);
@@ -699,6 +715,7 @@ protected:
     void manageRichLinkMessage(Message &message);
     friend class Connection;
     friend class Client;
+    friend class HistPrefetcher;
 /// @endcond PRIVATE
 public:
     unsigned initialHistoryFetchCount = 32; //< This is the amount of messages that will be requested from server _only_ in case local db is empty
@@ -724,7 +741,7 @@ public:
     bool empty() const { return mForwardList.empty() && mBackwardList.empty();}
     bool isDisabled() const { return mIsDisabled; }
     bool isFirstJoin() const { return mIsFirstJoin; }
-    void disable(bool state) { mIsDisabled = state; }
+    void disable(bool state);
     /** The index of the oldest decrypted message in the RAM history buffer.
      * This will be greater than lownum() if there are not-yet-decrypted messages
      * at the start of the buffer, i.e. when more history has been fetched, but
@@ -1099,6 +1116,155 @@ public:
 //===
 };
 
+/** @brief Downloads older history of chats in background, so that opening a
+ * chat can usually be served from the local db instead of the server.
+ *
+ * Chats are prefetched in small HIST batches, most recently active first, until
+ * they have \c Config::targetCount messages locally or the start of history is
+ * reached. Each shard connection has a budget of concurrent prefetches and a
+ * token bucket for the bytes of prefetched history, so that the prefetch doesn't
+ * compete with the JOIN/JOINRANGEHIST burst after a reconnect nor with live
+ * traffic. Any user-initiated history fetch pauses the prefetch for a while.
+ *
+ * The progress is the history stored in the db, so an interrupted prefetch
+ * resumes in the next session from the chats that are still below the target.
+ * Only chats whose whole local history is loaded in RAM are prefetched, since
+ * older history from server is appended to the RAM buffer.
+ */
+class HistPrefetcher
+{
+public:
+    struct Config
+    {
+        /** Stop prefetching a chat once it has this number of messages */
+        unsigned targetCount = 256;
+        /** Number of messages requested per HIST */
+        unsigned batchSize = 64;
+        /** Maximum number of chats being prefetched at once, per connection */
+        unsigned maxPerConnection = 2;
+        /** Sustained download rate of prefetched history, per connection */
+        unsigned bytesPerSec = 64 * 1024;
+        /** Time the prefetch is paused after a user-initiated history fetch */
+        unsigned pauseMs = 5000;
+    };
+
+protected:
+    struct ConnState
+    {
+        unsigned inflight = 0;
+        int64_t tokens = 0;
+        int64_t lastRefillTs = 0;
+    };
+    Client& mClient;
+    Config mConfig;
+    bool mEnabled = true;
+    std::map<int, ConnState> mConnStates;
+    int64_t mPausedUntil = 0;
+    megaHandle mTimer = 0;
+    int64_t mTimerTs = 0;
+    bool isCandidate(const Chat& chat) const;
+    ConnState& connState(int shardNo, int64_t now);
+    void run();
+    void onFetchEnd(Chat& chat);
+public:
+    HistPrefetcher(Client& client): mClient(client) {}
+    ~HistPrefetcher() { cancelTimer(); }
+    Config& config() { return mConfig; }
+    bool isEnabled() const { return mEnabled; }
+    void setEnabled(bool enabled);
+    /** @brief Runs the scheduler after \c delayMs, unless it's already due earlier */
+    void schedule(unsigned delayMs = 0);
+    void cancelTimer();
+    /** @brief The app requested history of a chat, so pause the prefetch */
+    void onUserFetch();
+    /** @brief A HIST started by the prefetcher completed */
+    void onFetchDone(Chat& chat) { onFetchEnd(chat); }
+    /** @brief The connection of a chat being prefetched was lost */
+    void onFetchAborted(Chat& chat) { onFetchEnd(chat); }
+    /** @brief Accounts the bytes of history received for a chat being prefetched */
+    void onBytesReceived(int shardNo, size_t bytes);
+};
+
+/** @brief Duration of each stage of the (re)connection to chatd, to see where
+ * the reconnect time goes. All values in microseconds */
+struct ConnectStats
+{
+    /** Request of the shard URL to the API */
+    karere::LatencyHistogram url;
+    /** Resolution of a shard hostname */
+    karere::LatencyHistogram dns;
+    /** TCP + TLS + websocket handshake */
+    karere::LatencyHistogram connect;
+    /** Since CLIENTID is sent until the server replies with ours */
+    karere::LatencyHistogram hello;
+    /** Since a chat sends JOIN/JOINRANGEHIST until the first JOIN is received */
+    karere::LatencyHistogram join;
+    /** Since a chat sends JOIN/JOINRANGEHIST until HISTDONE, i.e. it's online */
+    karere::LatencyHistogram histDone;
+    /** Since a reconnect attempt of a shard starts until all its chats are online */
+    karere::LatencyHistogram shardReady;
+    std::string toJson() const;
+};
+
+/** @brief Per-opcode counters and processing times of the chatd commands, and
+ * the time spent in the db, crypto and listener callbacks. Disabled by default:
+ * when disabled, recording is a single branch and the clock is not read.
+ * All times in microseconds */
+struct CommandStats
+{
+    /** Opcodes are < 64, see chatdMsg.h */
+    enum { kOpcodeCount = 64 };
+    struct Shard
+    {
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+        uint64_t framesIn = 0;
+        uint64_t framesOut = 0;
+    };
+    /** Time spent processing each received command, in Connection::execCommand */
+    karere::LatencyHistogram recv[kOpcodeCount];
+    uint64_t recvBytes[kOpcodeCount] = {0};
+    /** Time spent sending each command, in Connection::sendBuf. Every send
+     * carries a single command, so it's accounted to its opcode */
+    karere::LatencyHistogram send[kOpcodeCount];
+    uint64_t sendBytes[kOpcodeCount] = {0};
+    /** Commands with an opcode out of range */
+    uint64_t unknownOpcodes = 0;
+    /** Time in the CALL_DB, CALL_CRYPTO and CALL_LISTENER callbacks */
+    karere::LatencyHistogram db;
+    karere::LatencyHistogram crypto;
+    karere::LatencyHistogram listener;
+    /** Traffic of each shard */
+    std::map<int, Shard> shards;
+    bool enabled = false;
+
+    /** @brief Records the time elapsed since construction when going out of
+     * scope, if the stats were enabled at construction */
+    class Scope
+    {
+    protected:
+        karere::LatencyHistogram* mHist;
+        karere::LatencyHistogram::Clock::time_point mStart;
+    public:
+        Scope(const CommandStats& stats, karere::LatencyHistogram& hist)
+        : mHist(stats.enabled ? &hist : nullptr)
+        {
+            if (mHist)
+                mStart = karere::LatencyHistogram::Clock::now();
+        }
+        ~Scope()
+        {
+            if (mHist)
+                mHist->record(mStart);
+        }
+    };
+    void recordRecv(uint8_t opcode, size_t bytes, karere::LatencyHistogram::Clock::time_point start);
+    void recordSend(int shard, uint8_t opcode, size_t bytes, karere::LatencyHistogram::Clock::time_point start);
+    void recordFrameIn(int shard, size_t bytes);
+    void reset();
+    std::string toJson() const;
+};
+
 class Client
 {
 protected:
@@ -1114,6 +1280,19 @@ protected:
     bool mMessageReceivedConfirmation = false;
     uint8_t mRichLinkState = kRichLinkNotDefined;
     karere::UserAttrCache::Handle mRichPrevAttrCbHandle;
+    HistPrefetcher mHistPrefetcher;
+    ConnectStats mConnectStats;
+    CommandStats mCommandStats;
+    /// Recording of the wire traffic of all shards, if enabled
+    TraceWriter mTrace;
+    /// Number of chats that are neither online nor disabled, so that readiness
+    /// can be checked without iterating all chats
+    size_t mChatsNotLoggedIn = 0;
+    typedef std::function<void(int, std::vector<std::string>&, std::vector<std::string>&)> DnsCb;
+    typedef std::map<std::string, std::vector<DnsCb>> PendingDnsMap;
+    /// DNS resolutions in progress, with the callbacks waiting for each hostname.
+    /// Shared with the resolution callbacks, which can outlive the client
+    std::shared_ptr<PendingDnsMap> mPendingDns = std::make_shared<PendingDnsMap>();
 
     Connection& chatidConn(karere::Id chatid)
     {
@@ -1126,6 +1305,12 @@ protected:
     void msgConfirm(karere::Id msgxid, karere::Id msgid);
     void sendKeepalive();
     void sendEcho();
+    /** @brief Resolves \c host, or joins a resolution of it that is already in
+     * progress, so that shards (and the prefetch) share a single lookup.
+     * \c conn is used only to issue the request.
+     * @return 0 if the resolution started, or a negative value if it failed
+     * immediately, in which case \c cb is not called */
+    int resolveDns(Connection& conn, const std::string& host, DnsCb&& cb);
 public:
     enum: uint32_t { kOptManualResendWhenUserJoins = 1 };
     enum: uint8_t { kRichLinkNotDefined = 0,  kRichLinkEnabled = 1, kRichLinkDisabled = 2};
@@ -1172,8 +1357,28 @@ public:
     void cancelTimers();
     bool isMessageReceivedConfirmationActive() const;
     uint8_t richLinkState() const;
+    HistPrefetcher& histPrefetcher() { return mHistPrefetcher; }
+    const ConnectStats& connectStats() const { return mConnectStats; }
+    const CommandStats& commandStats() const { return mCommandStats; }
+    /** @brief Enables or disables the recording of the CommandStats. The
+     * stats recorded so far are kept, use resetStats() to clear them */
+    void setStatsEnabled(bool enabled) { mCommandStats.enabled = enabled; }
+    void resetStats() { mCommandStats.reset(); }
+    /** @brief Snapshot of the CommandStats, the ConnectStats and the current
+     * size of the send queues of all chats, as a JSON object */
+    std::string statsJson() const;
+    /** @brief Starts recording the frames sent and received by all shards
+     * to a trace file (see chatdTrace.h), or stops if \c path is empty.
+     * @return false if the file can't be created */
+    bool setTraceFile(const std::string& path);
+    const TraceWriter& trace() const { return mTrace; }
+    /** @brief Starts the resolution of the hostnames of all shards whose URL
+     * is known from a previous session and are not in the DNS cache, so that
+     * it runs in parallel with the request of the up-to-date URLs to the API */
+    void prefetchDns();
     friend class Connection;
     friend class Chat;
+    friend class HistPrefetcher;
 
     bool areAllChatsLoggedIn();
 
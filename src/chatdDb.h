@@ -2,6 +2,7 @@
 #define CHATD_DB_H
 
 #include "db.h"
+#include "dbWriter.h"
 #include "chatd.h"
 //extern sqlite3* db;
 
@@ -10,13 +11,32 @@ class ChatdSqliteDb: public chatd::DbInterface
 protected:
     SqliteDb& mDb;
     chatd::Chat& mChat;
+    karere::DbWriter* mWriter;
     std::string mSendingTblName;
     std::string mHistTblName;
+    // Writes that don't need a result are queued to the DbWriter (if any), and
+    // applied later by its thread. The mutation must not capture \c this, as the
+    // chat may be gone by the time it's applied
+    void enqueue(karere::DbWriter::MutationType type, karere::DbWriter::ApplyFunc&& func)
+    {
+        if (mWriter)
+            mWriter->enqueue(mChat.chatId(), type, std::move(func));
+        else
+            func(mDb);
+    }
+    // Must be called before any read that is not served by the overlay, and
+    // before any synchronous write of this chat
+    void waitApplied()
+    {
+        if (mWriter)
+            mWriter->waitApplied(mChat.chatId());
+    }
 public:
-    ChatdSqliteDb(chatd::Chat& chat, SqliteDb& db, const std::string& sendingTblName="sending", const std::string& histTblName="history")
-        :mDb(db), mChat(chat), mSendingTblName(sendingTblName), mHistTblName(histTblName){}
+    ChatdSqliteDb(chatd::Chat& chat, SqliteDb& db, karere::DbWriter* writer=nullptr, const std::string& sendingTblName="sending", const std::string& histTblName="history")
+        :mDb(db), mChat(chat), mWriter(writer), mSendingTblName(sendingTblName), mHistTblName(histTblName){}
     virtual void getHistoryInfo(chatd::ChatDbInfo& info)
     {
+        waitApplied();
         SqliteStmt stmt(mDb, "select min(idx), max(idx) from history where chatid=?1");
         stmt.bind(mChat.chatId()).step(); //will always return a row, even if table empty
         auto minIdx = stmt.intCol(0); //WARNING: the chatd implementation uses uint32_t values for idx.
@@ -47,7 +67,11 @@ public:
     }
     void assertAffectedRowCount(int count, const char* opname=nullptr)
     {
-        auto actual = sqlite3_changes(mDb);
+        assertAffectedRowCount(mDb, count, opname);
+    }
+    static void assertAffectedRowCount(SqliteDb& db, int count, const char* opname=nullptr)
+    {
+        auto actual = sqlite3_changes(db);
         if (actual == count)
             return;
         std::string msg;
@@ -71,6 +95,8 @@ public:
         Buffer rcpts;
         item.recipients.save(rcpts);
 
+        waitApplied();
+        std::lock_guard<std::recursive_mutex> lock(mDb.mutex()); // keep the rowid ours
         mDb.query("insert into sending (chatid, opcode, ts, msgid, msg, type, updated, "
                          "recipients, backrefid, backrefs) values(?,?,?,?,?,?,?,?,?,?)",
             (uint64_t)mChat.chatId(), opcode, msg->ts, msg->id(),
@@ -82,6 +108,8 @@ public:
 
     virtual int updateSendingItemsKeyid(chatd::KeyId localkeyid, chatd::KeyId keyid)
     {
+        waitApplied();
+        std::lock_guard<std::recursive_mutex> lock(mDb.mutex());
         mDb.query("update sending set keyid = ? where keyid = ? and chatid = ?", keyid, localkeyid, mChat.chatId());
         return sqlite3_changes(mDb);
     }
@@ -92,15 +120,24 @@ public:
         // possible values of `keyid`:
         // - NEWMSG/MSGUPDX: local keyxid = rowid of the KeyCmd related to this MsgCmd
         // - MSGUPD: chat keyid (already confirmed)
-        mDb.query("update sending set keyid=?, msg_cmd=?, key_cmd=? where rowid=?",
-                  keyid, msgCmd->msg(),
-                  keyCmd ? keyCmd->keyblob() : StaticBuffer(nullptr, 0),
-                  rowid);
-        assertAffectedRowCount(1,"addBlobsToSendingItem");
+        StaticBuffer msgBlob = msgCmd->msg();
+        StaticBuffer keyBlob = keyCmd ? keyCmd->keyblob() : StaticBuffer(nullptr, 0);
+        std::string msgData(msgBlob.buf(), msgBlob.dataSize());
+        std::string keyData(keyBlob.buf(), keyBlob.dataSize());
+        enqueue(karere::DbWriter::kMutAddSendingBlobs, [rowid, keyid, msgData, keyData](SqliteDb& db)
+        {
+            db.query("update sending set keyid=?, msg_cmd=?, key_cmd=? where rowid=?",
+                      keyid, StaticBuffer(msgData.data(), msgData.size()),
+                      StaticBuffer(keyData.data(), keyData.size()),
+                      rowid);
+            assertAffectedRowCount(db, 1,"addBlobsToSendingItem");
+        });
     }
 
     virtual int updateSendingItemsMsgidAndOpcode(karere::Id msgxid, karere::Id msgid)
     {
+        waitApplied();
+        std::lock_guard<std::recursive_mutex> lock(mDb.mutex());
         mDb.query(
             "update sending set opcode=?, msgid=? where chatid=? and opcode=? and msgid=?",
             chatd::OP_MSGUPD, msgid, mChat.chatId(), chatd::OP_MSGUPDX, msgxid);
@@ -109,56 +146,102 @@ public:
 
     virtual void deleteSendingItem(uint64_t rowid)
     {
-        mDb.query("delete from sending where rowid = ?1", rowid);
-        assertAffectedRowCount(1, "deleteSendingItem");
+        enqueue(karere::DbWriter::kMutDeleteSending, [rowid](SqliteDb& db)
+        {
+            db.query("delete from sending where rowid = ?1", rowid);
+            assertAffectedRowCount(db, 1, "deleteSendingItem");
+        });
     }
     virtual int updateSendingItemsContentAndDelta(const chatd::Message& msg)
     {
+        waitApplied();
+        std::lock_guard<std::recursive_mutex> lock(mDb.mutex());
         mDb.query("update sending set msg = ?, updated = ? where msgid = ? and chatid = ?",
                   msg, msg.updated, msg.id(), mChat.chatId());
         return sqlite3_changes(mDb);
     }
     virtual void addMsgToHistory(const chatd::Message& msg, chatd::Idx idx)
     {
-#if 1
-        SqliteStmt stmt(mDb, "select min(idx), max(idx), count(*) from history where chatid = ?");
-        stmt << mChat.chatId();
-        stmt.step();
-        int low = stmt.intCol(0);
-        int high = stmt.intCol(1);
-        int count = stmt.intCol(2);
-        if ((count > 0) && (idx != low-1) && (idx != high+1))
+        karere::Id chatid = mChat.chatId();
+        karere::Id msgid = msg.id();
+        karere::Id userid = msg.userid;
+        chatd::KeyId keyid = msg.keyid;
+        unsigned char type = msg.type;
+        uint32_t ts = msg.ts;
+        uint16_t updated = msg.updated;
+        chatd::BackRefId backRefId = msg.backRefId;
+        uint8_t isEncrypted = msg.isEncrypted();
+        std::string data(msg.buf(), msg.dataSize());
+        // for logging only, the chat is not accessible from the writer thread
+        chatd::Idx fwdStart = mChat.forwardStart();
+        chatd::Idx lownum = mChat.lownum();
+        chatd::Idx highnum = mChat.highnum();
+
+        if (mWriter)
+            mWriter->setOverlayMsg(chatid, msgid, idx, updated);
+        enqueue(karere::DbWriter::kMutAddMsg, [=](SqliteDb& db)
         {
-            CHATD_LOG_ERROR("chatid %s: addMsgToHistory: history discontinuity detected: "
-                "index of added msg %s is not adjacent to neither end of db history: "
-                "add idx=%d, histlow=%d, histhigh=%d, histcount= %d, fwdStart=%d, lownum=%d, highnum=%d",
-                mChat.chatId().toString().c_str(), msg.id().toString().c_str(),
-                idx, low, high, count, mChat.forwardStart(), mChat.lownum(), mChat.highnum());
-            assert(false);
-        }
+#if 1
+            SqliteStmt stmt(db, "select min(idx), max(idx), count(*) from history where chatid = ?");
+            stmt << chatid;
+            stmt.step();
+            int low = stmt.intCol(0);
+            int high = stmt.intCol(1);
+            int count = stmt.intCol(2);
+            if ((count > 0) && (idx != low-1) && (idx != high+1))
+            {
+                CHATD_LOG_ERROR("chatid %s: addMsgToHistory: history discontinuity detected: "
+                    "index of added msg %s is not adjacent to neither end of db history: "
+                    "add idx=%d, histlow=%d, histhigh=%d, histcount= %d, fwdStart=%d, lownum=%d, highnum=%d",
+                    chatid.toString().c_str(), msgid.toString().c_str(),
+                    idx, low, high, count, fwdStart, lownum, highnum);
+                assert(false);
+            }
 #endif
-        mDb.query("insert into history"
-            "(idx, chatid, msgid, keyid, type, userid, ts, updated, data, backrefid, is_encrypted) "
-            "values(?,?,?,?,?,?,?,?,?,?,?)", idx, mChat.chatId(), msg.id(), msg.keyid,
-            msg.type, msg.userid, msg.ts, msg.updated, msg, msg.backRefId, msg.isEncrypted());
+            db.query("insert into history"
+                "(idx, chatid, msgid, keyid, type, userid, ts, updated, data, backrefid, is_encrypted) "
+                "values(?,?,?,?,?,?,?,?,?,?,?)", idx, chatid, msgid, keyid,
+                type, userid, ts, updated, StaticBuffer(data.data(), data.size()), backRefId, isEncrypted);
+        });
     }
     virtual void updateMsgInHistory(karere::Id msgid, const chatd::Message& msg)
     {
-        if (msg.type == chatd::Message::kMsgTruncate)
-        {
-            mDb.query("update history set type = ?, data = ?, ts = ?, userid = ? where chatid = ? and msgid = ?",
-                msg.type, msg, msg.ts, msg.userid, mChat.chatId(), msgid);
-        }
-        else    // "updated" instead of "ts"
+        karere::Id chatid = mChat.chatId();
+        karere::Id userid = msg.userid;
+        unsigned char type = msg.type;
+        uint32_t ts = msg.ts;
+        uint16_t updated = msg.updated;
+        uint8_t isEncrypted = msg.isEncrypted();
+        std::string data(msg.buf(), msg.dataSize());
+
+        if (mWriter && (type != chatd::Message::kMsgTruncate))
+            mWriter->setOverlayMsg(chatid, msgid, karere::DbWriter::kIdxUnknown, updated);
+        enqueue(karere::DbWriter::kMutUpdateMsg, [=](SqliteDb& db)
         {
-            mDb.query("update history set type = ?, data = ?, updated = ?, userid = ?, is_encrypted = ? where chatid = ? and msgid = ?",
-                msg.type, msg, msg.updated, msg.userid, msg.isEncrypted(), mChat.chatId(), msgid);
-        }
-        assertAffectedRowCount(1, "updateMsgInHistory");
+            StaticBuffer buf(data.data(), data.size());
+            if (type == chatd::Message::kMsgTruncate)
+            {
+                db.query("update history set type = ?, data = ?, ts = ?, userid = ? where chatid = ? and msgid = ?",
+                    type, buf, ts, userid, chatid, msgid);
+            }
+            else    // "updated" instead of "ts"
+            {
+                db.query("update history set type = ?, data = ?, updated = ?, userid = ?, is_encrypted = ? where chatid = ? and msgid = ?",
+                    type, buf, updated, userid, isEncrypted, chatid, msgid);
+            }
+            assertAffectedRowCount(db, 1, "updateMsgInHistory");
+        });
     }
 
     virtual void getMessageDelta(karere::Id msgid, uint16_t *updated)
     {
+        karere::DbWriter::MsgState state;
+        if (mWriter && mWriter->getOverlayMsg(mChat.chatId(), msgid, state))
+        {
+            *updated = state.updated;
+            return;
+        }
+        waitApplied();
         SqliteStmt stmt3(mDb, "select updated from history where chatid = ? and msgid = ?");
         stmt3 << mChat.chatId() << msgid;
         stmt3.stepMustHaveData();
@@ -167,6 +250,7 @@ public:
 
     virtual void loadSendQueue(chatd::Chat::OutputQueue& queue)
     {
+        waitApplied();
         SqliteStmt stmt(mDb, "select rowid, opcode, msgid, keyid, msg, type, "
             "ts, updated, backrefid, backrefs, recipients, msg_cmd, key_cmd "
             "from sending where chatid=? order by rowid asc");
@@ -236,6 +320,7 @@ public:
     }
     virtual void fetchDbHistory(chatd::Idx idx, unsigned count, std::vector<chatd::Message*>& messages)
     {
+        waitApplied();
         SqliteStmt stmt(mDb, "select msgid, userid, ts, type, data, idx, keyid, backrefid, updated, is_encrypted from history "
             "where chatid = ?1 and idx <= ?2 order by idx desc limit ?3");
         stmt << mChat.chatId() << idx << count;
@@ -268,6 +353,13 @@ public:
     }
     virtual chatd::Idx getIdxOfMsgid(karere::Id msgid)
     {
+        karere::DbWriter::MsgState state;
+        if (mWriter && mWriter->getOverlayMsg(mChat.chatId(), msgid, state)
+            && (state.idx != karere::DbWriter::kIdxUnknown))
+        {
+            return state.idx;
+        }
+        waitApplied();
         SqliteStmt stmt(mDb, "select idx from history where chatid = ? and msgid = ?");
         stmt << mChat.chatId() << msgid;
         return (stmt.step()) ? stmt.int64Col(0) : CHATD_IDX_INVALID;
@@ -283,6 +375,7 @@ public:
         if (idx != CHATD_IDX_INVALID)
             sql+=" and (idx > ?)";
 
+        waitApplied();
         SqliteStmt stmt(mDb, sql);
         stmt << mChat.chatId() << mChat.client().userId()   // skip own messages
              << chatd::Message::kNotEncrypted               // include decrypted messages
@@ -300,13 +393,25 @@ public:
     virtual void saveItemToManualSending(const chatd::Chat::SendingItem& item, int reason)
     {
         auto& msg = *item.msg;
-        mDb.query("insert into manual_sending(chatid, rowid, msgid, type, "
-            "ts, updated, msg, opcode, reason) values(?,?,?,?,?,?,?,?,?)",
-            mChat.chatId(), item.rowid, item.msg->id(), msg.type, msg.ts,
-            msg.updated, msg, item.opcode(), reason);
+        karere::Id chatid = mChat.chatId();
+        uint64_t rowid = item.rowid;
+        karere::Id msgid = msg.id();
+        unsigned char type = msg.type;
+        uint32_t ts = msg.ts;
+        uint16_t updated = msg.updated;
+        uint8_t opcode = item.opcode();
+        std::string data(msg.buf(), msg.dataSize());
+        enqueue(karere::DbWriter::kMutManualSending, [=](SqliteDb& db)
+        {
+            db.query("insert into manual_sending(chatid, rowid, msgid, type, "
+                "ts, updated, msg, opcode, reason) values(?,?,?,?,?,?,?,?,?)",
+                chatid, rowid, msgid, type, ts,
+                updated, StaticBuffer(data.data(), data.size()), opcode, reason);
+        });
     }
     virtual void loadManualSendItems(std::vector<chatd::Chat::ManualSendItem>& items)
     {
+        waitApplied();
         SqliteStmt stmt(mDb, "select rowid, msgid, type, ts, updated, msg, opcode, "
             "reason from manual_sending where chatid=? order by rowid asc");
         stmt << mChat.chatId();
@@ -322,11 +427,14 @@ public:
     }
     virtual bool deleteManualSendItem(uint64_t rowid)
     {
+        waitApplied();
+        std::lock_guard<std::recursive_mutex> lock(mDb.mutex());
         mDb.query("delete from manual_sending where rowid = ?", rowid);
         return sqlite3_changes(mDb) != 0;
     }
     virtual void loadManualSendItem(uint64_t rowid, chatd::Chat::ManualSendItem& item)
     {
+        waitApplied();
         SqliteStmt stmt(mDb, "select msgid, type, ts, updated, msg, opcode, "
             "reason from manual_sending where chatid=? and rowid=?");
         stmt << mChat.chatId() << rowid;
@@ -344,6 +452,7 @@ public:
     }
     virtual void truncateHistory(const chatd::Message& msg)
     {
+        waitApplied();
         auto idx = getIdxOfMsgid(msg.id());
         if (idx == CHATD_IDX_INVALID)
             throw std::runtime_error("dbInterface::truncateHistory: msgid "+msg.id().toString()+" does not exist in db");
@@ -358,6 +467,7 @@ public:
     }
     virtual chatd::Idx getOldestIdx()
     {
+        waitApplied();
         SqliteStmt stmt(mDb, "select min(idx) from history where chatid = ?");
         stmt << mChat.chatId();
         stmt.stepMustHaveData(__FUNCTION__);
@@ -365,23 +475,45 @@ public:
     }
     virtual void setLastSeen(karere::Id msgid)
     {
-        mDb.query("update chats set last_seen=? where chatid=?", msgid, mChat.chatId());
-        assertAffectedRowCount(1);
+        karere::Id chatid = mChat.chatId();
+        if (mWriter)
+            mWriter->setOverlayVar(chatid, "last_seen", msgid);
+        enqueue(karere::DbWriter::kMutSetLastSeen, [chatid, msgid](SqliteDb& db)
+        {
+            db.query("update chats set last_seen=? where chatid=?", msgid, chatid);
+            assertAffectedRowCount(db, 1);
+        });
     }
     virtual void setLastReceived(karere::Id msgid)
     {
-        mDb.query("update chats set last_recv=? where chatid=?", msgid, mChat.chatId());
-        assertAffectedRowCount(1);
+        karere::Id chatid = mChat.chatId();
+        if (mWriter)
+            mWriter->setOverlayVar(chatid, "last_recv", msgid);
+        enqueue(karere::DbWriter::kMutSetLastRecv, [chatid, msgid](SqliteDb& db)
+        {
+            db.query("update chats set last_recv=? where chatid=?", msgid, chatid);
+            assertAffectedRowCount(db, 1);
+        });
     }
     virtual void setHaveAllHistory(bool haveAllHistory)
     {
-        mDb.query(
-            "insert or replace into chat_vars(chatid, name, value) "
-            "values(?, 'have_all_history', ?)", mChat.chatId(), haveAllHistory ? 1 : 0);
-        assertAffectedRowCount(1);
+        karere::Id chatid = mChat.chatId();
+        if (mWriter)
+            mWriter->setOverlayVar(chatid, "have_all_history", haveAllHistory ? 1 : 0);
+        enqueue(karere::DbWriter::kMutSetHaveAllHistory, [chatid, haveAllHistory](SqliteDb& db)
+        {
+            db.query(
+                "insert or replace into chat_vars(chatid, name, value) "
+                "values(?, 'have_all_history', ?)", chatid, haveAllHistory ? 1 : 0);
+            assertAffectedRowCount(db, 1);
+        });
     }
     virtual bool haveAllHistory()
     {
+        uint64_t value;
+        if (mWriter && mWriter->getOverlayVar(mChat.chatId(), "have_all_history", value))
+            return value == 1;
+        waitApplied();
         SqliteStmt stmt(mDb,
             "select value from chat_vars where chatid=? and name='have_all_history' and value='1'");
         stmt << mChat.chatId();
@@ -389,6 +521,7 @@ public:
     }
     virtual void getLastTextMessage(chatd::Idx from, chatd::LastTextMsgState& msg)
     {
+        waitApplied();
         SqliteStmt stmt(mDb,
             "select type, idx, data, msgid, userid from history where chatid=?1 and "
             "(length(data) > 0 OR type = ?2) and type != ?3  and type != ?4 and (idx <= ?5)"
@@ -410,6 +543,7 @@ public:
 
     virtual void clearHistory()
     {
+        waitApplied();
         mDb.query("delete from history where chatid = ?", mChat.chatId());
         setHaveAllHistory(false);
     }
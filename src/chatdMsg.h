@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <memory>
 #include <buffer.h>
 #include "karereId.h"
 
@@ -385,6 +386,23 @@ public:
     };
     enum { kFlagForceNonText = 0x01 };
 
+    /** @brief Base class for data that upper layers derive from the contents
+     * of the message (i.e. parsed attachments), to cache it with the message.
+     * The payload is immutable once cached, so it can be shared by all the
+     * objects created from the message, in any thread.
+     */
+    class CachedPayload
+    {
+    protected:
+        uint16_t mUpdated = 0;
+        uint8_t mType = 0;
+        uint8_t mIsEncrypted = 0;
+        size_t mSize = 0;
+        friend class Message;
+    public:
+        virtual ~CachedPayload() {}
+    };
+
     enum EncryptionStatus
     {
         kNotEncrypted        = 0,    /// Message already decrypted
@@ -485,6 +503,7 @@ private:
 
 protected:
     uint8_t mIsEncrypted = kNotEncrypted;
+    mutable std::shared_ptr<const CachedPayload> mCachedPayload;
 
 public:
     karere::Id userid;
@@ -510,6 +529,32 @@ public:
     bool isUndecryptable() const { return (mIsEncrypted == kEncryptedMalformed || mIsEncrypted == kEncryptedSignature); }
     void setEncrypted(uint8_t encrypted) { mIsEncrypted = encrypted; }
 
+    /** @brief The payload cached by \c setCachedPayload(), or NULL if there is
+     * none or the message has been edited, decrypted or retyped since.
+     */
+    std::shared_ptr<const CachedPayload> cachedPayload() const
+    {
+        const CachedPayload* payload = mCachedPayload.get();
+        if (payload && (payload->mUpdated != updated || payload->mType != type
+            || payload->mIsEncrypted != mIsEncrypted || payload->mSize != dataSize()))
+        {
+            mCachedPayload.reset();
+        }
+        return mCachedPayload;
+    }
+    /** @brief Caches \c payload, for the current version of the message */
+    void setCachedPayload(const std::shared_ptr<CachedPayload>& payload) const
+    {
+        payload->mUpdated = updated;
+        payload->mType = type;
+        payload->mIsEncrypted = mIsEncrypted;
+        payload->mSize = dataSize();
+        mCachedPayload = payload;
+    }
+    /** @brief Must be called when the contents are replaced without changing
+     * the \c updated field */
+    void clearCachedPayload() const { mCachedPayload.reset(); }
+
     explicit Message(karere::Id aMsgid, karere::Id aUserid, uint32_t aTs, uint16_t aUpdated,
           Buffer&& buf, bool aIsSending=false, KeyId aKeyid=CHATD_KEYID_INVALID,
           unsigned char aType=kMsgNormal, void* aUserp=nullptr)
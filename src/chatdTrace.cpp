@@ -0,0 +1,156 @@
+#include "chatdTrace.h"
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+namespace chatd
+{
+static const char kTraceMagic[] = "KRTRACE";
+enum { kTraceVersion = 1, kTraceBufSize = 64 * 1024 };
+
+static int64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool TraceWriter::open(const std::string& path)
+{
+    close();
+    mFile = fopen(path.c_str(), "wb");
+    if (!mFile)
+        return false;
+    setvbuf(mFile, nullptr, _IOFBF, kTraceBufSize);
+    uint8_t version = kTraceVersion;
+    uint64_t startTime = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    fwrite(kTraceMagic, 1, sizeof(kTraceMagic) - 1, mFile);
+    fwrite(&version, 1, 1, mFile);
+    fwrite(&startTime, sizeof(startTime), 1, mFile);
+    mLastTs = nowUs();
+    mFrameCount = 0;
+    mByteCount = 0;
+    return true;
+}
+
+void TraceWriter::close()
+{
+    if (!mFile)
+        return;
+    fclose(mFile);
+    mFile = nullptr;
+}
+
+void TraceWriter::flush()
+{
+    if (mFile)
+        fflush(mFile);
+}
+
+void TraceWriter::writeVarint(uint64_t val)
+{
+    uint8_t buf[10];
+    size_t len = 0;
+    do
+    {
+        uint8_t byte = val & 0x7f;
+        val >>= 7;
+        buf[len++] = val ? (byte | 0x80) : byte;
+    } while (val);
+    fwrite(buf, 1, len, mFile);
+}
+
+void TraceWriter::record(TraceDir dir, int shard, const char* data, size_t len)
+{
+    if (!mFile)
+        return;
+    int64_t ts = nowUs();
+    uint8_t head = (uint8_t)(shard & 0x7f) | (dir == kTraceSend ? 0x80 : 0);
+    fwrite(&head, 1, 1, mFile);
+    writeVarint((ts > mLastTs) ? (uint64_t)(ts - mLastTs) : 0);
+    writeVarint(len);
+    fwrite(data, 1, len, mFile);
+    mLastTs = std::max(ts, mLastTs);
+    mFrameCount++;
+    mByteCount += len;
+}
+
+void TraceReader::open(const std::string& path)
+{
+    close();
+    mFile = fopen(path.c_str(), "rb");
+    if (!mFile)
+        throw std::runtime_error("Can't open trace file "+path);
+    long size = (fseek(mFile, 0, SEEK_END) == 0) ? ftell(mFile) : -1;
+    if (size < 0 || fseek(mFile, 0, SEEK_SET) != 0)
+    {
+        close();
+        throw std::runtime_error("Can't determine the size of trace file "+path);
+    }
+    mFileSize = size;
+    char magic[sizeof(kTraceMagic) - 1];
+    uint8_t version = 0;
+    if (fread(magic, 1, sizeof(magic), mFile) != sizeof(magic)
+     || memcmp(magic, kTraceMagic, sizeof(magic))
+     || fread(&version, 1, 1, mFile) != 1
+     || fread(&mStartTime, sizeof(mStartTime), 1, mFile) != 1)
+    {
+        close();
+        throw std::runtime_error(path+" is not a chatd trace");
+    }
+    if (version != kTraceVersion)
+    {
+        close();
+        throw std::runtime_error("Unsupported chatd trace version "+std::to_string(version));
+    }
+    mTs = 0;
+}
+
+void TraceReader::close()
+{
+    if (!mFile)
+        return;
+    fclose(mFile);
+    mFile = nullptr;
+}
+
+bool TraceReader::readVarint(uint64_t& val)
+{
+    val = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        int byte = fgetc(mFile);
+        if (byte == EOF)
+            return false;
+        val |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool TraceReader::next(Frame& frame)
+{
+    if (!mFile)
+        return false;
+    int head = fgetc(mFile);
+    if (head == EOF)
+        return false;
+    uint64_t delta, len;
+    if (!readVarint(delta) || !readVarint(len))
+        throw std::runtime_error("Truncated chatd trace frame header");
+    mTs += delta;
+    frame.tsUs = mTs;
+    frame.dir = (head & 0x80) ? kTraceSend : kTraceRecv;
+    frame.shard = head & 0x7f;
+    // a corrupt length must not make us allocate more than the file can hold
+    long pos = ftell(mFile);
+    if (pos < 0 || len > mFileSize - (uint64_t)pos)
+        throw std::runtime_error("Truncated chatd trace frame");
+    frame.data.resize(len);
+    if (len && fread(&frame.data[0], 1, len, mFile) != len)
+        throw std::runtime_error("Truncated chatd trace frame");
+    return true;
+}
+}
@@ -0,0 +1,78 @@
+#ifndef CHATD_TRACE_H
+#define CHATD_TRACE_H
+/**
+ * @file chatdTrace.h
+ * @brief Recording of the chatd wire traffic to a compact binary trace, and
+ * reading it back for replay.
+ *
+ * File layout (integers in host byte order, as in chatd commands):
+ *  - header: "KRTRACE" magic, version.1, start time in us since the epoch.8
+ *  - frames: shard+direction.1, delta time in us.varint, length.varint, data
+ * The high bit of the first byte of a frame is set for sent frames. Each
+ * frame is exactly one websocket message, so it may hold several commands.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+namespace chatd
+{
+enum TraceDir: uint8_t
+{
+    kTraceRecv = 0,
+    kTraceSend = 1
+};
+
+class TraceWriter
+{
+protected:
+    FILE* mFile = nullptr;
+    int64_t mLastTs = 0;
+    uint64_t mFrameCount = 0;
+    uint64_t mByteCount = 0;
+    void writeVarint(uint64_t val);
+public:
+    ~TraceWriter() { close(); }
+    /** @brief Creates (or truncates) the trace file and writes its header
+     * @return false if the file can't be created */
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return mFile != nullptr; }
+    void record(TraceDir dir, int shard, const char* data, size_t len);
+    void flush();
+    uint64_t frameCount() const { return mFrameCount; }
+    uint64_t byteCount() const { return mByteCount; }
+};
+
+class TraceReader
+{
+public:
+    struct Frame
+    {
+        /** Time since the start of the recording */
+        uint64_t tsUs = 0;
+        TraceDir dir = kTraceRecv;
+        int shard = 0;
+        std::string data;
+    };
+protected:
+    FILE* mFile = nullptr;
+    uint64_t mStartTime = 0;
+    uint64_t mTs = 0;
+    /** Size of the file, which bounds the length of a frame */
+    uint64_t mFileSize = 0;
+    bool readVarint(uint64_t& val);
+public:
+    ~TraceReader() { close(); }
+    /** @brief Opens a trace and reads its header. Throws if the file can't be
+     * opened or is not a trace of a supported version */
+    void open(const std::string& path);
+    void close();
+    /** @brief Reads the next frame. Returns false at the end of the trace, and
+     * throws if the trace is truncated or corrupt */
+    bool next(Frame& frame);
+    /** @brief Time when the recording started, in us since the epoch */
+    uint64_t startTime() const { return mStartTime; }
+};
+}
+#endif
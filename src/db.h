@@ -2,6 +2,7 @@
 #define _KARERE_DB_H
 
 #include <sqlite3.h>
+#include <mutex>
 
 struct SqliteString
 {
@@ -23,17 +24,27 @@ protected:
     sqlite3* mDb = nullptr;
     bool mCommitEach = true;
     bool mHasOpenTransaction = false;
+    // when false, step() doesn't do timed commits, because another thread
+    // (the DbWriter) takes care of them
+    bool mCommitOnStep = true;
     uint16_t mCommitInterval = 20;
     time_t mLastCommitTs = 0;
+    // Serializes statement execution and transaction state changes between
+    // the app thread and the DbWriter thread. Recursive, so that a thread can
+    // hold it across several statements (i.e. a batch, or a statement followed
+    // by sqlite3_changes())
+    std::recursive_mutex mMutex;
     inline int step(SqliteStmt& stmt);
     void beginTransaction()
     {
+        std::lock_guard<std::recursive_mutex> lock(mMutex);
         assert(!mHasOpenTransaction);
         simpleQuery("BEGIN TRANSACTION");
         mHasOpenTransaction = true;
     }
     bool commitTransaction()
     {
+        std::lock_guard<std::recursive_mutex> lock(mMutex);
         if (!mHasOpenTransaction)
             return false;
         simpleQuery("COMMIT TRANSACTION");
@@ -45,10 +56,20 @@ public:
     SqliteDb(sqlite3* db=nullptr, uint16_t commitInterval=20)
     : mDb(db), mCommitInterval(commitInterval)
     {}
-    bool open(const char* fname, bool commitEach=true)
+    SqliteDb(const SqliteDb&) = delete;
+    SqliteDb& operator=(const SqliteDb&) = delete;
+    enum { kBusyTimeoutMs = 5000 };
+    /** @param readOnly Opens an additional connection to an existing db, i.e.
+     * for the message search. Read-only connections must use \c commitEach */
+    bool open(const char* fname, bool commitEach=true, bool readOnly=false)
     {
         assert(!mDb);
-        int ret = sqlite3_open(fname, &mDb);
+        assert(commitEach || !readOnly);
+        // the connection is shared with the DbWriter thread
+        int flags = readOnly
+            ? SQLITE_OPEN_READONLY | SQLITE_OPEN_FULLMUTEX
+            : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX;
+        int ret = sqlite3_open_v2(fname, &mDb, flags, nullptr);
         if (!mDb)
             return false;
         if (ret != SQLITE_OK)
@@ -57,6 +78,9 @@ public:
             mDb = nullptr;
             return false;
         }
+        // a commit has to wait for the readers of other connections to finish,
+        // and vice versa
+        sqlite3_busy_timeout(mDb, kBusyTimeoutMs);
         mCommitEach = commitEach;
         if (!mCommitEach)
         {
@@ -67,6 +91,7 @@ public:
     }
     void close()
     {
+        std::lock_guard<std::recursive_mutex> lock(mMutex);
         if (!mDb)
             return;
         if (!mCommitEach)
@@ -78,6 +103,7 @@ public:
     bool isOpen() const { return mDb != nullptr; }
     void setCommitMode(bool commitEach)
     {
+        std::lock_guard<std::recursive_mutex> lock(mMutex);
         if (commitEach == mCommitEach)
             return;
         mCommitEach = commitEach;
@@ -87,6 +113,10 @@ public:
         }
     }
     void setCommitInterval(uint16_t sec) { mCommitInterval = sec; }
+    uint16_t commitInterval() const { return mCommitInterval; }
+    bool commitEach() const { return mCommitEach; }
+    void setCommitOnStep(bool enable) { mCommitOnStep = enable; }
+    std::recursive_mutex& mutex() { return mMutex; }
     bool hasOpenTransaction() const { return !mHasOpenTransaction; }
     operator sqlite3*() { return mDb; }
     operator const sqlite3*() const { return mDb; }
@@ -109,6 +139,7 @@ public:
     }
     void commit()
     {
+        std::lock_guard<std::recursive_mutex> lock(mMutex);
         if (mCommitEach)
             return;
         commitTransaction();
@@ -116,6 +147,7 @@ public:
     }
     bool rollback()
     {
+        std::lock_guard<std::recursive_mutex> lock(mMutex);
         if (mCommitEach)
             return false;
         // the rollback may fail - in case of some critical errors, sqlite automatically
@@ -127,6 +159,7 @@ public:
     }
     bool timedCommit()
     {
+        std::lock_guard<std::recursive_mutex> lock(mMutex);
         if (mCommitEach)
             return false;
 
@@ -293,8 +326,9 @@ inline bool SqliteDb::query(const char* sql, Args&&... args)
 
 inline int SqliteDb::step(SqliteStmt& stmt)
 {
+    std::lock_guard<std::recursive_mutex> lock(mMutex);
     auto ret = sqlite3_step(stmt);
-    if (ret == SQLITE_DONE)
+    if ((ret == SQLITE_DONE) && mCommitOnStep)
     {
         timedCommit();
     }
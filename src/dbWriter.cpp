@@ -0,0 +1,371 @@
+#include "dbWriter.h"
+#include "karereCommon.h"
+#include "karereId.h"
+
+namespace karere
+{
+DbWriter::Stats::Stats()
+: overlayHits(0), errors(0), maxQueueSize(0)
+{
+    for (auto& cnt: byType)
+        cnt.store(0);
+}
+
+std::string DbWriter::Stats::toJson() const
+{
+    std::string result;
+    result.reserve(1024);
+    result.append("{\"appThread\":").append(appThread.toJson())
+          .append(",\"queueDelay\":").append(queueDelay.toJson())
+          .append(",\"batchApply\":").append(batchApply.toJson())
+          .append(",\"commit\":").append(commit.toJson())
+          .append(",\"readBarrier\":").append(readBarrier.toJson())
+          .append(",\"mutations\":{");
+    for (int i = 0; i <= kMutLast; i++)
+    {
+        if (i)
+            result+=',';
+        result.append("\"").append(typeToStr((MutationType)i)).append("\":")
+              .append(std::to_string(byType[i].load()));
+    }
+    result.append("},\"overlayHits\":").append(std::to_string(overlayHits.load()))
+          .append(",\"errors\":").append(std::to_string(errors.load()))
+          .append(",\"maxQueueSize\":").append(std::to_string(maxQueueSize.load()))
+          .append("}");
+    return result;
+}
+
+const char* DbWriter::typeToStr(MutationType type)
+{
+    switch (type)
+    {
+        case kMutAddMsg: return "addMsg";
+        case kMutUpdateMsg: return "updateMsg";
+        case kMutAddSendingBlobs: return "addSendingBlobs";
+        case kMutDeleteSending: return "deleteSending";
+        case kMutManualSending: return "manualSending";
+        case kMutSetLastSeen: return "setLastSeen";
+        case kMutSetLastRecv: return "setLastRecv";
+        case kMutSetHaveAllHistory: return "setHaveAllHistory";
+        default: return "(invalid)";
+    }
+}
+
+void DbWriter::start()
+{
+    if (mRunning || !gDbWriteBehind)
+        return;
+    assert(mDb.isOpen());
+    mTerminate = false;
+    mDb.setCommitOnStep(false);
+    mRunning = true;
+    mThread = std::thread([this]() { threadFunc(); });
+    KR_LOG_DEBUG("DbWriter: started write-behind thread");
+}
+
+void DbWriter::stop()
+{
+    if (!mRunning)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTerminate = true;
+    }
+    mQueueCond.notify_one();
+    mThread.join();
+    mRunning = false;
+    mDb.setCommitOnStep(true);
+    mOverlay.clear();
+    if (mPendingErrors)
+    {
+        // stop() is called on destruction, so they can't be thrown anymore
+        KR_LOG_ERROR("DbWriter: stopped with %u unreported failed write(s), the first one was %s",
+            mPendingErrors, mFirstPendingError.c_str());
+        mPendingErrors = 0;
+        mFirstPendingError.clear();
+    }
+    KR_LOG_INFO("DbWriter: stopped, stats: %s", mStats.toJson().c_str());
+}
+
+void DbWriter::enqueue(uint64_t chatid, MutationType type, ApplyFunc&& func)
+{
+    LatencyHistogram::Scope timer(mStats.appThread);
+    mStats.byType[type]++;
+    if (!mRunning)
+    {
+        func(mDb); // exceptions are propagated to the caller, as before
+        return;
+    }
+    size_t queueSize;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        uint64_t seq = ++mLastSeq;
+        mQueue.push_back({seq, chatid, type, LatencyHistogram::Clock::now(), std::move(func)});
+        mOverlay[chatid].lastSeq = seq;
+        queueSize = mQueue.size();
+    }
+    if (queueSize > mStats.maxQueueSize)
+        mStats.maxQueueSize = (uint32_t)queueSize;
+    mQueueCond.notify_one();
+}
+
+void DbWriter::setOverlayMsg(uint64_t chatid, uint64_t msgid, int32_t idx, uint16_t updated)
+{
+    if (!mRunning)
+        return;
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto& overlay = mOverlay[chatid];
+    // Only the app thread enqueues, so the mutation that follows will get the
+    // next seq. Reserve it, so the overlay is not dropped before it's applied
+    overlay.lastSeq = mLastSeq+1;
+    auto result = overlay.msgs.emplace(msgid, MsgState{idx, updated});
+    if (!result.second)
+    {
+        auto& state = result.first->second;
+        if (idx != kIdxUnknown)
+            state.idx = idx;
+        state.updated = updated;
+    }
+}
+
+void DbWriter::setOverlayVar(uint64_t chatid, const std::string& name, uint64_t value)
+{
+    if (!mRunning)
+        return;
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto& overlay = mOverlay[chatid];
+    overlay.lastSeq = mLastSeq+1; // see setOverlayMsg()
+    overlay.vars[name] = value;
+}
+
+bool DbWriter::getOverlayMsg(uint64_t chatid, uint64_t msgid, MsgState& state)
+{
+    if (!mRunning)
+        return false;
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto chatIt = mOverlay.find(chatid);
+    if (chatIt == mOverlay.end())
+        return false;
+    auto it = chatIt->second.msgs.find(msgid);
+    if (it == chatIt->second.msgs.end())
+        return false;
+    state = it->second;
+    mStats.overlayHits++;
+    return true;
+}
+
+bool DbWriter::getOverlayVar(uint64_t chatid, const std::string& name, uint64_t& value)
+{
+    if (!mRunning)
+        return false;
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto chatIt = mOverlay.find(chatid);
+    if (chatIt == mOverlay.end())
+        return false;
+    auto it = chatIt->second.vars.find(name);
+    if (it == chatIt->second.vars.end())
+        return false;
+    value = it->second;
+    mStats.overlayHits++;
+    return true;
+}
+
+void DbWriter::waitApplied(uint64_t chatid)
+{
+    if (!mRunning)
+        return;
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto it = mOverlay.find(chatid);
+    if (it == mOverlay.end())
+        return;
+    uint64_t seq = it->second.lastSeq;
+    if (mAppliedSeq >= seq)
+        return;
+    LatencyHistogram::Scope timer(mStats.readBarrier);
+    mQueueCond.notify_one();
+    mAppliedCond.wait(lock, [this, seq]() { return mAppliedSeq >= seq; });
+}
+
+void DbWriter::flush()
+{
+    if (!mRunning)
+        return;
+    std::unique_lock<std::mutex> lock(mMutex);
+    uint64_t seq = mLastSeq;
+    mAppliedCond.wait(lock, [this, seq]() { return mAppliedSeq >= seq; });
+    if (!mPendingErrors)
+        return;
+    std::string msg = "DbWriter: " + std::to_string(mPendingErrors)
+        + " write(s) failed since the last flush, the first one was " + mFirstPendingError;
+    mPendingErrors = 0;
+    mFirstPendingError.clear();
+    throw std::runtime_error(msg);
+}
+
+void DbWriter::onError(std::string&& what)
+{
+    // called by the writer thread, with mMutex unlocked
+    mStats.errors++;
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mPendingErrors++)
+        mFirstPendingError = std::move(what);
+}
+
+void DbWriter::setIdleTask(IdleTask&& task)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mIdleTask = std::move(task);
+    mIdleTaskGen++;
+    mQueueCond.notify_one();
+}
+
+bool DbWriter::runIdleTask()
+{
+    // called with mMutex unlocked
+    IdleTask task;
+    uint32_t gen;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        task = mIdleTask;
+        gen = mIdleTaskGen;
+    }
+    if (!task)
+        return false;
+    bool more = false;
+    try
+    {
+        std::lock_guard<std::recursive_mutex> dbLock(mDb.mutex());
+        more = task(mDb);
+    }
+    catch(std::exception& e)
+    {
+        mStats.errors++;
+        KR_LOG_ERROR("DbWriter: Exception in idle task: %s", e.what());
+    }
+    if (!more)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (gen == mIdleTaskGen) // not replaced meanwhile
+            mIdleTask = nullptr;
+    }
+    return more;
+}
+
+void DbWriter::applyBatch(std::deque<Mutation>& batch)
+{
+    // Hold the db lock for the whole batch, so that the app thread doesn't
+    // interleave statements and sqlite3_changes() is reliable in the mutations
+    std::lock_guard<std::recursive_mutex> dbLock(mDb.mutex());
+    LatencyHistogram::Scope timer(mStats.batchApply);
+    bool ownTransaction = mDb.commitEach();
+    if (ownTransaction)
+    {
+        // in commit-each mode, group the whole batch in a single transaction
+        mDb.simpleQuery("BEGIN TRANSACTION");
+    }
+    for (auto& mutation: batch)
+    {
+        try
+        {
+            mutation.apply(mDb);
+        }
+        catch(std::exception& e)
+        {
+            KR_LOG_ERROR("DbWriter: Exception applying mutation '%s' of chat %s: %s",
+                typeToStr(mutation.type), Id(mutation.chatid).toString().c_str(), e.what());
+            onError(std::string("mutation '") + typeToStr(mutation.type) + "' of chat "
+                + Id(mutation.chatid).toString() + ": " + e.what());
+        }
+        mStats.queueDelay.record(mutation.enqueueTs);
+    }
+    LatencyHistogram::Scope commitTimer(mStats.commit);
+    if (ownTransaction)
+    {
+        try
+        {
+            mDb.simpleQuery("COMMIT TRANSACTION");
+        }
+        catch(std::exception&)
+        {
+            // i.e. SQLITE_BUSY because of a reader on another connection. The
+            // batch is dropped, but the transaction must not stay open, or the
+            // BEGIN of every later batch would fail. The rollback may fail if
+            // sqlite has already rolled back, which is harmless
+            sqlite3_exec(mDb, "ROLLBACK", nullptr, nullptr, nullptr);
+            throw;
+        }
+    }
+    else
+    {
+        mDb.timedCommit();
+    }
+}
+
+void DbWriter::threadFunc()
+{
+    std::deque<Mutation> batch;
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (;;)
+    {
+        if (mQueue.empty())
+        {
+            if (mTerminate)
+                break;
+            if (mIdleTask)
+            {
+                lock.unlock();
+                bool more = runIdleTask();
+                lock.lock();
+                if (more)
+                    continue; // check the queue, it has priority over the idle task
+            }
+            // wake up at least once per commit interval, to do the timed commit
+            if (!mQueueCond.wait_for(lock, std::chrono::seconds(mDb.commitInterval()),
+                [this]() { return !mQueue.empty() || mTerminate; }))
+            {
+                lock.unlock();
+                try
+                {
+                    LatencyHistogram::Scope timer(mStats.commit);
+                    mDb.timedCommit();
+                }
+                catch(std::exception& e)
+                {
+                    KR_LOG_ERROR("DbWriter: Exception during timed commit: %s", e.what());
+                    onError(std::string("timed commit: ") + e.what());
+                }
+                lock.lock();
+            }
+            continue;
+        }
+        size_t count = std::min<size_t>(mQueue.size(), kMaxBatchSize);
+        batch.insert(batch.end(), std::make_move_iterator(mQueue.begin()),
+                     std::make_move_iterator(mQueue.begin()+count));
+        mQueue.erase(mQueue.begin(), mQueue.begin()+count);
+        lock.unlock();
+
+        try
+        {
+            applyBatch(batch);
+        }
+        catch(std::exception& e)
+        {
+            KR_LOG_ERROR("DbWriter: Exception committing batch of %zu mutations: %s", batch.size(), e.what());
+            onError("commit of a batch of " + std::to_string(batch.size()) + " mutations: " + e.what());
+        }
+
+        lock.lock();
+        mAppliedSeq = batch.back().seq;
+        batch.clear();
+        // drop the overlay of chats that have nothing pending anymore
+        for (auto it = mOverlay.begin(); it != mOverlay.end();)
+        {
+            if (it->second.lastSeq <= mAppliedSeq)
+                it = mOverlay.erase(it);
+            else
+                it++;
+        }
+        mAppliedCond.notify_all();
+    }
+}
+}
@@ -0,0 +1,165 @@
+#ifndef KARERE_DBWRITER_H
+#define KARERE_DBWRITER_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <map>
+#include <atomic>
+#include <string>
+#include <assert.h>
+#include "buffer.h"
+#include "db.h"
+#include "histogram.h"
+
+namespace karere
+{
+/** @brief Write-behind queue for the chatd persistence layer.
+ *
+ * The app thread enqueues typed mutations and returns immediately. A dedicated
+ * thread applies them in batches on the shared db connection, and does the
+ * (timed) commits, so that fsync-s no longer stall message processing.
+ *
+ * Mutations that are queued but not yet applied are invisible to sqlite. For
+ * the point lookups done by chatd (idx/delta of a msgid, per-chat variables),
+ * the writer maintains a read-your-writes overlay that is consulted before
+ * the db. Any other read of a chat must call \c waitApplied() first, which
+ * blocks until all queued mutations of that chat are applied (not committed).
+ *
+ * When write-behind is disabled (see \c gDbWriteBehind), mutations are applied
+ * synchronously by the calling thread, which allows to compare the app thread
+ * latency in both modes via \c stats()
+ *
+ * A mutation that fails on the writer thread (i.e. an affected row count
+ * assertion) can't throw to the code that enqueued it. It is logged and
+ * counted in \c stats().errors, and \c flush() throws for it, so the failure
+ * reaches the owner of the db when it saves it. Failures of the idle task are
+ * only logged and counted
+ */
+class DbWriter
+{
+public:
+    enum MutationType: uint8_t
+    {
+        kMutAddMsg = 0,
+        kMutUpdateMsg,
+        kMutAddSendingBlobs,
+        kMutDeleteSending,
+        kMutManualSending,
+        kMutSetLastSeen,
+        kMutSetLastRecv,
+        kMutSetHaveAllHistory,
+        kMutLast = kMutSetHaveAllHistory
+    };
+    typedef std::function<void(SqliteDb&)> ApplyFunc;
+    /** A low-priority job run by the writer thread when the queue is empty.
+     * Should do a bounded amount of work per call, and return true if there
+     * is more work left */
+    typedef std::function<bool(SqliteDb&)> IdleTask;
+    struct Stats
+    {
+        /** Time spent by the app thread in a write call */
+        LatencyHistogram appThread;
+        /** Time since enqueue until the mutation is applied */
+        LatencyHistogram queueDelay;
+        /** Time to apply one batch of mutations */
+        LatencyHistogram batchApply;
+        /** Time spent in COMMIT by the writer thread */
+        LatencyHistogram commit;
+        /** Time the app thread was blocked in \c waitApplied() */
+        LatencyHistogram readBarrier;
+        std::atomic<uint64_t> byType[kMutLast+1];
+        std::atomic<uint64_t> overlayHits;
+        std::atomic<uint64_t> errors;
+        std::atomic<uint32_t> maxQueueSize;
+        Stats();
+        std::string toJson() const;
+    };
+    /** @brief Value of a message as seen by the overlay */
+    struct MsgState
+    {
+        /** The index of the message, or kIdxUnknown (same as CHATD_IDX_INVALID) */
+        int32_t idx;
+        uint16_t updated;
+    };
+    enum: int32_t { kIdxUnknown = 0x7fffffff };
+
+protected:
+    struct Mutation
+    {
+        uint64_t seq;
+        uint64_t chatid;
+        MutationType type;
+        LatencyHistogram::Clock::time_point enqueueTs;
+        ApplyFunc apply;
+    };
+    struct ChatOverlay
+    {
+        uint64_t lastSeq = 0;
+        std::map<uint64_t, MsgState> msgs;
+        std::map<std::string, uint64_t> vars;
+    };
+    enum { kMaxBatchSize = 512 };
+    SqliteDb& mDb;
+    std::thread mThread;
+    std::mutex mMutex;
+    std::condition_variable mQueueCond;
+    std::condition_variable mAppliedCond;
+    std::deque<Mutation> mQueue;
+    std::map<uint64_t, ChatOverlay> mOverlay;
+    IdleTask mIdleTask;
+    uint32_t mIdleTaskGen = 0;
+    uint64_t mLastSeq = 0;
+    uint64_t mAppliedSeq = 0;
+    bool mRunning = false;
+    bool mTerminate = false;
+    /** Failed writes not yet reported by flush() */
+    unsigned mPendingErrors = 0;
+    std::string mFirstPendingError;
+    Stats mStats;
+    void threadFunc();
+    void onError(std::string&& what);
+    void applyBatch(std::deque<Mutation>& batch);
+    bool runIdleTask();
+    static const char* typeToStr(MutationType type);
+
+public:
+    DbWriter(SqliteDb& db): mDb(db) {}
+    ~DbWriter() { stop(); }
+    /** @brief Starts the writer thread, if not yet running and write-behind is enabled */
+    void start();
+    /** @brief Applies all pending mutations and stops the writer thread.
+     * The final commit is left to the owner of the db
+     */
+    void stop();
+    bool isRunning() const { return mRunning; }
+
+    /** @brief Queues a mutation of the specified chat, or applies it synchronously
+     * if the writer is not running */
+    void enqueue(uint64_t chatid, MutationType type, ApplyFunc&& func);
+
+    /** @brief Records the value of a message in the overlay, until the
+     * corresponding mutation is applied. Must be called before \c enqueue().
+     * If \c idx is \c kIdxUnknown, a previously recorded idx is preserved */
+    void setOverlayMsg(uint64_t chatid, uint64_t msgid, int32_t idx, uint16_t updated);
+    /** @brief Records the value of a per-chat variable, i.e. last_seen */
+    void setOverlayVar(uint64_t chatid, const std::string& name, uint64_t value);
+    bool getOverlayMsg(uint64_t chatid, uint64_t msgid, MsgState& state);
+    bool getOverlayVar(uint64_t chatid, const std::string& name, uint64_t& value);
+
+    /** @brief Blocks until all queued mutations of the chat are applied */
+    void waitApplied(uint64_t chatid);
+    /** @brief Blocks until all queued mutations are applied. Throws
+     * std::runtime_error if any write of the writer thread failed since the
+     * previous flush(), after all of them are applied */
+    void flush();
+    /** @brief Sets (or clears, if empty) the idle task. When the writer is
+     * not running, the task is not executed at all */
+    void setIdleTask(IdleTask&& task);
+    const Stats& stats() const { return mStats; }
+};
+}
+
+#endif
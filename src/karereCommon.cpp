@@ -3,6 +3,10 @@
 #include "sdkApi.h"
 #include "base/timers.hpp"
 #include "megachatapi_impl.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #ifdef USE_LIBWEBSOCKETS
 #include "waiter/libuvWaiter.h"
@@ -21,6 +25,7 @@ const char* gDbSchemaVersionSuffix = "4";
 // 3 --> +4: invalidate both caches, SDK + MEGAchat, if there's at least one chat (so deleted chats are re-fetched from API)
 
 bool gCatchException = true;
+bool gDbWriteBehind = true;
 
 void globalInit(void(*postFunc)(void*, void*), uint32_t options, const char* logPath, size_t logSize)
 {
@@ -95,4 +100,187 @@ eventloop *get_ev_loop(void *ctx)
 
 #endif
 
+/** The timer wheel of an app message loop, driven by a single OS timer. When
+ * it fires, it posts one message to the app, which expires all the timers due */
+struct AppTimerWheel: public megaMessage
+{
+    TimerWheel wheel;
+    void *appCtx;
+    // guards timerEvent, which is freed by close() while the wheel may still be armed
+    std::mutex eventMutex;
+    timerevent *timerEvent = nullptr;
+    std::atomic<bool> tickPosted;
+
+    AppTimerWheel(void *ctx)
+    : megaMessage(&onTick),
+      wheel([this](uint64_t deadline) { arm(deadline); }),
+      appCtx(ctx), tickPosted(false)
+    {
+#ifndef USE_LIBWEBSOCKETS
+        timerEvent = event_new(get_ev_loop(ctx), -1, 0,
+        [](evutil_socket_t /*fd*/, short /*what*/, void *arg)
+        {
+            static_cast<AppTimerWheel*>(arg)->postTick();
+        }, this);
+#endif
+    }
+    // The loop of appCtx must not be running anymore
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        if (!timerEvent)
+            return;
+#ifndef USE_LIBWEBSOCKETS
+        event_free(timerEvent); // deletes the event if it's pending
+#else
+        uv_timer_stop(timerEvent);
+        uv_close((uv_handle_t *)timerEvent, [](uv_handle_t* handle)
+        {
+            delete (uv_timer_t *)handle;
+        });
+#endif
+        timerEvent = nullptr;
+    }
+    void postTick()
+    {
+        if (!tickPosted.exchange(true))
+        {
+            megaPostMessageToGui(this, appCtx);
+        }
+    }
+    static void onTick(void *arg)
+    {
+        auto self = static_cast<AppTimerWheel*>(arg);
+        self->tickPosted = false;
+        self->wheel.expire();
+    }
+    // Called with the wheel locked, from any thread
+    void arm(uint64_t deadline)
+    {
+        uint64_t now = TimerWheel::steadyNowMs();
+        uint64_t delay = (deadline > now) ? deadline - now : 0;
+#ifndef USE_LIBWEBSOCKETS
+        std::lock_guard<std::mutex> lock(eventMutex);
+        if (!timerEvent)
+            return;
+        struct timeval tv;
+        tv.tv_sec = delay / 1000;
+        tv.tv_usec = (delay % 1000) * 1000;
+        evtimer_add(timerEvent, &tv); // re-adding a pending event reschedules it
+#else
+        // libuv is not thread-safe, the timer is handled by the app thread.
+        // The call is not run once the loop has stopped, so the wheel is alive
+        marshallCall([this, delay]()
+        {
+            std::lock_guard<std::mutex> lock(eventMutex);
+            if (!timerEvent)
+            {
+                timerEvent = new uv_timer_t();
+                timerEvent->data = this;
+                init_uv_timer(appCtx, timerEvent);
+            }
+            uv_timer_start(timerEvent, [](uv_timer_t *handle)
+            {
+                static_cast<AppTimerWheel*>(handle->data)->postTick();
+            }, delay, 0);
+        }, appCtx);
+#endif
+    }
+    ~AppTimerWheel()
+    {
+        close();
+    }
+};
+
+// The wheel of each app message loop. A wheel is shared while a timer is being
+// added or canceled, so releasing it from another thread doesn't destroy it
+// under that call. The registry itself is never destroyed, since timers may be
+// canceled during the destruction of static objects
+struct TimerWheels
+{
+    std::mutex mutex;
+    std::vector<std::pair<void*, std::shared_ptr<AppTimerWheel>>> wheels;
+};
+
+static TimerWheels& timerWheels()
+{
+    static TimerWheels* wheels = new TimerWheels;
+    return *wheels;
+}
+
+static std::shared_ptr<AppTimerWheel> findTimerWheel(void *ctx)
+{
+    auto& reg = timerWheels();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (auto& item: reg.wheels)
+    {
+        if (item.first == ctx)
+            return item.second;
+    }
+    // The loop without context lives as long as the services, so its wheel is created on demand
+    if (!ctx)
+    {
+        reg.wheels.emplace_back(ctx, std::make_shared<AppTimerWheel>(ctx));
+        return reg.wheels.back().second;
+    }
+    return nullptr;
+}
+
+megaHandle addAppTimer(TimerWheel::Entry *entry, unsigned time, bool repeat, void *ctx)
+{
+    auto appWheel = findTimerWheel(ctx);
+    if (!appWheel)
+    {
+        KR_LOG_ERROR("addAppTimer: the app context has no timer wheel, it has been released or never initialized");
+        assert(false);
+        delete entry;
+        return 0;
+    }
+    return appWheel->wheel.add(entry, time, repeat);
+}
+
+bool cancelAppTimer(megaHandle handle, void *ctx)
+{
+    // Timers may still be canceled after the release of the wheel, i.e. by
+    // objects that outlive the app context
+    auto appWheel = findTimerWheel(ctx);
+    return appWheel ? appWheel->wheel.cancel(handle) : false;
+}
+
+void initTimerWheel(void *ctx)
+{
+    auto& reg = timerWheels();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (auto& item: reg.wheels)
+    {
+        if (item.first == ctx)
+            return;
+    }
+    reg.wheels.emplace_back(ctx, std::make_shared<AppTimerWheel>(ctx));
+}
+
+void releaseTimerWheel(void *ctx)
+{
+    std::shared_ptr<AppTimerWheel> appWheel;
+    {
+        auto& reg = timerWheels();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (auto it = reg.wheels.begin(); it != reg.wheels.end(); it++)
+        {
+            if (it->first == ctx)
+            {
+                appWheel = std::move(it->second);
+                reg.wheels.erase(it);
+                break;
+            }
+        }
+    }
+    if (!appWheel)
+        return;
+    // The OS timer is freed now, before the event loop, even if an add or
+    // cancel still holds the wheel. The pending timers are destroyed with the
+    // last reference, out of the lock, since their callbacks may cancel timers
+    appWheel->close();
+}
+
 }
@@ -165,6 +165,10 @@ extern const char* gDbSchemaVersionSuffix;
 // This option should be used only in development/debugging
 extern bool gCatchException;
 
+// If true, chatd db writes are queued and applied by a dedicated thread (see DbWriter).
+// Otherwise they are executed synchronously by the app thread
+extern bool gDbWriteBehind;
+
 static inline int64_t timestampMs() { return services_get_time_ms(); }
 
 //logging stuff
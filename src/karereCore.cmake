@@ -0,0 +1,31 @@
+# karere-core: the part of karere that doesn't depend on the Mega SDK - the db
+# layer, the chatd trace format and the stub IChatServices. It is what the
+# benchmarks link to, and it can be built without the SDK:
+#     include(<karere src dir>/karereCore.cmake)
+#     target_link_libraries(myBench karere-core)
+# The chatd client and strongvelope are not part of it yet, as they still need
+# the SDK crypto and WebsocketsIO.
+# Code that links dbWriter.cpp must define karere::gDbWriteBehind.
+
+set(KARERE_CORE_SRCS
+    ${CMAKE_CURRENT_LIST_DIR}/base/logger.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/base64url.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/chatServices.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/chatdTrace.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/dbWriter.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/msgSearchIndex.cpp
+)
+
+if (NOT TARGET karere-core)
+    find_package(Sqlite3 REQUIRED)
+    find_package(Threads REQUIRED)
+    add_library(karere-core STATIC ${KARERE_CORE_SRCS})
+    target_include_directories(karere-core PUBLIC
+        ${CMAKE_CURRENT_LIST_DIR}
+        ${CMAKE_CURRENT_LIST_DIR}/base
+        ${CMAKE_CURRENT_LIST_DIR}/../third-party
+        ${SQLITE3_INCLUDE_DIR}
+    )
+    target_compile_definitions(karere-core PUBLIC HAVE_KARERE_LOGGER)
+    target_link_libraries(karere-core ${SQLITE3_LIBRARY} ${CMAKE_THREAD_LIBS_INIT})
+endif()
@@ -228,6 +228,16 @@ int MegaChatApi::getChatConnectionState(MegaChatHandle chatid)
     return pImpl->getChatConnectionState(chatid);
 }
 
+void MegaChatApi::setChatdStatsEnabled(bool enable, bool reset)
+{
+    pImpl->setChatdStatsEnabled(enable, reset);
+}
+
+char *MegaChatApi::getChatdStats()
+{
+    return pImpl->getChatdStats();
+}
+
 void MegaChatApi::retryPendingConnections(MegaChatRequestListener *listener)
 {
     pImpl->retryPendingConnections(listener);
@@ -263,6 +273,11 @@ bool MegaChatApi::isSignalActivityRequired()
     return pImpl->isSignalActivityRequired();
 }
 
+void MegaChatApi::setPresenceBatching(bool enable, int windowMs)
+{
+    pImpl->setPresenceBatching(enable, windowMs);
+}
+
 void MegaChatApi::setPresencePersist(bool enable, MegaChatRequestListener *listener)
 {
     pImpl->setPresencePersist(enable, listener);
@@ -588,6 +603,21 @@ void MegaChatApi::pushReceived(bool beep, MegaChatRequestListener *listener)
     pImpl->pushReceived(beep, listener);
 }
 
+bool MegaChatApi::enableMessageSearch(bool enable)
+{
+    return pImpl->enableMessageSearch(enable);
+}
+
+bool MegaChatApi::isMessageSearchEnabled()
+{
+    return pImpl->isMessageSearchEnabled();
+}
+
+void MegaChatApi::searchMessages(const char *text, MegaChatHandle chatid, int offset, int count, MegaChatRequestListener *listener)
+{
+    pImpl->searchMessages(text, chatid, offset, count, listener);
+}
+
 #ifndef KARERE_DISABLE_WEBRTC
 
 MegaStringList *MegaChatApi::getChatAudioInDevices()
@@ -665,6 +695,11 @@ void MegaChatApi::setIgnoredCall(MegaChatHandle chatid)
     pImpl->setIgnoredCall(chatid);
 }
 
+void MegaChatApi::setCallPrewarm(bool enable, bool video)
+{
+    pImpl->setCallPrewarm(enable, video);
+}
+
 MegaChatCall *MegaChatApi::getChatCallByCallId(MegaChatHandle callId)
 {
     return pImpl->getChatCallByCallId(callId);
@@ -853,6 +888,11 @@ MegaHandleList *MegaChatRequest::getMegaHandleListByChat(MegaChatHandle)
     return NULL;
 }
 
+MegaChatSearchResultList *MegaChatRequest::getMegaChatSearchResultList()
+{
+    return NULL;
+}
+
 int MegaChatRequest::getParamType()
 {
     return -1;
@@ -1069,6 +1109,71 @@ int MegaChatPeerList::size() const
     return 0;
 }
 
+MegaChatSearchResultList::MegaChatSearchResultList()
+{
+
+}
+
+MegaChatSearchResultList::~MegaChatSearchResultList()
+{
+
+}
+
+MegaChatSearchResultList *MegaChatSearchResultList::copy() const
+{
+    return NULL;
+}
+
+MegaChatHandle MegaChatSearchResultList::getChatHandle(unsigned int) const
+{
+    return MEGACHAT_INVALID_HANDLE;
+}
+
+MegaChatHandle MegaChatSearchResultList::getMsgHandle(unsigned int) const
+{
+    return MEGACHAT_INVALID_HANDLE;
+}
+
+const char *MegaChatSearchResultList::getSnippet(unsigned int) const
+{
+    return NULL;
+}
+
+unsigned int MegaChatSearchResultList::size() const
+{
+    return 0;
+}
+
+MegaChatOnlineStatusList::MegaChatOnlineStatusList()
+{
+
+}
+
+MegaChatOnlineStatusList::~MegaChatOnlineStatusList()
+{
+
+}
+
+MegaChatOnlineStatusList *MegaChatOnlineStatusList::copy() const
+{
+    return NULL;
+}
+
+MegaChatHandle MegaChatOnlineStatusList::getUserHandle(unsigned int) const
+{
+    return MEGACHAT_INVALID_HANDLE;
+}
+
+int MegaChatOnlineStatusList::getStatus(unsigned int) const
+{
+    return MegaChatApi::STATUS_INVALID;
+}
+
+unsigned int MegaChatOnlineStatusList::size() const
+{
+    return 0;
+}
+
 
 void MegaChatVideoListener::onChatVideoData(MegaChatApi */*api*/, MegaChatHandle /*chatid*/, int /*width*/, int /*height*/, char */*buffer*/, size_t /*size*/)
 {
@@ -1096,6 +1201,14 @@ void MegaChatListener::onChatOnlineStatusUpdate(MegaChatApi* /*api*/, MegaChatHa
 
 }
 
+void MegaChatListener::onChatOnlineStatusBatch(MegaChatApi *api, MegaChatOnlineStatusList *statuses)
+{
+    for (unsigned int i = 0; i < statuses->size(); i++)
+    {
+        onChatOnlineStatusUpdate(api, statuses->getUserHandle(i), statuses->getStatus(i), false);
+    }
+}
+
 void MegaChatListener::onChatPresenceConfigUpdate(MegaChatApi */*api*/, MegaChatPresenceConfig */*config*/)
 {
 
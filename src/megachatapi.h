@@ -57,6 +57,8 @@ class MegaChatVideoListener;
 class MegaChatListener;
 class MegaChatNotificationListener;
 class MegaChatListItem;
+class MegaChatSearchResultList;
+class MegaChatOnlineStatusList;
 
 /**
  * @brief Provide information about a call
@@ -525,6 +527,131 @@ protected:
 
 };
 
+/**
+ * @brief List of messages found by MegaChatApi::searchMessages
+ *
+ * Each result is identified by the chat and the id of the message, which can be used
+ * to retrieve the message with MegaChatApi::getMessage. Results are sorted by relevance.
+ *
+ * Objects of this class are immutable.
+ */
+class MegaChatSearchResultList
+{
+public:
+    virtual ~MegaChatSearchResultList();
+
+    /**
+     * @brief Creates a copy of this MegaChatSearchResultList object
+     *
+     * The resulting object is fully independent of the source MegaChatSearchResultList,
+     * it contains a copy of all internal attributes, so it will be valid after
+     * the original object is deleted.
+     *
+     * You are the owner of the returned object
+     *
+     * @return Copy of the MegaChatSearchResultList object
+     */
+    virtual MegaChatSearchResultList *copy() const;
+
+    /**
+     * @brief Returns the handle of the chat of the result at the position i in the list
+     *
+     * If the index is >= the size of the list, this function returns MEGACHAT_INVALID_HANDLE.
+     *
+     * @param i Position of the result that we want to get from the list
+     * @return MegaChatHandle of the chat that contains the message
+     */
+    virtual MegaChatHandle getChatHandle(unsigned int i) const;
+
+    /**
+     * @brief Returns the id of the message of the result at the position i in the list
+     *
+     * If the index is >= the size of the list, this function returns MEGACHAT_INVALID_HANDLE.
+     *
+     * @param i Position of the result that we want to get from the list
+     * @return MegaChatHandle of the message
+     */
+    virtual MegaChatHandle getMsgHandle(unsigned int i) const;
+
+    /**
+     * @brief Returns a fragment of the content of the message around the matching words
+     *
+     * The MegaChatSearchResultList retains the ownership of the returned string. It will
+     * be valid until the MegaChatSearchResultList is deleted.
+     *
+     * If the index is >= the size of the list, this function returns NULL.
+     *
+     * @param i Position of the result that we want to get from the list
+     * @return Fragment of the message content, in UTF-8
+     */
+    virtual const char *getSnippet(unsigned int i) const;
+
+    /**
+     * @brief Returns the number of results in the list
+     * @return Number of results in the list
+     */
+    virtual unsigned int size() const;
+
+protected:
+    MegaChatSearchResultList();
+};
+
+/**
+ * @brief List of online status changes, delivered by MegaChatListener::onChatOnlineStatusBatch
+ *
+ * Each user appears only once, with its latest status. Users are sorted in the order
+ * their first change was received.
+ *
+ * Objects of this class are immutable.
+ */
+class MegaChatOnlineStatusList
+{
+public:
+    virtual ~MegaChatOnlineStatusList();
+
+    /**
+     * @brief Creates a copy of this MegaChatOnlineStatusList object
+     *
+     * The resulting object is fully independent of the source MegaChatOnlineStatusList,
+     * it contains a copy of all internal attributes, so it will be valid after
+     * the original object is deleted.
+     *
+     * You are the owner of the returned object
+     *
+     * @return Copy of the MegaChatOnlineStatusList object
+     */
+    virtual MegaChatOnlineStatusList *copy() const;
+
+    /**
+     * @brief Returns the handle of the user at the position i in the list
+     *
+     * If the index is >= the size of the list, this function returns MEGACHAT_INVALID_HANDLE.
+     *
+     * @param i Position of the user that we want to get from the list
+     * @return MegaChatHandle of the user whose online status has changed
+     */
+    virtual MegaChatHandle getUserHandle(unsigned int i) const;
+
+    /**
+     * @brief Returns the new online status of the user at the position i in the list
+     *
+     * If the index is >= the size of the list, this function returns MegaChatApi::STATUS_INVALID.
+     *
+     * @param i Position of the user that we want to get from the list
+     * @return New online status of the user
+     */
+    virtual int getStatus(unsigned int i) const;
+
+    /**
+     * @brief Returns the number of users in the list
+     * @return Number of users in the list
+     */
+    virtual unsigned int size() const;
+
+protected:
+    MegaChatOnlineStatusList();
+};
+
 /**
  * @brief List of MegaChatRoom objects
  *
@@ -1229,7 +1356,7 @@ public:
         TYPE_SEND_TYPING_NOTIF, TYPE_SIGNAL_ACTIVITY,
         TYPE_SET_PRESENCE_PERSIST, TYPE_SET_PRESENCE_AUTOAWAY,
         TYPE_LOAD_AUDIO_VIDEO_DEVICES, TYPE_ARCHIVE_CHATROOM,
-        TYPE_PUSH_RECEIVED,
+        TYPE_PUSH_RECEIVED, TYPE_SEARCH_MESSAGES,
         TOTAL_OF_REQUEST_TYPES
     };
 
@@ -1402,6 +1529,19 @@ public:
      */
     virtual mega::MegaHandleList *getMegaHandleList();
 
+    /**
+     * @brief Returns the list of messages found by a search
+     *
+     * The SDK retains the ownership of the returned value. It will be valid until
+     * the MegaChatRequest object is deleted.
+     *
+     * This value is valid for these requests:
+     * - MegaChatApi::searchMessages - Returns the messages that match the search, best matches first
+     *
+     * @return List of messages found
+     */
+    virtual MegaChatSearchResultList *getMegaChatSearchResultList();
+
     /**
      * @brief Returns the type of parameter related to the request
      *
@@ -1412,6 +1552,7 @@ public:
      * - MegaChatApi::disableVideo - Returns MegaChatRequest::VIDEO
      * - MegaChatApi::answerChatCall - Returns one
      * - MegaChatApi::rejectChatCall - Returns zero
+     * - MegaChatApi::searchMessages - Returns the number of results to skip
      *
      * @return Type of parameter related to the request
      */
@@ -1964,6 +2105,35 @@ public:
      * @return The state of connection
      */
     int getChatConnectionState(MegaChatHandle chatid);
+
+    /**
+     * @brief Enables or disables the collection of chatd statistics
+     *
+     * The statistics include the number, size and processing time of the commands
+     * sent and received per opcode, the traffic of each chatd connection and the
+     * time spent in the database, crypto and app callbacks. They are disabled by
+     * default, and have a negligible cost while disabled.
+     *
+     * The statistics collected so far are kept when they are disabled.
+     *
+     * @param enable True to enable the statistics, false to disable them
+     * @param reset True to clear the statistics collected so far
+     */
+    void setChatdStatsEnabled(bool enable, bool reset = false);
+
+    /**
+     * @brief Returns a snapshot of the chatd statistics, as a JSON object
+     *
+     * Apart from the statistics enabled by MegaChatApi::setChatdStatsEnabled, it
+     * includes the duration of the stages of the connections to chatd and the
+     * current number of messages pending to be sent, which are always available.
+     * Times are in microseconds.
+     *
+     * You take the ownership of the returned value
+     *
+     * @return The statistics in JSON format, or NULL if MEGAchat is not initialized
+     */
+    char *getChatdStats();
     
     /**
      * @brief Refresh DNS servers and retry pending connections
@@ -2119,6 +2289,28 @@ public:
      */
     bool isSignalActivityRequired();
 
+    /**
+     * @brief Enables or disables the delivery of online status changes in batches
+     *
+     * When a connection to the presence server is established, it sends the status of
+     * every contact, which results in one call to MegaChatListener::onChatOnlineStatusUpdate
+     * per contact. When batching is enabled, the status changes of other users are
+     * collected instead, and delivered together by MegaChatListener::onChatOnlineStatusBatch.
+     * If a user changes several times within a batch, only the latest status is delivered.
+     *
+     * Changes of our own status are never batched.
+     *
+     * By default, batching is disabled.
+     *
+     * @param enable True to enable batching, false to deliver each change as it's received.
+     * When disabling, the changes already collected are delivered right away, in a last batch.
+     * On logout, the changes not yet delivered are discarded.
+     * @param windowMs Maximum time, in milliseconds, that a change may be held before being
+     * delivered. With 0, the batch contains the changes received in a single round of
+     * network events.
+     */
+    void setPresenceBatching(bool enable, int windowMs = 0);
+
     /**
      * @brief Get the online status of a user.
      *
@@ -2380,6 +2572,8 @@ public:
      * This function filters out archived chatrooms. You can retrieve them by using
      * the function \c getArchivedChatListItems.
      *
+     * The items are the state of the chatrooms as last notified (see MegaChatListItem).
+     *
      * You take the ownership of the returned value
      *
      * @return List of MegaChatListItemList objects with all chatrooms of this account.
@@ -2422,6 +2616,8 @@ public:
      * MegaChatRoom objects, but a limited set of data that is usually displayed
      * at the list of chatrooms, like the title of the chat or the unread count.
      *
+     * The item is the state of the chatroom as last notified (see MegaChatListItem).
+     *
      * You take the ownership of the returned value
      *
      * @param chatid MegaChatHandle that identifies the chat room
@@ -2432,6 +2628,8 @@ public:
     /**
      * @brief Return the number of chatrooms with unread messages
      *
+     * The count is computed from the items as last notified (see MegaChatListItem).
+     *
      * Archived chatrooms with unread messages are not considered.
      *
      * @return The number of chatrooms with unread messages
@@ -2441,6 +2639,8 @@ public:
     /**
      * @brief Return the chatrooms that are currently active
      *
+     * The items are the state of the chatrooms as last notified (see MegaChatListItem).
+     *
      * You take the onwership of the returned value.
      *
      * @return MegaChatListItemList including all the active chatrooms
@@ -2453,6 +2653,8 @@ public:
      * Chatrooms became inactive when you left a groupchat or you are removed by
      * a moderator. 1on1 chats do not become inactive, just read-only.
      *
+     * The items are the state of the chatrooms as last notified (see MegaChatListItem).
+     *
      * You take the onwership of the returned value.
      *
      * @return MegaChatListItemList including all the active chatrooms
@@ -2462,6 +2664,8 @@ public:
     /**
      * @brief Return the archived chatrooms
      *
+     * The items are the state of the chatrooms as last notified (see MegaChatListItem).
+     *
      * You take the onwership of the returned value.
      *
      * @return MegaChatListItemList including all the archived chatrooms
@@ -2473,6 +2677,8 @@ public:
      *
      * Archived chatrooms with unread messages are not considered.
      *
+     * The items are the state of the chatrooms as last notified (see MegaChatListItem).
+     *
      * You take the onwership of the returned value.
      *
      * @return MegaChatListItemList including all the chatrooms with unread messages
@@ -3227,6 +3433,62 @@ public:
      */
     void pushReceived(bool beep, MegaChatRequestListener *listener = NULL);
 
+    /**
+     * @brief Enables or disables the full-text search of messages
+     *
+     * When enabled, MEGAchat keeps an index of the content of the messages stored in the
+     * local cache. The messages already in the cache are indexed in background, so the
+     * search may not find them immediately after enabling it.
+     *
+     * When disabled, the index is removed from the local cache.
+     *
+     * The setting is persisted in the local cache, so it's preserved across sessions.
+     *
+     * @param enable True to enable the search, false to disable it
+     * @return True if the operation succeeded. It returns false if the local cache
+     * is not available, or if the search is not supported by the platform
+     */
+    bool enableMessageSearch(bool enable);
+
+    /**
+     * @brief Returns whether the full-text search of messages is enabled
+     * @return True if MegaChatApi::searchMessages can be used
+     */
+    bool isMessageSearchEnabled();
+
+    /**
+     * @brief Searches messages in the local history of one chatroom or all of them
+     *
+     * Only normal messages (MegaChatMessage::TYPE_NORMAL) that have been decrypted
+     * and stored in the local cache can be found. The search matches messages that
+     * contain all the words of the text, being the last word matched as a prefix.
+     *
+     * The search must be enabled by MegaChatApi::enableMessageSearch.
+     *
+     * The associated request type with this request is MegaChatRequest::TYPE_SEARCH_MESSAGES
+     * Valid data in the MegaChatRequest object received on callbacks:
+     * - MegaChatRequest::getText - Returns the text to search
+     * - MegaChatRequest::getChatHandle - Returns the chat where to search
+     * - MegaChatRequest::getParamType - Returns the number of results to skip
+     * - MegaChatRequest::getNumber - Returns the maximum number of results
+     *
+     * Valid data in the MegaChatRequest object received in onRequestFinish when the error code
+     * is MegaError::ERROR_OK:
+     * - MegaChatRequest::getMegaChatSearchResultList - Returns the messages found
+     *
+     * On the onRequestFinish error, the error code associated to the MegaChatError can be:
+     * - MegaChatError::ERROR_ACCESS - If the search is not enabled
+     * - MegaChatError::ERROR_ARGS - If the text is empty
+     *
+     * @param text Text to search
+     * @param chatid MegaChatHandle that identifies the chat room, or MEGACHAT_INVALID_HANDLE
+     * to search in all chats
+     * @param offset Number of results to skip, for pagination
+     * @param count Maximum number of results to return
+     * @param listener MegaChatRequestListener to track this request
+     */
+    void searchMessages(const char *text, MegaChatHandle chatid, int offset, int count, MegaChatRequestListener *listener = NULL);
+
 #ifndef KARERE_DISABLE_WEBRTC
     // Audio/Video device management
     /**
@@ -3419,6 +3681,21 @@ public:
      */
     void setIgnoredCall(MegaChatHandle chatid);
 
+    /**
+     * @brief Enable or disable the pre-warm of incoming calls
+     *
+     * When enabled, the capture devices are opened while an incoming call is ringing,
+     * so that MegaChatApi::answerChatCall doesn't have to wait for them. They are
+     * released if the call is not answered. By default, it's disabled.
+     *
+     * The time that each stage of the call setup took is included in the call stats.
+     *
+     * @param enable True to pre-warm incoming calls, false to disable it
+     * @param video True to pre-warm also the camera for incoming video calls. Note
+     * that this starts the camera before the call is answered
+     */
+    void setCallPrewarm(bool enable, bool video = false);
+
     /**
      * @brief Get the MegaChatCall that has a specific id
      *
@@ -3619,6 +3896,12 @@ private:
  *
  * Changes on any of this fields will be reported by a callback: MegaChatListener::onChatListItemUpdate
  * It also notifies about a groupchat that has been closed (the user has left the room).
+ *
+ * The items returned by MegaChatApi::getChatListItems, MegaChatApi::getChatListItem and
+ * the other getters that refer to this note are the state of the chatrooms as last notified
+ * by MegaChatListener::onChatListItemUpdate, so they don't include the changes whose
+ * notification is still pending. The call in progress flag is also updated on every change
+ * of the state of a call.
  */
 class MegaChatListItem
 {
@@ -4134,6 +4417,22 @@ public:
      */
     virtual void onChatOnlineStatusUpdate(MegaChatApi* api, MegaChatHandle userhandle, int status, bool inProgress);
 
+    /**
+     * @brief This function is called with the online status changes of several users,
+     * when batching is enabled by MegaChatApi::setPresenceBatching
+     *
+     * The default implementation calls MegaChatListener::onChatOnlineStatusUpdate for
+     * each user in the list, so listeners that don't override it keep working.
+     *
+     * The SDK retains the ownership of the MegaChatOnlineStatusList in the second parameter.
+     * The list will be valid until this function returns. If you want to save the list,
+     * use MegaChatOnlineStatusList::copy
+     *
+     * @param api MegaChatApi connected to the account
+     * @param statuses List of users and their new online status
+     */
+    virtual void onChatOnlineStatusBatch(MegaChatApi* api, MegaChatOnlineStatusList *statuses);
+
     /**
      * @brief This function is called when the presence configuration has changed
      *
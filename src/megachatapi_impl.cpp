@@ -72,6 +72,9 @@ MegaChatApiImpl::~MegaChatApiImpl()
     waiter->notify();
     thread.join();
 
+    // The timers are bound to the event loop of the waiter, so they go before it
+    releaseTimerWheel(this);
+
     // TODO: destruction of waiter hangs forever or may cause crashes
     //delete waiter;
 
@@ -93,6 +96,7 @@ void MegaChatApiImpl::init(MegaChatApi *chatApi, MegaApi *megaApi)
     this->mClient = NULL;
     this->terminating = false;
     this->waiter = new MegaChatWaiter();
+    initTimerWheel(this);
     this->websocketsIO = new MegaWebsocketsIO(&sdkMutex, waiter, megaApi, this);
 
     //Start blocking thread
@@ -304,6 +308,9 @@ void MegaChatApiImpl::sendPendingRequests()
         {
             bool deleteDb = request->getFlag();
             terminating = true;
+            mChatListItems.clear();
+            clearPeersCache();
+            cancelPresenceBatch();
             mClient->terminate(deleteDb);
 
             API_LOG_INFO("Chat engine is logged out!");
@@ -332,7 +339,10 @@ void MegaChatApiImpl::sendPendingRequests()
 
                 delete mClient;
                 mClient = NULL;
+                mChatListItems.clear();
+                clearPeersCache();
             }
+            cancelPresenceBatch();
 
             threadExit = 1;
             break;
@@ -982,6 +992,39 @@ void MegaChatApiImpl::sendPendingRequests()
             });
             break;
         }
+        case MegaChatRequest::TYPE_SEARCH_MESSAGES:
+        {
+            const char *text = request->getText();
+            int offset = request->getParamType();
+            int count = (int)request->getNumber();
+            if (!text || !text[0] || offset < 0 || count <= 0)
+            {
+                errorCode = MegaChatError::ERROR_ARGS;
+                break;
+            }
+            if (!mClient->isMessageSearchEnabled())
+            {
+                API_LOG_ERROR("Search messages - The message search is not enabled");
+                errorCode = MegaChatError::ERROR_ACCESS;
+                break;
+            }
+
+            mClient->searchMessages(text, request->getChatHandle(), offset, count)
+            .then([request, this](karere::Client::SearchResults results)
+            {
+                MegaChatSearchResultListPrivate resultList(*results);
+                request->setMegaChatSearchResultList(&resultList);
+                MegaChatErrorPrivate *megaChatError = new MegaChatErrorPrivate(MegaChatError::ERROR_OK);
+                fireOnChatRequestFinish(request, megaChatError);
+            })
+            .fail([request, this](const promise::Error& e)
+            {
+                API_LOG_ERROR("Search messages - Error querying the index: %s", e.what());
+                MegaChatErrorPrivate *megaChatError = new MegaChatErrorPrivate(MegaChatError::ERROR_UNKNOWN);
+                fireOnChatRequestFinish(request, megaChatError);
+            });
+            break;
+        }
 #ifndef KARERE_DISABLE_WEBRTC
         case MegaChatRequest::TYPE_START_CHAT_CALL:
         {
@@ -1541,6 +1584,10 @@ void MegaChatApiImpl::fireOnChatLocalVideoData(MegaChatHandle chatid, int width,
 
 void MegaChatApiImpl::fireOnChatListItemUpdate(MegaChatListItem *item)
 {
+    // publish before notifying, so the getters called from the listeners
+    // already return the new state
+    publishChatListItem(item);
+
     for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
     {
         (*it)->onChatListItemUpdate(chatApi, item);
@@ -1549,6 +1596,30 @@ void MegaChatApiImpl::fireOnChatListItemUpdate(MegaChatListItem *item)
     delete item;
 }
 
+void MegaChatApiImpl::publishChatListItem(const MegaChatListItem *item)
+{
+    if (terminating)
+    {
+        return;
+    }
+
+    auto snapshotItem = std::make_shared<MegaChatListItemPrivate>(item);
+    snapshotItem->removeChanges();
+    mChatListItems.set(item->getChatId(), std::move(snapshotItem));
+}
+
+void MegaChatApiImpl::republishChatListItem(MegaChatHandle chatid)
+{
+    ChatRoom *chatroom = findChatRoom(chatid);
+    if (!chatroom)
+    {
+        return;
+    }
+
+    MegaChatListItemPrivate item(*chatroom);
+    publishChatListItem(&item);
+}
+
 void MegaChatApiImpl::fireOnChatInitStateUpdate(int newState)
 {
     for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
@@ -1565,6 +1636,16 @@ void MegaChatApiImpl::fireOnChatOnlineStatusUpdate(MegaChatHandle userhandle, in
     }
 }
 
+void MegaChatApiImpl::fireOnChatOnlineStatusBatch(MegaChatOnlineStatusList *statuses)
+{
+    for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
+    {
+        (*it)->onChatOnlineStatusBatch(chatApi, statuses);
+    }
+
+    delete statuses;
+}
+
 void MegaChatApiImpl::fireOnChatPresenceConfigUpdate(MegaChatPresenceConfig *config)
 {
     for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
@@ -1648,6 +1729,34 @@ int MegaChatApiImpl::getChatConnectionState(MegaChatHandle chatid)
     return ret;
 }
 
+void MegaChatApiImpl::setChatdStatsEnabled(bool enable, bool reset)
+{
+    sdkMutex.lock();
+    if (mClient && mClient->mChatdClient)
+    {
+        if (reset)
+        {
+            mClient->mChatdClient->resetStats();
+        }
+        mClient->mChatdClient->setStatsEnabled(enable);
+    }
+    sdkMutex.unlock();
+}
+
+char *MegaChatApiImpl::getChatdStats()
+{
+    char *ret = NULL;
+
+    sdkMutex.lock();
+    if (mClient && mClient->mChatdClient)
+    {
+        ret = MegaApi::strdup(mClient->mChatdClient->statsJson().c_str());
+    }
+    sdkMutex.unlock();
+
+    return ret;
+}
+
 void MegaChatApiImpl::retryPendingConnections(MegaChatRequestListener *listener)
 {
     MegaChatRequestPrivate *request = new MegaChatRequestPrivate(MegaChatRequest::TYPE_RETRY_PENDING_CONNECTIONS, listener);
@@ -1734,6 +1843,91 @@ bool MegaChatApiImpl::isSignalActivityRequired()
     return enabled;
 }
 
+void MegaChatApiImpl::setPresenceBatching(bool enable, int windowMs)
+{
+    sdkMutex.lock();
+    mPresenceBatching = enable;
+    mPresenceBatchWindow = (windowMs > 0) ? windowMs : 0;
+    sdkMutex.unlock();
+
+    if (!enable)
+    {
+        // deliver the changes already collected now, rather than at the end of the window
+        marshallCall([this]()
+        {
+            if (mPresenceBatchTimer)
+            {
+                karere::cancelTimeout(mPresenceBatchTimer, this);
+                mPresenceBatchTimer = 0;
+            }
+            flushPresenceBatch();
+        }, this);
+    }
+}
+
+void MegaChatApiImpl::addToPresenceBatch(MegaChatHandle userhandle, int status)
+{
+    auto it = mPresenceBatchIndex.find(userhandle);
+    if (it != mPresenceBatchIndex.end())
+    {
+        // last write wins
+        mPresenceBatch[it->second].second = status;
+        return;
+    }
+
+    mPresenceBatchIndex[userhandle] = mPresenceBatch.size();
+    mPresenceBatch.emplace_back(userhandle, status);
+    if (mPresenceFlushPending)
+    {
+        return;
+    }
+
+    mPresenceFlushPending = true;
+    if (mPresenceBatchWindow)
+    {
+        mPresenceBatchTimer = karere::setTimeout([this]()
+        {
+            mPresenceBatchTimer = 0;
+            flushPresenceBatch();
+        }, mPresenceBatchWindow, this);
+    }
+    else
+    {
+        // after the rest of the events received in the same round
+        marshallCall([this]()
+        {
+            flushPresenceBatch();
+        }, this);
+    }
+}
+
+void MegaChatApiImpl::flushPresenceBatch()
+{
+    mPresenceFlushPending = false;
+    if (mPresenceBatch.empty())
+    {
+        return;
+    }
+
+    API_LOG_DEBUG("Delivering online status of %zu users in a batch", mPresenceBatch.size());
+    MegaChatOnlineStatusListPrivate *statuses = new MegaChatOnlineStatusListPrivate(mPresenceBatch);
+    mPresenceBatch.clear();
+    mPresenceBatchIndex.clear();
+    fireOnChatOnlineStatusBatch(statuses);
+}
+
+void MegaChatApiImpl::cancelPresenceBatch()
+{
+    if (mPresenceBatchTimer)
+    {
+        karere::cancelTimeout(mPresenceBatchTimer, this);
+        mPresenceBatchTimer = 0;
+    }
+    // a flush already marshalled finds the batch empty
+    mPresenceBatch.clear();
+    mPresenceBatchIndex.clear();
+}
+
 int MegaChatApiImpl::getOnlineStatus()
 {
     sdkMutex.lock();
@@ -1939,7 +2133,7 @@ MegaChatRoomList *MegaChatApiImpl::getChatRooms()
         ChatRoomList::iterator it;
         for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
         {
-            chats->addChatRoom(new MegaChatRoomPrivate(*it->second));
+            chats->addChatRoom(new MegaChatRoomPrivate(*it->second, this));
         }
     }
 
@@ -1957,7 +2151,7 @@ MegaChatRoom *MegaChatApiImpl::getChatRoom(MegaChatHandle chatid)
     ChatRoom *chatRoom = findChatRoom(chatid);
     if (chatRoom)
     {
-        chat = new MegaChatRoomPrivate(*chatRoom);
+        chat = new MegaChatRoomPrivate(*chatRoom, this);
     }
 
     sdkMutex.unlock();
@@ -1974,7 +2168,7 @@ MegaChatRoom *MegaChatApiImpl::getChatRoomByUser(MegaChatHandle userhandle)
     ChatRoom *chatRoom = findChatRoomByUser(userhandle);
     if (chatRoom)
     {
-        chat = new MegaChatRoomPrivate(*chatRoom);
+        chat = new MegaChatRoomPrivate(*chatRoom, this);
     }
 
     sdkMutex.unlock();
@@ -1986,21 +2180,13 @@ MegaChatListItemList *MegaChatApiImpl::getChatListItems()
 {
     MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate();
 
-    sdkMutex.lock();
-
-    if (mClient && !terminating)
+    mChatListItems.get()->forEach([items](uint64_t, const MegaChatListItemPrivate &item)
     {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
+        if (!item.isArchived())
         {
-            if (!it->second->isArchived())
-            {
-                items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-            }
+            items->addChatListItem(new MegaChatListItemPrivate(&item));
         }
-    }
-
-    sdkMutex.unlock();
+    });
 
     return items;
 }
@@ -2064,41 +2250,22 @@ MegaChatListItemList *MegaChatApiImpl::getChatListItemsByPeers(MegaChatPeerList
 
 MegaChatListItem *MegaChatApiImpl::getChatListItem(MegaChatHandle chatid)
 {
-    MegaChatListItemPrivate *item = NULL;
-
-    sdkMutex.lock();
-
-    ChatRoom *chatRoom = findChatRoom(chatid);
-    if (chatRoom)
-    {
-        item = new MegaChatListItemPrivate(*chatRoom);
-    }
-
-    sdkMutex.unlock();
-
-    return item;
+    auto snapshot = mChatListItems.get();
+    const MegaChatListItemPrivate *item = snapshot->find(chatid);
+    return item ? new MegaChatListItemPrivate(item) : NULL;
 }
 
 int MegaChatApiImpl::getUnreadChats()
 {
     int count = 0;
 
-    sdkMutex.lock();
-
-    if (mClient && !terminating)
+    mChatListItems.get()->forEach([&count](uint64_t, const MegaChatListItemPrivate &item)
     {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
+        if (!item.isArchived() && item.getUnreadCount())
         {
-            ChatRoom *room = it->second;
-            if (!room->isArchived() && room->chat().unreadMsgCount())
-            {
-                count++;
-            }
+            count++;
         }
-    }
-
-    sdkMutex.unlock();
+    });
 
     return count;
 }
@@ -2107,21 +2274,13 @@ MegaChatListItemList *MegaChatApiImpl::getActiveChatListItems()
 {
     MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate();
 
-    sdkMutex.lock();
-
-    if (mClient && !terminating)
+    mChatListItems.get()->forEach([items](uint64_t, const MegaChatListItemPrivate &item)
     {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
+        if (!item.isArchived() && item.isActive())
         {
-            if (!it->second->isArchived() && it->second->isActive())
-            {
-                items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-            }
+            items->addChatListItem(new MegaChatListItemPrivate(&item));
         }
-    }
-
-    sdkMutex.unlock();
+    });
 
     return items;
 }
@@ -2130,21 +2289,13 @@ MegaChatListItemList *MegaChatApiImpl::getInactiveChatListItems()
 {
     MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate();
 
-    sdkMutex.lock();
-
-    if (mClient && !terminating)
+    mChatListItems.get()->forEach([items](uint64_t, const MegaChatListItemPrivate &item)
     {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
+        if (!item.isArchived() && !item.isActive())
         {
-            if (!it->second->isArchived() && !it->second->isActive())
-            {
-                items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-            }
+            items->addChatListItem(new MegaChatListItemPrivate(&item));
         }
-    }
-
-    sdkMutex.unlock();
+    });
 
     return items;
 }
@@ -2153,21 +2304,13 @@ MegaChatListItemList *MegaChatApiImpl::getArchivedChatListItems()
 {
     MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate();
 
-    sdkMutex.lock();
-
-    if (mClient && !terminating)
+    mChatListItems.get()->forEach([items](uint64_t, const MegaChatListItemPrivate &item)
     {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
+        if (item.isArchived())
         {
-            if (it->second->isArchived())
-            {
-                items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-            }
+            items->addChatListItem(new MegaChatListItemPrivate(&item));
         }
-    }
-
-    sdkMutex.unlock();
+    });
 
     return items;
 }
@@ -2176,22 +2319,13 @@ MegaChatListItemList *MegaChatApiImpl::getUnreadChatListItems()
 {
     MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate();
 
-    sdkMutex.lock();
-
-    if (mClient && !terminating)
+    mChatListItems.get()->forEach([items](uint64_t, const MegaChatListItemPrivate &item)
     {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
+        if (!item.isArchived() && item.getUnreadCount())
         {
-            ChatRoom *room = it->second;
-            if (!room->isArchived() && room->chat().unreadMsgCount())
-            {
-                items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-            }
+            items->addChatListItem(new MegaChatListItemPrivate(&item));
         }
-    }
-
-    sdkMutex.unlock();
+    });
 
     return items;
 }
@@ -2856,6 +2990,46 @@ void MegaChatApiImpl::pushReceived(bool beep, MegaChatRequestListener *listener)
     waiter->notify();
 }
 
+bool MegaChatApiImpl::enableMessageSearch(bool enable)
+{
+    bool ret = false;
+    sdkMutex.lock();
+
+    if (mClient && !terminating)
+    {
+        try
+        {
+            ret = mClient->setMessageSearchEnabled(enable);
+        }
+        catch(std::exception& e)
+        {
+            API_LOG_ERROR("enableMessageSearch: %s", e.what());
+        }
+    }
+
+    sdkMutex.unlock();
+    return ret;
+}
+
+bool MegaChatApiImpl::isMessageSearchEnabled()
+{
+    sdkMutex.lock();
+    bool ret = mClient ? mClient->isMessageSearchEnabled() : false;
+    sdkMutex.unlock();
+    return ret;
+}
+
+void MegaChatApiImpl::searchMessages(const char *text, MegaChatHandle chatid, int offset, int count, MegaChatRequestListener *listener)
+{
+    MegaChatRequestPrivate *request = new MegaChatRequestPrivate(MegaChatRequest::TYPE_SEARCH_MESSAGES, listener);
+    request->setText(text);
+    request->setChatHandle(chatid);
+    request->setParamType(offset);
+    request->setNumber(count);
+    requestQueue.push(request);
+    waiter->notify();
+}
+
 #ifndef KARERE_DISABLE_WEBRTC
 
 MegaStringList *MegaChatApiImpl::getChatAudioInDevices()
@@ -3021,6 +3195,20 @@ void MegaChatApiImpl::setIgnoredCall(MegaChatHandle chatId)
      }
 }
 
+void MegaChatApiImpl::setCallPrewarm(bool enable, bool video)
+{
+    sdkMutex.lock();
+    if (mClient && mClient->rtc)
+    {
+        mClient->rtc->setCallPrewarm(enable, video);
+    }
+    else
+    {
+        API_LOG_ERROR("Call prewarm - WebRTC is not initialized");
+    }
+    sdkMutex.unlock();
+}
+
 MegaChatCall *MegaChatApiImpl::getChatCall(MegaChatHandle chatId)
 {
     MegaChatCall *chatCall = NULL;
@@ -3519,6 +3707,42 @@ IApp::IPeerChatListItem *MegaChatApiImpl::addPeerChatItem(PeerChatRoom &chat)
     return (IPeerChatListItem *) itemHandler;
 }
 
+std::shared_ptr<const MegaChatRoomPeers> MegaChatApiImpl::groupPeers(const GroupChatRoom &chat)
+{
+    std::lock_guard<std::mutex> lock(mPeersCacheMutex);
+    auto& cached = mPeersCache[chat.chatid()];
+    if (cached.second && cached.first == chat.membersVersion())
+    {
+        return cached.second;
+    }
+
+    auto peers = std::make_shared<MegaChatRoomPeers>();
+    const GroupChatRoom::MemberMap& members = chat.peers();
+    peers->peers.reserve(members.size());
+    for (auto& member: members)
+    {
+        peers->addWithFullname(member.first, (privilege_t) member.second->priv(),
+                               member.second->name(), member.second->email());
+    }
+
+    cached.first = chat.membersVersion();
+    cached.second = peers;
+    return cached.second;
+}
+
+void MegaChatApiImpl::clearPeersCache(MegaChatHandle chatid)
+{
+    std::lock_guard<std::mutex> lock(mPeersCacheMutex);
+    if (chatid == MEGACHAT_INVALID_HANDLE)
+    {
+        mPeersCache.clear();
+    }
+    else
+    {
+        mPeersCache.erase(chatid);
+    }
+}
+
 void MegaChatApiImpl::removeGroupChatItem(IGroupChatListItem &item)
 {
     set<MegaChatGroupListItemHandler *>::iterator it = chatGroupListItemHandler.begin();
@@ -3527,6 +3751,9 @@ void MegaChatApiImpl::removeGroupChatItem(IGroupChatListItem &item)
         IGroupChatListItem *itemHandler = (*it);
         if (itemHandler == &item)
         {
+            mChatListItems.erase((*it)->getChatRoom().chatid());
+            clearPeersCache((*it)->getChatRoom().chatid());
+
 //            TODO: Redmine ticket #5693
 //            MegaChatListItemPrivate *listItem = new MegaChatListItemPrivate((*it)->getChatRoom());
 //            listItem->setClosed();
@@ -3549,6 +3776,8 @@ void MegaChatApiImpl::removePeerChatItem(IPeerChatListItem &item)
         IPeerChatListItem *itemHandler = (*it);
         if (itemHandler == &item)
         {
+            mChatListItems.erase((*it)->getChatRoom().chatid());
+
 //            TODO: Redmine ticket #5693
 //            MegaChatListItemPrivate *listItem = new MegaChatListItemPrivate((*it)->getChatRoom());
 //            listItem->setClosed();
@@ -3572,6 +3801,11 @@ void MegaChatApiImpl::onPresenceChanged(Id userid, Presence pres, bool inProgres
     else
     {
         API_LOG_INFO("Presence of user %s has been changed to %s", userid.toString().c_str(), pres.toString());
+        if (mPresenceBatching && mClient && userid != mClient->myHandle())
+        {
+            addToPresenceBatch(userid.val, pres.status());
+            return;
+        }
     }
     fireOnChatOnlineStatusUpdate(userid.val, pres.status(), inProgress);
 }
@@ -3703,6 +3937,8 @@ MegaChatRequestPrivate::MegaChatRequestPrivate(int type, MegaChatRequestListener
     this->mMessage = NULL;
     this->mMegaNodeList = NULL;
     this->mMegaHandleList = NULL;
+    this->mSearchResults = NULL;
+    this->mParamType = 0;
 }
 
 MegaChatRequestPrivate::MegaChatRequestPrivate(MegaChatRequestPrivate &request)
@@ -3712,6 +3948,7 @@ MegaChatRequestPrivate::MegaChatRequestPrivate(MegaChatRequestPrivate &request)
     this->mMessage = NULL;
     this->mMegaNodeList = NULL;
     this->mMegaHandleList = NULL;
+    this->mSearchResults = NULL;
 
     this->type = request.getType();
     this->listener = request.getListener();
@@ -3735,6 +3972,8 @@ MegaChatRequestPrivate::MegaChatRequestPrivate(MegaChatRequestPrivate &request)
             this->setMegaHandleListByChat(chatid, request.getMegaHandleListByChat(chatid));
         }
     }
+    this->setMegaChatSearchResultList(request.getMegaChatSearchResultList());
+    this->setParamType(request.getParamType());
 }
 
 MegaChatRequestPrivate::~MegaChatRequestPrivate()
@@ -3744,6 +3983,7 @@ MegaChatRequestPrivate::~MegaChatRequestPrivate()
     delete mMessage;
     delete mMegaNodeList;
     delete mMegaHandleList;
+    delete mSearchResults;
     for (map<MegaChatHandle, MegaHandleList*>::iterator it = mMegaHandleListMap.begin(); it != mMegaHandleListMap.end(); it++)
     {
         delete it->second;
@@ -3791,6 +4031,7 @@ const char *MegaChatRequestPrivate::getRequestString() const
         case TYPE_SET_PRESENCE_AUTOAWAY: return "SET_PRESENCE_AUTOAWAY";
         case TYPE_ARCHIVE_CHATROOM: return "ARCHIVE_CHATROOM";
         case TYPE_PUSH_RECEIVED: return "PUSH_RECEIVED";
+        case TYPE_SEARCH_MESSAGES: return "SEARCH_MESSAGES";
     }
     return "UNKNOWN";
 }
@@ -3969,6 +4210,21 @@ MegaHandleList *MegaChatRequestPrivate::getMegaHandleList()
     return mMegaHandleList;
 }
 
+MegaChatSearchResultList *MegaChatRequestPrivate::getMegaChatSearchResultList()
+{
+    return mSearchResults;
+}
+
+void MegaChatRequestPrivate::setMegaChatSearchResultList(MegaChatSearchResultList *results)
+{
+    if (mSearchResults != NULL)
+    {
+        delete mSearchResults;
+    }
+
+    mSearchResults = results ? results->copy() : NULL;
+}
+
 int MegaChatRequestPrivate::getParamType()
 {
     return mParamType;
@@ -4759,7 +5015,7 @@ void MegaChatRoomHandler::onUserJoin(Id userid, Priv privilege)
         // forward the event to the chatroom, so chatlist items also receive the notification
         mRoom->onUserJoin(userid, privilege);
 
-        MegaChatRoomPrivate *chatroom = new MegaChatRoomPrivate(*mRoom);
+        MegaChatRoomPrivate *chatroom = new MegaChatRoomPrivate(*mRoom, chatApiImpl);
         if (userid.val == chatApiImpl->getMyUserHandle())
         {
             chatroom->setOwnPriv(privilege);
@@ -4779,7 +5035,7 @@ void MegaChatRoomHandler::onUserLeave(Id userid)
         // forward the event to the chatroom, so chatlist items also receive the notification
         mRoom->onUserLeave(userid);
 
-        MegaChatRoomPrivate *chatroom = new MegaChatRoomPrivate(*mRoom);
+        MegaChatRoomPrivate *chatroom = new MegaChatRoomPrivate(*mRoom, chatApiImpl);
         chatroom->setMembersUpdated();
         fireOnChatRoomUpdate(chatroom);
     }
@@ -4789,7 +5045,7 @@ void MegaChatRoomHandler::onRejoinedChat()
 {
     if (mRoom)
     {
-        MegaChatRoomPrivate *chatroom = new MegaChatRoomPrivate(*mRoom);
+        MegaChatRoomPrivate *chatroom = new MegaChatRoomPrivate(*mRoom, chatApiImpl);
         fireOnChatRoomUpdate(chatroom);
     }
 }
@@ -4798,7 +5054,7 @@ void MegaChatRoomHandler::onExcludedFromChat()
 {
     if (mRoom)
     {
-        MegaChatRoomPrivate *chatroom = new MegaChatRoomPrivate(*mRoom);
+        MegaChatRoomPrivate *chatroom = new MegaChatRoomPrivate(*mRoom, chatApiImpl);
         chatroom->setClosed();
         fireOnChatRoomUpdate(chatroom);
     }
@@ -4813,7 +5069,7 @@ void MegaChatRoomHandler::onUnreadChanged()
 
         if (mChat)
         {
-            MegaChatRoomPrivate *chatroom = new MegaChatRoomPrivate(*mRoom);
+            MegaChatRoomPrivate *chatroom = new MegaChatRoomPrivate(*mRoom, chatApiImpl);
             chatroom->setUnreadCount(mChat->unreadMsgCount());
             fireOnChatRoomUpdate(chatroom);
         }
@@ -4943,17 +5199,50 @@ void MegaChatRoomListPrivate::addChatRoom(MegaChatRoom *chat)
 }
 
 
+void MegaChatRoomPeers::add(MegaChatHandle uh, privilege_t priv, const char *firstname,
+                            const char *lastname, const char *email)
+{
+    index[uh] = (unsigned int)peers.size();
+    peers.push_back(userpriv_pair(uh, priv));
+    firstnames.push_back(firstname ? firstname : "");
+    lastnames.push_back(lastname ? lastname : "");
+    emails.push_back(email ? email : "");
+}
+
+void MegaChatRoomPeers::addWithFullname(MegaChatHandle uh, privilege_t priv, const string &name,
+                                        const string &email)
+{
+    char *firstname = MegaChatRoomPrivate::firstnameFromBuffer(name);
+    char *lastname = MegaChatRoomPrivate::lastnameFromBuffer(name);
+    add(uh, priv, firstname, lastname, email.c_str());
+    delete [] firstname;
+    delete [] lastname;
+}
+
+int MegaChatRoomPeers::find(MegaChatHandle uh) const
+{
+    auto it = index.find(uh);
+    return (it == index.end()) ? -1 : (int)it->second;
+}
+
 MegaChatRoomPrivate::MegaChatRoomPrivate(const MegaChatRoom *chat)
 {
     this->chatid = chat->getChatId();
     this->priv = (privilege_t) chat->getOwnPrivilege();
-    for (unsigned int i = 0; i < chat->getPeerCount(); i++)
+    const MegaChatRoomPrivate *source = dynamic_cast<const MegaChatRoomPrivate *>(chat);
+    if (source)
     {
-        MegaChatHandle uh = chat->getPeerHandle(i);
-        peers.push_back(userpriv_pair(uh, (privilege_t) chat->getPeerPrivilege(i)));
-        peerFirstnames.push_back(chat->getPeerFirstname(i));
-        peerLastnames.push_back(chat->getPeerLastname(i));
-        peerEmails.push_back(chat->getPeerEmail(i));
+        mPeers = source->mPeers;
+    }
+    else
+    {
+        auto peers = std::make_shared<MegaChatRoomPeers>();
+        for (unsigned int i = 0; i < chat->getPeerCount(); i++)
+        {
+            peers->add(chat->getPeerHandle(i), (privilege_t) chat->getPeerPrivilege(i),
+                       chat->getPeerFirstname(i), chat->getPeerLastname(i), chat->getPeerEmail(i));
+        }
+        mPeers = peers;
     }
     this->group = chat->isGroup();
     this->title = chat->getTitle();
@@ -4965,7 +5254,7 @@ MegaChatRoomPrivate::MegaChatRoomPrivate(const MegaChatRoom *chat)
     this->uh = chat->getUserTyping();
 }
 
-MegaChatRoomPrivate::MegaChatRoomPrivate(const ChatRoom &chat)
+MegaChatRoomPrivate::MegaChatRoomPrivate(const ChatRoom &chat, MegaChatApiImpl *api)
 {
     this->changed = 0;
     this->chatid = chat.chatid();
@@ -4980,49 +5269,23 @@ MegaChatRoomPrivate::MegaChatRoomPrivate(const ChatRoom &chat)
 
     if (group)
     {
-        GroupChatRoom &groupchat = (GroupChatRoom&) chat;
-        GroupChatRoom::MemberMap peers = groupchat.peers();
-
-        GroupChatRoom::MemberMap::iterator it;
-        for (it = peers.begin(); it != peers.end(); it++)
-        {
-            this->peers.push_back(userpriv_pair(it->first, (privilege_t) it->second->priv()));
-
-            const char *buffer = MegaChatRoomPrivate::firstnameFromBuffer(it->second->name());
-            this->peerFirstnames.push_back(buffer ? buffer : "");
-            delete [] buffer;
-
-            buffer = MegaChatRoomPrivate::lastnameFromBuffer(it->second->name());
-            this->peerLastnames.push_back(buffer ? buffer : "");
-            delete [] buffer;
-
-            this->peerEmails.push_back(it->second->email());
-        }
+        mPeers = api->groupPeers((const GroupChatRoom&) chat);
     }
     else
     {
+        // a single peer, not worth caching
         PeerChatRoom &peerchat = (PeerChatRoom&) chat;
-        privilege_t priv = (privilege_t) peerchat.peerPrivilege();
-        handle uh = peerchat.peer();
-        string name = peerchat.completeTitleString();
-
-        this->peers.push_back(userpriv_pair(uh, priv));
-
-        const char *buffer = MegaChatRoomPrivate::firstnameFromBuffer(name);
-        this->peerFirstnames.push_back(buffer ? buffer : "");
-        delete [] buffer;
-
-        buffer = MegaChatRoomPrivate::lastnameFromBuffer(name);
-        this->peerLastnames.push_back(buffer ? buffer : "");
-        delete [] buffer;
-
-        this->peerEmails.push_back(peerchat.email());
+        auto peers = std::make_shared<MegaChatRoomPeers>();
+        peers->addWithFullname(peerchat.peer(), (privilege_t) peerchat.peerPrivilege(),
+                               peerchat.completeTitleString(), peerchat.email());
+        mPeers = peers;
     }
 }
 
 MegaChatRoom *MegaChatRoomPrivate::copy() const
 {
-    return new MegaChatRoomPrivate(this);
+    // the peers are immutable and shared, only the scalars are copied
+    return new MegaChatRoomPrivate(*this);
 }
 
 MegaChatHandle MegaChatRoomPrivate::getChatId() const
@@ -5037,146 +5300,106 @@ int MegaChatRoomPrivate::getOwnPrivilege() const
 
 int MegaChatRoomPrivate::getPeerPrivilegeByHandle(MegaChatHandle userhandle) const
 {
-    for (unsigned int i = 0; i < peers.size(); i++)
-    {
-        if (peers.at(i).first == userhandle)
-        {
-            return peers.at(i).second;
-        }
-    }
-
-    return PRIV_UNKNOWN;
+    int i = mPeers->find(userhandle);
+    return (i < 0) ? PRIV_UNKNOWN : mPeers->peers[i].second;
 }
 
 const char *MegaChatRoomPrivate::getPeerFirstnameByHandle(MegaChatHandle userhandle) const
 {
-    for (unsigned int i = 0; i < peers.size(); i++)
-    {
-        if (peers.at(i).first == userhandle)
-        {
-            return peerFirstnames.at(i).c_str();
-        }
-    }
-
-    return NULL;
+    int i = mPeers->find(userhandle);
+    return (i < 0) ? NULL : mPeers->firstnames[i].c_str();
 }
 
 const char *MegaChatRoomPrivate::getPeerLastnameByHandle(MegaChatHandle userhandle) const
 {
-    for (unsigned int i = 0; i < peers.size(); i++)
-    {
-        if (peers.at(i).first == userhandle)
-        {
-            return peerLastnames.at(i).c_str();
-        }
-    }
-
-    return NULL;
+    int i = mPeers->find(userhandle);
+    return (i < 0) ? NULL : mPeers->lastnames[i].c_str();
 }
 
 const char *MegaChatRoomPrivate::getPeerFullnameByHandle(MegaChatHandle userhandle) const
 {
-    for (unsigned int i = 0; i < peers.size(); i++)
-    {
-        if (peers.at(i).first == userhandle)
-        {
-            string ret = peerFirstnames.at(i);
-            if (!peerFirstnames.at(i).empty() && !peerLastnames.at(i).empty())
-            {
-                ret.append(" ");
-            }
-            ret.append(peerLastnames.at(i));
-
-            return MegaApi::strdup(ret.c_str());
-        }
-    }
-
-    return NULL;
+    int i = mPeers->find(userhandle);
+    return (i < 0) ? NULL : getPeerFullname(i);
 }
 
 const char *MegaChatRoomPrivate::getPeerEmailByHandle(MegaChatHandle userhandle) const
 {
-    for (unsigned int i = 0; i < peerEmails.size(); i++)
-    {
-        if (peers.at(i).first == userhandle)
-        {
-            return peerEmails.at(i).c_str();
-        }
-    }
-
-    return NULL;
+    int i = mPeers->find(userhandle);
+    return (i < 0) ? NULL : mPeers->emails[i].c_str();
 }
 
 int MegaChatRoomPrivate::getPeerPrivilege(unsigned int i) const
 {
-    if (i >= peers.size())
+    if (i >= mPeers->peers.size())
     {
         return MegaChatRoom::PRIV_UNKNOWN;
     }
 
-    return peers.at(i).second;
+    return mPeers->peers[i].second;
 }
 
 unsigned int MegaChatRoomPrivate::getPeerCount() const
 {
-    return peers.size();
+    return mPeers->peers.size();
 }
 
 MegaChatHandle MegaChatRoomPrivate::getPeerHandle(unsigned int i) const
 {
-    if (i >= peers.size())
+    if (i >= mPeers->peers.size())
     {
         return MEGACHAT_INVALID_HANDLE;
     }
 
-    return peers.at(i).first;
+    return mPeers->peers[i].first;
 }
 
 const char *MegaChatRoomPrivate::getPeerFirstname(unsigned int i) const
 {
-    if (i >= peerFirstnames.size())
+    if (i >= mPeers->firstnames.size())
     {
         return NULL;
     }
 
-    return peerFirstnames.at(i).c_str();
+    return mPeers->firstnames[i].c_str();
 }
 
 const char *MegaChatRoomPrivate::getPeerLastname(unsigned int i) const
 {
-    if (i >= peerLastnames.size())
+    if (i >= mPeers->lastnames.size())
     {
         return NULL;
     }
 
-    return peerLastnames.at(i).c_str();
+    return mPeers->lastnames[i].c_str();
 }
 
 const char *MegaChatRoomPrivate::getPeerFullname(unsigned int i) const
 {
-    if (i >= peerLastnames.size() || i >= peerFirstnames.size())
+    if (i >= mPeers->lastnames.size() || i >= mPeers->firstnames.size())
     {
         return NULL;
     }
 
-    string ret = peerFirstnames.at(i);
-    if (!peerFirstnames.at(i).empty() && !peerLastnames.at(i).empty())
+    const string& firstname = mPeers->firstnames[i];
+    const string& lastname = mPeers->lastnames[i];
+    string ret = firstname;
+    if (!firstname.empty() && !lastname.empty())
     {
         ret.append(" ");
     }
-    ret.append(peerLastnames.at(i));
+    ret.append(lastname);
 
     return MegaApi::strdup(ret.c_str());
 }
 
 const char *MegaChatRoomPrivate::getPeerEmail(unsigned int i) const
 {
-    if (i >= peerEmails.size())
+    if (i >= mPeers->emails.size())
     {
         return NULL;
     }
 
-    return peerEmails.at(i).c_str();
+    return mPeers->emails[i].c_str();
 }
 
 bool MegaChatRoomPrivate::isGroup() const
@@ -5405,6 +5628,61 @@ MegaChatPeerListPrivate::MegaChatPeerListPrivate(userpriv_vector *userpriv)
     }
 }
 
+MegaChatSearchResultListPrivate::MegaChatSearchResultListPrivate(const std::vector<MsgSearchIndex::Result>& results)
+    : mList(results)
+{
+}
+
+MegaChatSearchResultList *MegaChatSearchResultListPrivate::copy() const
+{
+    return new MegaChatSearchResultListPrivate(mList);
+}
+
+MegaChatHandle MegaChatSearchResultListPrivate::getChatHandle(unsigned int i) const
+{
+    return (i < mList.size()) ? mList[i].chatid.val : MEGACHAT_INVALID_HANDLE;
+}
+
+MegaChatHandle MegaChatSearchResultListPrivate::getMsgHandle(unsigned int i) const
+{
+    return (i < mList.size()) ? mList[i].msgid.val : MEGACHAT_INVALID_HANDLE;
+}
+
+const char *MegaChatSearchResultListPrivate::getSnippet(unsigned int i) const
+{
+    return (i < mList.size()) ? mList[i].snippet.c_str() : NULL;
+}
+
+unsigned int MegaChatSearchResultListPrivate::size() const
+{
+    return (unsigned int)mList.size();
+}
+
+
+MegaChatOnlineStatusListPrivate::MegaChatOnlineStatusListPrivate(const StatusVector& statuses)
+    : mList(statuses)
+{
+}
+
+MegaChatOnlineStatusList *MegaChatOnlineStatusListPrivate::copy() const
+{
+    return new MegaChatOnlineStatusListPrivate(mList);
+}
+
+MegaChatHandle MegaChatOnlineStatusListPrivate::getUserHandle(unsigned int i) const
+{
+    return (i < mList.size()) ? mList[i].first : MEGACHAT_INVALID_HANDLE;
+}
+
+int MegaChatOnlineStatusListPrivate::getStatus(unsigned int i) const
+{
+    return (i < mList.size()) ? mList[i].second : MegaChatApi::STATUS_INVALID;
+}
+
+unsigned int MegaChatOnlineStatusListPrivate::size() const
+{
+    return (unsigned int)mList.size();
+}
 
 MegaChatListItemHandler::MegaChatListItemHandler(MegaChatApiImpl &chatApi, ChatRoom &room)
     :chatApi(chatApi), mRoom(room)
@@ -5661,6 +5939,11 @@ void MegaChatListItemPrivate::setCallInProgress()
     this->changed |= MegaChatListItem::CHANGE_TYPE_CALL;
 }
 
+void MegaChatListItemPrivate::removeChanges()
+{
+    this->changed = 0;
+}
+
 void MegaChatListItemPrivate::setLastMessage()
 {
     this->changed |= MegaChatListItem::CHANGE_TYPE_LAST_MSG;
@@ -5743,6 +6026,47 @@ MegaChatPeerListItemHandler::MegaChatPeerListItemHandler(MegaChatApiImpl &chatAp
 
 }
 
+std::shared_ptr<const MegaChatMessagePayload> MegaChatMessagePayload::get(const Message &msg)
+{
+    std::shared_ptr<const Message::CachedPayload> cached = msg.cachedPayload();
+    if (cached)
+    {
+        return std::static_pointer_cast<const MegaChatMessagePayload>(cached);
+    }
+
+    auto payload = std::make_shared<MegaChatMessagePayload>();
+    switch (msg.type)
+    {
+        case Message::kMsgAttachment:
+            payload->nodeList.reset(JSonUtils::parseAttachNodeJSon(msg.toText().c_str()));
+            break;
+
+        case Message::kMsgContact:
+            payload->users.reset(JSonUtils::parseAttachContactJSon(msg.toText().c_str()));
+            break;
+
+        case Message::kMsgContainsMeta:
+        {
+            std::string text = msg.toText();
+            if (text.length() > 2)
+            {
+                payload->containsMeta.reset(JSonUtils::parseContainsMeta(text.c_str()));
+            }
+            else
+            {
+                payload->containsMeta.reset(new MegaChatContainsMetaPrivate());
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    msg.setCachedPayload(payload);
+    return payload;
+}
+
 MegaChatMessagePrivate::MegaChatMessagePrivate(const MegaChatMessage *msg)
 {
     this->msg = MegaApi::strdup(msg->getContent());
@@ -5760,24 +6084,38 @@ MegaChatMessagePrivate::MegaChatMessagePrivate(const MegaChatMessage *msg)
     this->priv = msg->getPrivilege();
     this->code = msg->getCode();
     this->rowId = msg->getRowId();
-    this->megaNodeList = msg->getMegaNodeList() ? msg->getMegaNodeList()->copy() : NULL;
     this->megaHandleList = msg->getMegaHandleList() ? msg->getMegaHandleList()->copy() : NULL;
 
+    const MegaChatMessagePrivate *source = dynamic_cast<const MegaChatMessagePrivate *>(msg);
+    if (source)
+    {
+        this->megaNodeList = source->megaNodeList;
+        this->megaChatUsers = source->megaChatUsers;
+        this->mContainsMeta = source->mContainsMeta;
+        return;
+    }
+
+    if (msg->getMegaNodeList())
+    {
+        this->megaNodeList.reset(msg->getMegaNodeList()->copy());
+    }
+
     if (msg->getUsersCount() != 0)
     {
-        this->megaChatUsers = new std::vector<MegaChatAttachedUser>();
+        std::vector<MegaChatAttachedUser> *users = new std::vector<MegaChatAttachedUser>();
 
         for (unsigned int i = 0; i < msg->getUsersCount(); ++i)
         {
             MegaChatAttachedUser megaChatUser(msg->getUserHandle(i), msg->getUserEmail(i), msg->getUserName(i));
 
-            this->megaChatUsers->push_back(megaChatUser);
+            users->push_back(megaChatUser);
         }
+        this->megaChatUsers.reset(users);
     }
 
     if (msg->getType() == TYPE_CONTAINS_META)
     {
-        this->mContainsMeta = msg->getContainsMeta()->copy();
+        this->mContainsMeta.reset(msg->getContainsMeta()->copy());
     }
 }
 
@@ -5821,7 +6159,7 @@ MegaChatMessagePrivate::MegaChatMessagePrivate(const Message &msg, Message::Stat
         }
         case MegaChatMessage::TYPE_NODE_ATTACHMENT:
         {
-            megaNodeList = JSonUtils::parseAttachNodeJSon(msg.toText().c_str());
+            megaNodeList = MegaChatMessagePayload::get(msg)->nodeList;
             break;
         }
         case MegaChatMessage::TYPE_REVOKE_NODE_ATTACHMENT:
@@ -5831,20 +6169,13 @@ MegaChatMessagePrivate::MegaChatMessagePrivate(const Message &msg, Message::Stat
         }
         case MegaChatMessage::TYPE_CONTACT_ATTACHMENT:
         {
-            megaChatUsers = JSonUtils::parseAttachContactJSon(msg.toText().c_str());
+            megaChatUsers = MegaChatMessagePayload::get(msg)->users;
             break;
         }
         case MegaChatMessage::TYPE_CONTAINS_META:
         {
-             if (msg.toText().length() > 2)
-             {
-                 mContainsMeta = JSonUtils::parseContainsMeta(msg.toText().c_str());
-             }
-             else
-             {
-                 mContainsMeta = new MegaChatContainsMetaPrivate();
-             }
-             break;
+            mContainsMeta = MegaChatMessagePayload::get(msg)->containsMeta;
+            break;
         }
         case MegaChatMessage::TYPE_CALL_ENDED:
         {
@@ -5896,10 +6227,8 @@ MegaChatMessagePrivate::MegaChatMessagePrivate(const Message &msg, Message::Stat
 MegaChatMessagePrivate::~MegaChatMessagePrivate()
 {
     delete [] msg;
-    delete megaChatUsers;
-    delete megaNodeList;
-    delete mContainsMeta;
     delete megaHandleList;
+    delete mNodeListCopy;
 }
 
 MegaChatMessage *MegaChatMessagePrivate::copy() const
@@ -6072,7 +6401,7 @@ int MegaChatMessagePrivate::convertEndCallTermCodeToUI(const Message::CallEndedI
 unsigned int MegaChatMessagePrivate::getUsersCount() const
 {
     unsigned int size = 0;
-    if (megaChatUsers != NULL)
+    if (megaChatUsers)
     {
         size = megaChatUsers->size();
     }
@@ -6112,12 +6441,16 @@ const char *MegaChatMessagePrivate::getUserEmail(unsigned int index) const
 
 MegaNodeList *MegaChatMessagePrivate::getMegaNodeList() const
 {
-    return megaNodeList;
+    if (!mNodeListCopy && megaNodeList)
+    {
+        mNodeListCopy = megaNodeList->copy();
+    }
+    return mNodeListCopy;
 }
 
 const MegaChatContainsMeta *MegaChatMessagePrivate::getContainsMeta() const
 {
-    return mContainsMeta;
+    return mContainsMeta.get();
 }
 
 MegaHandleList *MegaChatMessagePrivate::getMegaHandleList() const
@@ -6285,6 +6618,9 @@ void MegaChatCallHandler::onStateChange(uint8_t newState)
         }
 
         chatCall->setStatus(state);
+        // the chat list items include whether there is a call in progress,
+        // but the call state changes are not notified as item updates
+        megaChatApi->republishChatListItem(call->chat().chatId());
         megaChatApi->fireOnChatCallUpdate(chatCall);
     }
     else
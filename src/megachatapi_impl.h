@@ -38,6 +38,7 @@
 
 #include <chatClient.h>
 #include <chatd.h>
+#include <base/snapshotMap.h>
 #include <sdkApi.h>
 #include <karereCommon.h>
 #include <logger.h>
@@ -45,6 +46,9 @@
 #include "net/websocketsIO.h"
 
 #include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #ifdef USE_LIBWEBSOCKETS
 
@@ -92,6 +96,7 @@ public:
     virtual mega::MegaNodeList *getMegaNodeList();
     virtual mega::MegaHandleList *getMegaHandleListByChat(MegaChatHandle chatid);
     virtual mega::MegaHandleList *getMegaHandleList();
+    virtual MegaChatSearchResultList *getMegaChatSearchResultList();
     virtual int getParamType();
 
     void setTag(int tag);
@@ -108,6 +113,7 @@ public:
     void setMegaNodeList(mega::MegaNodeList *nodelist);
     void setMegaHandleList(mega::MegaHandleList *handlelist);
     void setMegaHandleListByChat(MegaChatHandle chatid, mega::MegaHandleList *handlelist);
+    void setMegaChatSearchResultList(MegaChatSearchResultList *results);
     void setParamType(int paramType);
 
 protected:
@@ -127,6 +133,7 @@ protected:
     mega::MegaNodeList* mMegaNodeList;
     mega::MegaHandleList *mMegaHandleList;
     std::map<MegaChatHandle, mega::MegaHandleList*> mMegaHandleListMap;
+    MegaChatSearchResultList *mSearchResults;
     int mParamType;
 };
 
@@ -320,6 +327,7 @@ public:
     void setLastTimestamp(int64_t ts);
     void setArchived(bool);
     void setCallInProgress();
+    void removeChanges();
 
     /**
      * If the message is of type MegaChatMessage::TYPE_ATTACHMENT, this function
@@ -564,6 +572,39 @@ private:
     mega::userpriv_vector list;
 };
 
+class MegaChatSearchResultListPrivate : public MegaChatSearchResultList
+{
+public:
+    MegaChatSearchResultListPrivate() {}
+    MegaChatSearchResultListPrivate(const std::vector<karere::MsgSearchIndex::Result>& results);
+    virtual ~MegaChatSearchResultListPrivate() {}
+    virtual MegaChatSearchResultList *copy() const;
+
+    virtual MegaChatHandle getChatHandle(unsigned int i) const;
+    virtual MegaChatHandle getMsgHandle(unsigned int i) const;
+    virtual const char *getSnippet(unsigned int i) const;
+    virtual unsigned int size() const;
+
+private:
+    std::vector<karere::MsgSearchIndex::Result> mList;
+};
+
+class MegaChatOnlineStatusListPrivate : public MegaChatOnlineStatusList
+{
+public:
+    typedef std::vector<std::pair<MegaChatHandle, int> > StatusVector;
+    MegaChatOnlineStatusListPrivate(const StatusVector& statuses);
+    virtual ~MegaChatOnlineStatusListPrivate() {}
+    virtual MegaChatOnlineStatusList *copy() const;
+
+    virtual MegaChatHandle getUserHandle(unsigned int i) const;
+    virtual int getStatus(unsigned int i) const;
+    virtual unsigned int size() const;
+
+private:
+    StatusVector mList;
+};
+
 class MegaChatListItemListPrivate :  public MegaChatListItemList
 {
 public:
@@ -581,11 +622,36 @@ private:
     std::vector<MegaChatListItem*> list;
 };
 
+/**
+ * @brief Immutable list of the peers of a chatroom, with their names split in first and
+ * last name. It's shared by all the MegaChatRoomPrivate snapshots of a room, until its
+ * members change.
+ */
+struct MegaChatRoomPeers
+{
+    mega::userpriv_vector peers;
+    std::vector<std::string> firstnames;
+    std::vector<std::string> lastnames;
+    std::vector<std::string> emails;
+    /** userhandle -> position in the vectors */
+    std::unordered_map<MegaChatHandle, unsigned int> index;
+
+    void add(MegaChatHandle uh, mega::privilege_t priv, const char *firstname,
+             const char *lastname, const char *email);
+    /** @brief Adds a peer, with the name as received in the user attribute */
+    void addWithFullname(MegaChatHandle uh, mega::privilege_t priv, const std::string& name,
+                         const std::string& email);
+    /** @brief Position of the peer, or -1 if it's not a peer of the room */
+    int find(MegaChatHandle uh) const;
+};
+
 class MegaChatRoomPrivate : public MegaChatRoom
 {
 public:
     MegaChatRoomPrivate(const MegaChatRoom *);
-    MegaChatRoomPrivate(const karere::ChatRoom&);
+    /** @param api Provides the cached peers of group chats */
+    MegaChatRoomPrivate(const karere::ChatRoom&, MegaChatApiImpl *api);
+    MegaChatRoomPrivate(const MegaChatRoomPrivate&) = default;
 
     virtual ~MegaChatRoomPrivate() {}
     virtual MegaChatRoom *copy() const;
@@ -630,10 +696,7 @@ private:
 
     MegaChatHandle chatid;
     mega::privilege_t priv;
-    mega::userpriv_vector peers;
-    std::vector<std::string> peerFirstnames;
-    std::vector<std::string> peerLastnames;
-    std::vector<std::string> peerEmails;
+    std::shared_ptr<const MegaChatRoomPeers> mPeers;
     bool group;
     bool active;
     bool archived;
@@ -672,6 +735,20 @@ class MegaChatAttachedUser;
 class MegaChatRichPreviewPrivate;
 class MegaChatContainsMetaPrivate;
 
+/** @brief Parsed contents of attachment, contact and contains-meta messages.
+ * It's cached in the chatd::Message, so the JSON of a message is parsed once
+ * per version of the message, rather than every time a MegaChatMessage is
+ * created from it, and shared by those MegaChatMessage objects.
+ */
+class MegaChatMessagePayload : public chatd::Message::CachedPayload
+{
+public:
+    std::shared_ptr<const std::vector<MegaChatAttachedUser> > users;
+    std::shared_ptr<const mega::MegaNodeList> nodeList;
+    std::shared_ptr<const MegaChatContainsMeta> containsMeta;
+    static std::shared_ptr<const MegaChatMessagePayload> get(const chatd::Message &msg);
+};
+
 class MegaChatMessagePrivate : public MegaChatMessage
 {
 public:
@@ -738,10 +815,13 @@ private:
     bool deleted;
     int priv;               // certain messages need additional info, like priv changes
     int code;               // generic field for additional information (ie. the reason of manual sending)
-    std::vector<MegaChatAttachedUser> *megaChatUsers = NULL;
-    mega::MegaNodeList *megaNodeList = NULL;
+    // the parsed contents are immutable, and shared by the copies of the message
+    std::shared_ptr<const std::vector<MegaChatAttachedUser> > megaChatUsers;
+    std::shared_ptr<const mega::MegaNodeList> megaNodeList;
+    // the MegaNodeList API is not const, so the app gets its own copy of the shared one
+    mutable mega::MegaNodeList *mNodeListCopy = NULL;
     mega::MegaHandleList *megaHandleList = NULL;
-    const MegaChatContainsMeta *mContainsMeta = NULL;
+    std::shared_ptr<const MegaChatContainsMeta> mContainsMeta;
 };
 
 //Thread safe request queue
@@ -814,6 +894,24 @@ private:
     std::set<MegaChatGroupListItemHandler *> chatGroupListItemHandler;
     std::map<MegaChatHandle, MegaChatRoomHandler*> chatRoomHandler;
 
+    // The chat list items, as last notified to the app. Written by the karere
+    // thread only, and read by the getters without locking sdkMutex
+    karere::SnapshotMap<MegaChatListItemPrivate> mChatListItems;
+    void publishChatListItem(const MegaChatListItem *item);
+public:
+    /** @brief Publishes the current state of the chatroom as its chat list item,
+     * for the changes that are not notified by onChatListItemUpdate */
+    void republishChatListItem(MegaChatHandle chatid);
+    /** @brief The peers of a group chat, shared by all the MegaChatRoom objects
+     * built for the same version of its members */
+    std::shared_ptr<const MegaChatRoomPeers> groupPeers(const karere::GroupChatRoom& chat);
+private:
+    // Peers of the group chats, by chatid, for the version of the members they were built from
+    std::mutex mPeersCacheMutex;
+    std::map<MegaChatHandle, std::pair<uint64_t, std::shared_ptr<const MegaChatRoomPeers> > > mPeersCache;
+    /** @brief Drops the cached peers of the chat, or of all chats if \c chatid is invalid */
+    void clearPeersCache(MegaChatHandle chatid = MEGACHAT_INVALID_HANDLE);
+
     int reqtag;
     std::map<int, MegaChatRequestPrivate *> requestMap;
 
@@ -828,6 +926,19 @@ private:
     void cleanCallHandlerMap();
 #endif
 
+    // Presence changes of other users, collected for one batch when batching is
+    // enabled. See MegaChatApi::setPresenceBatching
+    bool mPresenceBatching = false;
+    int mPresenceBatchWindow = 0;
+    bool mPresenceFlushPending = false;
+    megaHandle mPresenceBatchTimer = 0;
+    MegaChatOnlineStatusListPrivate::StatusVector mPresenceBatch;
+    std::map<MegaChatHandle, size_t> mPresenceBatchIndex;
+    void addToPresenceBatch(MegaChatHandle userhandle, int status);
+    void flushPresenceBatch();
+    /** @brief Discards the collected changes and cancels their delivery */
+    void cancelPresenceBatch();
+
     static int convertInitState(int state);
 
     MegaChatMessage *prepareAttachNodesMessage(std::string buffer, MegaChatHandle chatid);
@@ -902,6 +1013,7 @@ public:
     void fireOnChatListItemUpdate(MegaChatListItem *item);
     void fireOnChatInitStateUpdate(int newState);
     void fireOnChatOnlineStatusUpdate(MegaChatHandle userhandle, int status, bool inProgress);
+    void fireOnChatOnlineStatusBatch(MegaChatOnlineStatusList *statuses);
     void fireOnChatPresenceConfigUpdate(MegaChatPresenceConfig *config);
     void fireOnChatConnectionStateUpdate(MegaChatHandle chatid, int newState);
 
@@ -916,6 +1028,8 @@ public:
     void disconnect(MegaChatRequestListener *listener = NULL);
     int getConnectionState();
     int getChatConnectionState(MegaChatHandle chatid);
+    void setChatdStatsEnabled(bool enable, bool reset);
+    char *getChatdStats();
     static int convertChatConnectionState(chatd::ChatState state);
     void retryPendingConnections(MegaChatRequestListener *listener = NULL);
     void logout(MegaChatRequestListener *listener = NULL);
@@ -930,6 +1044,7 @@ public:
     void signalPresenceActivity(MegaChatRequestListener *listener = NULL);
     MegaChatPresenceConfig *getPresenceConfig();
     bool isSignalActivityRequired();
+    void setPresenceBatching(bool enable, int windowMs);
 
     int getUserOnlineStatus(MegaChatHandle userhandle);
     void setBackgroundStatus(bool background, MegaChatRequestListener *listener = NULL);
@@ -992,6 +1107,9 @@ public:
     bool isMessageReceptionConfirmationActive() const;
     void saveCurrentState();
     void pushReceived(bool beep, MegaChatRequestListener *listener = NULL);
+    bool enableMessageSearch(bool enable);
+    bool isMessageSearchEnabled();
+    void searchMessages(const char *text, MegaChatHandle chatid, int offset, int count, MegaChatRequestListener *listener = NULL);
 
 #ifndef KARERE_DISABLE_WEBRTC
 
@@ -1011,6 +1129,7 @@ public:
     void loadAudioVideoDeviceList(MegaChatRequestListener *listener = NULL);
     MegaChatCall *getChatCall(MegaChatHandle chatId);
     void setIgnoredCall(MegaChatHandle chatId);
+    void setCallPrewarm(bool enable, bool video);
     MegaChatCall *getChatCallByCallId(MegaChatHandle callId);
     int getNumCalls();
     mega::MegaHandleList *getChatCalls();
@@ -0,0 +1,108 @@
+#ifndef KARERE_MEMBERINDEX_H
+#define KARERE_MEMBERINDEX_H
+/**
+ * @file memberIndex.h
+ * @brief Reverse index from a userid to the group chat member entries of
+ * that user, in all rooms.
+ */
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <tuple>
+#include <assert.h>
+
+namespace karere
+{
+/** @brief Maps a userid to all the \c M objects that reference that user, so
+ * that per-user events (presence, name and email changes) can be dispatched
+ * to the rooms the user is in, without scanning all rooms.
+ *
+ * Each user entry also holds a \c Data object, for per-user state that is
+ * shared by all the user's members, i.e. attribute subscriptions. It is
+ * created with the first member of the user and destroyed with the last one.
+ * Entries are not moved in memory while they exist, so pointers to them can
+ * be passed to callbacks.
+ */
+template <class M, class Data>
+class MemberIndex
+{
+public:
+    struct Entry: public Data
+    {
+        uint64_t userid;
+        std::vector<M*> members;
+        Entry(uint64_t aUserid): userid(aUserid) {}
+    };
+protected:
+    std::unordered_map<uint64_t, Entry> mEntries;
+public:
+    /** @brief Adds \c member to the entry of \c userid, creating the entry if
+     * necessary.
+     * @param created Set to \c true if the entry was created by this call
+     */
+    Entry& add(uint64_t userid, M* member, bool& created)
+    {
+        auto it = mEntries.find(userid);
+        created = (it == mEntries.end());
+        if (created)
+        {
+            it = mEntries.emplace(std::piecewise_construct,
+                std::forward_as_tuple(userid), std::forward_as_tuple(userid)).first;
+        }
+        assert(std::find(it->second.members.begin(), it->second.members.end(), member)
+               == it->second.members.end());
+        it->second.members.push_back(member);
+        return it->second;
+    }
+    /** @brief Removes \c member from the entry of \c userid.
+     * @return The entry if \c member was the last member of the user, in which
+     * case the caller must release the entry's resources and call \c erase().
+     * Otherwise returns NULL.
+     */
+    Entry* remove(uint64_t userid, M* member)
+    {
+        auto it = mEntries.find(userid);
+        if (it == mEntries.end())
+            return nullptr;
+
+        auto& members = it->second.members;
+        auto memberIt = std::find(members.begin(), members.end(), member);
+        if (memberIt == members.end())
+            return nullptr;
+
+        *memberIt = members.back();
+        members.pop_back();
+        return members.empty() ? &it->second : nullptr;
+    }
+    void erase(uint64_t userid) { mEntries.erase(userid); }
+    Entry* find(uint64_t userid)
+    {
+        auto it = mEntries.find(userid);
+        return (it == mEntries.end()) ? nullptr : &it->second;
+    }
+    /** @brief Calls \c func(member) for each member of the user. \c func may
+     * add and remove members of the user, i.e. via app callbacks
+     */
+    template <class F>
+    void forEachMember(uint64_t userid, F&& func)
+    {
+        auto entry = find(userid);
+        if (!entry)
+            return;
+
+        std::vector<M*> members(entry->members);
+        for (auto member: members)
+        {
+            // skip members removed by a previous call
+            entry = find(userid);
+            if (!entry)
+                return;
+            if (std::find(entry->members.begin(), entry->members.end(), member) != entry->members.end())
+                func(member);
+        }
+    }
+    size_t userCount() const { return mEntries.size(); }
+};
+}
+#endif
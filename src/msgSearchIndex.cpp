@@ -0,0 +1,302 @@
+#include <ctype.h>
+#include "msgSearchIndex.h"
+#include "karereCommon.h"
+#include "chatdMsg.h"
+
+namespace karere
+{
+// Only normal messages that have been decrypted are indexed. Management and
+// special messages (attachments, contacts...) have a different type
+#define MSG_SEARCH_INDEXABLE(row) \
+    #row ".type = 1 and " #row ".is_encrypted = 0 and length(" #row ".data) > 0"
+
+static const char* kMsgSearchTriggers[] =
+{
+    "create trigger if not exists msg_search_ai after insert on history"
+    " when " MSG_SEARCH_INDEXABLE(new) " begin"
+    " insert into msg_search(rowid, content) values(new.rowid, cast(new.data as text));"
+    " end",
+
+    "create trigger if not exists msg_search_ad after delete on history begin"
+    " delete from msg_search where rowid = old.rowid;"
+    " end",
+
+    "create trigger if not exists msg_search_au after update of type, is_encrypted, data on history begin"
+    " delete from msg_search where rowid = old.rowid;"
+    " insert into msg_search(rowid, content) select new.rowid, cast(new.data as text)"
+    " where " MSG_SEARCH_INDEXABLE(new) ";"
+    " end"
+};
+
+static_assert(chatd::Message::kMsgNormal == 1, "MSG_SEARCH_INDEXABLE assumes kMsgNormal == 1");
+
+bool MsgSearchIndex::load()
+{
+    std::lock_guard<std::recursive_mutex> lock(mDb.mutex());
+    SqliteStmt stmt(mDb, "select count(*) from sqlite_master where type='table' and name='msg_search'");
+    stmt.stepMustHaveData("msg search load");
+    mEnabled = (stmt.intCol(0) > 0);
+    if (!mEnabled)
+        return false;
+
+    SqliteStmt cursor(mDb, "select value from vars where name='msg_search_backfill'");
+    mBackfillCursor = cursor.step() ? cursor.int64Col(0) : 0;
+    return true;
+}
+
+void MsgSearchIndex::createTables()
+{
+    mDb.simpleQuery("create virtual table if not exists msg_search using fts5(content)");
+    for (auto sql: kMsgSearchTriggers)
+    {
+        mDb.simpleQuery(sql);
+    }
+}
+
+bool MsgSearchIndex::enable()
+{
+    if (mEnabled)
+        return true;
+
+    std::lock_guard<std::recursive_mutex> lock(mDb.mutex());
+    try
+    {
+        createTables();
+    }
+    catch(std::exception& e)
+    {
+        KR_LOG_ERROR("Can't create the message search index, probably sqlite was built without FTS5: %s", e.what());
+        return false;
+    }
+
+    // Everything above the current max rowid is indexed by the triggers
+    SqliteStmt stmt(mDb, "select max(rowid) from history");
+    int64_t cursor = stmt.step() ? stmt.int64Col(0) + 1 : 0;
+    mDb.query("insert or replace into vars(name,value) values('msg_search_backfill', ?)", cursor);
+    mBackfillCursor = cursor;
+    mEnabled = true;
+    KR_LOG_INFO("Message search index enabled, %s", cursor ? "existing history will be indexed in background" : "history is empty");
+    return true;
+}
+
+void MsgSearchIndex::disable()
+{
+    std::lock_guard<std::recursive_mutex> lock(mDb.mutex());
+    mDb.simpleQuery("drop trigger if exists msg_search_ai");
+    mDb.simpleQuery("drop trigger if exists msg_search_ad");
+    mDb.simpleQuery("drop trigger if exists msg_search_au");
+    mDb.simpleQuery("drop table if exists msg_search");
+    mDb.query("delete from vars where name='msg_search_backfill'");
+    mBackfillCursor = 0;
+    mEnabled = false;
+}
+
+bool MsgSearchIndex::backfill(SqliteDb& db, unsigned maxRows)
+{
+    std::lock_guard<std::recursive_mutex> lock(db.mutex());
+    int64_t cursor = mBackfillCursor.load();
+    if (!mEnabled || cursor <= 0) // may have been disabled meanwhile
+        return false;
+
+    bool ownTransaction = db.commitEach();
+    if (ownTransaction)
+        db.simpleQuery("BEGIN TRANSACTION");
+    try
+    {
+        // Walk the history backwards, so that the most recent messages become
+        // searchable first
+        SqliteStmt rows(db, "select rowid, cast(data as text) from history where rowid < ? and "
+            MSG_SEARCH_INDEXABLE(history) " order by rowid desc limit ?");
+        rows << cursor << maxRows;
+        // Rows below the cursor may have already been indexed by the update trigger
+        SqliteStmt del(db, "delete from msg_search where rowid = ?");
+        SqliteStmt ins(db, "insert into msg_search(rowid, content) values(?, ?)");
+        unsigned count = 0;
+        while (rows.step())
+        {
+            int64_t rowid = rows.int64Col(0);
+            std::string content = rows.stringCol(1); // bound as SQLITE_STATIC
+            del.reset().clearBind();
+            del << rowid;
+            del.step();
+            ins.reset().clearBind();
+            ins << rowid << content;
+            ins.step();
+            cursor = rowid;
+            count++;
+        }
+        if (count < maxRows)
+            cursor = 0;
+
+        db.query("insert or replace into vars(name,value) values('msg_search_backfill', ?)", cursor);
+        if (ownTransaction)
+            db.simpleQuery("COMMIT");
+    }
+    catch(...)
+    {
+        if (ownTransaction)
+            sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        throw;
+    }
+    mBackfillCursor = cursor;
+    if (!cursor)
+        KR_LOG_INFO("Message search index: backfill of existing history completed");
+    return cursor > 0;
+}
+
+std::string MsgSearchIndex::toFtsQuery(const std::string& text)
+{
+    // Each word becomes a quoted string, and the last one is also matched
+    // as a prefix, to allow search-as-you-type
+    std::string result;
+    size_t i = 0;
+    size_t len = text.size();
+    while (i < len)
+    {
+        while (i < len && isspace((unsigned char)text[i]))
+            i++;
+        if (i >= len)
+            break;
+        if (!result.empty())
+            result += ' ';
+        result += '"';
+        while (i < len && !isspace((unsigned char)text[i]))
+        {
+            if (text[i] == '"')
+                result += '"'; // quotes are escaped by doubling them
+            result += text[i++];
+        }
+        result += '"';
+    }
+    if (!result.empty())
+        result += '*';
+    return result;
+}
+
+void MsgSearchIndex::search(const std::string& text, Id chatid, unsigned offset,
+                            unsigned count, std::vector<Result>& results)
+{
+    if (!mEnabled)
+        throw std::runtime_error("Message search index is not enabled");
+
+    std::lock_guard<std::recursive_mutex> lock(mDb.mutex());
+    runSearch(mDb, text, chatid, offset, count, results);
+}
+
+void MsgSearchIndex::runSearch(SqliteDb& db, const std::string& text, Id chatid,
+                               unsigned offset, unsigned count, std::vector<Result>& results)
+{
+    std::string query = toFtsQuery(text);
+    if (query.empty() || !count)
+        return;
+
+    std::string sql = "select h.chatid, h.msgid, snippet(msg_search, 0, '', '', '...', 16) "
+        "from msg_search join history h on h.rowid = msg_search.rowid where msg_search match ?";
+    if (chatid.isValid())
+        sql.append(" and h.chatid = ?");
+    sql.append(" order by rank limit ? offset ?");
+
+    SqliteStmt stmt(db, sql);
+    stmt << query;
+    if (chatid.isValid())
+        stmt << chatid;
+    stmt << count << offset;
+    while (stmt.step())
+    {
+        results.emplace_back();
+        auto& result = results.back();
+        result.chatid = stmt.uint64Col(0);
+        result.msgid = stmt.uint64Col(1);
+        result.snippet = stmt.stringCol(2);
+    }
+}
+
+bool MsgSearchIndex::startWorker(const std::string& dbPath)
+{
+    if (mWorkerRunning)
+        return true;
+    if (!mReadDb.open(dbPath.c_str(), true, true))
+    {
+        KR_LOG_ERROR("Message search: can't open read connection to %s", dbPath.c_str());
+        return false;
+    }
+    mWorkerTerminate = false;
+    mWorkerRunning = true;
+    mWorker = std::thread([this]() { workerFunc(); });
+    return true;
+}
+
+void MsgSearchIndex::stopWorker()
+{
+    if (!mWorkerRunning)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mWorkerMutex);
+        mWorkerTerminate = true;
+    }
+    mWorkerCond.notify_one();
+    mWorker.join();
+    mWorkerRunning = false;
+    mReadDb.close();
+}
+
+void MsgSearchIndex::searchAsync(const std::string& text, Id chatid, unsigned offset,
+                                 unsigned count, SearchCb&& cb)
+{
+    assert(mWorkerRunning);
+    {
+        std::lock_guard<std::mutex> lock(mWorkerMutex);
+        mJobs.push_back({text, chatid, offset, count, std::move(cb)});
+    }
+    mWorkerCond.notify_one();
+}
+
+void MsgSearchIndex::workerFunc()
+{
+    for (;;)
+    {
+        SearchJob job;
+        {
+            std::unique_lock<std::mutex> lock(mWorkerMutex);
+            mWorkerCond.wait(lock, [this]() { return mWorkerTerminate || !mJobs.empty(); });
+            if (mWorkerTerminate)
+                break;
+            job = std::move(mJobs.front());
+            mJobs.pop_front();
+        }
+
+        std::vector<Result> results;
+        std::string error;
+        try
+        {
+            if (!mEnabled)
+                throw std::runtime_error("Message search index is not enabled");
+            {
+                // the main connection keeps a long transaction open, whose
+                // changes are not visible to other connections until committed
+                std::lock_guard<std::recursive_mutex> lock(mDb.mutex());
+                mDb.commit();
+            }
+            runSearch(mReadDb, job.text, job.chatid, job.offset, job.count, results);
+        }
+        catch(std::exception& e)
+        {
+            KR_LOG_ERROR("Message search failed: %s", e.what());
+            results.clear();
+            error = e.what();
+        }
+        job.cb(std::move(results), error);
+    }
+
+    // complete the searches that were not run
+    std::deque<SearchJob> jobs;
+    {
+        std::lock_guard<std::mutex> lock(mWorkerMutex);
+        jobs.swap(mJobs);
+    }
+    for (auto& job: jobs)
+    {
+        job.cb(std::vector<Result>(), "Message search was terminated");
+    }
+}
+}
@@ -0,0 +1,120 @@
+#ifndef KARERE_MSGSEARCHINDEX_H
+#define KARERE_MSGSEARCHINDEX_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include "buffer.h"
+#include "db.h"
+#include "karereId.h"
+
+namespace karere
+{
+/** @brief Optional full-text index over the decrypted message history.
+ *
+ * The index is an SQLite FTS5 table kept in the karere db, keyed by the rowid
+ * of the \c history table. It is maintained by triggers on \c history, so
+ * every message that chatd stores (or updates) in plaintext is indexed as part
+ * of the same write. Since chatd writes are applied by the DbWriter thread,
+ * indexing never blocks message delivery.
+ *
+ * History that was already in the db when the index was created is indexed
+ * in the background, in small chunks, by \c backfill().
+ *
+ * If the sqlite library was built without FTS5, \c enable() fails and the
+ * search is not available.
+ *
+ * Searches requested by the app are run by a worker thread, over its own
+ * read-only connection to the db, so that they block neither the app thread
+ * nor the DbWriter.
+ */
+class MsgSearchIndex
+{
+public:
+    struct Result
+    {
+        Id chatid;
+        Id msgid;
+        std::string snippet;
+    };
+    enum { kBackfillChunk = 500 };
+    /** Called by the search worker thread. \c error is empty on success */
+    typedef std::function<void(std::vector<Result>&& results, const std::string& error)> SearchCb;
+
+protected:
+    struct SearchJob
+    {
+        std::string text;
+        Id chatid;
+        unsigned offset;
+        unsigned count;
+        SearchCb cb;
+    };
+    SqliteDb& mDb;
+    // read by the DbWriter (backfill()) and by the search worker
+    std::atomic<bool> mEnabled;
+    // rows of history with rowid below this are not yet indexed. Zero when done
+    std::atomic<int64_t> mBackfillCursor;
+    // search worker, see searchAsync()
+    SqliteDb mReadDb;
+    std::thread mWorker;
+    std::mutex mWorkerMutex;
+    std::condition_variable mWorkerCond;
+    std::deque<SearchJob> mJobs;
+    bool mWorkerRunning = false;
+    bool mWorkerTerminate = false;
+    void createTables();
+    void workerFunc();
+    static void runSearch(SqliteDb& db, const std::string& text, Id chatid,
+                          unsigned offset, unsigned count, std::vector<Result>& results);
+
+public:
+    MsgSearchIndex(SqliteDb& db): mDb(db), mEnabled(false), mBackfillCursor(0) {}
+    ~MsgSearchIndex() { stopWorker(); }
+    /** @brief Checks whether the index exists in the db (it was enabled in
+     * a previous session). Must be called after the db is opened */
+    bool load();
+    /** @brief Creates the index, if it doesn't exist.
+     * @return false if FTS5 is not supported by sqlite */
+    bool enable();
+    /** @brief Drops the index and its triggers */
+    void disable();
+    bool isEnabled() const { return mEnabled; }
+    bool needsBackfill() const { return mBackfillCursor.load() > 0; }
+    /** @brief Indexes up to \c maxRows messages stored before the index was
+     * created. Intended to be run as a DbWriter idle task.
+     * @return true if there is more history left to index */
+    bool backfill(SqliteDb& db, unsigned maxRows=kBackfillChunk);
+    /** @brief Searches messages that contain all the words in \c text (the
+     * last one as a prefix), best matches first
+     * @param chatid Restrict the search to this chat. Id::inval() for all chats
+     * @param offset Number of results to skip, for pagination
+     * @param count Maximum number of results to return
+     */
+    void search(const std::string& text, Id chatid, unsigned offset,
+                unsigned count, std::vector<Result>& results);
+    /** @brief Starts the search worker, with its own read-only connection to
+     * the db at \c dbPath. Does nothing if it's already running
+     * @return false if the db could not be opened */
+    bool startWorker(const std::string& dbPath);
+    /** @brief Stops the search worker. Searches that were not yet run are
+     * completed with an error. Must be called before the db is closed */
+    void stopWorker();
+    bool isWorkerRunning() const { return mWorkerRunning; }
+    /** @brief Same as \c search(), but run by the worker thread, which then
+     * calls \c cb. The worker must have been started.
+     * The worker commits the db before searching, so that all messages
+     * applied so far are visible to its connection */
+    void searchAsync(const std::string& text, Id chatid, unsigned offset,
+                     unsigned count, SearchCb&& cb);
+    /** @brief Converts free text into an FTS5 query, so that characters with
+     * special meaning in the FTS5 syntax are matched literally */
+    static std::string toFtsQuery(const std::string& text);
+};
+}
+#endif
@@ -1,4 +1,5 @@
 #include "net/websocketsIO.h"
+#include "base/timers.hpp"
 
 WebsocketsIO::WebsocketsIO(::mega::Mutex *mutex, ::mega::MegaApi *megaApi, void *ctx)
     : mApi(*megaApi, ctx, false)
@@ -49,7 +50,7 @@ void WebsocketsClientImpl::wsConnectCb()
 {
     ScopedLock lock(this->mutex);
     WEBSOCKETS_LOG_DEBUG("Connection established");
-    client->wsConnectCb();
+    client->wsConnectCbPrivate(this);
 }
 
 void WebsocketsClientImpl::wsCloseCb(int errcode, int errtype, const char *preason, size_t reason_len)
@@ -65,7 +66,7 @@ void WebsocketsClientImpl::wsCloseCb(int errcode, int errtype, const char *preas
         WEBSOCKETS_LOG_DEBUG("Connection closed by server");
     }
 
-    client->wsCloseCbPrivate(errcode, errtype, preason, reason_len);
+    client->wsCloseCbPrivate(this, errcode, errtype, preason, reason_len);
 }
 
 void WebsocketsClientImpl::wsHandleMsgCb(char *data, size_t len)
@@ -83,6 +84,7 @@ WebsocketsClient::WebsocketsClient()
 
 WebsocketsClient::~WebsocketsClient()
 {
+    cancelRace();
     delete ctx;
     ctx = NULL;
 }
@@ -105,6 +107,10 @@ bool WebsocketsClient::wsConnect(WebsocketsIO *websocketIO, const char *ip, cons
         delete ctx;
     }
 
+    cancelRace();
+    mConnectIp = ip;
+    mConnectRtt = -1;
+    mConnectStart = Clock::now();
     ctx = websocketIO->wsConnect(ip, host, port, path, ssl, this);
     if (!ctx)
     {
@@ -113,6 +119,70 @@ bool WebsocketsClient::wsConnect(WebsocketsIO *websocketIO, const char *ip, cons
     return ctx != NULL;
 }
 
+bool WebsocketsClient::wsConnectDualStack(WebsocketsIO *websocketIO, const std::string &ip, const std::string &fallbackIp,
+                                          const char *host, int port, const char *path, bool ssl)
+{
+    if (!wsConnect(websocketIO, ip.c_str(), host, port, path, ssl))
+    {
+        if (fallbackIp.empty())
+        {
+            return false;
+        }
+
+        WEBSOCKETS_LOG_DEBUG("Retrying using the IP: %s", fallbackIp.c_str());
+        return wsConnect(websocketIO, fallbackIp.c_str(), host, port, path, ssl);
+    }
+
+    if (!fallbackIp.empty())
+    {
+        mRaceIO = websocketIO;
+        mRaceIp = fallbackIp;
+        mRaceHost = host;
+        mRacePath = path;
+        mRacePort = port;
+        mRaceSsl = ssl;
+        mRaceTimer = karere::setTimeout([this]()
+        {
+            mRaceTimer = 0;
+            startRaceAttempt();
+        }, kConnectRaceDelay, websocketIO->appCtx);
+    }
+    return true;
+}
+
+void WebsocketsClient::startRaceAttempt()
+{
+    if (mRaceIp.empty() || mRaceCtx)
+    {
+        return;
+    }
+
+    WEBSOCKETS_LOG_DEBUG("Not connected to %s yet, racing %s", mConnectIp.c_str(), mRaceIp.c_str());
+    mRaceStart = Clock::now();
+    mRaceCtx = mRaceIO->wsConnect(mRaceIp.c_str(), mRaceHost.c_str(), mRacePort, mRacePath.c_str(), mRaceSsl, this);
+    if (!mRaceCtx)
+    {
+        WEBSOCKETS_LOG_WARNING("Immediate error in wsConnect to %s", mRaceIp.c_str());
+        mRaceIp.clear();
+    }
+}
+
+void WebsocketsClient::cancelRace()
+{
+    if (mRaceTimer)
+    {
+        karere::cancelTimeout(mRaceTimer, mRaceIO->appCtx);
+        mRaceTimer = 0;
+    }
+    if (mRaceCtx)
+    {
+        mRaceCtx->wsDisconnect(true);
+        delete mRaceCtx;
+        mRaceCtx = NULL;
+    }
+    mRaceIp.clear();
+}
+
 bool WebsocketsClient::wsSendMessage(char *msg, size_t len)
 {
     assert (ctx);
@@ -137,7 +207,8 @@ bool WebsocketsClient::wsSendMessage(char *msg, size_t len)
 void WebsocketsClient::wsDisconnect(bool immediate)
 {
     WEBSOCKETS_LOG_DEBUG("Disconnecting. Immediate: %d", immediate);
-    
+    cancelRace();
+
     if (!ctx)
     {
         return;
@@ -164,9 +235,45 @@ bool WebsocketsClient::wsIsConnected()
     return ctx->wsIsConnected();
 }
 
-void WebsocketsClient::wsCloseCbPrivate(int errcode, int errtype, const char *preason, size_t reason_len)
+void WebsocketsClient::wsConnectCbPrivate(WebsocketsClientImpl *impl)
 {
-    if (!ctx)   // immediate disconnect ocurred before the marshall is executed (only applies to libws)
+    if (impl == mRaceCtx)
+    {
+        WEBSOCKETS_LOG_DEBUG("Connected first to %s, dropping the attempt to %s", mRaceIp.c_str(), mConnectIp.c_str());
+        if (ctx)
+        {
+            ctx->wsDisconnect(true);
+            delete ctx;
+        }
+        ctx = mRaceCtx;
+        mRaceCtx = NULL;
+        mConnectIp = mRaceIp;
+        mConnectStart = mRaceStart;
+    }
+    else if (impl != ctx)
+    {
+        WEBSOCKETS_LOG_WARNING("Connection established for a discarded attempt");
+        assert(false);
+        return;
+    }
+    cancelRace();
+
+    mConnectRtt = (int)std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - mConnectStart).count();
+    wsConnectCb();
+}
+
+void WebsocketsClient::wsCloseCbPrivate(WebsocketsClientImpl *impl, int errcode, int errtype, const char *preason, size_t reason_len)
+{
+    if (impl == mRaceCtx)  // the first attempt is still connecting
+    {
+        WEBSOCKETS_LOG_DEBUG("Connection to %s failed", mRaceIp.c_str());
+        delete mRaceCtx;
+        mRaceCtx = NULL;
+        mRaceIp.clear();
+        return;
+    }
+
+    if (!ctx || impl != ctx)   // immediate disconnect ocurred before the marshall is executed (only applies to libws)
     {
         return;
     }
@@ -174,6 +281,37 @@ void WebsocketsClient::wsCloseCbPrivate(int errcode, int errtype, const char *pr
     delete ctx;
     ctx = NULL;
 
+    if (mRaceCtx)   // the fallback attempt is still connecting
+    {
+        WEBSOCKETS_LOG_DEBUG("Connection to %s failed, waiting for %s", mConnectIp.c_str(), mRaceIp.c_str());
+        ctx = mRaceCtx;
+        mRaceCtx = NULL;
+        mConnectIp = mRaceIp;
+        mConnectStart = mRaceStart;
+        mRaceIp.clear();
+        return;
+    }
+
+    if (!mRaceIp.empty())   // failed before the race delay, don't wait for it
+    {
+        if (mRaceTimer)
+        {
+            karere::cancelTimeout(mRaceTimer, mRaceIO->appCtx);
+            mRaceTimer = 0;
+        }
+        startRaceAttempt();
+        if (mRaceCtx)
+        {
+            WEBSOCKETS_LOG_DEBUG("Connection to %s failed, retrying using the IP: %s", mConnectIp.c_str(), mRaceIp.c_str());
+            ctx = mRaceCtx;
+            mRaceCtx = NULL;
+            mConnectIp = mRaceIp;
+            mConnectStart = mRaceStart;
+            mRaceIp.clear();
+            return;
+        }
+    }
+
     WEBSOCKETS_LOG_DEBUG("Socket was closed gracefully or by server");
 
     wsCloseCb(errcode, errtype, preason, reason_len);
@@ -188,7 +326,9 @@ bool DNScache::set(const std::string &url, const std::string &ipv4, const std::s
         record.ipv6 = ipv6;
         record.resolveTs = time(NULL);
 
-        mRecords[url] = record;
+        DNSrecord &newRecord = mRecords[url];
+        newRecord = record;
+        notifyChange(url, &newRecord);
 
         return true;
     }
@@ -198,7 +338,58 @@ bool DNScache::set(const std::string &url, const std::string &ipv4, const std::s
 
 void DNScache::clear(const std::string &url)
 {
-    mRecords.erase(url);
+    if (mRecords.erase(url))
+    {
+        notifyChange(url, NULL);
+    }
+}
+
+void DNScache::load(const std::string &url, const DNSrecord &record)
+{
+    mRecords[url] = record;
+}
+
+void DNScache::setChangeCb(ChangeCb &&cb)
+{
+    mChangeCb = std::move(cb);
+}
+
+void DNScache::notifyChange(const std::string &url, const DNSrecord *record)
+{
+    if (mChangeCb)
+    {
+        mChangeCb(url, record);
+    }
+}
+
+bool DNScache::getByPreference(const std::string &url, bool preferIpv6, std::string &ip, std::string &fallbackIp)
+{
+    auto it = mRecords.find(url);
+    if (it == mRecords.end())
+    {
+        return false;
+    }
+
+    // the family that connected faster last time goes first. If only one of them
+    // ever connected, that one
+    const DNSrecord &record = it->second;
+    bool ipv6First = preferIpv6;
+    if (record.connectIpv4Rtt >= 0 && record.connectIpv6Rtt >= 0)
+    {
+        ipv6First = record.connectIpv6Rtt < record.connectIpv4Rtt;
+    }
+    else if (record.connectIpv4Rtt >= 0 || record.connectIpv6Rtt >= 0)
+    {
+        ipv6First = record.connectIpv6Rtt >= 0;
+    }
+
+    ip = ipv6First ? record.ipv6 : record.ipv4;
+    fallbackIp = ipv6First ? record.ipv4 : record.ipv6;
+    if (ip.empty())
+    {
+        ip.swap(fallbackIp);
+    }
+    return true;
 }
 
 bool DNScache::get(const std::string &url, std::string &ipv4, std::string &ipv6)
@@ -215,19 +406,39 @@ bool DNScache::get(const std::string &url, std::string &ipv4, std::string &ipv6)
     return true;
 }
 
-void DNScache::connectDone(const std::string &url, const std::string &ip)
+// smoothed like the TCP RTT estimator, so that a single slow connect doesn't flip the preference
+static int smoothRtt(int oldRtt, int rtt)
+{
+    return (oldRtt < 0) ? rtt : (3 * oldRtt + rtt) / 4;
+}
+
+void DNScache::connectDone(const std::string &url, const std::string &ip, int rttMs)
 {
     auto it = mRecords.find(url);
     if (it != mRecords.end())
     {
-        if (ip == it->second.ipv4)
+        DNSrecord &record = it->second;
+        if (ip == record.ipv4)
+        {
+            record.connectIpv4Ts = time(NULL);
+            if (rttMs >= 0)
+            {
+                record.connectIpv4Rtt = smoothRtt(record.connectIpv4Rtt, rttMs);
+            }
+        }
+        else if (ip == record.ipv6)
         {
-            it->second.connectIpv4Ts = time(NULL);
+            record.connectIpv6Ts = time(NULL);
+            if (rttMs >= 0)
+            {
+                record.connectIpv6Rtt = smoothRtt(record.connectIpv6Rtt, rttMs);
+            }
         }
-        else if (ip == it->second.ipv6)
+        else
         {
-            it->second.connectIpv6Ts = time(NULL);
+            return;
         }
+        notifyChange(url, &record);
     }
 }
 
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <functional>
 #include <vector>
+#include <map>
+#include <chrono>
 #include <mega/waiter.h>
 #include <mega/thread.h>
 #include "base/logger.h"
@@ -20,27 +22,38 @@ class WebsocketsClientImpl;
 class DNScache
 {
 public:
+    struct DNSrecord
+    {
+        std::string ipv4;
+        std::string ipv6;
+        time_t resolveTs = 0;       // can be used to invalidate IP addresses by age
+        time_t connectIpv4Ts = 0;   // can be used for heuristics based on last successful connection
+        time_t connectIpv6Ts = 0;   // can be used for heuristics based on last successful connection
+        int connectIpv4Rtt = -1;    // smoothed time to connect, in ms (-1 if unknown)
+        int connectIpv6Rtt = -1;
+    };
+    // called when a record is added, updated or removed (record is NULL), i.e. to persist the cache
+    typedef std::function<void(const std::string &url, const DNSrecord *record)> ChangeCb;
+
     DNScache() {}
     // returns false if ipv4 and ipv6 for the given url already match the ones in cache, true if not (so they are updated)
     bool set(const std::string &url, const std::string &ipv4, const std::string &ipv6);
     void clear(const std::string &url);
     // returns true if hit in cache, false if there's no record for the given url
     bool get(const std::string &url, std::string &ipv4, std::string &ipv6);
-    void connectDone(const std::string &url, const std::string &ip);
+    // like get(), but returns first the IP that is expected to connect faster, and the other one as fallback
+    bool getByPreference(const std::string &url, bool preferIpv6, std::string &ip, std::string &fallbackIp);
+    void connectDone(const std::string &url, const std::string &ip, int rttMs = -1);
     time_t age(const std::string &url);
     bool isMatch(const std::string &url, const std::vector<std::string> &ipsv4, const std::vector<std::string> &ipsv6);
     bool isMatch(const std::string &url, const std::string &ipv4, const std::string &ipv6);
+    // adds a record from persistent storage, without notifying the change
+    void load(const std::string &url, const DNSrecord &record);
+    void setChangeCb(ChangeCb &&cb);
 private:
-    struct DNSrecord
-    {
-        std::string ipv4;
-        std::string ipv6;
-        time_t resolveTs = 0;       // can be used to invalidate IP addresses by age
-        time_t connectIpv4Ts = 0;   // can be used for heuristics based on last successful connection
-        time_t connectIpv6Ts = 0;   // can be used for heuristics based on last successful connection
-    };
-
     std::map<std::string, DNSrecord> mRecords;
+    ChangeCb mChangeCb;
+    void notifyChange(const std::string &url, const DNSrecord *record);
 };
 
 // Generic websockets network layer
@@ -71,20 +84,50 @@ protected:
 // It's needed to subclass this class in order to receive callbacks
 class WebsocketsClient
 {
+public:
+    // delay before racing the fallback IP while the first one is still connecting (RFC 8305)
+    enum { kConnectRaceDelay = 250 };
+
 private:
+    typedef std::chrono::steady_clock Clock;
     WebsocketsClientImpl *ctx;
     pthread_t thread_id;
 
+    // Dual-stack connection race: a second attempt to the other IP family,
+    // started if ctx hasn't connected after kConnectRaceDelay, or has failed.
+    // The first one to connect becomes ctx and the other is dropped
+    WebsocketsIO *mRaceIO = nullptr;
+    WebsocketsClientImpl *mRaceCtx = nullptr;
+    megaHandle mRaceTimer = 0;
+    std::string mRaceIp;
+    std::string mRaceHost;
+    std::string mRacePath;
+    int mRacePort = 0;
+    bool mRaceSsl = false;
+    Clock::time_point mRaceStart;
+    std::string mConnectIp;
+    Clock::time_point mConnectStart;
+    int mConnectRtt = -1;
+    void startRaceAttempt();
+    void cancelRace();
+
 public:
     WebsocketsClient();
     virtual ~WebsocketsClient();
     bool wsResolveDNS(WebsocketsIO *websocketIO, const char *hostname, std::function<void(int, std::vector<std::string>&, std::vector<std::string>&)> f);
     bool wsConnect(WebsocketsIO *websocketIO, const char *ip,
                    const char *host, int port, const char *path, bool ssl);
+    // connects to ip, racing fallbackIp (if not empty) as described above
+    bool wsConnectDualStack(WebsocketsIO *websocketIO, const std::string &ip, const std::string &fallbackIp,
+                   const char *host, int port, const char *path, bool ssl);
     bool wsSendMessage(char *msg, size_t len);  // returns true on success, false if error
     void wsDisconnect(bool immediate);
     bool wsIsConnected();
-    void wsCloseCbPrivate(int errcode, int errtype, const char *preason, size_t reason_len);
+    // IP of the current connection, and the time it took to connect in ms. Valid since wsConnectCb()
+    const std::string &wsConnectedIp() const { return mConnectIp; }
+    int wsConnectRtt() const { return mConnectRtt; }
+    void wsConnectCbPrivate(WebsocketsClientImpl *impl);
+    void wsCloseCbPrivate(WebsocketsClientImpl *impl, int errcode, int errtype, const char *preason, size_t reason_len);
 
     virtual void wsConnectCb() = 0;
     virtual void wsCloseCb(int errcode, int errtype, const char *preason, size_t reason_len) = 0;
@@ -45,22 +45,60 @@ Client::connect(const std::string& url, Id myHandle, IdRefMap&& currentPeers,
 
 void Client::pushPeers()
 {
-    Command cmd(OP_ADDPEERS, 4 + mCurrentPeers.size()*8);
-    cmd.append<uint32_t>(mCurrentPeers.size());
+    // the server starts every connection with an empty set of peers, so all of
+    // them are sent, including the ones that were pending
+    mPendingPeers.clear();
+    std::vector<uint64_t> peers;
+    peers.reserve(mCurrentPeers.size());
     for (auto& peer: mCurrentPeers)
     {
-        cmd.append<uint64_t>(peer.first);
+        peers.push_back(peer.first);
     }
-    if (cmd.dataSize() > 1)
+    sendAddPeers(peers);
+}
+
+void Client::sendAddPeers(const std::vector<uint64_t>& peers)
+{
+    for (size_t start = 0; start < peers.size(); start += kMaxPeersPerCommand)
     {
-        sendCommand(std::move(cmd));
+        size_t count = std::min<size_t>(peers.size() - start, kMaxPeersPerCommand);
+        Command cmd(OP_ADDPEERS, 4 + count*8);
+        cmd.append<uint32_t>(count);
+        for (size_t i = start; i < start + count; i++)
+        {
+            cmd.append<uint64_t>(peers[i]);
+        }
+        if (!sendCommand(std::move(cmd)))
+        {
+            return; // the rest will be sent upon reconnection
+        }
+    }
+}
+
+void Client::flushPendingPeers()
+{
+    mPeersFlushPending = false;
+    if (mPendingPeers.empty())
+        return;
+
+    std::vector<uint64_t> peers;
+    peers.reserve(mPendingPeers.size());
+    for (auto& peer: mPendingPeers)
+    {
+        peers.push_back(peer.val);
+    }
+    mPendingPeers.clear();
+    if (isOnline())
+    {
+        sendAddPeers(peers);
     }
 }
 
 void Client::wsConnectCb()
 {
-    PRESENCED_LOG_DEBUG("Presenced connected to %s", mTargetIp.c_str());
-    mDNScache.connectDone(mUrl.host, mTargetIp);
+    mTargetIp = wsConnectedIp();
+    PRESENCED_LOG_DEBUG("Presenced connected to %s in %d ms", mTargetIp.c_str(), wsConnectRtt());
+    mDNScache.connectDone(mUrl.host, mTargetIp, wsConnectRtt());
     setConnState(kConnected);
     assert(!mConnectPromise.done());
     mConnectPromise.resolve();
@@ -372,49 +410,22 @@ void Client::disconnect()
 
 void Client::doConnect()
 {
-    string ipv4, ipv6;
-    bool cachedIPs = mDNScache.get(mUrl.host, ipv4, ipv6);
+    string fallbackIp;
+    bool cachedIPs = mDNScache.getByPreference(mUrl.host, usingipv6, mTargetIp, fallbackIp);
     assert(cachedIPs);
-    mTargetIp = (usingipv6 && ipv6.size()) ? ipv6 : ipv4;
 
     setConnState(kConnecting);
-    PRESENCED_LOG_DEBUG("Connecting to presenced using the IP: %s", mTargetIp.c_str());
+    PRESENCED_LOG_DEBUG("Connecting to presenced using the IP: %s (fallback: %s)", mTargetIp.c_str(), fallbackIp.c_str());
 
-    bool rt = wsConnect(karereClient->websocketIO, mTargetIp.c_str(),
+    bool rt = wsConnectDualStack(karereClient->websocketIO, mTargetIp, fallbackIp,
           mUrl.host.c_str(),
           mUrl.port,
           mUrl.path.c_str(),
           mUrl.isSecure);
 
-    if (!rt)    // immediate failure --> try the other IP family (if available)
+    if (!rt)    // immediate failure with both IP families
     {
         PRESENCED_LOG_DEBUG("Connection to presenced failed using the IP: %s", mTargetIp.c_str());
-
-        string oldTargetIp = mTargetIp;
-        mTargetIp.clear();
-        if (oldTargetIp == ipv6 && ipv4.size())
-        {
-            mTargetIp = ipv4;
-        }
-        else if (oldTargetIp == ipv4 && ipv6.size())
-        {
-            mTargetIp = ipv6;
-        }
-
-        if (mTargetIp.size())
-        {
-            PRESENCED_LOG_DEBUG("Retrying using the IP: %s", mTargetIp.c_str());
-            if (wsConnect(karereClient->websocketIO, mTargetIp.c_str(),
-                          mUrl.host.c_str(),
-                          mUrl.port,
-                          mUrl.path.c_str(),
-                          mUrl.isSecure))
-            {
-                return;
-            }
-            PRESENCED_LOG_DEBUG("Connection to presenced failed using the IP: %s", mTargetIp.c_str());
-        }
-
         onSocketClose(0, 0, "Websocket error on wsConnect (presenced)");
     }
 }
@@ -730,10 +741,23 @@ void Client::setConnState(ConnState newState)
 void Client::addPeer(karere::Id peer)
 {
     int result = mCurrentPeers.insert(peer);
-    if (result == 1) //refcount = 1, wasnt there before
+    if (result != 1 || !isOnline()) //refcount > 1, or it will be sent by login()
+        return;
+
+    // Peers are usually added in bursts, i.e. when the list of chats is
+    // received, so they are sent together
+    mPendingPeers.insert(peer);
+    if (mPeersFlushPending)
+        return;
+
+    mPeersFlushPending = true;
+    auto wptr = weakHandle();
+    marshallCall([this, wptr]()
     {
-        sendCommand(Command(OP_ADDPEERS)+(uint32_t)(1)+peer);
-    }
+        if (wptr.deleted())
+            return;
+        flushPendingPeers();
+    }, karereClient->appCtx);
 }
 void Client::removePeer(karere::Id peer, bool force)
 {
@@ -759,6 +783,8 @@ void Client::removePeer(karere::Id peer, bool force)
         assert(it->second == 0);
     }
     mCurrentPeers.erase(it);
+    if (mPendingPeers.erase(peer))
+        return; // the server doesn't know about it yet
     sendCommand(Command(OP_DELPEERS)+(uint32_t)(1)+peer);
 }
 }
@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 #include <string>
+#include <set>
+#include <vector>
 #include <buffer.h>
 #include <base/promise.h>
 #include <base/timers.hpp>
@@ -249,6 +251,8 @@ public:
         kLoggedIn
     };
     enum: uint16_t { kProtoVersion = 0x0001 };
+    /** Max number of peers in a single ADDPEERS, to bound the size of the frames */
+    enum { kMaxPeersPerCommand = 1000 };
 
 protected:
     ConnState mConnState = kConnNew;
@@ -271,6 +275,10 @@ protected:
     time_t mTsLastSend = 0;
     bool mPrefsAckWait = false;
     IdRefMap mCurrentPeers;
+    /** Peers added while connected that have not been sent yet. They are sent
+     * together in one ADDPEERS at the end of the event loop turn */
+    std::set<karere::Id> mPendingPeers;
+    bool mPeersFlushPending = false;
     void initWebsocketCtx();
     void setConnState(ConnState newState);
 
@@ -291,6 +299,8 @@ protected:
     void setOnlineConfig(Config Config);
     void pingWithPresence();
     void pushPeers();
+    void flushPendingPeers();
+    void sendAddPeers(const std::vector<uint64_t>& peers);
     void configChanged();
     std::string prefsString() const;
     bool sendKeepalive(time_t now=0);
@@ -31,7 +31,15 @@ void RtcCrypto::mac(const std::string& data, const SdpKey& key, SdpKey& output)
 
 void RtcCrypto::computeSymmetricKey(karere::Id peer, strongvelope::SendKey& output)
 {
-    //No symmetric key cache here, unlike strongvelope
+    static const std::string padString("webrtc pairwise key\x01");
+    // Shared with strongvelope, invalidated when the peer's Cu25519 key changes
+    auto& cache = mClient.userAttrCache().sharedKeys();
+    auto cached = cache.get(peer, padString);
+    if (cached)
+    {
+        output.assign(cached->buf(), cached->dataSize());
+        return;
+    }
     auto pms = mClient.userAttrCache().getAttr(peer, ::mega::MegaApi::USER_ATTR_CU25519_PUBLIC_KEY);
     if (!pms.done())
         throw std::runtime_error("RtcCrypto::computeSymmetricKey: Key not readily available in cache");
@@ -44,7 +52,10 @@ void RtcCrypto::computeSymmetricKey(karere::Id peer, strongvelope::SendKey& outp
     strongvelope::Key<crypto_scalarmult_BYTES> sharedSecret;
     auto ignore = crypto_scalarmult(sharedSecret.ubuf(), (const unsigned char*)mClient.mMyPrivCu25519, pubKey->ubuf());
     (void)ignore;
-    strongvelope::deriveSharedKey(sharedSecret, output, "webrtc pairwise key\x01");
+    auto result = std::make_shared<strongvelope::SendKey>();
+    strongvelope::deriveSharedKey(sharedSecret, *result, padString);
+    cache.put(peer, padString, result);
+    output.assign(result->buf(), result->dataSize());
 }
 
 void RtcCrypto::encryptKeyTo(karere::Id peer, const SdpKey& data, SdpKey& output)
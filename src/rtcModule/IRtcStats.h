@@ -81,7 +81,9 @@ public:
     virtual bool isCaller() const = 0;
     virtual karere::Id callId() const = 0;
     virtual size_t sampleCnt() const = 0;
-    virtual const std::vector<Sample*>* samples() const = 0;
+    /** @brief Copies the sample at \c idx to \c sample. Returns false if
+     * there is no such sample */
+    virtual bool getSample(size_t idx, Sample& sample) const = 0;
     virtual const IConnInfo* connInfo() const = 0;
     virtual void toJson(std::string&) const = 0;
     virtual ~IRtcStats(){}
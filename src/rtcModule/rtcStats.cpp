@@ -2,6 +2,8 @@
 #include "webrtcPrivate.h"
 #include <timers.hpp>
 #include <string.h> //for memset
+#include <inttypes.h>
+#include <algorithm>
 #include <karereCommon.h> //for timestampMs()
 #include <chatClient.h>
 #define RPTYPE(name) webrtc::StatsReport::kStatsReportType##name
@@ -30,7 +32,7 @@ EmptyStats::EmptyStats(const Session& sess, const std::string& aTermRsn)
 
 Recorder::Recorder(Session& sess, int scanPeriod, int maxSamplePeriod)
     :mScanPeriod(scanPeriod * 1000), mMaxSamplePeriod(maxSamplePeriod * 1000),
-    mCurrSample(new Sample), mSession(sess), mStats(new RtcStats)
+    mCurrSample(new Sample), mLastSample(), mSession(sess), mStats(new RtcStats)
 {
     memset(mCurrSample.get(), 0, sizeof(Sample));
     AddRef();
@@ -38,15 +40,20 @@ Recorder::Recorder(Session& sess, int scanPeriod, int maxSamplePeriod)
         mScanPeriod = 1000;
     if (mMaxSamplePeriod < 0)
         mMaxSamplePeriod = 5000;
+    // while the connection is healthy, poll just often enough to add a
+    // sample every mMaxSamplePeriod
+    PollPolicy::Config pollConfig;
+    pollConfig.minPeriodMs = mScanPeriod;
+    pollConfig.maxPeriodMs = std::max(mScanPeriod, mMaxSamplePeriod);
+    mPollPolicy = PollPolicy(pollConfig);
     resetBwCalculators();
 }
 
 void Recorder::addSample()
 {
-    Sample* sample = mCurrSample.release();
-    assert(sample);
-    mStats->mSamples.push_back(sample);
-    mCurrSample.reset(new Sample(*sample));
+    assert(mCurrSample);
+    mStats->mSamples.push(*mCurrSample);
+    mLastSample = *mCurrSample;
     resetBwCalculators();
 }
 void Recorder::resetBwCalculators()
@@ -116,6 +123,12 @@ void Recorder::onStats(const webrtc::StatsReports &data)
     long ts = karere::timestampMs() - mStats->mStartTs;
     long period = ts - mCurrSample->ts;
     mCurrSample->ts = ts;
+    PollPolicy::Health health;
+    health.iceConnected = (mSession.mTsIceConn != 0);
+    health.rtt = health.avgRtt = mCurrSample->cstats.rtt;
+    long prevPl = mCurrSample->astats.pl + mCurrSample->vstats.r.pl;
+    auto prevRxWidth = mCurrSample->vstats.r.width;
+    auto prevTxWidth = mCurrSample->vstats.s.width;
     for (const webrtc::StatsReport* item: data)
     {
         if (item->id()->type() == RPTYPE(Ssrc))
@@ -185,6 +198,7 @@ void Recorder::onStats(const webrtc::StatsReports &data)
                 mStats->mConnInfo.mProto = getStringValue(VALNAME(TransportType), item);
             }
             auto& cstat = mCurrSample->cstats;
+            health.rtt = getLongValue(VALNAME(Rtt), item);
             AVG(Rtt, cstat.rtt);
             mConnRxBwCalc.calculate(period, getLongValue(VALNAME(BytesReceived), item));
             mConnTxBwCalc.calculate(period, getLongValue(VALNAME(BytesSent), item));
@@ -208,7 +222,7 @@ void Recorder::onStats(const webrtc::StatsReports &data)
     }
     else
     {
-        auto& last = *mStats->mSamples.back();
+        auto& last = mLastSample;
         auto d_dly = (mCurrSample->vstats.r.dly - last.vstats.r.dly);
         if (d_dly < 0)
             d_dly = -d_dly;
@@ -245,6 +259,37 @@ void Recorder::onStats(const webrtc::StatsReports &data)
             onSample(&(mStats->mConnInfo), 0);
         onSample(mCurrSample.get(), 1);
     }
+
+    if ((mStats->mTtfm < 0) && (mAudioRxBwCalc.mTotalBytes > 0 || mVideoRxBwCalc.mTotalBytes > 0))
+    {
+        mStats->mTtfm = ts;
+    }
+
+    health.packetsLost = mCurrSample->astats.pl + mCurrSample->vstats.r.pl - prevPl;
+    health.txBps = mCurrSample->cstats.s.bps;
+    health.txAvgBps = mCurrSample->cstats.s.abps;
+    health.rxBps = mCurrSample->cstats.r.bps;
+    health.rxAvgBps = mCurrSample->cstats.r.abps;
+    health.resolutionChanged = (mCurrSample->vstats.r.width != prevRxWidth)
+                            || (mCurrSample->vstats.s.width != prevTxWidth);
+    mPollPolicy.onPoll(health);
+    scheduleNextPoll();
+}
+
+void Recorder::scheduleNextPoll()
+{
+    if (!mRunning || mTimer)
+        return;
+    unsigned delay = mPollPolicy.nextDelay(mSession.call().sessionCount());
+    mTimer = setTimeout([this]()
+    {
+        mTimer = 0;
+        if (!mSession.rtcConn()->GetStats(static_cast<webrtc::StatsObserver*>(this), nullptr, mStatsLevel))
+        {
+            // no OnComplete() will come to schedule the next one
+            scheduleNextPoll();
+        }
+    }, delay, mSession.mManager.mClient.appCtx);
 }
 
 void Recorder::start()
@@ -257,16 +302,24 @@ void Recorder::start()
     mStats->mPeerAnonId = mSession.peerAnonId();
     mStats->mSper = mScanPeriod;
     mStats->mStartTs = karere::timestampMs();
-    mTimer = setInterval([this]()
-    {
-        mSession.rtcConn()->GetStats(static_cast<webrtc::StatsObserver*>(this), nullptr, mStatsLevel);
-    }, mScanPeriod, mSession.mManager.mClient.appCtx);
+    auto& call = mSession.call();
+    if (call.answerTs())
+        mStats->mAnswerMs = mStats->mStartTs - call.answerTs();
+    mStats->mLocalStreamMs = call.localStreamMs();
+    mRunning = true;
+    scheduleNextPoll();
 }
 
 std::string Recorder::terminate(const StatSessInfo& info)
 {
-    cancelInterval(mTimer, mSession.mManager.mClient.appCtx);
-    mTimer = 0;
+    mRunning = false;
+    if (mTimer)
+    {
+        cancelTimeout(mTimer, mSession.mManager.mClient.appCtx);
+        mTimer = 0;
+    }
+    KR_LOG_DEBUG("Stats: %" PRIu64 " polls, %" PRIu64 " of them with an unsteady connection",
+        mPollPolicy.polls(), mPollPolicy.unsteadyPolls());
     mStats->mDur = karere::timestampMs() - mStats->mStartTs;
     mStats->mTermRsn = info.mTermReason;
     mStats->mDeviceInfo = info.deviceInfo;
@@ -275,49 +328,32 @@ std::string Recorder::terminate(const StatSessInfo& info)
     return json;
 }
 
-Recorder::~Recorder()
+void Recorder::onMediaStart()
 {
-    if (mTimer)
-        cancelInterval(mTimer, mSession.mManager.mClient.appCtx);
+    if (mStats->mTtfm < 0)
+        mStats->mTtfm = karere::timestampMs() - mStats->mStartTs;
 }
 
-const char* decToString(float v)
+void Recorder::onSetupStage(SetupStage stage)
 {
-    static char buf[128];
-    snprintf(buf, 127, "%.1f", v);
-    return buf;
+    int64_t& ms = (stage == kStageSdp) ? mStats->mSdpMs : mStats->mIceMs;
+    if (ms < 0)
+        ms = karere::timestampMs() - mStats->mStartTs;
+}
+
+Recorder::~Recorder()
+{
+    if (mTimer)
+        cancelTimeout(mTimer, mSession.mManager.mClient.appCtx);
 }
 
 #define JSON_ADD_STR(name, val) json.append("\"" #name "\":\"").append(val)+="\",";
 #define JSON_ADD_INT(name, val) json.append("\"" #name "\":").append(std::to_string((long)val))+=',';
-#define JSON_ADD_DECNUM(name, val) json.append("\"" #name "\":").append(decToStr(val))+=',';
-
-#define JSON_SUBOBJ(name) json+="\"" name "\":{";
-#define JSON_END_SUBOBJ() json[json.size()-1]='}'; json+=','
-
-#define JSON_ADD_SAMPLES_WITH_CONV(path, name, conv)   \
-    json.append("\"" #name "\":[");    \
-    if (mSamples.empty())              \
-        json+=']';                     \
-    else                               \
-    {                                  \
-        for (auto sample: mSamples)    \
-            json.append(conv(sample->path name))+=","; \
-        json[json.size()-1]=']';       \
-    }\
-    json+=',';
-
-#define JSON_ADD_SAMPLES(path, name) JSON_ADD_SAMPLES_WITH_CONV(path, name, std::to_string)
-#define JSON_ADD_DEC_SAMPLES(path, name) JSON_ADD_SAMPLES_WITH_CONV(path, name, decToString)
 
-#define JSON_ADD_BWINFO(path)           \
-    JSON_ADD_SAMPLES(path., bs);        \
-    JSON_ADD_SAMPLES(path., bps);       \
-    JSON_ADD_SAMPLES(path., abps)
-
-void RtcStats::toJson(std::string& json) const
+void RtcStats::writeJson(const SampleBuffer::ChunkSink& sink, bool deltaEncoded) const
 {
-    json.reserve(10240);
+    std::string json;
+    json.reserve(512);
     json ="{";
     JSON_ADD_STR(cid, mSessionId.toString());
     JSON_ADD_STR(sid, mSessionId.toString());
@@ -327,6 +363,17 @@ void RtcStats::toJson(std::string& json) const
     JSON_ADD_INT(ts, mStartTs);
     JSON_ADD_INT(sper, mSper);
     JSON_ADD_INT(dur, round((float)mDur/1000));
+    if (mTtfm >= 0)
+        JSON_ADD_INT(ttfm, mTtfm);
+    // call setup stages, "ans" + "ttfm" is the answer to media latency
+    if (mAnswerMs >= 0)
+        JSON_ADD_INT(ans, mAnswerMs);
+    if (mLocalStreamMs >= 0)
+        JSON_ADD_INT(lstr, mLocalStreamMs);
+    if (mSdpMs >= 0)
+        JSON_ADD_INT(tsdp, mSdpMs);
+    if (mIceMs >= 0)
+        JSON_ADD_INT(tice, mIceMs);
     JSON_ADD_STR(termRsn, mTermRsn);
     JSON_ADD_STR(bws, mDeviceInfo); //TODO: Add platform info
 
@@ -337,56 +384,19 @@ void RtcStats::toJson(std::string& json) const
     JSON_ADD_STR(ctype, mConnInfo.mCtype);
     JSON_ADD_STR(proto, mConnInfo.mProto);
     JSON_ADD_STR(vcodec, mConnInfo.mVcodec);
-    JSON_SUBOBJ("samples");
-        JSON_ADD_SAMPLES(, ts);
-        JSON_SUBOBJ("c");
-            JSON_ADD_SAMPLES(cstats., rtt);
-                JSON_SUBOBJ("s");
-                    JSON_ADD_BWINFO(cstats.s);
-                JSON_END_SUBOBJ();
-                JSON_SUBOBJ("r");
-                    JSON_ADD_BWINFO(cstats.r);
-                JSON_END_SUBOBJ();
-        JSON_END_SUBOBJ();
-        JSON_SUBOBJ("v");
-            JSON_SUBOBJ("s");
-                JSON_ADD_BWINFO(vstats.s);
-                JSON_ADD_SAMPLES(vstats.s., gbps);
-                JSON_ADD_SAMPLES(vstats.s., gabps);
-                JSON_ADD_SAMPLES(vstats.s., rtt);
-                JSON_ADD_SAMPLES(vstats.s., fps);
-                JSON_ADD_SAMPLES(vstats.s., cfps);
-                JSON_ADD_SAMPLES(vstats.s., cjtr);
-                JSON_ADD_SAMPLES(vstats.s., width);
-                JSON_ADD_SAMPLES(vstats.s., height);
-                JSON_ADD_DEC_SAMPLES(vstats.s., el);
-                JSON_ADD_SAMPLES(vstats.s., lcpu);
-                JSON_ADD_SAMPLES(vstats.s., lbw);
-                JSON_ADD_SAMPLES(vstats.s., bwav);
-            JSON_END_SUBOBJ();
-            JSON_SUBOBJ("r");
-                JSON_ADD_BWINFO(vstats.r);
-                JSON_ADD_SAMPLES(vstats.r., fps);
-                JSON_ADD_SAMPLES(vstats.r., jtr);
-                JSON_ADD_SAMPLES(vstats.r., dly);
-                JSON_ADD_SAMPLES(vstats.r., pl);
-                JSON_ADD_SAMPLES(vstats.r., width);
-                JSON_ADD_SAMPLES(vstats.r., height);
-            JSON_END_SUBOBJ(); //r
-        JSON_END_SUBOBJ(); //v
-        JSON_SUBOBJ("a");
-            JSON_ADD_SAMPLES(astats., rtt);
-            JSON_ADD_SAMPLES(astats., jtr);
-            JSON_ADD_SAMPLES(astats., pl);
-            JSON_SUBOBJ("s");
-                JSON_ADD_BWINFO(astats.s);
-            JSON_END_SUBOBJ();
-            JSON_SUBOBJ("r");
-                JSON_ADD_BWINFO(astats.r);
-            JSON_END_SUBOBJ();
-        JSON_END_SUBOBJ(); //a
-    JSON_END_SUBOBJ(); //samples
-    json[json.size()-1]='}'; //all
+    if (deltaEncoded)
+        JSON_ADD_STR(enc, "delta");
+    sink(json.c_str(), json.size());
+    mSamples.writeJson(sink, deltaEncoded);
+    sink("}", 1);
+}
+
+void RtcStats::toJson(std::string& json) const
+{
+    // the samples are the bulk of it, ~6 bytes per value
+    json.clear();
+    json.reserve(1024 + mSamples.size() * SampleBuffer::kColumnCount * 6);
+    writeJson([&json](const char* data, size_t len) { json.append(data, len); }, false);
 }
 
 void EmptyStats::toJson(std::string& json) const
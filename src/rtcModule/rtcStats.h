@@ -3,6 +3,8 @@
 #include "webrtcAdapter.h"
 #include "IRtcStats.h"
 #include "ITypesImpl.h"
+#include "sampleBuffer.h"
+#include "statsPollPolicy.h"
 #include <timers.hpp>
 #include <karereId.h>
 
@@ -48,19 +50,37 @@ public:
     int mSper; //sample period
     int64_t mStartTs;
     int64_t mDur;
+    /** Time from the start of the session setup to the first received media, in ms, -1 if none */
+    int64_t mTtfm = -1;
+    /** Stages of the call setup, in ms, -1 if not reached: from our answer to the
+     * start of the session setup, getting the local stream, and from the start of
+     * the session setup to the end of the SDP exchange and to ICE connected */
+    int64_t mAnswerMs = -1;
+    int64_t mLocalStreamMs = -1;
+    int64_t mSdpMs = -1;
+    int64_t mIceMs = -1;
     karere::Id mCallId;
     karere::Id mSessionId;
     karere::Id mOwnAnonId;
     karere::Id mPeerAnonId;
     std::string mDeviceInfo;
-    std::vector<Sample*> mSamples;
+    SampleBuffer mSamples;
     ConnInfo mConnInfo;
+    /** @brief Serializes the stats in chunks. The delta encoding of the samples
+     * (see SampleBuffer::writeJson) is flagged with "enc":"delta" */
+    void writeJson(const SampleBuffer::ChunkSink& sink, bool deltaEncoded) const;
     //IRtcStats implementation
     virtual const std::string& termRsn() const { return mTermRsn; }
     virtual bool isCaller() const { return mIsCaller; }
     virtual karere::Id callId() const { return mCallId; }
     virtual size_t sampleCnt() const { return mSamples.size(); }
-    virtual const std::vector<Sample*>* samples() const { return &mSamples; }
+    virtual bool getSample(size_t idx, Sample& sample) const
+    {
+        if (idx >= mSamples.size())
+            return false;
+        mSamples.get(idx, sample);
+        return true;
+    }
     virtual const IConnInfo* connInfo() const { return &mConnInfo; }
     virtual void toJson(std::string& out) const;
 };
@@ -81,7 +101,7 @@ public:
     virtual bool isCaller() const { return mIsCaller; }
     virtual karere::Id callId() const { return mCallId; }
     virtual size_t sampleCnt() const { return 0; }
-    virtual const std::vector<Sample*>* samples() const { return nullptr; }
+    virtual bool getSample(size_t, Sample&) const { return false; }
     virtual const IConnInfo* connInfo() const { return nullptr; }
     virtual void toJson(std::string&) const;
 };
@@ -107,8 +127,12 @@ protected:
     webrtc::PeerConnectionInterface::StatsOutputLevel mStatsLevel =
             webrtc::PeerConnectionInterface::kStatsOutputLevelStandard;
     std::unique_ptr<Sample> mCurrSample;
+    /** The last sample added to mStats, to decide whether to add the next one */
+    Sample mLastSample;
     bool mHasConnInfo = false;
     megaHandle mTimer = 0;
+    bool mRunning = false;
+    PollPolicy mPollPolicy;
     BwCalculator mVideoRxBwCalc;
     BwCalculator mVideoTxBwCalc;
     BwCalculator mAudioRxBwCalc;
@@ -117,6 +141,7 @@ protected:
     BwCalculator mConnTxBwCalc;
     void addSample();
     void resetBwCalculators();
+    void scheduleNextPoll();
     int64_t getLongValue(webrtc::StatsReport::StatsValueName name, const webrtc::StatsReport* item);
     std::string getStringValue(webrtc::StatsReport::StatsValueName name, const webrtc::StatsReport* item);
 public:
@@ -134,6 +159,13 @@ public:
     std::string terminate(const StatSessInfo &info);
     virtual void OnComplete(const webrtc::StatsReports& data);
     void onStats(const webrtc::StatsReports &data);
+    /** @brief Called when the first frame of remote video is rendered. Media
+     * that has no video is detected by the next poll */
+    void onMediaStart();
+    enum SetupStage { kStageSdp, kStageIce };
+    /** @brief Records the time to reach a stage of the session setup, the first time */
+    void onSetupStage(SetupStage stage);
+    const PollPolicy& pollPolicy() const { return mPollPolicy; }
     std::function<void(void*, int)> onSample;
 };
 }
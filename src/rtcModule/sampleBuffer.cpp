@@ -0,0 +1,287 @@
+#include "sampleBuffer.h"
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <limits>
+
+namespace rtcModule
+{
+namespace stats
+{
+// The integer fields of Sample and their columns. kVideoTxEl is handled separately
+#define SAMPLE_INT_COLUMNS(X)                                                       \
+    X(kTs, ts)                                                                      \
+    X(kConnRtt, cstats.rtt)                                                         \
+    X(kConnTxBs, cstats.s.bs) X(kConnTxBps, cstats.s.bps) X(kConnTxAbps, cstats.s.abps) \
+    X(kConnRxBs, cstats.r.bs) X(kConnRxBps, cstats.r.bps) X(kConnRxAbps, cstats.r.abps) \
+    X(kVideoTxBs, vstats.s.bs) X(kVideoTxBps, vstats.s.bps) X(kVideoTxAbps, vstats.s.abps) \
+    X(kVideoTxGbps, vstats.s.gbps) X(kVideoTxGabps, vstats.s.gabps)                \
+    X(kVideoTxRtt, vstats.s.rtt) X(kVideoTxFps, vstats.s.fps)                       \
+    X(kVideoTxCfps, vstats.s.cfps) X(kVideoTxCjtr, vstats.s.cjtr)                   \
+    X(kVideoTxWidth, vstats.s.width) X(kVideoTxHeight, vstats.s.height)             \
+    X(kVideoTxLcpu, vstats.s.lcpu) X(kVideoTxLbw, vstats.s.lbw)                     \
+    X(kVideoTxBwav, vstats.s.bwav)                                                  \
+    X(kVideoRxBs, vstats.r.bs) X(kVideoRxBps, vstats.r.bps) X(kVideoRxAbps, vstats.r.abps) \
+    X(kVideoRxFps, vstats.r.fps) X(kVideoRxJtr, vstats.r.jtr)                       \
+    X(kVideoRxDly, vstats.r.dly) X(kVideoRxPl, vstats.r.pl)                         \
+    X(kVideoRxWidth, vstats.r.width) X(kVideoRxHeight, vstats.r.height)             \
+    X(kAudioRtt, astats.rtt) X(kAudioJtr, astats.jtr) X(kAudioPl, astats.pl)        \
+    X(kAudioTxBs, astats.s.bs) X(kAudioTxBps, astats.s.bps) X(kAudioTxAbps, astats.s.abps) \
+    X(kAudioRxBs, astats.r.bs) X(kAudioRxBps, astats.r.bps) X(kAudioRxAbps, astats.r.abps)
+
+static inline int32_t clamp32(int64_t val)
+{
+    if (val > std::numeric_limits<int32_t>::max())
+        return std::numeric_limits<int32_t>::max();
+    if (val < std::numeric_limits<int32_t>::min())
+        return std::numeric_limits<int32_t>::min();
+    return (int32_t)val;
+}
+
+static inline bool isSumColumn(unsigned col)
+{
+    switch (col)
+    {
+        case SampleBuffer::kConnTxBs: case SampleBuffer::kConnRxBs:
+        case SampleBuffer::kVideoTxBs: case SampleBuffer::kVideoRxBs:
+        case SampleBuffer::kAudioTxBs: case SampleBuffer::kAudioRxBs:
+        case SampleBuffer::kSpan:
+            return true;
+        default:
+            return false;
+    }
+}
+
+SampleBuffer::SampleBuffer(size_t capacity)
+: mData(kColumnCount * (capacity < 4 ? 4 : capacity)), mCapacity(capacity < 4 ? 4 : capacity)
+{}
+
+void SampleBuffer::push(const Sample& sample)
+{
+    if (mCount == mCapacity)
+        downsample();
+    assert(mCount < mCapacity);
+#define PUSH_COLUMN(col, field) column(col)[mCount] = clamp32(sample.field);
+    SAMPLE_INT_COLUMNS(PUSH_COLUMN)
+#undef PUSH_COLUMN
+    column(kVideoTxEl)[mCount] = clamp32(lround(sample.vstats.s.el * 10));
+    column(kSpan)[mCount] = 1;
+    mCount++;
+}
+
+void SampleBuffer::get(size_t idx, Sample& sample) const
+{
+    assert(idx < mCount);
+    sample = Sample();
+#define GET_COLUMN(col, field) sample.field = column(col)[idx];
+    SAMPLE_INT_COLUMNS(GET_COLUMN)
+#undef GET_COLUMN
+    sample.vstats.s.el = column(kVideoTxEl)[idx] / 10.0f;
+}
+
+void SampleBuffer::downsample()
+{
+    // Frees a quarter of the buffer. The newest quarter is kept as it is, and
+    // in the rest, the finest samples are merged first. If the finest level
+    // has a single sample, it's merged with its finer neighbour.
+    size_t target = mCapacity / 4;
+    size_t end = mCount - target;
+    size_t freed = 0;
+    while (freed < target)
+    {
+        const int32_t* span = column(kSpan);
+        int32_t level = span[0];
+        for (size_t i = 1; i < end; i++)
+        {
+            if (span[i] < level)
+                level = span[i];
+        }
+        mMerges.clear();
+        for (size_t i = 0; (i + 1 < end) && (freed + mMerges.size() < target); )
+        {
+            if (span[i] == level && span[i+1] == level)
+            {
+                mMerges.push_back(i);
+                i += 2;
+            }
+            else
+            {
+                i++;
+            }
+        }
+        if (mMerges.empty())
+        {
+            size_t i = 0;
+            while (span[i] != level)
+                i++;
+            if (i + 1 >= end || (i > 0 && span[i-1] <= span[i+1]))
+                i--;
+            mMerges.push_back(i);
+        }
+        applyMerges();
+        end -= mMerges.size();
+        freed += mMerges.size();
+    }
+    mDownsampleCount++;
+}
+
+void SampleBuffer::applyMerges()
+{
+    for (unsigned col = 0; col < kColumnCount; col++)
+    {
+        int32_t* data = column(col);
+        bool sum = isSumColumn(col);
+        size_t out = mMerges[0];
+        size_t next = 0;
+        for (size_t i = mMerges[0]; i < mCount; i++)
+        {
+            if (next < mMerges.size() && mMerges[next] == i)
+            {
+                int32_t newer = data[i+1];
+                data[out++] = sum ? clamp32((int64_t)data[i] + newer) : newer;
+                next++;
+                i++;
+            }
+            else
+            {
+                data[out++] = data[i];
+            }
+        }
+    }
+    mCount -= mMerges.size();
+}
+
+namespace
+{
+class ChunkWriter
+{
+protected:
+    const SampleBuffer::ChunkSink& mSink;
+    char mBuf[SampleBuffer::kChunkSize];
+    size_t mLen = 0;
+public:
+    ChunkWriter(const SampleBuffer::ChunkSink& sink): mSink(sink) {}
+    ~ChunkWriter() { flush(); }
+    void flush()
+    {
+        if (!mLen)
+            return;
+        mSink(mBuf, mLen);
+        mLen = 0;
+    }
+    void append(const char* str, size_t len)
+    {
+        if (mLen + len > sizeof(mBuf))
+        {
+            flush();
+            if (len > sizeof(mBuf))
+            {
+                mSink(str, len);
+                return;
+            }
+        }
+        memcpy(mBuf + mLen, str, len);
+        mLen += len;
+    }
+    void append(const char* str) { append(str, strlen(str)); }
+    void append(char ch)
+    {
+        if (mLen == sizeof(mBuf))
+            flush();
+        mBuf[mLen++] = ch;
+    }
+    /** Writes \c val, with a decimal point before the last \c decimals digits */
+    void appendInt(int64_t val, unsigned decimals = 0)
+    {
+        char buf[24];
+        char* end = buf + sizeof(buf);
+        char* pos = end;
+        bool neg = val < 0;
+        uint64_t uval = neg ? (0 - (uint64_t)val) : (uint64_t)val;
+        unsigned digits = 0;
+        do
+        {
+            *--pos = '0' + (uval % 10);
+            uval /= 10;
+            if (++digits == decimals)
+                *--pos = '.';
+        } while (uval || digits <= decimals);
+        if (neg)
+            *--pos = '-';
+        append(pos, end - pos);
+    }
+};
+}
+
+void SampleBuffer::writeJson(const ChunkSink& sink, bool deltaEncoded) const
+{
+    ChunkWriter out(sink);
+    auto writeColumn = [this, &out, deltaEncoded](const char* name, unsigned col, bool last)
+    {
+        const int32_t* data = column(col);
+        unsigned decimals = (col == kVideoTxEl) ? 1 : 0;
+        out.append('"');
+        out.append(name);
+        out.append("\":[");
+        int64_t prev = 0;
+        for (size_t i = 0; i < mCount; i++)
+        {
+            if (i)
+                out.append(',');
+            out.appendInt(deltaEncoded ? (int64_t)data[i] - prev : data[i], decimals);
+            prev = data[i];
+        }
+        out.append(last ? "]" : "],");
+    };
+    auto writeBwInfo = [&writeColumn](unsigned bs, bool last)
+    {
+        writeColumn("bs", bs, false);
+        writeColumn("bps", bs + 1, false);
+        writeColumn("abps", bs + 2, last);
+    };
+    out.append("\"samples\":{");
+    writeColumn("ts", kTs, false);
+    out.append("\"c\":{");
+        writeColumn("rtt", kConnRtt, false);
+        out.append("\"s\":{");
+        writeBwInfo(kConnTxBs, true);
+        out.append("},\"r\":{");
+        writeBwInfo(kConnRxBs, true);
+        out.append("}");
+    out.append("},\"v\":{");
+        out.append("\"s\":{");
+        writeBwInfo(kVideoTxBs, false);
+        writeColumn("gbps", kVideoTxGbps, false);
+        writeColumn("gabps", kVideoTxGabps, false);
+        writeColumn("rtt", kVideoTxRtt, false);
+        writeColumn("fps", kVideoTxFps, false);
+        writeColumn("cfps", kVideoTxCfps, false);
+        writeColumn("cjtr", kVideoTxCjtr, false);
+        writeColumn("width", kVideoTxWidth, false);
+        writeColumn("height", kVideoTxHeight, false);
+        writeColumn("el", kVideoTxEl, false);
+        writeColumn("lcpu", kVideoTxLcpu, false);
+        writeColumn("lbw", kVideoTxLbw, false);
+        writeColumn("bwav", kVideoTxBwav, true);
+        out.append("},\"r\":{");
+        writeBwInfo(kVideoRxBs, false);
+        writeColumn("fps", kVideoRxFps, false);
+        writeColumn("jtr", kVideoRxJtr, false);
+        writeColumn("dly", kVideoRxDly, false);
+        writeColumn("pl", kVideoRxPl, false);
+        writeColumn("width", kVideoRxWidth, false);
+        writeColumn("height", kVideoRxHeight, true);
+        out.append("}");
+    out.append("},\"a\":{");
+        writeColumn("rtt", kAudioRtt, false);
+        writeColumn("jtr", kAudioJtr, false);
+        writeColumn("pl", kAudioPl, false);
+        out.append("\"s\":{");
+        writeBwInfo(kAudioTxBs, true);
+        out.append("},\"r\":{");
+        writeBwInfo(kAudioRxBs, true);
+        out.append("}");
+    out.append("}}");
+}
+}
+}
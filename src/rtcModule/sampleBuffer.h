@@ -0,0 +1,76 @@
+#ifndef RTC_SAMPLEBUFFER_H
+#define RTC_SAMPLEBUFFER_H
+/**
+ * @file sampleBuffer.h
+ * @brief Bounded, columnar storage of the call stats samples of a session.
+ *
+ * Each field of \c Sample that is uploaded is a column of 32-bit integers, and
+ * all columns are allocated once, for a fixed number of samples. When the
+ * buffer is full, old samples are downsampled by merging adjacent pairs that
+ * cover the same number of original samples, finest first, so a long call
+ * keeps its whole timeline, at a resolution that decreases with age, instead
+ * of growing without bounds. Byte counts are summed by the merge, the rest of
+ * the fields keep the value of the newer sample.
+ */
+#include "IRtcStats.h"
+#include <functional>
+#include <vector>
+
+namespace rtcModule
+{
+namespace stats
+{
+class SampleBuffer
+{
+public:
+    enum Column
+    {
+        kTs,
+        kConnRtt, kConnTxBs, kConnTxBps, kConnTxAbps, kConnRxBs, kConnRxBps, kConnRxAbps,
+        kVideoTxBs, kVideoTxBps, kVideoTxAbps, kVideoTxGbps, kVideoTxGabps, kVideoTxRtt,
+        kVideoTxFps, kVideoTxCfps, kVideoTxCjtr, kVideoTxWidth, kVideoTxHeight,
+        kVideoTxEl, // in tenths, the only non-integer field
+        kVideoTxLcpu, kVideoTxLbw, kVideoTxBwav,
+        kVideoRxBs, kVideoRxBps, kVideoRxAbps, kVideoRxFps, kVideoRxJtr, kVideoRxDly,
+        kVideoRxPl, kVideoRxWidth, kVideoRxHeight,
+        kAudioRtt, kAudioJtr, kAudioPl,
+        kAudioTxBs, kAudioTxBps, kAudioTxAbps, kAudioRxBs, kAudioRxBps, kAudioRxAbps,
+        kSpan, // number of original samples merged into the sample, not uploaded
+        kColumnCount
+    };
+    /** At least 85 minutes of samples at the default max sample period of 5s, 168KB */
+    enum { kDefaultCapacity = 1024 };
+    /** Receives the serialized JSON in chunks of up to \c kChunkSize bytes */
+    typedef std::function<void(const char* data, size_t len)> ChunkSink;
+    enum { kChunkSize = 4096 };
+
+protected:
+    std::vector<int32_t> mData; // column-major, kColumnCount x mCapacity
+    size_t mCapacity;
+    size_t mCount = 0;
+    unsigned mDownsampleCount = 0;
+    std::vector<size_t> mMerges; // the pairs merged by a downsample pass, by their first index
+    int32_t* column(unsigned col) { return &mData[col * mCapacity]; }
+    const int32_t* column(unsigned col) const { return &mData[col * mCapacity]; }
+    void downsample();
+    void applyMerges();
+public:
+    SampleBuffer(size_t capacity = kDefaultCapacity);
+    void push(const Sample& sample);
+    size_t size() const { return mCount; }
+    bool empty() const { return mCount == 0; }
+    size_t capacity() const { return mCapacity; }
+    /** Number of times that the buffer was full and samples were merged */
+    unsigned downsampleCount() const { return mDownsampleCount; }
+    int32_t value(unsigned col, size_t idx) const { return column(col)[idx]; }
+    /** @brief Fills \c sample with the sample at \c idx. The fields that are
+     * not uploaded are zeroed */
+    void get(size_t idx, Sample& sample) const;
+    /** @brief Writes the samples as the "samples" JSON object of the stats,
+     * one array per field. If \c deltaEncoded is true, each array holds its
+     * first value followed by the differences between consecutive values */
+    void writeJson(const ChunkSink& sink, bool deltaEncoded) const;
+};
+}
+}
+#endif
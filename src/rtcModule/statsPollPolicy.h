@@ -0,0 +1,97 @@
+#ifndef RTC_STATSPOLLPOLICY_H
+#define RTC_STATSPOLLPOLICY_H
+/**
+ * @file statsPollPolicy.h
+ * @brief Adaptive period of the GetStats polls of a session.
+ *
+ * While the connection is healthy, the period doubles after every poll up to
+ * \c maxPeriodMs. Packet loss, an RTT spike, a bitrate swing or a resolution
+ * change bring it back to the minimum, as does ICE not being connected. The
+ * minimum is stretched so that all the sessions of a call together don't poll
+ * more often than once every \c callPollIntervalMs.
+ */
+#include <stdint.h>
+
+namespace rtcModule
+{
+namespace stats
+{
+class PollPolicy
+{
+public:
+    struct Config
+    {
+        unsigned minPeriodMs = 1000;
+        unsigned maxPeriodMs = 8000;
+        /** Minimum interval between polls of any of the sessions of a call */
+        unsigned callPollIntervalMs = 250;
+    };
+    /** What a poll found, compared to the previous one */
+    struct Health
+    {
+        bool iceConnected = false;
+        /** Packets lost since the previous poll, audio and video */
+        long packetsLost = 0;
+        /** Current RTT of the connection, and its moving average */
+        long rtt = 0;
+        long avgRtt = 0;
+        /** Current send and receive bitrates, and their moving averages */
+        long txBps = 0, txAvgBps = 0;
+        long rxBps = 0, rxAvgBps = 0;
+        bool resolutionChanged = false;
+    };
+    enum { kRttSpikeMs = 50 };
+
+protected:
+    Config mConfig;
+    unsigned mPeriod;
+    uint64_t mPolls = 0;
+    uint64_t mUnsteadyPolls = 0;
+    static bool swings(long bps, long avgBps)
+    {
+        // more than 25% away from the average, ignoring very low rates
+        long diff = (bps > avgBps) ? (bps - avgBps) : (avgBps - bps);
+        return (avgBps > 16) && (diff * 4 > avgBps);
+    }
+
+public:
+    PollPolicy(): mPeriod(mConfig.minPeriodMs) {}
+    PollPolicy(const Config& config)
+    : mConfig(config), mPeriod(config.minPeriodMs) {}
+    static bool isSteady(const Health& health)
+    {
+        return health.iceConnected
+            && (health.packetsLost <= 0)
+            && (health.rtt <= health.avgRtt + health.avgRtt / 2 + kRttSpikeMs)
+            && !swings(health.txBps, health.txAvgBps)
+            && !swings(health.rxBps, health.rxAvgBps)
+            && !health.resolutionChanged;
+    }
+    /** @brief Updates the period with the result of a poll */
+    void onPoll(const Health& health)
+    {
+        mPolls++;
+        if (isSteady(health))
+        {
+            mPeriod = (mPeriod * 2 < mConfig.maxPeriodMs) ? mPeriod * 2 : mConfig.maxPeriodMs;
+        }
+        else
+        {
+            mUnsteadyPolls++;
+            mPeriod = mConfig.minPeriodMs;
+        }
+    }
+    /** @brief Delay until the next poll, for a call with \c sessionCount sessions */
+    unsigned nextDelay(unsigned sessionCount) const
+    {
+        unsigned callMin = mConfig.callPollIntervalMs * (sessionCount ? sessionCount : 1);
+        return (mPeriod > callMin) ? mPeriod : callMin;
+    }
+    unsigned period() const { return mPeriod; }
+    uint64_t polls() const { return mPolls; }
+    uint64_t unsteadyPolls() const { return mUnsteadyPolls; }
+    const Config& config() const { return mConfig; }
+};
+}
+}
+#endif
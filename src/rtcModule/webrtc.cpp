@@ -325,6 +325,7 @@ void RtcModule::handleCallData(Chat &chat, Id chatid, Id userid, uint32_t client
     sendCommand(chat, OP_RTMSG_ENDPOINT, RTCMD_CALL_RINGING, chatid, userid, clientid, callid);
     if (!answerAutomatic)
     {
+        prewarm(avFlagsRemote);
         auto wcall = call->weakHandle();
         setTimeout([wcall]() mutable
         {
@@ -374,9 +375,14 @@ void RtcModule::removeCall(Call& call)
         return;
     }
     mCalls.erase(chatid);
+    for (auto& item: mCalls)
+    {
+        if (item.second->state() == Call::kStateRingIn)
+            return; // still ringing, keep the pre-warmed sources
+    }
+    releasePrewarm();
 }
-std::shared_ptr<artc::LocalStreamHandle>
-RtcModule::getLocalStream(AvFlags av, std::string& errors)
+void RtcModule::openInputDevices(std::string& errors)
 {
     const auto& devices = mDeviceManager.inputDevices();
     if (devices.video.empty() || mVideoInDeviceName.empty())
@@ -427,16 +433,66 @@ RtcModule::getLocalStream(AvFlags av, std::string& errors)
         errors.append("Error getting audio device: ")
               .append(e.what()?e.what():"Unknown error")+='\n';
     }
+}
+
+std::shared_ptr<artc::LocalStreamHandle>
+RtcModule::getLocalStream(AvFlags av, std::string& errors)
+{
+    openInputDevices(errors);
     if (!mAudioInput && !mVideoInput)
+    {
+        releasePrewarm();
         return std::make_shared<artc::LocalStreamHandle>(nullptr, nullptr);
+    }
 
+    // if the sources were pre-warmed, the new tracks just reuse them
     std::shared_ptr<artc::LocalStreamHandle> localStream =
         std::make_shared<artc::LocalStreamHandle>(
             mAudioInput?mAudioInput.getTrack():nullptr,
             mVideoInput?mVideoInput.getTrack():nullptr);
     localStream->setAv(av);
+    releasePrewarm();
     return localStream;
 }
+
+void RtcModule::setCallPrewarm(bool enable, bool video)
+{
+    mPrewarm = enable;
+    mPrewarmVideo = enable && video;
+    if (!mPrewarmVideo)
+        mPrewarmVideoTrack.reset();
+    if (!mPrewarm)
+        releasePrewarm();
+}
+
+void RtcModule::prewarm(AvFlags av)
+{
+    if (!mPrewarm)
+        return;
+    auto start = karere::timestampMs();
+    std::string errors;
+    openInputDevices(errors);
+    if (!errors.empty())
+    {
+        RTCM_LOG_WARNING("prewarm: %s", errors.c_str());
+    }
+    if (mAudioInput && !mPrewarmAudioTrack)
+    {
+        mPrewarmAudioTrack = mAudioInput.getTrack();
+    }
+    if (mPrewarmVideo && av.video() && mVideoInput && !mPrewarmVideoTrack)
+    {
+        mPrewarmVideoTrack = mVideoInput.getTrack();
+    }
+    RTCM_LOG_DEBUG("prewarm: capture sources ready in %ld ms (audio: %d, video: %d)",
+        (long)(karere::timestampMs() - start), !!mPrewarmAudioTrack, !!mPrewarmVideoTrack);
+}
+
+void RtcModule::releasePrewarm()
+{
+    mPrewarmAudioTrack.reset();
+    mPrewarmVideoTrack.reset();
+}
 void RtcModule::getAudioInDevices(std::vector<std::string>& devices) const
 {
     for (auto& dev:mDeviceManager.inputDevices().audio)
@@ -683,7 +739,9 @@ void Call::setState(uint8_t newState)
 void Call::getLocalStream(AvFlags av, std::string& errors)
 {
     // getLocalStream currently never fails - if there is error, stream is a string with the error message
+    auto start = karere::timestampMs();
     mLocalStream = mManager.getLocalStream(av, errors);
+    mLocalStreamMs = karere::timestampMs() - start;
     if (!errors.empty())
     {
         SUB_LOG_WARNING("There were some errors getting local stream: %s", errors.c_str());
@@ -1317,13 +1375,13 @@ bool Call::join(Id userid)
 {
     assert(mState == Call::kStateHasLocalStream);
     // JOIN:
-    // chatid.8 userid.8 clientid.4 dataLen.2 type.1 callid.8 anonId.8
+    // chatid.8 userid.8 clientid.4 dataLen.2 type.1 callid.8 anonId.8 caps.1
     // if userid is not specified, join all clients in the chat, otherwise
     // join a specific user (used when a session gets broken)
     setState(Call::kStateJoining);
     bool sent = userid
-            ? cmd(RTCMD_JOIN, userid, 0, mId, mManager.mOwnAnonId)
-            : cmdBroadcast(RTCMD_JOIN, mId, mManager.mOwnAnonId);
+            ? cmd(RTCMD_JOIN, userid, 0, mId, mManager.mOwnAnonId, RtcModule::kOwnCaps)
+            : cmdBroadcast(RTCMD_JOIN, mId, mManager.mOwnAnonId, RtcModule::kOwnCaps);
     if (!sent)
     {
         asyncDestroy(TermCode::kErrNetSignalling, true);
@@ -1349,10 +1407,10 @@ bool Call::rejoin(karere::Id userid)
 {
     assert(mState == Call::kStateInProgress);
     // JOIN:
-    // chatid.8 userid.8 clientid.4 dataLen.2 type.1 callid.8 anonId.8
+    // chatid.8 userid.8 clientid.4 dataLen.2 type.1 callid.8 anonId.8 caps.1
     // if userid is not specified, join all clients in the chat, otherwise
     // join a specific user (used when a session gets broken)
-    bool sent = cmd(RTCMD_JOIN, userid, 0, mId, mManager.mOwnAnonId);
+    bool sent = cmd(RTCMD_JOIN, userid, 0, mId, mManager.mOwnAnonId, RtcModule::kOwnCaps);
     if (!sent)
     {
         asyncDestroy(TermCode::kErrNetSignalling, true);
@@ -1487,6 +1545,7 @@ bool Call::answer(AvFlags av)
         return false;
     }
     assert(mIsJoiner);
+    mTsAnswer = karere::timestampMs();
     return startOrJoin(av);
 }
 
@@ -1697,6 +1756,9 @@ AvFlags Call::sentAv() const
     C: send SDP_ANSWER sid.8 fprHash.32 avflags.1 sdpLen.2 sdpAnswer.sdpLen
         => state: SessState.kWaitMedia
     A and C: exchange ICE_CANDIDATE sid.8 midLen.1 mid.midLen mLineIdx.1 candLen.2 iceCand.candLen
+        or, if the peer has kCapIceBatch in the caps.1 that follows JOIN and SESSION,
+        ICE_CANDIDATES sid.8 count.1 (mLineIdx.1 midLen.1 mid.midLen candLen.2 iceCand.candLen)*count
+        with the candidates gathered within kIceBatchWindow
     A or C: may send MUTE sid.8 avState.1 (if user mutes/unmutes audio/video).
         Webrtc does not have an in-band notification of stream muting
         (needed to update the GUI), so we do it out-of-band
@@ -1724,15 +1786,17 @@ Session::Session(Call& call, RtMessage& packet)
     if (packet.type == RTCMD_JOIN)
     {
         // peer will send offer
-        // JOIN callid.8 anonId.8
+        // JOIN callid.8 anonId.8 [caps.1]
         mIsJoiner = false;
         mSid = call.mManager.random<uint64_t>();
         setState(kStateWaitSdpOffer);
         mPeerAnonId = packet.payload.read<uint64_t>(8);
+        if (packet.payload.dataSize() > 16)
+            mPeerCaps = packet.payload.read<uint8_t>(16);
     }
     else
     {
-        // SESSION callid.8 sid.8 anonId.8 encHashKey.32
+        // SESSION callid.8 sid.8 anonId.8 encHashKey.32 actualCallId.8 [caps.1]
         assert(packet.type == RTCMD_SESSION);
         mIsJoiner = true;
         mSid = packet.payload.read<uint64_t>(8);
@@ -1742,6 +1806,8 @@ Session::Session(Call& call, RtMessage& packet)
         SdpKey encKey;
         packet.payload.read(24, encKey);
         call.mManager.crypto().decryptKeyFrom(mPeer, encKey, mPeerSdpKey);
+        if (packet.payload.dataSize() > 64)
+            mPeerCaps = packet.payload.read<uint8_t>(64);
     }
 
     mName = "sess[" + mSid.toString() + "]";
@@ -1759,13 +1825,14 @@ void Session::sendCmdSession(RtMessage& joinPacket)
 {
     SdpKey encKey;
     mCall.mManager.crypto().encryptKeyTo(mPeer, mOwnSdpKey, encKey);
-    // SESSION callid.8 sid.8 anonId.8 encHashKey.32
+    // SESSION callid.8 sid.8 anonId.8 encHashKey.32 actualCallId.8 caps.1
    mCall.mManager.cmdEndpoint(RTCMD_SESSION, joinPacket,
         joinPacket.callid,
         mSid,
         mCall.mManager.mOwnAnonId,
         encKey,
-        mCall.id()
+        mCall.id(),
+        RtcModule::kOwnCaps
     );
 }
 
@@ -1847,6 +1914,9 @@ void Session::handleMessage(RtMessage& packet)
         case RTCMD_ICE_CANDIDATE:
             msgIceCandidate(packet);
             return;
+        case RTCMD_ICE_CANDIDATES:
+            msgIceCandidates(packet);
+            return;
         case RTCMD_SESS_TERMINATE:
             msgSessTerminate(packet);
             return;
@@ -1893,6 +1963,8 @@ void Session::onAddStream(artc::tspMediaStream stream)
     mRemotePlayer.reset(new artc::StreamPlayer(renderer, mManager.mClient.appCtx));
     mRemotePlayer->setOnMediaStart([this]()
     {
+        if (mStatRecorder)
+            mStatRecorder->onMediaStart();
         FIRE_EVENT(SESS, onVideoRecv);
     });
     mRemotePlayer->attachToStream(stream);
@@ -1916,15 +1988,41 @@ void Session::onRemoveStream(artc::tspMediaStream stream)
 
 void Session::onIceCandidate(std::shared_ptr<artc::IceCandText> cand)
 {
-    // mLineIdx.1 midLen.1 mid.midLen candLen.2 cand.candLen
     if (!cand)
         return;
-    
+
+    if (!(mPeerCaps & kCapIceBatch))
+    {
+        sendIceCandidate(*cand);
+        return;
+    }
+    // Candidates are gathered in bursts, send each burst in one message
+    mIceCandBatch.push_back(cand);
+    if (mIceCandBatch.size() >= 0xff)
+    {
+        flushIceCandidates();
+        return;
+    }
+    if (mIceBatchTimer)
+        return;
+    auto wptr = weakHandle();
+    mIceBatchTimer = setTimeout([wptr, this]()
+    {
+        if (wptr.deleted())
+            return;
+        mIceBatchTimer = 0;
+        flushIceCandidates();
+    }, RtcModule::kIceBatchWindow, mManager.mClient.appCtx);
+}
+
+void Session::sendIceCandidate(const artc::IceCandText& cand)
+{
+    // mLineIdx.1 midLen.1 mid.midLen candLen.2 cand.candLen
     RtMessageComposer msg(OP_RTMSG_ENDPOINT, RTCMD_ICE_CANDIDATE,
-        mCall.mChat.chatId(), mPeer, mPeerClient, 10+cand->candidate.size());
+        mCall.mChat.chatId(), mPeer, mPeerClient, 10+cand.candidate.size());
     msg.payloadAppend(mSid);
-    msg.payloadAppend(static_cast<uint8_t>(cand->sdpMLineIndex));
-    auto& mid = cand->sdpMid;
+    msg.payloadAppend(static_cast<uint8_t>(cand.sdpMLineIndex));
+    auto& mid = cand.sdpMid;
     if (!mid.empty())
     {
         msg.payloadAppend(static_cast<uint8_t>(mid.size()), mid);
@@ -1933,8 +2031,45 @@ void Session::onIceCandidate(std::shared_ptr<artc::IceCandText> cand)
     {
         msg.payloadAppend(static_cast<uint8_t>(0));
     }
-    msg.payloadAppend(static_cast<uint16_t>(cand->candidate.size()),
-        cand->candidate);
+    msg.payloadAppend(static_cast<uint16_t>(cand.candidate.size()),
+        cand.candidate);
+    mCall.mChat.sendCommand(std::move(msg));
+}
+
+void Session::flushIceCandidates()
+{
+    if (mIceBatchTimer)
+    {
+        cancelTimeout(mIceBatchTimer, mManager.mClient.appCtx);
+        mIceBatchTimer = 0;
+    }
+    if (mIceCandBatch.empty())
+        return;
+    if (mIceCandBatch.size() == 1)
+    {
+        sendIceCandidate(*mIceCandBatch[0]);
+        mIceCandBatch.clear();
+        return;
+    }
+    // sid.8 count.1 (mLineIdx.1 midLen.1 mid.midLen candLen.2 cand.candLen)*count
+    size_t len = 9;
+    for (auto& cand: mIceCandBatch)
+        len += 4 + cand->sdpMid.size() + cand->candidate.size();
+    RtMessageComposer msg(OP_RTMSG_ENDPOINT, RTCMD_ICE_CANDIDATES,
+        mCall.mChat.chatId(), mPeer, mPeerClient, len);
+    msg.payloadAppend(mSid, static_cast<uint8_t>(mIceCandBatch.size()));
+    for (auto& cand: mIceCandBatch)
+    {
+        msg.payloadAppend(static_cast<uint8_t>(cand->sdpMLineIndex));
+        msg.payloadAppend(static_cast<uint8_t>(cand->sdpMid.size()));
+        if (!cand->sdpMid.empty())
+        {
+            msg.payloadAppend(cand->sdpMid);
+        }
+        msg.payloadAppend(static_cast<uint16_t>(cand->candidate.size()), cand->candidate);
+    }
+    SUB_LOG_DEBUG("Sending %zu ICE candidates in one message", mIceCandBatch.size());
+    mIceCandBatch.clear();
     mCall.mChat.sendCommand(std::move(msg));
 }
 
@@ -1962,6 +2097,8 @@ void Session::onIceConnectionChange(webrtc::PeerConnectionInterface::IceConnecti
     else if (state == webrtc::PeerConnectionInterface::kIceConnectionConnected)
     {
         mTsIceConn = time(NULL);
+        if (mStatRecorder)
+            mStatRecorder->onSetupStage(stats::Recorder::kStageIce);
         mCall.notifySessionConnected(*this);
     }
 }
@@ -1969,6 +2106,8 @@ void Session::onIceConnectionChange(webrtc::PeerConnectionInterface::IceConnecti
 void Session::onIceComplete()
 {
     SUB_LOG_DEBUG("onIceComplete");
+    // no more candidates will come, don't wait for the batch window
+    flushIceCandidates();
 }
 void Session::onSignalingChange(webrtc::PeerConnectionInterface::SignalingState newState)
 {
@@ -2100,6 +2239,8 @@ void Session::msgSdpOfferSendAnswer(RtMessage& packet)
             static_cast<uint16_t>(mOwnSdp.size()),
             mOwnSdp
         );
+        if (mStatRecorder)
+            mStatRecorder->onSetupStage(stats::Recorder::kStageSdp);
     })
     .fail([wptr, this](const promise::Error& err)
     {
@@ -2149,6 +2290,8 @@ void Session::msgSdpAnswer(RtMessage& packet)
     {
         if (mState > Session::kStateInProgress)
             return promise::Error("Session killed");
+        if (mStatRecorder)
+            mStatRecorder->onSetupStage(stats::Recorder::kStageSdp);
         setState(Session::kStateInProgress);
         return promise::_Void();
     })
@@ -2292,6 +2435,13 @@ void Session::destroy(TermCode code, const std::string& msg)
 
     submitStats(code, msg);
 
+    if (mIceBatchTimer)
+    {
+        cancelTimeout(mIceBatchTimer, mManager.mClient.appCtx);
+        mIceBatchTimer = 0;
+    }
+    mIceCandBatch.clear();
+
     if (mRtcConn)
     {
         if (mRtcConn->signaling_state() != webrtc::PeerConnectionInterface::kClosed)
@@ -2363,7 +2513,45 @@ void Session::msgIceCandidate(RtMessage& packet)
     assert((int) packet.payload.dataSize() >= 12 + midLen + candLen);
     std::string strCand;
     packet.payload.read(midLen + 12, candLen, strCand);
+    addIceCandidate(mid, mLineIdx, strCand);
+}
 
+void Session::msgIceCandidates(RtMessage& packet)
+{
+    assert(!mPeerSdp.empty());
+    // sid.8 count.1 (mLineIdx.1 midLen.1 mid.midLen candLen.2 cand.candLen)*count
+    auto& data = packet.payload;
+    auto count = data.read<uint8_t>(8);
+    size_t offs = 9;
+    std::string mid;
+    std::string strCand;
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (offs + 4 > data.dataSize())
+            throw runtime_error("Invalid ice candidates packet: truncated at candidate "+std::to_string(i));
+        auto mLineIdx = data.read<uint8_t>(offs);
+        auto midLen = data.read<uint8_t>(offs + 1);
+        if (offs + 4 + midLen > data.dataSize())
+            throw runtime_error("Invalid ice candidates packet: midLen spans beyond data length");
+        mid.clear();
+        if (midLen)
+        {
+            data.read(offs + 2, midLen, mid);
+        }
+        auto candLen = data.read<uint16_t>(offs + 2 + midLen);
+        offs += 4 + midLen;
+        if (offs + candLen > data.dataSize())
+            throw runtime_error("Invalid ice candidates packet: candLen spans beyond data length");
+        strCand.clear();
+        data.read(offs, candLen, strCand);
+        offs += candLen;
+        if (!addIceCandidate(mid, mLineIdx, strCand))
+            return;
+    }
+}
+
+bool Session::addIceCandidate(const std::string& mid, uint8_t mLineIdx, const std::string& strCand)
+{
     webrtc::SdpParseError err;
     std::unique_ptr<webrtc::IceCandidateInterface> cand(webrtc::CreateIceCandidate(mid, mLineIdx, strCand, &err));
     if (!cand)
@@ -2378,7 +2566,9 @@ void Session::msgIceCandidate(RtMessage& packet)
     if (!mRtcConn->AddIceCandidate(cand.get()))
     {
         terminateAndDestroy(TermCode::kErrProtocol);
+        return false;
     }
+    return true;
 }
 
 void Session::msgMute(RtMessage& packet)
@@ -2506,6 +2696,7 @@ const char* rtcmdTypeToStr(uint8_t type)
         RET_ENUM_NAME(RTCMD_SDP_OFFER); // joiner sends an SDP offer
         RET_ENUM_NAME(RTCMD_SDP_ANSWER); // joinee answers with SDP answer
         RET_ENUM_NAME(RTCMD_ICE_CANDIDATE); // both parties exchange ICE candidates
+        RET_ENUM_NAME(RTCMD_ICE_CANDIDATES);
         RET_ENUM_NAME(RTCMD_SESS_TERMINATE); // initiate termination of a session
         RET_ENUM_NAME(RTCMD_SESS_TERMINATE_ACK); // acknowledge the receipt of SESS_TERMINATE, so the sender can safely stop the stream and
         // it will not be detected as an error by the receiver
@@ -2599,6 +2790,7 @@ std::string rtmsgCommandToString(const StaticBuffer& buf)
         case RTCMD_SDP_OFFER:
         case RTCMD_SDP_ANSWER:
         case RTCMD_ICE_CANDIDATE:
+        case RTCMD_ICE_CANDIDATES:
         case RTCMD_SESS_TERMINATE:
         case RTCMD_SESS_TERMINATE_ACK:
         case RTCMD_MUTE:
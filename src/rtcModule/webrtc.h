@@ -78,7 +78,15 @@ enum: uint8_t
     RTCMD_SESS_TERMINATE = 10, // initiate termination of a session | <sessionId><termCode>
     RTCMD_SESS_TERMINATE_ACK = 11, // acknowledge the receipt of SESS_TERMINATE, so the sender can safely stop the stream and
     // it will not be detected as an error by the receiver
-    RTCMD_MUTE = 12 // Change audio-video call  <av>
+    RTCMD_MUTE = 12, // Change audio-video call  <av>
+    RTCMD_ICE_CANDIDATES = 13 // a batch of ICE candidates, sent only to peers with kCapIceBatch
+    // | <sessionId><count>{<LineIdx><mid.len><mid><cand.len><cand>}*count
+};
+/** Bits of the capabilities byte that is appended to RTCMD_JOIN and RTCMD_SESSION.
+ * Older clients don't send it and ignore it */
+enum: uint8_t
+{
+    kCapIceBatch = 0x01 // understands RTCMD_ICE_CANDIDATES
 };
 enum TermCode: uint8_t
 {
@@ -343,6 +351,15 @@ public:
     virtual void loadDeviceList() = 0;
     
     virtual bool isCaptureActive() const = 0;
+    /**
+     * @brief Enables or disables the pre-warm of incoming calls. While an incoming
+     * call is ringing, the capture devices are opened and their sources created,
+     * so that answering it doesn't have to wait for them. The sources are released
+     * if the call is not answered. Disabled by default.
+     * @param video If false, only the audio source is pre-warmed. Creating the video
+     * source starts the camera, before the user has answered
+     */
+    virtual void setCallPrewarm(bool enable, bool video) = 0;
     virtual void setMediaConstraint(const std::string& name, const std::string &value, bool optional=false) = 0;
     virtual void setPcConstraint(const std::string& name, const std::string &value, bool optional=false) = 0;
     virtual bool isCallInProgress(karere::Id chatid = karere::Id::inval()) const = 0;
@@ -35,6 +35,11 @@ protected:
     std::unique_ptr<stats::Recorder> mStatRecorder;
     megaHandle mSetupTimer = 0;
     time_t mTsIceConn = 0;
+    /** Capabilities of the peer, kCapXXX from its JOIN or SESSION */
+    uint8_t mPeerCaps = 0;
+    /** Local ICE candidates waiting for mIceBatchTimer to be sent together */
+    std::vector<std::shared_ptr<artc::IceCandText>> mIceCandBatch;
+    megaHandle mIceBatchTimer = 0;
     promise::Promise<void> mTerminatePromise;
     bool mVideoReceived = false;
     void setState(uint8_t state);
@@ -48,6 +53,10 @@ protected:
     void msgSessTerminateAck(RtMessage& packet);
     void msgSessTerminate(RtMessage& packet);
     void msgIceCandidate(RtMessage& packet);
+    void msgIceCandidates(RtMessage& packet);
+    bool addIceCandidate(const std::string& mid, uint8_t mLineIdx, const std::string& strCand);
+    void sendIceCandidate(const artc::IceCandText& cand);
+    void flushIceCandidates();
     void msgMute(RtMessage& packet);
     void mungeSdp(std::string& sdp);
     void onVideoRecv();
@@ -117,6 +126,10 @@ protected:
     std::shared_ptr<artc::StreamPlayer> mLocalPlayer;
     megaHandle mDestroySessionTimer = 0;
     unsigned int mTotalSessionRetry = 0;
+    /** When the call was answered, 0 if it wasn't answered by us */
+    int64_t mTsAnswer = 0;
+    /** How long getting the local stream took, -1 if it was not got yet */
+    int64_t mLocalStreamMs = -1;
     uint8_t mPredestroyState;
     void setState(uint8_t newState);
     void handleMessage(RtMessage& packet);
@@ -162,6 +175,9 @@ protected:
     friend class Session;
 public:
     chatd::Chat& chat() const { return mChat; }
+    size_t sessionCount() const { return mSessions.size(); }
+    int64_t answerTs() const { return mTsAnswer; }
+    int64_t localStreamMs() const { return mLocalStreamMs; }
     Call(RtcModule& rtcModule, chatd::Chat& chat,
         karere::Id callid, bool isGroup, bool isJoiner, ICallHandler* handler,
         karere::Id callerUser, uint32_t callerClient);
@@ -185,8 +201,13 @@ public:
         kRingOutTimeout = 30000,
         kIncallPingInterval = 4000,
         kMediaGetTimeout = 20000,
-        kSessSetupTimeout = 20000
+        kSessSetupTimeout = 20000,
+        /** How long local ICE candidates are collected before being sent in
+         * one RTCMD_ICE_CANDIDATES */
+        kIceBatchWindow = 50
     };
+    /** Our capabilities, sent in JOIN and SESSION */
+    static const uint8_t kOwnCaps = kCapIceBatch;
     int maxbr = 0;
     RtcModule(karere::Client& client, IGlobalHandler& handler, IRtcCrypto* crypto,
         const char* iceServers);
@@ -208,6 +229,7 @@ public:
     virtual bool selectAudioInDevice(const std::string& devname);
     virtual void loadDeviceList();
     virtual bool isCaptureActive() const;
+    virtual void setCallPrewarm(bool enable, bool video);
     virtual void setMediaConstraint(const std::string& name, const std::string &value, bool optional);
     virtual void setPcConstraint(const std::string& name, const std::string &value, bool optional);
     virtual bool isCallInProgress(karere::Id chatid) const;
@@ -227,6 +249,11 @@ protected:
     webrtc::FakeConstraints mPcConstraints;
     webrtc::FakeConstraints mMediaConstraints;
     std::map<karere::Id, std::shared_ptr<Call>> mCalls;
+    bool mPrewarm = false;
+    bool mPrewarmVideo = false;
+    /** Tracks that keep the capture sources alive while an incoming call is ringing */
+    std::shared_ptr<artc::LocalAudioTrackHandle> mPrewarmAudioTrack;
+    std::shared_ptr<artc::LocalVideoTrackHandle> mPrewarmVideoTrack;
     IRtcCrypto& crypto() const { return *mCrypto; }
     template <class... Args>
     void cmdEndpoint(chatd::Chat &chat, uint8_t type, karere::Id chatid, karere::Id userid, uint32_t clientid, Args... args);
@@ -234,6 +261,9 @@ protected:
     void cmdEndpoint(uint8_t type, const RtMessage& info, Args... args);
     void removeCall(Call& call);
     std::shared_ptr<artc::LocalStreamHandle> getLocalStream(karere::AvFlags av, std::string& errors);
+    void openInputDevices(std::string& errors);
+    void prewarm(karere::AvFlags av);
+    void releasePrewarm();
     std::shared_ptr<Call> startOrJoinCall(karere::Id chatid, karere::AvFlags av, ICallHandler& handler, bool isJoin);
     template <class T> T random() const;
     template <class T> void random(T& result) const;
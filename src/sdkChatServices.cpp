@@ -0,0 +1,68 @@
+#include "sdkChatServices.h"
+#include "userAttrCache.h"
+#include "base64url.h"
+
+namespace karere
+{
+promise::Promise<std::shared_ptr<Buffer>> SdkChatServices::fetchUserAttr(Id user, unsigned attrType)
+{
+    switch (attrType)
+    {
+        case USER_ATTR_RSA_PUBKEY:
+        {
+            return mApi.call(&::mega::MegaApi::getUserData, user.toString().c_str())
+            .then([user](ReqResult result) -> promise::Promise<std::shared_ptr<Buffer>>
+            {
+                auto rsakey = result->getPassword();
+                size_t keylen;
+                if (!rsakey || ((keylen = strlen(rsakey)) < 1))
+                {
+                    KR_LOG_WARNING("Public RSA key returned by API for user %s is null or empty", user.toString().c_str());
+                    return promise::Error("No key", ::mega::API_ENOENT, ERRTYPE_MEGASDK);
+                }
+                auto data = std::make_shared<Buffer>(keylen+1);
+                int binlen = base64urldecode(rsakey, keylen, data->buf(), keylen);
+                data->setDataSize(binlen);
+                return data;
+            });
+        }
+        case USER_ATTR_EMAIL:
+        {
+            return mApi.call(&::mega::MegaApi::getUserEmail, user.val)
+            .then([](ReqResult result)
+            {
+                auto email = result->getEmail();
+                return std::make_shared<Buffer>(email, strlen(email));
+            });
+        }
+        default:
+        {
+            return mApi.call(&::mega::MegaApi::getUserAttribute, user.toString().c_str(), (int)attrType)
+            .then([attrType](ReqResult result)
+            {
+                return std::shared_ptr<Buffer>(gUserAttrDescs[attrType].getData(*result));
+            });
+        }
+    }
+}
+
+promise::Promise<std::string> SdkChatServices::fetchChatdUrl(Id chatid)
+{
+    return mApi.call(&::mega::MegaApi::getUrlChat, chatid.val)
+    .then([](ReqResult result)
+    {
+        const char* url = result->getLink();
+        return std::string(url ? url : "");
+    });
+}
+
+promise::Promise<std::string> SdkChatServices::fetchRichPreview(const std::string& url)
+{
+    return mApi.call(&::mega::MegaApi::requestRichPreview, url.c_str())
+    .then([](ReqResult result)
+    {
+        const char* text = result->getText();
+        return std::string(text ? text : "");
+    });
+}
+}
@@ -0,0 +1,21 @@
+#ifndef SDKCHATSERVICES_H
+#define SDKCHATSERVICES_H
+#include "chatServices.h"
+#include "sdkApi.h"
+
+namespace karere
+{
+/** @brief The IChatServices used by karere::Client, which forwards the
+ * requests to the Mega SDK */
+class SdkChatServices: public IChatServices
+{
+protected:
+    MyMegaApi& mApi;
+public:
+    SdkChatServices(MyMegaApi& api): mApi(api) {}
+    virtual promise::Promise<std::shared_ptr<Buffer>> fetchUserAttr(Id user, unsigned attrType);
+    virtual promise::Promise<std::string> fetchChatdUrl(Id chatid);
+    virtual promise::Promise<std::string> fetchRichPreview(const std::string& url);
+};
+}
+#endif
@@ -0,0 +1,88 @@
+#ifndef KARERE_SHAREDKEYCACHE_H
+#define KARERE_SHAREDKEYCACHE_H
+/**
+ * @file sharedKeyCache.h
+ * @brief Client-wide cache of the symmetric keys derived from the Curve25519
+ * shared secret with each peer.
+ */
+#include <stdint.h>
+#include <string>
+#include <memory>
+#include <map>
+#include <utility>
+
+namespace karere
+{
+/** @brief Caches the keys derived from the Cu25519 shared secret with a peer,
+ * keyed by the peer's userid and the pad string used in the derivation
+ * (chat and webrtc use different pad strings). All strongvelope instances
+ * and the webrtc crypto module share one cache, which is owned by
+ * \c UserAttrCache, so that a peer who is in many of our chats costs a
+ * single \c crypto_scalarmult per pad string.
+ *
+ * The entries of a peer must be invalidated when the peer's Cu25519 public
+ * key changes.
+ */
+template <class K>
+class SharedKeyCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        /** Entries dropped because the peer's public key changed */
+        uint64_t invalidated = 0;
+        double hitRate() const
+        {
+            uint64_t total = hits + misses;
+            return total ? (double)hits / total : 0.0;
+        }
+    };
+protected:
+    typedef std::pair<uint64_t, std::string> CacheKey;
+    std::map<CacheKey, std::shared_ptr<K>> mKeys;
+    Stats mStats;
+public:
+    /** @brief Returns the cached key, or an empty pointer if there is none,
+     * in which case the caller should derive the key and \c put() it.
+     */
+    std::shared_ptr<K> get(uint64_t userid, const std::string& padString)
+    {
+        auto it = mKeys.find(CacheKey(userid, padString));
+        if (it == mKeys.end())
+        {
+            mStats.misses++;
+            return nullptr;
+        }
+        mStats.hits++;
+        return it->second;
+    }
+    /** @brief Same as \c get(), but doesn't count towards the stats. Used to
+     * re-check the cache after an asynchronous operation.
+     */
+    std::shared_ptr<K> peek(uint64_t userid, const std::string& padString) const
+    {
+        auto it = mKeys.find(CacheKey(userid, padString));
+        return (it == mKeys.end()) ? nullptr : it->second;
+    }
+    void put(uint64_t userid, const std::string& padString, const std::shared_ptr<K>& key)
+    {
+        mKeys[CacheKey(userid, padString)] = key;
+    }
+    /** @brief Removes all keys derived with the public key of \c userid */
+    void invalidate(uint64_t userid)
+    {
+        auto it = mKeys.lower_bound(CacheKey(userid, std::string()));
+        while (it != mKeys.end() && it->first.first == userid)
+        {
+            it = mKeys.erase(it);
+            mStats.invalidated++;
+        }
+    }
+    void clear() { mKeys.clear(); }
+    size_t size() const { return mKeys.size(); }
+    const Stats& stats() const { return mStats; }
+};
+}
+#endif
@@ -638,21 +638,25 @@ void ProtocolHandler::msgEncryptWithKey(const Message& src, MsgCommand& dest,
 promise::Promise<std::shared_ptr<SendKey>>
 ProtocolHandler::computeSymmetricKey(karere::Id userid, const std::string& padString)
 {
-    auto it = mSymmKeyCache.find(userid);
-    if (it != mSymmKeyCache.end())
+    // The cache is shared by all chats, a peer who is in many of our chats
+    // costs a single crypto_scalarmult
+    auto& cache = mUserAttrCache.sharedKeys();
+    auto cached = cache.get(userid, padString);
+    if (cached)
     {
-        return it->second;
+        return cached;
     }
     auto wptr = weakHandle();
     return mUserAttrCache.getAttr(userid, ::mega::MegaApi::USER_ATTR_CU25519_PUBLIC_KEY)
     .then([wptr, this, userid, padString](const StaticBuffer* pubKey) -> promise::Promise<std::shared_ptr<SendKey>>
     {
         wptr.throwIfDeleted();
-        // We may have had 2 almost parallel requests, and the second may
-        // have put the key into the cache already
-        auto it = mSymmKeyCache.find(userid);
-        if (it != mSymmKeyCache.end())
-            return it->second;
+        // We (or another chat) may have had 2 almost parallel requests, and
+        // the other may have put the key into the cache already
+        auto& cache = mUserAttrCache.sharedKeys();
+        auto cached = cache.peek(userid, padString);
+        if (cached)
+            return cached;
 
         if (pubKey->empty())
             return promise::Error("Empty Cu25519 chat key for user "+userid.toString());
@@ -662,7 +666,7 @@ ProtocolHandler::computeSymmetricKey(karere::Id userid, const std::string& padSt
         (void)ignore;
         auto result = std::make_shared<SendKey>();
         deriveSharedKey(sharedSecret, *result, padString);
-        mSymmKeyCache.emplace(userid, result);
+        cache.put(userid, padString, result);
         return result;
     });
 }
@@ -1018,7 +1022,19 @@ Promise<Message*> ProtocolHandler::msgDecrypt(Message* message)
             keyid = message->keyid;
         }
 
-        // Get sender key
+        // Get sender and signing keys
+        auto symPms = getKey(UserKeyId(message->userid, keyid), isLegacy);
+        auto edPms = mUserAttrCache.getAttr(parsedMsg->sender,
+            ::mega::MegaApi::USER_ATTR_ED25519_PUBLIC_KEY);
+
+        // Usually both keys are already cached, so there is no need to wait
+        if (symPms.succeeded() && edPms.succeeded())
+        {
+            EcKey edKey;
+            edKey.assign(edPms.value()->buf(), edPms.value()->dataSize());
+            return verifyAndDecrypt(parsedMsg, message, edKey, *symPms.value(), isLegacy);
+        }
+
         struct Context
         {
             std::shared_ptr<SendKey> sendKey;
@@ -1026,23 +1042,19 @@ Promise<Message*> ProtocolHandler::msgDecrypt(Message* message)
         };
         auto ctx = std::make_shared<Context>();
 
-        auto symPms = getKey(UserKeyId(message->userid, keyid), isLegacy)
-        .then([ctx](const std::shared_ptr<SendKey>& key)
+        auto symCtxPms = symPms.then([ctx](const std::shared_ptr<SendKey>& key)
         {
             ctx->sendKey = key;
         });
 
-        // Get signing key
-        auto edPms = mUserAttrCache.getAttr(parsedMsg->sender,
-            ::mega::MegaApi::USER_ATTR_ED25519_PUBLIC_KEY)
-        .then([ctx](Buffer* key)
+        auto edCtxPms = edPms.then([ctx](Buffer* key)
         {
             ctx->edKey.assign(key->buf(), key->dataSize());
         });
 
         // Verify signature and decrypt
         auto wptr = weakHandle();
-        return promise::when(symPms, edPms)
+        return promise::when(symCtxPms, edCtxPms)
         .then([this, wptr, message, parsedMsg, ctx, isLegacy, keyid, cacheVersion]() ->promise::Promise<Message*>
         {
             if (wptr.deleted())
@@ -1055,29 +1067,35 @@ Promise<Message*> ProtocolHandler::msgDecrypt(Message* message)
                 return promise::Error("msgDecrypt: history was reloaded, ignore message", EINVAL, SVCRYPTO_ENOMSG);
             }
 
-            if (!parsedMsg->verifySignature(ctx->edKey, *ctx->sendKey))
-            {
-                return promise::Error("Signature invalid for message "+
-                                      message->id().toString(), EINVAL, SVCRYPTO_ESIGNATURE);
-            }
-
-            if (isLegacy)
-            {
-                return legacyMsgDecrypt(parsedMsg, message, *ctx->sendKey);
-            }
-
-            // Decrypt message payload.
-            parsedMsg->symmetricDecrypt(*ctx->sendKey, *message);
-            return message;
+            return verifyAndDecrypt(parsedMsg, message, ctx->edKey, *ctx->sendKey, isLegacy);
         });
     }
-    catch(std::runtime_error& e)
+    catch(std::exception& e)
     {
         // ParsedMessage ctor throws if unexpected format, unknown/missing TLVs, etc.
         return promise::Error(e.what(), EINVAL, SVCRYPTO_EMALFORMED);
     }
 }
 
+Promise<Message*> ProtocolHandler::verifyAndDecrypt(const std::shared_ptr<ParsedMessage>& parsedMsg,
+    Message* message, const EcKey& edKey, const SendKey& sendKey, bool isLegacy)
+{
+    if (!parsedMsg->verifySignature(edKey, sendKey))
+    {
+        return promise::Error("Signature invalid for message "+
+                              message->id().toString(), EINVAL, SVCRYPTO_ESIGNATURE);
+    }
+
+    if (isLegacy)
+    {
+        return legacyMsgDecrypt(parsedMsg, message, sendKey);
+    }
+
+    // Decrypt message payload.
+    parsedMsg->symmetricDecrypt(sendKey, *message);
+    return message;
+}
+
 Promise<void>
 ProtocolHandler::legacyExtractKeys(const std::shared_ptr<ParsedMessage>& parsedMsg)
 {
@@ -1440,9 +1458,7 @@ ParsedMessage::decryptChatTitle(chatd::Message* msg, bool msgCanBeDeleted)
 void ProtocolHandler::onUserJoin(Id userid)
 {
     // preload keys for the new participant
-    mUserAttrCache.getAttr(userid, ::mega::MegaApi::USER_ATTR_CU25519_PUBLIC_KEY, nullptr, nullptr);
-    mUserAttrCache.getAttr(userid, ::mega::MegaApi::USER_ATTR_ED25519_PUBLIC_KEY, nullptr, nullptr);
-    mUserAttrCache.getAttr(userid, USER_ATTR_RSA_PUBKEY, nullptr, nullptr);
+    mUserAttrCache.prefetchKeys(userid);
 }
 
 void ProtocolHandler::onUserLeave(Id /*userid*/)
@@ -1461,12 +1477,10 @@ void ProtocolHandler::setUsers(karere::SetOfIds* users)
     assert(users);
     mParticipants = users;
 
-    //pre-fetch user attributes
+    //pre-fetch user attributes, they are fetched together in one batch
     for (auto userid: *users)
     {
-        mUserAttrCache.getAttr(userid, ::mega::MegaApi::USER_ATTR_CU25519_PUBLIC_KEY, nullptr, nullptr);
-        mUserAttrCache.getAttr(userid, ::mega::MegaApi::USER_ATTR_ED25519_PUBLIC_KEY, nullptr, nullptr);
-        mUserAttrCache.getAttr(userid, USER_ATTR_RSA_PUBKEY, nullptr, nullptr);
+        mUserAttrCache.prefetchKeys(userid);
     }
 }
 
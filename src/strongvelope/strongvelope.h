@@ -301,9 +301,6 @@ protected:
     // received and confirmed keys (doesn't include unconfirmed keys)
     std::map<UserKeyId, KeyEntry> mKeys;
 
-    // cache of symmetric keys (pubCu255 * privCu255)
-    std::map<karere::Id, std::shared_ptr<SendKey>> mSymmKeyCache;
-
     // current list of participants (mapped to the `chatd::Client::mUsers`)
     karere::SetOfIds* mParticipants = nullptr;
 
@@ -376,6 +373,9 @@ protected:
         const std::shared_ptr<ParsedMessage>& parsedMsg, chatd::Message* msg);
     chatd::Message* legacyMsgDecrypt(const std::shared_ptr<ParsedMessage>& parsedMsg,
         chatd::Message* msg, const SendKey& key);
+    /** Verifies the signature of the message and decrypts it, once the keys are available */
+    promise::Promise<chatd::Message*> verifyAndDecrypt(const std::shared_ptr<ParsedMessage>& parsedMsg,
+        chatd::Message* message, const EcKey& edKey, const SendKey& sendKey, bool isLegacy);
 
 
 // legacy RSA encryption methods
@@ -4,6 +4,7 @@
 #include "db.h"
 #include <codecvt>
 #include <locale>
+#include <inttypes.h>
 #include <mega/types.h>
 
 using namespace promise;
@@ -170,6 +171,10 @@ UserAttrDesc gUserAttrDescs[21] =
 
 UserAttrCache::~UserAttrCache()
 {
+    if (mFetchTimer)
+    {
+        cancelTimeout(mFetchTimer, mClient.appCtx);
+    }
     mClient.api.sdk.removeGlobalListener(this);
 }
 
@@ -232,6 +237,12 @@ void UserAttrCache::onUserAttrChange(::mega::MegaUser& user)
 void UserAttrCache::onUserAttrChange(uint64_t userid, int changed)
 {
 //  printf("user %s changed %u\n", Id(user.getHandle()).toString().c_str(), changed);
+    if (changed & ::mega::MegaUser::CHANGE_TYPE_PUBKEY_CU255)
+    {
+        UACACHE_LOG_DEBUG("Cu25519 key of user %s changed, dropping the keys derived from it",
+            Id(userid).toString().c_str());
+        mSharedKeys.invalidate(userid);
+    }
     for (size_t i = 0; i < sizeof(gUserAttrDescs)/sizeof(gUserAttrDescs[0]); i++)
     {
         auto& desc = gUserAttrDescs[i];
@@ -298,6 +309,7 @@ void UserAttrCacheItem::notify()
 void UserAttrCacheItem::resolve(UserAttrPair key)
 {
     pending = kCacheFetchNotPending;
+    parent.mStats.inFlight--;
     UACACHE_LOG_DEBUG("Attr %s fetched, writing to db and doing callbacks...", key.toString().c_str());
     parent.dbWrite(key, *data);
     notify();
@@ -311,6 +323,7 @@ void UserAttrCacheItem::resolveNoDb(UserAttrPair key)
 void UserAttrCacheItem::error(UserAttrPair key, int errCode)
 {
     pending = kCacheFetchNotPending;
+    parent.mStats.inFlight--;
     data.reset();
     if (errCode == ::mega::API_ENOENT)
     {
@@ -353,6 +366,7 @@ UserAttrCache::Handle UserAttrCache::getAttr(uint64_t userHandle, unsigned type,
     auto it = find(key);
     if (it != end())
     {
+        mStats.hits++;
         auto& item = *it->second;
         if (cb)
         { // Maybe not optimal to store each cb pointer, as these pointers would be mostly only a few, with different userp-s
@@ -377,6 +391,7 @@ UserAttrCache::Handle UserAttrCache::getAttr(uint64_t userHandle, unsigned type,
     }
 
     //we don't have the attrib item, create it
+    mStats.misses++;
     UACACHE_LOG_DEBUG("Attibute %s not found in cache, fetching", key.toString().c_str());
     auto item = std::make_shared<UserAttrCacheItem>(*this, nullptr, kCacheFetchNewPending);
     it = emplace(key, item).first;
@@ -387,53 +402,77 @@ UserAttrCache::Handle UserAttrCache::getAttr(uint64_t userHandle, unsigned type,
 
 void UserAttrCache::fetchAttr(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item)
 {
-    if (!mIsLoggedIn && !(key.attrType & USER_ATTR_FLAG_COMPOSITE))
+    if (key.attrType & USER_ATTR_FLAG_COMPOSITE)
+    {
+        // fetched via the attributes it's composed of, which are batched
+        doFetchAttr(key, item);
         return;
-    switch (key.attrType)
-    {
-        case USER_ATTR_FULLNAME:
-            fetchUserFullName(key, item);
-            break;
-        case USER_ATTR_RSA_PUBKEY:
-            fetchRsaPubkey(key, item);
-            break;
-        case USER_ATTR_EMAIL:
-            fetchEmail(key, item);
-            break;
-        default:
-            fetchStandardAttr(key, item);
-            break;
     }
-}
-void UserAttrCache::fetchStandardAttr(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item)
-{
+    if (!mIsLoggedIn)
+        return;
+
+    // Misses usually come in bursts (i.e. opening a group chat, or prefetching
+    // the keys of its members), so collect them and send them together, which
+    // allows the SDK to send them in the same API request
+    mFetchQueue.insert(key);
+    if (mFetchTimer)
+        return;
+
     auto wptr = weakHandle();
-    mClient.api.call(&::mega::MegaApi::getUserAttribute,
-        key.user.toString().c_str(), (int)key.attrType)
-    .then([wptr, this, key, item](ReqResult result)
+    mFetchTimer = karere::setTimeout([this, wptr]()
     {
-        wptr.throwIfDeleted();
-        item->data.reset(gUserAttrDescs[key.attrType].getData(*result));
-        item->resolve(key);
-    })
-    .fail([wptr, this, key, item](const promise::Error& err)
+        if (wptr.deleted())
+            return;
+
+        mFetchTimer = 0;
+        flushFetchQueue();
+    }, kFetchBatchDelay, mClient.appCtx);
+}
+
+void UserAttrCache::flushFetchQueue()
+{
+    if (mFetchQueue.empty() || !mIsLoggedIn) // pending items are re-fetched upon login
+        return;
+
+    std::set<UserAttrPair> queue;
+    queue.swap(mFetchQueue);
+    uint32_t count = 0;
+    for (auto& key: queue)
     {
-        wptr.throwIfDeleted();
-        item->error(key, err.code());
-        return err;
-    });
+        auto it = find(key);
+        // the item may have been removed from the cache, or fetched by another batch
+        if (it == end() || it->second->pending == kCacheFetchNotPending)
+            continue;
+
+        count++;
+        mStats.inFlight++;
+        doFetchAttr(key, it->second);
+    }
+
+    if (count)
+    {
+        mStats.batches++;
+        mStats.batchedFetches += count;
+        if (count > mStats.maxBatchSize)
+            mStats.maxBatchSize = count;
+        UACACHE_LOG_DEBUG("Fetching %u attributes (in flight: %u, hits: %" PRIu64 ", misses: %" PRIu64 ")",
+            count, mStats.inFlight, mStats.hits, mStats.misses);
+    }
 }
 
-void UserAttrCache::fetchEmail(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item)
+void UserAttrCache::doFetchAttr(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item)
 {
+    if (key.attrType == USER_ATTR_FULLNAME)
+    {
+        fetchUserFullName(key, item);
+        return;
+    }
     auto wptr = weakHandle();
-    mClient.api.call(&::mega::MegaApi::getUserEmail,
-        key.user.val)
-    .then([wptr, this, key, item](ReqResult result)
+    mClient.services().fetchUserAttr(key.user, key.attrType)
+    .then([wptr, this, key, item](std::shared_ptr<Buffer> data)
     {
         wptr.throwIfDeleted();
-        auto email = result->getEmail();
-        item->data.reset(new Buffer(email, strlen(email)));
+        item->data.reset(data ? new Buffer(std::move(*data)) : nullptr);
         item->resolve(key);
     })
     .fail([wptr, this, key, item](const promise::Error& err)
@@ -508,38 +547,10 @@ void UserAttrCache::fetchUserFullName(UserAttrPair key, std::shared_ptr<UserAttr
     });
 }
 
-void UserAttrCache::fetchRsaPubkey(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item)
-{
-    auto wptr = weakHandle();
-    mClient.api.call(&::mega::MegaApi::getUserData, key.user.toString().c_str())
-    .fail([wptr, this, key, item](const promise::Error& err)
-    {
-        wptr.throwIfDeleted();
-        item->error(key, err.code());
-        return err;
-    })
-    .then([wptr, this, key, item](ReqResult result) -> promise::Promise<void>
-    {
-        wptr.throwIfDeleted();
-        auto rsakey = result->getPassword();
-        size_t keylen;
-        if (!rsakey || ((keylen = strlen(rsakey)) < 1))
-        {
-            KR_LOG_WARNING("Public RSA key returned by API for user %s is null or empty", key.user.toString().c_str());
-            item->error(key, ::mega::API_ENOENT);
-            return promise::Error("No key", ::mega::API_ENOENT, ERRTYPE_MEGASDK);
-        }
-        item->data.reset(new Buffer(keylen+1));
-        int binlen = base64urldecode(rsakey, keylen, item->data->buf(), keylen);
-        item->data->setDataSize(binlen);
-        item->resolve(key);
-        return promise::_Void();
-    });
-}
-
 void UserAttrCache::invalidate()
 {
     mClient.db.query("delete from userattrs");
+    mSharedKeys.clear();
     for (auto& item: *this)
     {
         item.second->pending = kCacheFetchUpdatePending;
@@ -561,6 +572,13 @@ void UserAttrCache::onLogOut()
     mIsLoggedIn = false;
 }
 
+void UserAttrCache::prefetchKeys(uint64_t user)
+{
+    getAttr(user, ::mega::MegaApi::USER_ATTR_CU25519_PUBLIC_KEY, nullptr, nullptr);
+    getAttr(user, ::mega::MegaApi::USER_ATTR_ED25519_PUBLIC_KEY, nullptr, nullptr);
+    getAttr(user, USER_ATTR_RSA_PUBKEY, nullptr, nullptr);
+}
+
 promise::Promise<Buffer*>
 UserAttrCache::getAttr(uint64_t user, unsigned attrType)
 {
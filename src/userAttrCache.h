@@ -4,12 +4,16 @@
 #include "karereId.h"
 #include <megaapi.h>
 #include <list>
+#include <set>
 #include <promise.h>
+#include <base/timers.hpp>
 #include <base/trackDelete.h>
+#include "sharedKeyCache.h"
 
 #define UACACHE_LOG_DEBUG(fmtString,...) KARERE_LOG_DEBUG(krLogChannel_uacache, fmtString, ##__VA_ARGS__)
 
 class Buffer;
+namespace strongvelope { template<size_t L> class Key; typedef Key<16> SendKey; }
 
 namespace mega
 {
@@ -123,18 +127,39 @@ struct UserAttrCacheItem
 class UserAttrCache: public std::map<UserAttrPair, std::shared_ptr<UserAttrCacheItem>>,
                      public mega::MegaGlobalListener, public karere::DeleteTrackable
 {
+public:
+    /** Time during which cache misses are collected, before they are fetched together */
+    enum { kFetchBatchDelay = 10 };
+    struct Stats
+    {
+        /** Requests served from the cache, including the ones waiting for a fetch in progress */
+        uint64_t hits = 0;
+        /** Requests that had to fetch the attribute */
+        uint64_t misses = 0;
+        /** Fetches sent to the API and not completed yet */
+        uint32_t inFlight = 0;
+        /** Number of batches of fetches sent, and the total and max number of fetches in them */
+        uint64_t batches = 0;
+        uint64_t batchedFetches = 0;
+        uint32_t maxBatchSize = 0;
+    };
 protected:
     Client& mClient;
     bool mIsLoggedIn = false;
+    Stats mStats;
+    /** Attributes to be fetched when the current batch is flushed */
+    std::set<UserAttrPair> mFetchQueue;
+    megaHandle mFetchTimer = 0;
+    SharedKeyCache<strongvelope::SendKey> mSharedKeys;
+    void flushFetchQueue();
     void dbWrite(UserAttrPair key, const Buffer& data);
     void dbWriteNull(UserAttrPair key);
     void dbInvalidateItem(UserAttrPair item);
+    /** Queues the attribute to be fetched with the current batch */
     void fetchAttr(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item);
+    void doFetchAttr(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item);
 //actual attrib fetch backend functions
     void fetchUserFullName(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item);
-    void fetchStandardAttr(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item);
-    void fetchRsaPubkey(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item);
-    void fetchEmail(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item);
 //==
     void onUserAttrChange(uint64_t userid, int changed);
     void onUserAttrChange(mega::MegaUser& user);
@@ -182,6 +207,14 @@ public:
      * request is currently registered (expired one-shot for example).
      */
     bool removeCb(Handle handle);
+    /** @brief Fetches the public keys of the user (Cu25519, Ed25519 and RSA)
+     * in advance, if they are not cached yet */
+    void prefetchKeys(uint64_t user);
+    const Stats& stats() const { return mStats; }
+    /** @brief The keys derived from the Cu25519 shared secret with each peer,
+     * shared by strongvelope and webrtc. Entries are invalidated when the
+     * peer's Cu25519 public key changes */
+    SharedKeyCache<strongvelope::SendKey>& sharedKeys() { return mSharedKeys; }
 };
 
 }
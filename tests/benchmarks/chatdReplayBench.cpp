@@ -0,0 +1,291 @@
+/**
+ * @file chatdReplayBench.cpp
+ * @brief Replays the received frames of a chatd trace (see chatdTrace.h),
+ * recorded by chatd::Client::setTraceFile() or by karere_bench, through the
+ * chat core of the app: a karere::Client running offline (see benchClient.h),
+ * whose chatd::Connection parses the frames, chatd::Chat builds the history
+ * and ChatdSqliteDb writes it, through the DbWriter, to the karere db.
+ *
+ * The chats are the ones that the recorded client joined (its sent JOIN,
+ * JOINRANGEHIST and HIST commands). They are created empty and connected,
+ * each shard over an in-process link, and once they have sent their joins,
+ * the received frames are fed to the connection of their shard. Sent frames
+ * are not replayed: the commands that the client sends in response go to the
+ * link and are only counted. As the client starts from an empty db, a trace
+ * that begins in the middle of a session, or spans several sessions, may not
+ * be processed exactly as it was recorded.
+ *
+ * The whole trace is loaded before replaying it, so file IO is not measured.
+ * With pace=1, frames are replayed at the times they were recorded, and the
+ * lag behind the recording is reported, which shows whether an incident (a
+ * reconnect flood, a history reload storm) is reproduced with the client
+ * keeping up or falling behind.
+ *
+ * Usage: chatdReplayBench trace=<file> [pace=0] [repeat=1] [dir=/tmp]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include "chatdTrace.h"
+#include "histogram.h"
+#include "benchClient.h"
+
+using namespace karere;
+using namespace standin;
+
+/** The chats and the user of a trace, as found in the commands it sent */
+struct TraceChats
+{
+    Id myHandle = Id::inval();
+    /** chatid -> shard */
+    std::map<Id, int> chats;
+};
+
+// Each sent frame is a single command, so the opcode is the first byte
+static void scanSentFrame(const chatd::TraceReader::Frame& frame, TraceChats& result)
+{
+    if (frame.data.empty())
+        return;
+    uint8_t opcode = (uint8_t)frame.data[0];
+    if (opcode != chatd::OP_JOIN && opcode != chatd::OP_JOINRANGEHIST && opcode != chatd::OP_HIST)
+        return;
+    size_t pos = 1;
+    Id chatid(get<uint64_t>(frame.data, pos));
+    result.chats[chatid] = frame.shard;
+    if (opcode == chatd::OP_JOIN && !result.myHandle.isValid())
+        result.myHandle = get<uint64_t>(frame.data, pos);
+}
+
+static std::string shardHost(int shard)
+{
+    return "shard" + std::to_string(shard) + ".chatd.bench";
+}
+
+/** Counts the messages that reach the app */
+class ReplayListener: public BenchChatListener
+{
+public:
+    uint64_t histMsgs = 0;
+    uint64_t newMsgs = 0;
+    uint64_t edits = 0;
+    ReplayListener(Client& client): BenchChatListener(client) {}
+    virtual void onRecvHistoryMessage(chatd::Idx, chatd::Message&, chatd::Message::Status, bool isLocal)
+    {
+        if (!isLocal)
+            histMsgs++;
+    }
+    virtual void onRecvNewMessage(chatd::Idx, chatd::Message&, chatd::Message::Status) { newMsgs++; }
+    virtual void onMessageEdited(const chatd::Message&, chatd::Idx) { edits++; }
+};
+
+struct RunStats
+{
+    LatencyHistogram frameLatency;
+    LatencyHistogram lag;
+    double replayMs = 0;
+    double totalMs = 0;
+    uint64_t sentFrames = 0;
+    uint64_t histMsgs = 0;
+    uint64_t newMsgs = 0;
+    uint64_t edits = 0;
+    size_t chatsOnline = 0;
+};
+
+static bool replay(EventLoop& loop, ::mega::MegaApi& sdk, const std::string& dir,
+    const TraceChats& traceChats, const std::vector<chatd::TraceReader::Frame>& frames,
+    bool pace, RunStats& stats)
+{
+    // the link of each shard. The client is the only peer, so what it sends is dropped
+    std::map<std::string, int> hostShards;
+    for (auto& entry: traceChats.chats)
+        hostShards[shardHost(entry.second)] = entry.second;
+    std::map<int, std::shared_ptr<Link>> links;
+    LinkWebsocketsIO io(loop, sdk, [&](const std::string& host) -> std::shared_ptr<Link>
+    {
+        auto it = hostShards.find(host);
+        if (it == hostShards.end())
+            return nullptr;
+        auto link = std::make_shared<Link>(loop, LinkConfig(), (unsigned)it->second);
+        link->onServerRecv = [&stats](const std::string&) { stats.sentFrames++; };
+        links[it->second] = link;
+        return link;
+    });
+    BenchApp app;
+    std::unique_ptr<BenchClient> client(new BenchClient(sdk, io, app, dir, traceChats.myHandle));
+    std::vector<std::unique_ptr<ReplayListener>> listeners;
+    std::vector<chatd::Chat*> chats;
+    for (auto& entry: traceChats.chats)
+    {
+        listeners.emplace_back(new ReplayListener(*client));
+        SetOfIds users;
+        users.insert(traceChats.myHandle);
+        chats.push_back(&client->addChat(entry.first, entry.second,
+            "wss://" + shardHost(entry.second), users, *listeners.back()));
+    }
+    for (auto chat: chats)
+        chat->connect();
+
+    // the chats have joined once the links are up and idle
+    bool connected = loop.runUntil([&]()
+    {
+        if (links.size() < hostShards.size())
+            return false;
+        for (auto chat: chats)
+        {
+            if (!chat->connection().isOnline())
+                return false;
+        }
+        return true;
+    }, 10000);
+    if (!connected)
+    {
+        fprintf(stderr, "The chats could not connect to the links\n");
+        return false;
+    }
+    auto idle = []() { return false; };
+    loop.runUntil(idle, 50);
+    stats.sentFrames = 0;
+
+    auto start = Clock::now();
+    for (auto& frame: frames)
+    {
+        if (pace)
+        {
+            auto when = start + std::chrono::microseconds(frame.tsUs);
+            loop.runUntil(idle, (unsigned)std::max<int64_t>(0,
+                std::chrono::duration_cast<std::chrono::milliseconds>(when - Clock::now()).count()));
+            if (when > Clock::now())
+                std::this_thread::sleep_until(when);
+            else
+                stats.lag.record(when);
+        }
+        auto it = links.find(frame.shard);
+        if (it == links.end() || !it->second->isOpen() || !it->second->onClientRecv)
+            continue;
+        {
+            LatencyHistogram::Scope timer(stats.frameLatency);
+            it->second->onClientRecv(frame.data);
+        }
+        // the calls that the frame has queued on the loop are part of its processing
+        loop.runUntil(idle, 0);
+    }
+    stats.replayMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    try
+    {
+        client->mDbWriter.flush();
+    }
+    catch (std::exception& e)
+    {
+        // i.e. an update of a message that the trace didn't deliver first
+        fprintf(stderr, "  %s\n", e.what());
+    }
+    client->db.commit();
+    stats.totalMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    for (auto chat: chats)
+    {
+        if (chat->onlineState() == chatd::kChatStateOnline)
+            stats.chatsOnline++;
+    }
+    for (auto& listener: listeners)
+    {
+        stats.histMsgs += listener->histMsgs;
+        stats.newMsgs += listener->newMsgs;
+        stats.edits += listener->edits;
+    }
+    client.reset();
+    loop.runUntil(idle, 50);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    std::map<std::string, std::string> opts = {
+        {"trace", ""}, {"pace", "0"}, {"repeat", "1"}, {"dir", "/tmp"}
+    };
+    for (int i = 1; i < argc; i++)
+    {
+        const char* eq = strchr(argv[i], '=');
+        if (!eq || !opts.count(std::string((const char*)argv[i], eq)))
+        {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            return 2;
+        }
+        opts[std::string((const char*)argv[i], eq)] = eq + 1;
+    }
+    if (opts["trace"].empty())
+    {
+        fprintf(stderr, "Usage: chatdReplayBench trace=<file> [pace=0] [repeat=1] [dir=/tmp]\n");
+        return 2;
+    }
+    bool pace = (opts["pace"] == "1");
+    unsigned repeat = std::max(1, atoi(opts["repeat"].c_str()));
+
+    std::vector<chatd::TraceReader::Frame> frames;
+    TraceChats traceChats;
+    uint64_t bytes = 0;
+    size_t sentFrames = 0;
+    try
+    {
+        chatd::TraceReader reader;
+        reader.open(opts["trace"]);
+        chatd::TraceReader::Frame frame;
+        while (reader.next(frame))
+        {
+            if (frame.dir != chatd::kTraceRecv)
+            {
+                scanSentFrame(frame, traceChats);
+                sentFrames++;
+                continue;
+            }
+            bytes += frame.data.size();
+            frames.push_back(std::move(frame));
+        }
+    }
+    catch (std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    printf("%zu received frames (%llu bytes), %zu sent frames, %zu chats, spanning %.1f s\n",
+           frames.size(), (unsigned long long)bytes, sentFrames, traceChats.chats.size(),
+           frames.empty() ? 0.0 : frames.back().tsUs / 1e6);
+    if (traceChats.chats.empty() || !traceChats.myHandle.isValid())
+    {
+        fprintf(stderr, "The trace has no JOIN sent by the client, so its chats are unknown\n");
+        return 1;
+    }
+
+    // never logged in, it is only required by karere::Client
+    ::mega::MegaApi sdk("karere-native", opts["dir"].c_str(), "Karere Benchmark");
+    // the karere services are initialized once, for all runs
+    EventLoop loop;
+    KarereOnLoop karereOnLoop(loop);
+    for (unsigned run = 0; run < repeat; run++)
+    {
+        RunStats stats;
+        if (!replay(loop, sdk, opts["dir"], traceChats, frames, pace, stats))
+            return 1;
+        double totalMs = std::max(stats.totalMs, 0.001);
+        printf("run %u: %llu history and %llu new messages, %llu edits in %.1f ms (%.1f ms with db),"
+               " %.0f frames/s, %.1f MB/s, %zu/%zu chats online\n",
+               run + 1, (unsigned long long)stats.histMsgs, (unsigned long long)stats.newMsgs,
+               (unsigned long long)stats.edits, stats.replayMs, stats.totalMs,
+               frames.size() / (totalMs / 1000), bytes / (totalMs / 1000) / 1048576,
+               stats.chatsOnline, traceChats.chats.size());
+        auto& hist = stats.frameLatency;
+        printf("  per frame: p50 %llu us, p99 %llu us, max %llu us | %llu frames sent by the client\n",
+               (unsigned long long)hist.percentileUs(50), (unsigned long long)hist.percentileUs(99),
+               (unsigned long long)hist.maxUs(), (unsigned long long)stats.sentFrames);
+        if (pace)
+            printf("  behind the recording: %llu frames, p99 %llu us, max %llu us\n",
+                   (unsigned long long)stats.lag.count(), (unsigned long long)stats.lag.percentileUs(99),
+                   (unsigned long long)stats.lag.maxUs());
+    }
+    return 0;
+}
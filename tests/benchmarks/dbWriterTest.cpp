@@ -0,0 +1,107 @@
+/**
+ * @file dbWriterTest.cpp
+ * @brief Checks that the DbWriter recovers from a failed commit: a reader on
+ * another connection (like the message search worker) keeps the commit of a
+ * batch busy, and once it is gone, the later batches must still be applied.
+ *
+ * Usage: dbWriterTest [dbDir=.]
+ * Exits with a non-zero status on failure.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <stdexcept>
+#include "dbWriter.h"
+
+namespace karere
+{
+// normally defined in karereCommon.cpp, which depends on the Mega SDK
+bool gDbWriteBehind = true;
+}
+
+using namespace karere;
+
+static int gFailures = 0;
+
+static void check(bool cond, const char* what)
+{
+    printf("%s: %s\n", cond ? "ok" : "FAILED", what);
+    if (!cond)
+        gFailures++;
+}
+
+static int countRows(SqliteDb& db, int value)
+{
+    SqliteStmt stmt(db, "select count(*) from t where v=?");
+    stmt << value;
+    stmt.step();
+    return stmt.intCol(0);
+}
+
+static void insert(DbWriter& writer, int value)
+{
+    writer.enqueue(1, DbWriter::kMutAddMsg, [value](SqliteDb& aDb)
+    {
+        aDb.query("insert into t(v) values(?)", value);
+    });
+}
+
+// Returns whether flush() reported a failed write
+static bool flushFails(DbWriter& writer)
+{
+    try
+    {
+        writer.flush();
+        return false;
+    }
+    catch (std::runtime_error& e)
+    {
+        printf("  flush: %s\n", e.what());
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string path = std::string(argc > 1 ? argv[1] : ".") + "/dbWriterTest.sqlite";
+    remove(path.c_str());
+    SqliteDb db;
+    if (!db.open(path.c_str())) // commit-each mode, as the app uses it
+    {
+        fprintf(stderr, "Can't open db %s\n", path.c_str());
+        return 1;
+    }
+    db.simpleQuery("CREATE TABLE t(v int)");
+    // don't wait the default busy timeout for the reader below
+    sqlite3_busy_timeout(db, 100);
+
+    sqlite3* reader = nullptr;
+    if (sqlite3_open_v2(path.c_str(), &reader, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+    {
+        fprintf(stderr, "Can't open a read connection to %s\n", path.c_str());
+        return 1;
+    }
+    {
+        DbWriter writer(db);
+        writer.start();
+
+        // the shared lock of a read transaction makes the commit of the batch busy
+        sqlite3_exec(reader, "BEGIN; SELECT count(*) FROM t;", nullptr, nullptr, nullptr);
+        insert(writer, 1);
+        check(flushFails(writer), "a busy commit is reported by flush()");
+        sqlite3_exec(reader, "COMMIT", nullptr, nullptr, nullptr);
+
+        insert(writer, 2);
+        insert(writer, 3);
+        check(!flushFails(writer), "the batches after a failed commit are applied without errors");
+        writer.stop();
+    }
+    check(countRows(db, 1) == 0, "the batch whose commit failed is rolled back");
+    check(countRows(db, 2) == 1 && countRows(db, 3) == 1, "the batches after a failed commit are stored");
+    check(sqlite3_get_autocommit(db) != 0, "no transaction is left open");
+
+    sqlite3_close(reader);
+    db.close();
+    remove(path.c_str());
+    return gFailures ? 1 : 0;
+}
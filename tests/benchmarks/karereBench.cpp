@@ -0,0 +1,442 @@
+/**
+ * @file karereBench.cpp
+ * @brief Load and latency benchmark of the chat core, run offline against the
+ * in-process stand-in servers of standin/.
+ *
+ * The client is the one of the app: a karere::Client (see benchClient.h),
+ * whose chatd::Client and presenced::Client connect to the stand-ins over
+ * in-process links. The history of the chats is stored in the karere db, and
+ * messages are sent in plaintext. The steps drive the client through its API
+ * - Chat::connect(), Chat::getHistory(), Chat::msgSubmit(),
+ * presenced::Client::connect() - and time the listener callbacks.
+ *
+ * Usage: karere_bench [key=value]...
+ *   chats=100 msgs=200 size=120 members=5  generated history
+ *   latency=0 jitter=0                     one-way latency of the links, in ms
+ *   disconnectEvery=0                      chatd closes a connection after N frames
+ *   sends=2000 window=50                   messages sent, max unconfirmed at a time
+ *   incoming=20                            messages posted by other users, per chat
+ *   offline=5                              messages posted per chat while disconnected
+ *   peers=5000 storm=20000                 presenced peers and presence changes
+ *   steps=login,history,send,incoming,reconnect,presence
+ *   trace=<file>                           records the chatd traffic, see chatdTrace.h
+ *   dir=/tmp                               directory of the karere db
+ *
+ * The exit code is non-zero if a step doesn't complete within its timeout.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include "histogram.h"
+#include "chatdStandin.h"
+#include "presencedStandin.h"
+#include "benchClient.h"
+
+using namespace standin;
+using karere::Id;
+using karere::LatencyHistogram;
+
+enum { kHistoryFetchCount = 256 };
+enum { kStepTimeoutMs = 300000 };
+
+static const char kChatdHost[] = "chatd.bench";
+static const char kPresencedHost[] = "presenced.bench";
+
+/** What the listeners of all chats have seen, and the start times of the
+ * steps that their latencies are measured from */
+struct ChatdCounters
+{
+    LatencyHistogram onlineLatency;     // connect/disconnect -> chat online
+    LatencyHistogram fetchLatency;      // getHistory() -> onHistoryDone()
+    LatencyHistogram confirmLatency;    // msgSubmit() -> onMessageConfirmed()
+    LatencyHistogram keyLatency;        // new key -> key confirmed
+    LatencyHistogram incomingLatency;   // postMessages() -> onRecvNewMessage()
+    Clock::time_point connectStart;
+    Clock::time_point incomingStart;
+    /** msgxid -> time of msgSubmit() */
+    std::map<Id, Clock::time_point> sending;
+    uint64_t histMsgs = 0;
+    uint64_t newMsgs = 0;
+    uint64_t confirmed = 0;
+    std::function<void()> onConfirm;
+};
+
+class ChatBench: public BenchChatListener
+{
+protected:
+    ChatdCounters& mCounters;
+    chatd::Chat* mChat = nullptr;
+    Clock::time_point mFetchStart;
+    Clock::time_point mKeyStart;
+public:
+    bool online = false;
+    /** Times that the chat has come online */
+    unsigned onlineCount = 0;
+    bool fetching = false;
+    bool histEnd = false;
+
+    ChatBench(karere::Client& client, ChatdCounters& counters)
+        : BenchChatListener(client), mCounters(counters) {}
+    chatd::Chat& chat() { return *mChat; }
+    PlainCrypto* createCrypto(Id chatid)
+    {
+        auto crypto = new PlainCrypto(chatid);
+        crypto->onNewKey = [this]() { mKeyStart = Clock::now(); };
+        crypto->onKeyConfirm = [this]() { mCounters.keyLatency.record(mKeyStart); };
+        return crypto;
+    }
+    /** Requests the next kHistoryFetchCount messages. Returns false if there
+     * is no more history */
+    bool fetchHistory()
+    {
+        mFetchStart = Clock::now();
+        auto source = mChat->getHistory(kHistoryFetchCount);
+        if (source == chatd::kHistSourceServer)
+            fetching = true;
+        else if (source == chatd::kHistSourceNone)
+            histEnd = true;
+        return !histEnd;
+    }
+    virtual void init(chatd::Chat& chat, chatd::DbInterface*& dbIntf)
+    {
+        BenchChatListener::init(chat, dbIntf);
+        mChat = &chat;
+    }
+    virtual void onOnlineStateChange(chatd::ChatState state)
+    {
+        bool isOnline = (state == chatd::kChatStateOnline);
+        if (isOnline && !online)
+        {
+            onlineCount++;
+            mCounters.onlineLatency.record(mCounters.connectStart);
+        }
+        online = isOnline;
+    }
+    virtual void onRecvHistoryMessage(chatd::Idx, chatd::Message&, chatd::Message::Status, bool isLocal)
+    {
+        if (!isLocal)
+            mCounters.histMsgs++;
+    }
+    virtual void onHistoryDone(chatd::HistSource source)
+    {
+        if (fetching && source == chatd::kHistSourceServer)
+        {
+            fetching = false;
+            mCounters.fetchLatency.record(mFetchStart);
+        }
+    }
+    virtual void onRecvNewMessage(chatd::Idx, chatd::Message& msg, chatd::Message::Status)
+    {
+        if (msg.userid == mClient.myHandle())
+            return;
+        mCounters.newMsgs++;
+        mCounters.incomingLatency.record(mCounters.incomingStart);
+    }
+    virtual void onMessageConfirmed(Id msgxid, const chatd::Message&, chatd::Idx)
+    {
+        auto it = mCounters.sending.find(msgxid);
+        if (it == mCounters.sending.end())
+            return;
+        mCounters.confirmLatency.record(it->second);
+        mCounters.sending.erase(it);
+        mCounters.confirmed++;
+        if (mCounters.onConfirm)
+            mCounters.onConfirm();
+    }
+};
+
+static double msSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void report(const char* step, uint64_t count, const char* unit, uint64_t bytes,
+    double ms, const char* histName, const LatencyHistogram& hist)
+{
+    double secs = std::max(ms, 0.001) / 1000;
+    printf("%-9s %8llu %-8s in %9.1f ms | %10.0f %s/s %8.2f MB/s | %-14s p50 %7llu p95 %7llu p99 %7llu max %7llu us\n",
+           step, (unsigned long long)count, unit, ms, count / secs, unit, bytes / secs / 1048576, histName,
+           (unsigned long long)hist.percentileUs(50), (unsigned long long)hist.percentileUs(95),
+           (unsigned long long)hist.percentileUs(99), (unsigned long long)hist.maxUs());
+}
+
+static bool timedOut(const char* step)
+{
+    fprintf(stderr, "%s: timed out\n", step);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    std::map<std::string, std::string> opts = {
+        {"chats", "100"}, {"msgs", "200"}, {"size", "120"}, {"members", "5"},
+        {"latency", "0"}, {"jitter", "0"}, {"disconnectEvery", "0"},
+        {"sends", "2000"}, {"window", "50"}, {"incoming", "20"}, {"offline", "5"},
+        {"peers", "5000"}, {"storm", "20000"},
+        {"steps", "login,history,send,incoming,reconnect,presence"}, {"trace", ""},
+        {"dir", "/tmp"}
+    };
+    for (int i = 1; i < argc; i++)
+    {
+        const char* eq = strchr(argv[i], '=');
+        if (!eq || !opts.count(std::string((const char*)argv[i], eq)))
+        {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            return 2;
+        }
+        opts[std::string((const char*)argv[i], eq)] = eq + 1;
+    }
+    auto opt = [&opts](const char* name) { return (unsigned)strtoul(opts[name].c_str(), nullptr, 10); };
+    std::string steps = "," + opts["steps"] + ",";
+    auto hasStep = [&steps](const char* name) { return steps.find(std::string(",") + name + ",") != std::string::npos; };
+
+    LinkConfig link;
+    link.latencyMs = opt("latency");
+    link.jitterMs = opt("jitter");
+    ChatdConfig chatdConfig;
+    chatdConfig.chatCount = opt("chats");
+    chatdConfig.msgsPerChat = opt("msgs");
+    chatdConfig.msgSize = opt("size");
+    chatdConfig.membersPerChat = std::max(1u, opt("members"));
+    chatdConfig.disconnectEvery = opt("disconnectEvery");
+    chatdConfig.link = link;
+    PresencedConfig presencedConfig;
+    presencedConfig.link = link;
+
+    printf("%u chats x %u messages of %u bytes, %u members, link latency %u+-%u ms, disconnect every %u frames\n",
+           chatdConfig.chatCount, chatdConfig.msgsPerChat, chatdConfig.msgSize, chatdConfig.membersPerChat,
+           link.latencyMs, link.jitterMs, chatdConfig.disconnectEvery);
+
+    // never logged in, it is only required by karere::Client
+    ::mega::MegaApi sdk("karere-native", opts["dir"].c_str(), "Karere Benchmark");
+    EventLoop loop;
+    KarereOnLoop karereOnLoop(loop);
+    ChatdStandin chatdServer(loop, chatdConfig);
+    PresencedStandin presencedServer(loop, presencedConfig);
+    LinkWebsocketsIO io(loop, sdk, [&](const std::string& host) -> std::shared_ptr<Link>
+    {
+        if (host == kChatdHost)
+            return chatdServer.connect();
+        if (host == kPresencedHost)
+            return presencedServer.connect();
+        return nullptr;
+    });
+    BenchApp app;
+    Id myHandle(chatdConfig.myUserid);
+    std::unique_ptr<BenchClient> client(new BenchClient(sdk, io, app, opts["dir"], myHandle));
+    if (!opts["trace"].empty() && !client->chatd().setTraceFile(opts["trace"]))
+    {
+        fprintf(stderr, "Can't create trace file %s\n", opts["trace"].c_str());
+        return 1;
+    }
+
+    ChatdCounters counters;
+    std::vector<std::unique_ptr<ChatBench>> chats;
+    for (auto& entry: chatdServer.chats())
+    {
+        karere::SetOfIds users;
+        for (auto userid: entry.second.members)
+            users.insert(userid);
+        chats.emplace_back(new ChatBench(*client, counters));
+        auto& bench = *chats.back();
+        client->addChat(entry.first, 0, std::string("wss://") + kChatdHost, users, bench,
+                        bench.createCrypto(entry.first));
+    }
+    auto allOnline = [&chats]()
+    {
+        for (auto& bench: chats)
+        {
+            if (!bench->online)
+                return false;
+        }
+        return true;
+    };
+    auto msgCount = [&chats]()
+    {
+        uint64_t count = 0;
+        for (auto& bench: chats)
+            count += bench->chat().size();
+        return count;
+    };
+    bool failed = false;
+    bool connected = false;
+
+    if (hasStep("login") || hasStep("history") || hasStep("send") || hasStep("incoming") || hasStep("reconnect"))
+    {
+        // JOIN+HIST of the initial history of every chat, until all are online
+        auto start = counters.connectStart = Clock::now();
+        for (auto& bench: chats)
+            bench->chat().connect();
+        connected = true;
+        if (!loop.runUntil(allOnline, kStepTimeoutMs))
+            failed = timedOut("login");
+        else if (hasStep("login"))
+            report("login", msgCount(), "msgs", io.bytesRecv, msSince(start), "connect->online", counters.onlineLatency);
+    }
+    if (!failed && hasStep("history"))
+    {
+        // fetch the rest of the history of every chat, in batches of kHistoryFetchCount
+        uint64_t msgs = counters.histMsgs;
+        uint64_t bytes = io.bytesRecv;
+        auto start = Clock::now();
+        auto fetchMore = [&chats]()
+        {
+            bool more = false;
+            for (auto& bench: chats)
+            {
+                if (!bench->fetching && !bench->histEnd)
+                    more |= bench->fetchHistory();
+            }
+            return more;
+        };
+        auto allFetched = [&chats]()
+        {
+            for (auto& bench: chats)
+            {
+                if (bench->fetching)
+                    return false;
+            }
+            return true;
+        };
+        while (fetchMore())
+        {
+            if (!loop.runUntil(allFetched, kStepTimeoutMs))
+            {
+                failed = timedOut("history");
+                break;
+            }
+        }
+        if (!failed)
+            report("history", counters.histMsgs - msgs, "msgs", io.bytesRecv - bytes, msSince(start),
+                   "getHistory", counters.fetchLatency);
+    }
+    if (!failed && hasStep("send"))
+    {
+        // msgSubmit() round-robin over the chats, with at most 'window' unconfirmed
+        unsigned total = opt("sends");
+        unsigned window = std::max(1u, opt("window"));
+        unsigned sent = 0;
+        std::string payload(chatdConfig.msgSize, 'x');
+        auto sendNext = [&]()
+        {
+            while (sent < total && counters.sending.size() < window && !chats.empty())
+            {
+                auto& chat = chats[sent++ % chats.size()]->chat();
+                auto msg = chat.msgSubmit(payload.data(), payload.size(), chatd::Message::kMsgNormal, nullptr);
+                counters.sending[msg->id()] = Clock::now();
+            }
+        };
+        // not from within the callback of the chat
+        counters.onConfirm = [&]() { loop.post(sendNext); };
+        uint64_t confirmed = counters.confirmed;
+        auto start = Clock::now();
+        sendNext();
+        if (!loop.runUntil([&]() { return counters.confirmed - confirmed >= total; }, kStepTimeoutMs))
+            failed = timedOut("send");
+        else
+        {
+            report("send", total, "msgs", (uint64_t)total * chatdConfig.msgSize, msSince(start), "submit->confirm", counters.confirmLatency);
+            report("", counters.keyLatency.count(), "keys", 0, msSince(start), "new key->KEYID", counters.keyLatency);
+        }
+        counters.onConfirm = nullptr;
+    }
+    if (!failed && hasStep("incoming"))
+    {
+        // other members post messages in all chats at once
+        unsigned perChat = opt("incoming");
+        uint64_t expected = counters.newMsgs + (uint64_t)perChat * chats.size();
+        uint64_t bytes = io.bytesRecv;
+        counters.incomingLatency.reset();
+        auto start = counters.incomingStart = Clock::now();
+        for (auto& entry: chatdServer.chats())
+            chatdServer.postMessages(entry.first, perChat);
+        if (!loop.runUntil([&]() { return counters.newMsgs >= expected; }, kStepTimeoutMs))
+            failed = timedOut("incoming");
+        else
+            report("incoming", (uint64_t)perChat * chats.size(), "msgs", io.bytesRecv - bytes,
+                   msSince(start), "post->recv", counters.incomingLatency);
+    }
+    if (!failed && hasStep("reconnect"))
+    {
+        // the server restarts, and messages are posted while the client is
+        // offline. They are received via JOINRANGEHIST
+        unsigned perChat = opt("offline");
+        std::vector<unsigned> onlineCounts;
+        for (auto& bench: chats)
+            onlineCounts.push_back(bench->onlineCount);
+        uint64_t expected = counters.newMsgs + (uint64_t)perChat * chats.size();
+        uint64_t bytes = io.bytesRecv;
+        counters.onlineLatency.reset();
+        counters.incomingLatency.reset();
+        auto start = counters.connectStart = counters.incomingStart = Clock::now();
+        chatdServer.disconnectAll();
+        for (auto& entry: chatdServer.chats())
+            chatdServer.postMessages(entry.first, perChat);
+        auto rejoined = [&]()
+        {
+            for (size_t i = 0; i < chats.size(); i++)
+            {
+                if (chats[i]->onlineCount <= onlineCounts[i] || !chats[i]->online)
+                    return false;
+            }
+            return counters.newMsgs >= expected;
+        };
+        if (!loop.runUntil(rejoined, kStepTimeoutMs))
+            failed = timedOut("reconnect");
+        else
+            report("reconnect", chats.size(), "chats", io.bytesRecv - bytes, msSince(start),
+                   "close->online", counters.onlineLatency);
+    }
+    if (connected)
+    {
+        auto& stats = chatdServer.stats();
+        printf("chatd: %llu connections, %llu commands, %llu messages written (%llu resent), %llu OLDMSG, %llu NEWMSG sent, client holds %llu messages\n",
+               (unsigned long long)stats.connections, (unsigned long long)stats.commands,
+               (unsigned long long)stats.msgsWritten, (unsigned long long)stats.msgsDeduplicated,
+               (unsigned long long)stats.oldMsgsSent, (unsigned long long)stats.newMsgsSent,
+               (unsigned long long)msgCount());
+    }
+
+    if (!failed && hasStep("presence"))
+    {
+        // HELLO and ADDPEERS with all peers, until the status of each is received
+        unsigned peerCount = opt("peers");
+        uint64_t statusRecv = 0;
+        Clock::time_point statusStart;
+        LatencyHistogram statusLatency;
+        app.onPresence = [&](Id, karere::Presence)
+        {
+            statusRecv++;
+            statusLatency.record(statusStart);
+        };
+        presenced::IdRefMap peers;
+        for (unsigned i = 0; i < peerCount; i++)
+            peers.insert(Id(0x200000 + i));
+        auto start = statusStart = Clock::now();
+        client->presenced().connect(std::string("wss://") + kPresencedHost, myHandle, std::move(peers),
+                                    presenced::Config(karere::Presence::kOnline));
+        if (!loop.runUntil([&]() { return statusRecv >= peerCount; }, kStepTimeoutMs))
+            failed = timedOut("presence");
+        else
+            report("presence", peerCount, "peers", 0, msSince(start), "connect->STATUS", statusLatency);
+
+        unsigned storm = opt("storm");
+        uint64_t expected = statusRecv + storm;
+        statusLatency.reset();
+        start = statusStart = Clock::now();
+        presencedServer.presenceStorm(storm);
+        if (!failed && !loop.runUntil([&]() { return statusRecv >= expected; }, kStepTimeoutMs))
+            failed = timedOut("storm");
+        else if (!failed)
+            report("storm", storm, "statuses", 0, msSince(start), "storm->STATUS", statusLatency);
+        app.onPresence = nullptr;
+    }
+    client.reset();
+    return failed ? 1 : 0;
+}
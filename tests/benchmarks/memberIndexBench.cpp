@@ -0,0 +1,133 @@
+/**
+ * @file memberIndexBench.cpp
+ * @brief Presence fan-out after a presenced reconnect, when one PEERSTATUS is
+ * received per contact. Compares looking up the user in the member map of
+ * every group chat (the previous implementation) with the userid -> members
+ * index maintained by ChatRoomList.
+ *
+ * Usage: memberIndexBench [contactCount=5000] [roomCount=2000] [avgRoomSize=20]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <vector>
+#include <map>
+#include <set>
+#include "memberIndex.h"
+#include "histogram.h"
+
+using namespace karere;
+typedef LatencyHistogram::Clock Clock;
+
+struct Member
+{
+    uint64_t userid;
+    int presence = 0;
+    Member(uint64_t aUserid): userid(aUserid) {}
+};
+
+struct NoData {};
+typedef MemberIndex<Member, NoData> Index;
+
+struct Room
+{
+    std::map<uint64_t, Member*> peers;
+};
+
+static double msSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    size_t contactCount = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 5000;
+    size_t roomCount = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 2000;
+    size_t avgRoomSize = (argc > 3) ? strtoul(argv[3], nullptr, 10) : 20;
+
+    // room sizes are skewed: most groups are small, a few are large
+    std::mt19937 rng(12345);
+    std::geometric_distribution<size_t> roomSize(1.0 / avgRoomSize);
+    std::uniform_int_distribution<uint64_t> user(1, contactCount);
+    std::vector<Room> rooms(roomCount);
+    Index index;
+    size_t memberships = 0;
+    auto start = Clock::now();
+    for (auto& room: rooms)
+    {
+        size_t size = std::min<size_t>(2 + roomSize(rng), contactCount);
+        while (room.peers.size() < size)
+        {
+            uint64_t userid = user(rng);
+            if (room.peers.count(userid))
+                continue;
+            Member* member = new Member(userid);
+            room.peers.emplace(userid, member);
+            bool created;
+            index.add(userid, member, created);
+            memberships++;
+        }
+    }
+    printf("Contacts: %zu, rooms: %zu, memberships: %zu, users in rooms: %zu (setup %.1f ms)\n",
+           contactCount, roomCount, memberships, index.userCount(), msSince(start));
+
+    // presence storm, room scan
+    size_t updated = 0;
+    start = Clock::now();
+    for (uint64_t userid = 1; userid <= contactCount; userid++)
+    {
+        for (auto& room: rooms)
+        {
+            auto it = room.peers.find(userid);
+            if (it == room.peers.end())
+                continue;
+            it->second->presence = 1;
+            updated++;
+        }
+    }
+    double scanMs = msSince(start);
+    printf("%-12s %9.2f ms, %zu members updated, %.0f ns per PEERSTATUS\n",
+           "room scan", scanMs, updated, scanMs * 1e6 / contactCount);
+
+    size_t indexUpdated = 0;
+    start = Clock::now();
+    for (uint64_t userid = 1; userid <= contactCount; userid++)
+    {
+        auto entry = index.find(userid);
+        if (!entry)
+            continue;
+        for (auto member: entry->members)
+        {
+            member->presence = 2;
+            indexUpdated++;
+        }
+    }
+    double indexMs = msSince(start);
+    printf("%-12s %9.2f ms, %zu members updated, %.0f ns per PEERSTATUS (%.0fx faster)\n",
+           "index", indexMs, indexUpdated, indexMs * 1e6 / contactCount, scanMs / indexMs);
+    if (updated != indexUpdated)
+    {
+        fprintf(stderr, "Index updated %zu members instead of %zu\n", indexUpdated, updated);
+        return 1;
+    }
+
+    // attribute subscriptions: one per member before, one per user now
+    printf("name/email subscriptions: %zu per member, %zu per user\n", memberships * 2, index.userCount() * 2);
+
+    // cost of maintaining the index, i.e. when rooms are deleted
+    start = Clock::now();
+    for (auto& room: rooms)
+    {
+        for (auto& peer: room.peers)
+        {
+            if (index.remove(peer.first, peer.second))
+                index.erase(peer.first);
+            delete peer.second;
+        }
+        room.peers.clear();
+    }
+    double removeMs = msSince(start);
+    printf("%-12s %9.2f ms for %zu members, %.0f ns per member\n",
+           "remove all", removeMs, memberships, removeMs * 1e6 / memberships);
+    return index.userCount() ? 1 : 0;
+}
@@ -0,0 +1,280 @@
+/**
+ * @file msgPayloadBench.cpp
+ * @brief Allocations and time spent creating app-facing message objects from
+ * the history of an attachment-heavy chat, when the JSON of attachment,
+ * contact and contains-meta messages is parsed for every object (the previous
+ * implementation) and when the parsed payload is cached in the chatd::Message.
+ *
+ * The parsers mirror the allocation pattern of JSonUtils (rapidjson document,
+ * one object per node/contact with its strings), since the real ones need the
+ * Mega SDK.
+ *
+ * Usage: msgPayloadBench [msgCount=10000] [loadCount=5]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <random>
+#include <vector>
+#include <memory>
+#include <rapidjson/document.h>
+#include "chatdMsg.h"
+#include "histogram.h"
+
+using namespace chatd;
+using namespace karere;
+typedef LatencyHistogram::Clock Clock;
+
+static size_t gAllocCount = 0;
+
+void* operator new(size_t size)
+{
+    gAllocCount++;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+struct Node
+{
+    uint64_t handle;
+    std::string name;
+    std::string key;
+    std::string fingerprint;
+    int64_t size;
+};
+typedef std::vector<Node> NodeList;
+
+struct User
+{
+    uint64_t handle;
+    std::string email;
+    std::string name;
+};
+typedef std::vector<User> UserList;
+
+struct Meta
+{
+    std::string url;
+    std::string title;
+    std::string desc;
+};
+
+static NodeList* parseNodes(const std::string& json)
+{
+    rapidjson::Document doc;
+    doc.Parse(json.c_str());
+    if (doc.HasParseError() || !doc.IsArray())
+        return nullptr;
+    NodeList* nodes = new NodeList;
+    for (rapidjson::SizeType i = 0; i < doc.Size(); i++)
+    {
+        const rapidjson::Value& file = doc[i];
+        Node node;
+        node.handle = std::hash<std::string>()(file["h"].GetString());
+        node.name = file["name"].GetString();
+        std::vector<int32_t> key;
+        const rapidjson::Value& k = file["k"];
+        for (rapidjson::SizeType j = 0; j < k.Size(); j++)
+            key.push_back(k[j].GetInt());
+        node.key.assign((const char*)key.data(), key.size() * 4);
+        node.fingerprint = file["hash"].GetString();
+        node.size = file["s"].GetInt64();
+        nodes->push_back(std::move(node));
+    }
+    return nodes;
+}
+
+static UserList* parseUsers(const std::string& json)
+{
+    rapidjson::Document doc;
+    doc.Parse(json.c_str());
+    if (doc.HasParseError() || !doc.IsArray())
+        return nullptr;
+    UserList* users = new UserList;
+    for (rapidjson::SizeType i = 0; i < doc.Size(); i++)
+    {
+        const rapidjson::Value& user = doc[i];
+        users->push_back(User{std::hash<std::string>()(user["u"].GetString()),
+                              user["email"].GetString(), user["name"].GetString()});
+    }
+    return users;
+}
+
+static Meta* parseMeta(const std::string& json)
+{
+    rapidjson::Document doc;
+    doc.Parse(json.c_str());
+    if (doc.HasParseError() || !doc.IsObject())
+        return nullptr;
+    const rapidjson::Value& extra = doc["extra"][0];
+    return new Meta{extra["url"].GetString(), extra["t"].GetString(), extra["d"].GetString()};
+}
+
+// Equivalent of MegaChatMessagePayload
+struct Payload: public Message::CachedPayload
+{
+    std::shared_ptr<const NodeList> nodes;
+    std::shared_ptr<const UserList> users;
+    std::shared_ptr<const Meta> meta;
+};
+
+static void parseInto(const Message& msg, Payload& payload)
+{
+    std::string text = msg.toText();
+    switch (msg.type)
+    {
+        case Message::kMsgAttachment: payload.nodes.reset(parseNodes(text)); break;
+        case Message::kMsgContact: payload.users.reset(parseUsers(text)); break;
+        case Message::kMsgContainsMeta: payload.meta.reset(parseMeta(text.substr(1))); break;
+        default: break;
+    }
+}
+
+static std::shared_ptr<const Payload> cachedPayload(const Message& msg)
+{
+    auto cached = msg.cachedPayload();
+    if (cached)
+        return std::static_pointer_cast<const Payload>(cached);
+    auto payload = std::make_shared<Payload>();
+    parseInto(msg, *payload);
+    msg.setCachedPayload(payload);
+    return payload;
+}
+
+// Equivalent of MegaChatMessagePrivate, holding the parsed contents
+struct AppMessage
+{
+    Payload payload;
+    AppMessage(const Message& msg, bool useCache)
+    {
+        if (useCache)
+        {
+            auto cached = cachedPayload(msg);
+            payload.nodes = cached->nodes;
+            payload.users = cached->users;
+            payload.meta = cached->meta;
+        }
+        else
+        {
+            parseInto(msg, payload);
+        }
+    }
+    size_t itemCount() const
+    {
+        return (payload.nodes ? payload.nodes->size() : 0) + (payload.users ? payload.users->size() : 0)
+            + (payload.meta ? 1 : 0);
+    }
+};
+
+static std::string randomString(std::mt19937& rng, size_t len)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    std::string ret(len, ' ');
+    for (auto& c: ret)
+        c = chars[rng() % (sizeof(chars) - 1)];
+    return ret;
+}
+
+static Message* makeMessage(std::mt19937& rng, uint64_t msgid)
+{
+    std::string json;
+    unsigned char type;
+    unsigned kind = rng() % 10;
+    if (kind < 7)
+    {
+        type = Message::kMsgAttachment;
+        json = "[";
+        for (unsigned i = 0, count = 1 + rng() % 3; i < count; i++)
+        {
+            json.append(i ? "," : "").append("{\"h\":\"").append(randomString(rng, 8))
+                .append("\",\"name\":\"").append(randomString(rng, 24)).append(".jpg\",\"k\":[");
+            for (int k = 0; k < 8; k++)
+                json.append(k ? "," : "").append(std::to_string((int32_t)rng()));
+            json.append("],\"hash\":\"").append(randomString(rng, 36)).append("\",\"s\":")
+                .append(std::to_string(rng() % 10000000)).append(",\"t\":0,\"ts\":1550000000}");
+        }
+        json.append("]");
+    }
+    else if (kind < 9)
+    {
+        type = Message::kMsgContact;
+        json = "[{\"u\":\"" + randomString(rng, 11) + "\",\"email\":\"" + randomString(rng, 12)
+            + "@mega.nz\",\"name\":\"" + randomString(rng, 16) + "\"}]";
+    }
+    else
+    {
+        type = Message::kMsgContainsMeta;
+        // the JSON is preceded by the type of metadata
+        json = std::string(1, 0) + "{\"textMessage\":\"see https://mega.nz\",\"extra\":[{\"url\":\"https://mega.nz\",\"t\":\""
+            + randomString(rng, 30) + "\",\"d\":\"" + randomString(rng, 80) + "\"}]}";
+    }
+    // special messages have a 2-byte binary prefix
+    std::string buf(2, 0);
+    buf[1] = type;
+    buf.append(json);
+    return new Message(msgid, 1, 1550000000, 0, buf.data(), buf.size(), false, 1, type);
+}
+
+static void load(const char* label, const std::vector<Message*>& history, size_t loadCount, bool useCache)
+{
+    size_t items = 0;
+    size_t allocsBefore = gAllocCount;
+    auto start = Clock::now();
+    for (size_t i = 0; i < loadCount; i++)
+    {
+        // each history load creates one object per message, which the app keeps
+        // until the next load
+        std::vector<std::unique_ptr<AppMessage>> objects;
+        objects.reserve(history.size());
+        for (auto msg: history)
+        {
+            objects.emplace_back(new AppMessage(*msg, useCache));
+            items += objects.back()->itemCount();
+        }
+    }
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    size_t allocs = gAllocCount - allocsBefore;
+    size_t objects = history.size() * loadCount;
+    printf("%-8s %9.1f ms, %9zu allocations (%.1f per message object), %zu items\n",
+           label, ms, allocs, (double)allocs / objects, items);
+}
+
+int main(int argc, char** argv)
+{
+    size_t msgCount = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 10000;
+    size_t loadCount = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 5;
+
+    std::mt19937 rng(12345);
+    std::vector<Message*> history;
+    history.reserve(msgCount);
+    for (size_t i = 0; i < msgCount; i++)
+        history.push_back(makeMessage(rng, i + 1));
+    printf("%zu messages, %zu history loads\n", msgCount, loadCount);
+
+    load("parse", history, loadCount, false);
+    // the first load with the cache parses every message, the rest reuse it
+    load("cached", history, loadCount, true);
+
+    // an edit must invalidate the cached payload
+    Message& msg = *history[0];
+    auto before = cachedPayload(msg);
+    if (cachedPayload(msg) != before)
+    {
+        fprintf(stderr, "Payload was not cached\n");
+        return 1;
+    }
+    msg.updated = 10;
+    if (cachedPayload(msg) == before)
+    {
+        fprintf(stderr, "Payload was not invalidated by an edit\n");
+        return 1;
+    }
+
+    for (auto m: history)
+        delete m;
+    return 0;
+}
@@ -0,0 +1,275 @@
+/**
+ * @file msgSearchBench.cpp
+ * @brief Measures the cost of the full-text message search index:
+ *  - ingest: messages stored via the DbWriter, with and without the index
+ *    triggers, as seen by the app thread and in total throughput
+ *  - backfill: indexing of history that existed before the index was enabled
+ *  - query: latency of searches in all chats and in a single chat, run in
+ *    the calling thread and by the search worker, over its read connection
+ *
+ * Usage: msgSearchBench [msgCount=1000000] [queryCount=2000] [dbDir=.]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include "dbWriter.h"
+#include "msgSearchIndex.h"
+#include "histogram.h"
+
+namespace karere
+{
+// normally defined in karereCommon.cpp, which depends on the Mega SDK
+bool gDbWriteBehind = true;
+}
+
+using namespace karere;
+typedef LatencyHistogram::Clock Clock;
+
+enum { kChatCount = 200 };
+static const char* kSchema =
+    "CREATE TABLE vars(name text not null primary key, value blob);"
+    "CREATE TABLE history(idx int not null, chatid int64 not null, msgid int64 not null,"
+    " userid int64, keyid int not null, type tinyint, updated smallint, ts int,"
+    " is_encrypted tinyint, data blob, backrefid int64 not null, UNIQUE(chatid,msgid), UNIQUE(chatid,idx));";
+
+class MsgGenerator
+{
+protected:
+    std::mt19937 mRng;
+    std::vector<std::string> mWords;
+    // word frequencies follow a power law, like in natural language
+    std::discrete_distribution<size_t> mWordDist;
+    std::vector<double> weights()
+    {
+        std::vector<double> result(mWords.size());
+        for (size_t i = 0; i < result.size(); i++)
+            result[i] = 1.0 / (i + 1);
+        return result;
+    }
+    std::vector<std::string> makeWords(size_t count)
+    {
+        static const char* syllables[] = { "ka", "re", "mi", "to", "su", "la", "ne", "po",
+            "chi", "da", "ver", "ban", "gor", "lin", "mas", "que" };
+        std::vector<std::string> result;
+        std::uniform_int_distribution<int> len(1, 4);
+        std::uniform_int_distribution<size_t> syl(0, 15);
+        for (size_t i = 0; i < count; i++)
+        {
+            std::string word;
+            for (int j = len(mRng); j > 0; j--)
+                word += syllables[syl(mRng)];
+            result.push_back(word);
+        }
+        return result;
+    }
+
+public:
+    MsgGenerator(size_t vocabulary = 20000)
+    : mRng(12345), mWords(makeWords(vocabulary))
+    {
+        auto w = weights();
+        mWordDist = std::discrete_distribution<size_t>(w.begin(), w.end());
+    }
+    std::string word() { return mWords[mWordDist(mRng)]; }
+    std::string message()
+    {
+        std::uniform_int_distribution<int> len(3, 25);
+        std::string result;
+        for (int i = len(mRng); i > 0; i--)
+        {
+            if (!result.empty())
+                result += ' ';
+            result += word();
+        }
+        return result;
+    }
+    uint64_t chatid() { return std::uniform_int_distribution<uint64_t>(1, kChatCount)(mRng); }
+};
+
+static double secsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void openDb(SqliteDb& db, const std::string& path)
+{
+    remove(path.c_str());
+    if (!db.open(path.c_str(), false))
+    {
+        fprintf(stderr, "Can't open db %s\n", path.c_str());
+        exit(1);
+    }
+    db.simpleQuery(kSchema);
+}
+
+// Stores the messages as chatd does, through the write-behind queue
+static void ingest(SqliteDb& db, size_t msgCount, const char* label)
+{
+    MsgGenerator gen;
+    std::vector<int> nextIdx(kChatCount + 1, 0);
+    DbWriter writer(db);
+    writer.start();
+    auto start = Clock::now();
+    for (size_t i = 0; i < msgCount; i++)
+    {
+        uint64_t chatid = gen.chatid();
+        int idx = nextIdx[chatid]++;
+        std::string text = gen.message();
+        writer.enqueue(chatid, DbWriter::kMutAddMsg, [chatid, idx, i, text](SqliteDb& aDb)
+        {
+            aDb.query("insert into history(idx, chatid, msgid, userid, keyid, type, updated,"
+                      " ts, is_encrypted, data, backrefid) values(?,?,?,1,0,1,0,?,0,?,0)",
+                      idx, chatid, (uint64_t)i + 1, (int)i, text);
+        });
+    }
+    double enqueueSecs = secsSince(start);
+    writer.flush();
+    db.commit();
+    double totalSecs = secsSince(start);
+    auto& stats = writer.stats();
+    printf("%-22s %8.0f msg/s total, app thread: avg %llu us, p99 %llu us (%.1f s enqueue, %.1f s total)\n",
+           label, msgCount / totalSecs,
+           (unsigned long long)stats.appThread.avgUs(),
+           (unsigned long long)stats.appThread.percentileUs(99),
+           enqueueSecs, totalSecs);
+    writer.stop();
+}
+
+static void backfill(SqliteDb& db, MsgSearchIndex& index, size_t msgCount)
+{
+    auto start = Clock::now();
+    LatencyHistogram chunkTime;
+    size_t chunks = 0;
+    bool more = true;
+    while (more)
+    {
+        LatencyHistogram::Scope timer(chunkTime);
+        more = index.backfill(db);
+        chunks++;
+    }
+    db.commit();
+    double secs = secsSince(start);
+    printf("%-22s %8.0f msg/s, %zu chunks of %d, per chunk: avg %llu us, p99 %llu us\n",
+           "backfill", msgCount / secs, chunks, (int)MsgSearchIndex::kBackfillChunk,
+           (unsigned long long)chunkTime.avgUs(),
+           (unsigned long long)chunkTime.percentileUs(99));
+}
+
+static void query(MsgSearchIndex& index, size_t queryCount, bool singleChat)
+{
+    MsgGenerator gen;
+    LatencyHistogram latency;
+    size_t totalResults = 0;
+    std::uniform_int_distribution<int> wordCount(1, 3);
+    std::mt19937 rng(54321);
+    auto start = Clock::now();
+    for (size_t i = 0; i < queryCount; i++)
+    {
+        std::string text;
+        for (int j = wordCount(rng); j > 0; j--)
+            text.append(gen.word()).append(" ");
+        // type-ahead: the last word is often incomplete
+        if (text.size() > 4 && (i & 1))
+            text.resize(text.size() - 3);
+
+        std::vector<MsgSearchIndex::Result> results;
+        LatencyHistogram::Scope timer(latency);
+        index.search(text, singleChat ? Id(gen.chatid()) : Id::inval(), 0, 50, results);
+        totalResults += results.size();
+    }
+    double secs = secsSince(start);
+    printf("%-22s %8.0f query/s, latency: avg %llu us, p50 %llu us, p99 %llu us, max %llu us, avg %.1f results\n",
+           singleChat ? "query (single chat)" : "query (all chats)", queryCount / secs,
+           (unsigned long long)latency.avgUs(),
+           (unsigned long long)latency.percentileUs(50),
+           (unsigned long long)latency.percentileUs(99),
+           (unsigned long long)latency.maxUs(),
+           (double)totalResults / queryCount);
+}
+
+// Same as query(), but through the search worker. The latency includes the
+// handoff to the worker and its commit of the main connection
+static void queryAsync(MsgSearchIndex& index, size_t queryCount, const std::string& dbPath)
+{
+    if (!index.startWorker(dbPath))
+    {
+        fprintf(stderr, "Can't start the search worker\n");
+        return;
+    }
+    MsgGenerator gen;
+    LatencyHistogram latency;
+    size_t totalResults = 0;
+    size_t errors = 0;
+    std::mutex mutex;
+    std::condition_variable cond;
+    auto start = Clock::now();
+    for (size_t i = 0; i < queryCount; i++)
+    {
+        bool done = false;
+        LatencyHistogram::Scope timer(latency);
+        index.searchAsync(gen.word(), Id::inval(), 0, 50,
+        [&](std::vector<MsgSearchIndex::Result>&& results, const std::string& error)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            totalResults += results.size();
+            if (!error.empty())
+                errors++;
+            done = true;
+            cond.notify_one();
+        });
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&done]() { return done; });
+    }
+    double secs = secsSince(start);
+    index.stopWorker();
+    printf("%-22s %8.0f query/s, latency: avg %llu us, p50 %llu us, p99 %llu us, max %llu us, avg %.1f results, %zu errors\n",
+           "query (worker)", queryCount / secs,
+           (unsigned long long)latency.avgUs(),
+           (unsigned long long)latency.percentileUs(50),
+           (unsigned long long)latency.percentileUs(99),
+           (unsigned long long)latency.maxUs(),
+           (double)totalResults / queryCount, errors);
+}
+
+int main(int argc, char** argv)
+{
+    size_t msgCount = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t queryCount = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 2000;
+    std::string dir = (argc > 3) ? argv[3] : ".";
+
+    printf("Messages: %zu in %d chats, queries: %zu\n", msgCount, (int)kChatCount, queryCount);
+    {
+        SqliteDb db;
+        openDb(db, dir + "/bench_noindex.db");
+        ingest(db, msgCount, "ingest (no index)");
+    }
+
+    SqliteDb db;
+    openDb(db, dir + "/bench_index.db");
+    MsgSearchIndex index(db);
+    if (!index.enable())
+    {
+        fprintf(stderr, "sqlite was built without FTS5\n");
+        return 1;
+    }
+    ingest(db, msgCount, "ingest (indexed)");
+
+    // Same history, but indexed after the fact
+    {
+        SqliteDb backfillDb;
+        openDb(backfillDb, dir + "/bench_backfill.db");
+        ingest(backfillDb, msgCount, "ingest (pre-backfill)");
+        MsgSearchIndex backfillIndex(backfillDb);
+        backfillIndex.enable();
+        backfill(backfillDb, backfillIndex, msgCount);
+    }
+
+    query(index, queryCount, false);
+    query(index, queryCount, true);
+    queryAsync(index, queryCount, dir + "/bench_index.db");
+    return 0;
+}
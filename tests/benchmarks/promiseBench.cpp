@@ -0,0 +1,143 @@
+/**
+ * @file promiseBench.cpp
+ * @brief Heap allocations and time per operation of the promise chains that
+ * are common in karere: continuations on already resolved promises (i.e.
+ * cached user attributes and keys), then/fail pairs on pending promises
+ * (i.e. requests, retries), and multi-step chains (i.e. msgDecrypt).
+ *
+ * Usage: promiseBench [iterations=1000000]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <string>
+#include <vector>
+#include "promise.h"
+#include "histogram.h"
+
+using namespace promise;
+typedef karere::LatencyHistogram::Clock Clock;
+
+static size_t gAllocCount = 0;
+
+// Counts the allocations. The replacements must not be inlined: gcc would
+// then see memory from operator new released with free(), and warn about it
+#ifdef __GNUC__
+    #define BENCH_NOINLINE __attribute__((noinline))
+#else
+    #define BENCH_NOINLINE
+#endif
+
+BENCH_NOINLINE void* operator new(size_t size)
+{
+    gAllocCount++;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+BENCH_NOINLINE void operator delete(void* ptr) noexcept { free(ptr); }
+BENCH_NOINLINE void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+static int gSink = 0;
+
+template <class F>
+static void bench(const char* label, size_t iterations, F&& func)
+{
+    size_t allocsBefore = gAllocCount;
+    auto start = Clock::now();
+    for (size_t i = 0; i < iterations; i++)
+        func((int)i);
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+    printf("%-34s %5.1f allocations, %6.1f ns\n", label, (double)(gAllocCount - allocsBefore) / iterations, ns);
+}
+
+int main(int argc, char** argv)
+{
+    size_t iterations = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 1000000;
+    Promise<int> resolved(1);
+    void* self = &iterations;
+
+    bench("construct resolved", iterations, [](int i)
+    {
+        Promise<int> pms(i);
+        gSink += pms.value();
+    });
+
+    bench("then on resolved (value)", iterations, [&](int i)
+    {
+        auto pms = resolved.then([i](int x) { return x + i; });
+        gSink += pms.value();
+    });
+
+    bench("then on resolved (promise)", iterations, [&](int i)
+    {
+        auto pms = resolved.then([&resolved, i](int) { return resolved; });
+        gSink += pms.value();
+    });
+
+    bench("then/fail on resolved", iterations, [&](int i)
+    {
+        resolved.then([i, self](int x) { gSink += x + i + (self != nullptr); })
+        .fail([](const Error&) { gSink++; });
+    });
+
+    bench("then/fail on pending", iterations, [self](int i)
+    {
+        Promise<int> pms;
+        pms.then([i, self](int x) { gSink += x + i + (self != nullptr); })
+        .fail([](const Error&) { gSink++; });
+        pms.resolve(i);
+    });
+
+    bench("3-step chain on pending", iterations, [self](int i)
+    {
+        Promise<int> pms;
+        pms.then([self](int x) { return x + (self != nullptr); })
+        .then([](int x) { return std::to_string(x); })
+        .then([i](const std::string& str) { gSink += (int)str.size() + i; })
+        .fail([](const Error&) { gSink++; });
+        pms.resolve(i);
+    });
+
+    bench("reject through then to fail", iterations, [](int i)
+    {
+        Promise<int> pms;
+        pms.then([](int x) { gSink += x; })
+        .fail([i](const Error& err) { gSink += err.code() + i; });
+        pms.reject("error", 1, 1);
+    });
+
+    // msgDecrypt with the sender and signing keys cached: chained through
+    // when(), and checking the already resolved promises instead
+    Promise<std::shared_ptr<std::string>> sendKey(std::make_shared<std::string>("key"));
+    std::string edKeyData("edkey");
+    Promise<std::string*> edKey(&edKeyData);
+    bench("decrypt, chained (cached keys)", iterations, [&](int i)
+    {
+        auto ctx = std::make_shared<std::pair<std::string, std::string>>();
+        auto symPms = sendKey.then([ctx](const std::shared_ptr<std::string>& key) { ctx->first = *key; });
+        auto edPms = edKey.then([ctx](std::string* key) { ctx->second = *key; });
+        when(symPms, edPms)
+        .then([ctx, i]() -> Promise<int> { return (int)(ctx->first.size() + ctx->second.size()) + i; })
+        .then([](int x) { gSink += x; });
+    });
+    bench("decrypt, direct (cached keys)", iterations, [&](int i)
+    {
+        Promise<int> pms = (sendKey.succeeded() && edKey.succeeded())
+            ? Promise<int>((int)(sendKey.value()->size() + edKey.value()->size()) + i)
+            : Promise<int>(Error("not cached"));
+        pms.then([](int x) { gSink += x; });
+    });
+
+    bench("when of 4 pending", iterations / 10, [](int i)
+    {
+        std::vector<Promise<int>> promises(4);
+        auto all = when(promises);
+        all.then([i]() { gSink += i; });
+        for (auto& pms: promises)
+            pms.resolve(i);
+    });
+
+    return (gSink == 42) ? 1 : 0; // keeps gSink alive
+}
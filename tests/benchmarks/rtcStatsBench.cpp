@@ -0,0 +1,224 @@
+/**
+ * @file rtcStatsBench.cpp
+ * @brief Memory and serialization time of the call stats of long calls, when
+ * every sample is a heap-allocated Sample serialized with std::to_string (the
+ * previous implementation) and with the bounded, columnar SampleBuffer.
+ * Also checks that downsampling preserves the byte counts and the last sample.
+ *
+ * Usage: rtcStatsBench [hours=1,3,8] [samplePeriodMs=2000] [capacity=1024]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "sampleBuffer.h"
+#include "histogram.h"
+
+using namespace rtcModule::stats;
+typedef karere::LatencyHistogram::Clock Clock;
+
+static double msSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// What the Recorder produces: slowly varying values and per-period byte counts
+static void nextSample(Sample& s, std::mt19937& rng, long periodMs)
+{
+    std::uniform_int_distribution<int> jitter(-3, 3);
+    s.ts += periodMs;
+    auto bw = [&rng, periodMs](BwInfo& info, long kbps)
+    {
+        info.bs = kbps * 128 * periodMs / 1000 + rng() % 1000;
+        info.bps = kbps + rng() % 50;
+        info.abps = (info.abps * 4 + info.bps) / 5;
+    };
+    bw(s.cstats.s, 1200); bw(s.cstats.r, 1100);
+    bw(s.vstats.s, 1000); bw(s.vstats.r, 900);
+    bw(s.astats.s, 40); bw(s.astats.r, 40);
+    s.cstats.rtt = 80 + jitter(rng);
+    s.vstats.s.rtt = 85 + jitter(rng);
+    s.vstats.s.fps = 30;
+    s.vstats.s.cfps = 30;
+    s.vstats.s.width = 1280;
+    s.vstats.s.height = 720;
+    s.vstats.s.el = 20 + jitter(rng) / 10.0f;
+    s.vstats.s.gbps = 1000 + jitter(rng);
+    s.vstats.s.gabps = 1000;
+    s.vstats.s.bwav = 2500;
+    s.vstats.r.fps = 29 + jitter(rng) / 3;
+    s.vstats.r.jtr = 15 + jitter(rng);
+    s.vstats.r.dly = 120 + jitter(rng);
+    s.vstats.r.pl += (rng() % 10 == 0);
+    s.vstats.r.width = 1280;
+    s.vstats.r.height = 720;
+    s.astats.rtt = 80 + jitter(rng);
+    s.astats.jtr = 10 + jitter(rng);
+    s.astats.pl += (rng() % 20 == 0);
+}
+
+// The previous RtcStats::toJson, for the samples part
+static const char* decToString(float v)
+{
+    static char buf[128];
+    snprintf(buf, 127, "%.1f", v);
+    return buf;
+}
+#define JSON_SUBOBJ(name) json+="\"" name "\":{";
+#define JSON_END_SUBOBJ() json[json.size()-1]='}'; json+=','
+#define JSON_ADD_SAMPLES_WITH_CONV(path, name, conv)   \
+    json.append("\"" #name "\":[");    \
+    if (samples.empty())               \
+        json+=']';                     \
+    else                               \
+    {                                  \
+        for (auto sample: samples)     \
+            json.append(conv(sample->path name))+=","; \
+        json[json.size()-1]=']';       \
+    }\
+    json+=',';
+#define JSON_ADD_SAMPLES(path, name) JSON_ADD_SAMPLES_WITH_CONV(path, name, std::to_string)
+#define JSON_ADD_DEC_SAMPLES(path, name) JSON_ADD_SAMPLES_WITH_CONV(path, name, decToString)
+#define JSON_ADD_BWINFO(path)           \
+    JSON_ADD_SAMPLES(path., bs);        \
+    JSON_ADD_SAMPLES(path., bps);       \
+    JSON_ADD_SAMPLES(path., abps)
+
+static void oldToJson(const std::vector<Sample*>& samples, std::string& json)
+{
+    json.reserve(10240);
+    json = "{";
+    JSON_SUBOBJ("samples");
+        JSON_ADD_SAMPLES(, ts);
+        JSON_SUBOBJ("c");
+            JSON_ADD_SAMPLES(cstats., rtt);
+                JSON_SUBOBJ("s");
+                    JSON_ADD_BWINFO(cstats.s);
+                JSON_END_SUBOBJ();
+                JSON_SUBOBJ("r");
+                    JSON_ADD_BWINFO(cstats.r);
+                JSON_END_SUBOBJ();
+        JSON_END_SUBOBJ();
+        JSON_SUBOBJ("v");
+            JSON_SUBOBJ("s");
+                JSON_ADD_BWINFO(vstats.s);
+                JSON_ADD_SAMPLES(vstats.s., gbps);
+                JSON_ADD_SAMPLES(vstats.s., gabps);
+                JSON_ADD_SAMPLES(vstats.s., rtt);
+                JSON_ADD_SAMPLES(vstats.s., fps);
+                JSON_ADD_SAMPLES(vstats.s., cfps);
+                JSON_ADD_SAMPLES(vstats.s., cjtr);
+                JSON_ADD_SAMPLES(vstats.s., width);
+                JSON_ADD_SAMPLES(vstats.s., height);
+                JSON_ADD_DEC_SAMPLES(vstats.s., el);
+                JSON_ADD_SAMPLES(vstats.s., lcpu);
+                JSON_ADD_SAMPLES(vstats.s., lbw);
+                JSON_ADD_SAMPLES(vstats.s., bwav);
+            JSON_END_SUBOBJ();
+            JSON_SUBOBJ("r");
+                JSON_ADD_BWINFO(vstats.r);
+                JSON_ADD_SAMPLES(vstats.r., fps);
+                JSON_ADD_SAMPLES(vstats.r., jtr);
+                JSON_ADD_SAMPLES(vstats.r., dly);
+                JSON_ADD_SAMPLES(vstats.r., pl);
+                JSON_ADD_SAMPLES(vstats.r., width);
+                JSON_ADD_SAMPLES(vstats.r., height);
+            JSON_END_SUBOBJ();
+        JSON_END_SUBOBJ();
+        JSON_SUBOBJ("a");
+            JSON_ADD_SAMPLES(astats., rtt);
+            JSON_ADD_SAMPLES(astats., jtr);
+            JSON_ADD_SAMPLES(astats., pl);
+            JSON_SUBOBJ("s");
+                JSON_ADD_BWINFO(astats.s);
+            JSON_END_SUBOBJ();
+            JSON_SUBOBJ("r");
+                JSON_ADD_BWINFO(astats.r);
+            JSON_END_SUBOBJ();
+        JSON_END_SUBOBJ();
+    JSON_END_SUBOBJ();
+    json[json.size()-1] = '}';
+}
+
+static void run(double hours, long periodMs, size_t capacity)
+{
+    size_t count = (size_t)(hours * 3600 * 1000 / periodMs);
+    std::mt19937 rng(12345);
+    Sample curr = Sample();
+    std::vector<Sample*> samples;
+    SampleBuffer buffer(capacity);
+    int64_t totalBytes = 0;
+    double oldPushMs = 0, newPushMs = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        nextSample(curr, rng, periodMs);
+        totalBytes += curr.vstats.r.bs;
+        auto start = Clock::now();
+        samples.push_back(new Sample(curr));
+        oldPushMs += msSince(start);
+        start = Clock::now();
+        buffer.push(curr);
+        newPushMs += msSince(start);
+    }
+
+    // the samples of the previous implementation were never freed, and each
+    // allocation has some overhead on top of sizeof(Sample)
+    size_t oldMem = samples.capacity() * sizeof(Sample*) + samples.size() * (sizeof(Sample) + 16);
+    size_t newMem = buffer.capacity() * SampleBuffer::kColumnCount * sizeof(int32_t);
+
+    std::string oldJson;
+    auto start = Clock::now();
+    oldToJson(samples, oldJson);
+    double oldMs = msSince(start);
+
+    std::string newJson;
+    size_t chunks = 0;
+    start = Clock::now();
+    newJson.reserve(buffer.size() * SampleBuffer::kColumnCount * 6);
+    buffer.writeJson([&newJson, &chunks](const char* data, size_t len) { newJson.append(data, len); chunks++; }, false);
+    double newMs = msSince(start);
+
+    std::string deltaJson;
+    start = Clock::now();
+    buffer.writeJson([&deltaJson](const char* data, size_t len) { deltaJson.append(data, len); }, true);
+    double deltaMs = msSince(start);
+
+    int64_t bufferBytes = 0;
+    for (size_t i = 0; i < buffer.size(); i++)
+        bufferBytes += buffer.value(SampleBuffer::kVideoRxBs, i);
+    Sample last;
+    buffer.get(buffer.size() - 1, last);
+    bool lastOk = (last.ts == curr.ts) && (last.vstats.r.pl == curr.vstats.r.pl)
+        && (fabs(last.vstats.s.el - curr.vstats.s.el) < 0.05f);
+    // without downsampling, the output must be the same as the old one
+    bool jsonOk = buffer.downsampleCount() || (oldJson == "{" + newJson + "}");
+
+    printf("%4.1f h, %6zu samples | old: %8.1f KB, push %6.2f ms, json %7.2f ms, %8.1f KB"
+           " | new: %zu samples (%u downsamples), %6.1f KB, push %5.2f ms, json %5.2f ms, %7.1f KB"
+           " in %zu chunks, delta %5.2f ms, %7.1f KB | %s\n",
+        hours, count, oldMem / 1024.0, oldPushMs, oldMs, oldJson.size() / 1024.0,
+        buffer.size(), buffer.downsampleCount(), newMem / 1024.0, newPushMs, newMs,
+        newJson.size() / 1024.0, chunks, deltaMs, deltaJson.size() / 1024.0,
+        (bufferBytes == totalBytes && lastOk && jsonOk) ? "ok" : "MISMATCH");
+
+    for (auto sample: samples)
+        delete sample;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<double> hours;
+    std::string hoursArg = (argc > 1) ? argv[1] : "1,3,8";
+    for (char* tok = strtok(&hoursArg[0], ","); tok; tok = strtok(nullptr, ","))
+        hours.push_back(strtod(tok, nullptr));
+    long periodMs = (argc > 2) ? strtol(argv[2], nullptr, 10) : 2000;
+    size_t capacity = (argc > 3) ? (size_t)strtoul(argv[3], nullptr, 10) : (size_t)SampleBuffer::kDefaultCapacity;
+    // a short call that fits in the buffer, to check the output against the old one
+    run(0.5, periodMs, capacity);
+    for (double h: hours)
+        run(h, periodMs, capacity);
+    return 0;
+}
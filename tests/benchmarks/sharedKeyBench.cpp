@@ -0,0 +1,163 @@
+/**
+ * @file sharedKeyBench.cpp
+ * @brief Key rotation in many overlapping group chats: number of Cu25519
+ * shared secrets computed and time spent, when each chat has its own cache of
+ * symmetric keys (the previous implementation) and when all chats share the
+ * client-wide SharedKeyCache. Also shows the effect of some peers changing
+ * their Cu25519 key between rotation rounds.
+ *
+ * crypto_scalarmult is replaced by a stand-in of similar cost, since the
+ * benchmarks don't depend on libsodium.
+ *
+ * Usage: sharedKeyBench [userCount=2000] [roomCount=500] [avgRoomSize=20] [rounds=3]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <vector>
+#include <set>
+#include "sharedKeyCache.h"
+#include "histogram.h"
+
+using namespace karere;
+typedef LatencyHistogram::Clock Clock;
+
+struct SendKey
+{
+    unsigned char data[16];
+};
+
+static const std::string kChatPad("strongvelope pairwise key\x01");
+static size_t gDerivations = 0;
+
+// Stand-in for crypto_scalarmult + deriveSharedKey, roughly as expensive
+// as a Curve25519 scalar multiplication (tens of microseconds)
+static std::shared_ptr<SendKey> deriveKey(uint64_t userid, uint64_t keyVersion, const std::string& pad)
+{
+    gDerivations++;
+    uint64_t state = userid * 0x9E3779B97F4A7C15ULL ^ keyVersion ^ std::hash<std::string>()(pad);
+    for (int i = 0; i < 20000; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+    }
+    auto key = std::make_shared<SendKey>();
+    memcpy(key->data, &state, sizeof(state));
+    memcpy(key->data + sizeof(state), &state, sizeof(state));
+    return key;
+}
+
+static size_t gSink = 0;
+
+static std::shared_ptr<SendKey> computeSymmetricKey(SharedKeyCache<SendKey>& cache,
+    const std::vector<uint64_t>& keyVersions, uint64_t userid, const std::string& pad)
+{
+    auto key = cache.get(userid, pad);
+    if (key)
+        return key;
+    key = deriveKey(userid, keyVersions[userid], pad);
+    cache.put(userid, pad, key);
+    return key;
+}
+
+static double msSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    size_t userCount = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 2000;
+    size_t roomCount = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 500;
+    size_t avgRoomSize = (argc > 3) ? strtoul(argv[3], nullptr, 10) : 20;
+    size_t rounds = (argc > 4) ? strtoul(argv[4], nullptr, 10) : 3;
+
+    // room sizes are skewed: most groups are small, a few are large
+    std::mt19937 rng(12345);
+    std::geometric_distribution<size_t> roomSize(1.0 / avgRoomSize);
+    std::uniform_int_distribution<uint64_t> user(0, userCount - 1);
+    std::vector<std::vector<uint64_t>> rooms(roomCount);
+    size_t memberships = 0;
+    for (auto& room: rooms)
+    {
+        std::set<uint64_t> members;
+        size_t size = std::min<size_t>(2 + roomSize(rng), userCount);
+        while (members.size() < size)
+            members.insert(user(rng));
+        room.assign(members.begin(), members.end());
+        memberships += room.size();
+    }
+    printf("Users: %zu, rooms: %zu, memberships: %zu, rotation rounds: %zu\n",
+           userCount, roomCount, memberships, rounds);
+
+    // which users change their Cu25519 key between rounds (1%)
+    std::vector<std::vector<uint64_t>> keyChanges(rounds);
+    for (auto& changes: keyChanges)
+        for (size_t i = 0; i < userCount / 100; i++)
+            changes.push_back(user(rng));
+
+    std::vector<uint64_t> keyVersions(userCount, 0);
+    std::vector<SharedKeyCache<SendKey>> perRoom(roomCount);
+    auto start = Clock::now();
+    for (size_t round = 0; round < rounds; round++)
+    {
+        for (size_t i = 0; i < roomCount; i++)
+        {
+            // a rotation encrypts the new key to every member
+            for (auto userid: rooms[i])
+                gSink += computeSymmetricKey(perRoom[i], keyVersions, userid, kChatPad)->data[0];
+        }
+        for (auto userid: keyChanges[round])
+        {
+            keyVersions[userid]++;
+            for (auto& cache: perRoom)
+                cache.invalidate(userid);
+        }
+    }
+    double perRoomMs = msSince(start);
+    size_t perRoomDerivations = gDerivations;
+    uint64_t hits = 0, misses = 0;
+    for (auto& cache: perRoom)
+    {
+        hits += cache.stats().hits;
+        misses += cache.stats().misses;
+    }
+    printf("%-10s %9.1f ms, %7zu shared secrets computed, hit rate %.1f%%\n",
+           "per room", perRoomMs, perRoomDerivations, 100.0 * hits / (hits + misses));
+
+    gDerivations = 0;
+    keyVersions.assign(userCount, 0);
+    SharedKeyCache<SendKey> shared;
+    start = Clock::now();
+    for (size_t round = 0; round < rounds; round++)
+    {
+        for (auto& room: rooms)
+        {
+            for (auto userid: room)
+                gSink += computeSymmetricKey(shared, keyVersions, userid, kChatPad)->data[0];
+        }
+        for (auto userid: keyChanges[round])
+        {
+            keyVersions[userid]++;
+            shared.invalidate(userid);
+        }
+    }
+    double sharedMs = msSince(start);
+    printf("%-10s %9.1f ms, %7zu shared secrets computed, hit rate %.1f%% (%.0fx faster)\n",
+           "shared", sharedMs, gDerivations, 100.0 * shared.stats().hitRate(), perRoomMs / sharedMs);
+
+    // keys must be re-derived after a key change, with the new public key
+    uint64_t changed = rooms[0][0];
+    auto before = computeSymmetricKey(shared, keyVersions, changed, kChatPad);
+    keyVersions[changed]++;
+    shared.invalidate(changed);
+    if (shared.peek(changed, kChatPad)
+     || memcmp(computeSymmetricKey(shared, keyVersions, changed, kChatPad)->data, before->data, sizeof(before->data)) == 0)
+    {
+        fprintf(stderr, "Key of user was not invalidated by a Cu25519 key change\n");
+        return 1;
+    }
+    return (gSink == 42) ? 1 : 0; // keeps gSink alive
+}
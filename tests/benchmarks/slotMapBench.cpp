@@ -0,0 +1,120 @@
+/**
+ * @file slotMapBench.cpp
+ * @brief Cost of handle lookup and churn (remove + add) in the services
+ * handle store, as the number of live handles grows. Compares the slot map
+ * with std::unordered_map (the previous handle store) and std::map.
+ *
+ * Usage: slotMapBench [opCount=2000000]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include "slotMap.h"
+#include "histogram.h"
+
+using namespace karere;
+typedef LatencyHistogram::Clock Clock;
+typedef uint32_t Handle;
+
+struct Item
+{
+    unsigned short type = 0;
+    void* ptr = nullptr;
+};
+
+static double nsPerOp(Clock::time_point start, size_t ops)
+{
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ops;
+}
+
+// Adapts the std maps to the slot map interface, with a counter as the handle generator
+template <class M>
+struct StdStore
+{
+    M map;
+    Handle ctr = 0;
+    Handle insert(const Item& item) { Handle h = ++ctr; map.emplace(h, item); return h; }
+    Item* get(Handle h) { auto it = map.find(h); return (it == map.end()) ? nullptr : &it->second; }
+    bool remove(Handle h) { return map.erase(h) != 0; }
+};
+
+// Keeps the handles in an array, so picking a random live handle doesn't
+// depend on the store
+template <class S>
+static void bench(const char* label, size_t liveCount, size_t opCount)
+{
+    S store;
+    std::vector<Handle> live;
+    live.reserve(liveCount);
+    Item item;
+    for (size_t i = 0; i < liveCount; i++)
+        live.push_back(store.insert(item));
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<size_t> pick(0, liveCount - 1);
+    std::vector<size_t> picks(opCount);
+    for (auto& p: picks)
+        p = pick(rng);
+
+    size_t found = 0;
+    auto start = Clock::now();
+    for (auto p: picks)
+        found += (store.get(live[p]) != nullptr);
+    double lookupNs = nsPerOp(start, opCount);
+
+    start = Clock::now();
+    for (auto p: picks)
+    {
+        store.remove(live[p]);
+        live[p] = store.insert(item);
+    }
+    double churnNs = nsPerOp(start, opCount);
+    if (found != opCount)
+    {
+        fprintf(stderr, "%s: %zu of %zu lookups failed\n", label, opCount - found, opCount);
+        exit(1);
+    }
+    printf("%-14s %8zu live: lookup %6.1f ns, remove+add %6.1f ns\n", label, liveCount, lookupNs, churnNs);
+}
+
+static void checkStaleHandles()
+{
+    SlotMap<Item> store;
+    Item item;
+    std::vector<Handle> stale;
+    for (int i = 0; i < 100000; i++)
+    {
+        Handle h = store.insert(item);
+        if (!h || !store.remove(h))
+        {
+            fprintf(stderr, "Can't add/remove handle %u\n", h);
+            exit(1);
+        }
+        stale.push_back(h);
+    }
+    Handle current = store.insert(item);
+    for (auto h: stale)
+    {
+        if (store.get(h) || h == current)
+        {
+            fprintf(stderr, "Stale handle %u is valid\n", h);
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t opCount = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 2000000;
+    checkStaleHandles();
+    for (size_t live: { 100, 1000, 10000, 100000, 250000 })
+    {
+        bench<SlotMap<Item>>("slot map", live, opCount);
+        bench<StdStore<std::unordered_map<Handle, Item>>>("unordered_map", live, opCount);
+        bench<StdStore<std::map<Handle, Item>>>("map", live, opCount);
+    }
+    return 0;
+}
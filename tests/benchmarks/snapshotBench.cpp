@@ -0,0 +1,165 @@
+/**
+ * @file snapshotBench.cpp
+ * @brief Contention between a UI thread polling the chat list and the karere
+ * thread processing a burst of chatd messages. The karere thread holds
+ * sdkMutex while it processes each batch of events, so a getter that locks
+ * it (the previous implementation) waits for the whole batch, while a getter
+ * that reads the published SnapshotMap doesn't wait at all.
+ *
+ * Message processing is replaced by a busy loop of similar cost, and the list
+ * items by a struct with the same kind of members as MegaChatListItemPrivate.
+ *
+ * Usage: snapshotBench [roomCount=300] [burstSize=20000] [batchSize=100]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <memory>
+#include "snapshotMap.h"
+#include "histogram.h"
+
+using namespace karere;
+typedef LatencyHistogram::Clock Clock;
+
+struct ListItem
+{
+    uint64_t chatid;
+    std::string title;
+    std::string lastMsg;
+    int unreadCount = 0;
+    int64_t lastTs = 0;
+    bool archived = false;
+};
+
+static volatile uint64_t gSink = 0;
+
+// Stand-in for decrypting and storing a message (a few microseconds)
+static void processMessage(uint64_t msgid)
+{
+    uint64_t state = msgid;
+    for (int i = 0; i < 2000; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+    }
+    gSink = gSink + state;
+}
+
+struct Result
+{
+    double burstMs;
+    uint64_t polls;
+};
+
+template <class Poll, class Update>
+static Result run(const char* label, size_t roomCount, size_t burstSize, size_t batchSize,
+    std::mutex& sdkMutex, Poll&& poll, Update&& update)
+{
+    std::atomic<bool> done(false);
+    LatencyHistogram pollLatency;
+    std::thread ui([&]()
+    {
+        while (!done.load())
+        {
+            auto start = Clock::now();
+            gSink = gSink + poll();
+            pollLatency.record(start);
+            // a UI refreshing its chat list at a high rate
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+
+    auto start = Clock::now();
+    for (size_t batch = 0; batch < burstSize; batch += batchSize)
+    {
+        std::lock_guard<std::mutex> lock(sdkMutex);
+        for (size_t i = batch; i < batch + batchSize && i < burstSize; i++)
+        {
+            processMessage(i);
+            update(i % roomCount, i);
+        }
+    }
+    double burstMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    done = true;
+    ui.join();
+    printf("%-9s burst %7.1f ms | UI polls: %6llu, avg %5llu us, p50 %5llu us, p99 %6llu us, max %6llu us\n",
+           label, burstMs, (unsigned long long)pollLatency.count(),
+           (unsigned long long)pollLatency.avgUs(), (unsigned long long)pollLatency.percentileUs(50),
+           (unsigned long long)pollLatency.percentileUs(99), (unsigned long long)pollLatency.maxUs());
+    return Result{burstMs, pollLatency.count()};
+}
+
+int main(int argc, char** argv)
+{
+    size_t roomCount = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 300;
+    size_t burstSize = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 20000;
+    size_t batchSize = (argc > 3) ? strtoul(argv[3], nullptr, 10) : 100;
+    printf("%zu rooms, burst of %zu messages processed in batches of %zu\n", roomCount, burstSize, batchSize);
+
+    std::mutex sdkMutex;
+    std::vector<ListItem> rooms(roomCount);
+    for (size_t i = 0; i < roomCount; i++)
+    {
+        rooms[i].chatid = i + 1;
+        rooms[i].title = "Group chat " + std::to_string(i);
+    }
+
+    // getChatListItems(), locking sdkMutex and copying the items from the rooms
+    run("mutex", roomCount, burstSize, batchSize, sdkMutex,
+    [&]()
+    {
+        std::vector<std::unique_ptr<ListItem>> items;
+        std::lock_guard<std::mutex> lock(sdkMutex);
+        for (auto& room: rooms)
+        {
+            if (!room.archived)
+                items.emplace_back(new ListItem(room));
+        }
+        return items.size();
+    },
+    [&](size_t room, size_t msgid)
+    {
+        rooms[room].lastMsg = "message " + std::to_string(msgid);
+        rooms[room].lastTs = msgid;
+        rooms[room].unreadCount++;
+    });
+
+    // getChatListItems(), copying the items from the current snapshot
+    SnapshotMap<ListItem> snapshots;
+    for (auto& room: rooms)
+        snapshots.set(room.chatid, std::make_shared<ListItem>(room));
+    run("snapshot", roomCount, burstSize, batchSize, sdkMutex,
+    [&]()
+    {
+        std::vector<std::unique_ptr<ListItem>> items;
+        auto snapshot = snapshots.get();
+        snapshot->forEach([&items](uint64_t, const ListItem& item)
+        {
+            if (!item.archived)
+                items.emplace_back(new ListItem(item));
+        });
+        return items.size();
+    },
+    [&](size_t room, size_t msgid)
+    {
+        ListItem& item = rooms[room];
+        item.lastMsg = "message " + std::to_string(msgid);
+        item.lastTs = msgid;
+        item.unreadCount++;
+        snapshots.set(item.chatid, std::make_shared<ListItem>(item));
+    });
+
+    auto snapshot = snapshots.get();
+    if (snapshot->size() != roomCount || snapshot->version() != roomCount + burstSize
+     || snapshot->find(1)->unreadCount != rooms[0].unreadCount)
+    {
+        fprintf(stderr, "Snapshot doesn't match the room state\n");
+        return 1;
+    }
+    return 0;
+}
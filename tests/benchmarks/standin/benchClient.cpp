@@ -0,0 +1,264 @@
+#include "benchClient.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "base/gcm.h"
+#include "chatdDb.h"
+#include "userAttrCache.h"
+
+using namespace karere;
+
+namespace standin
+{
+static EventLoop* gKarereLoop = nullptr;
+
+static void postToLoop(void* msg, void* /*appCtx*/)
+{
+    gKarereLoop->postFromThread([msg]() { megaProcessMessage(msg); });
+}
+
+KarereOnLoop::KarereOnLoop(EventLoop& loop)
+{
+    assert(!gKarereLoop);
+    gKarereLoop = &loop;
+    // the debug log of every command would take most of the measured time
+    if (!getenv("KRLOG"))
+    {
+        for (auto& chan: gLogger.logChannels)
+            chan.logLevel = krLogLevelWarn;
+    }
+    globalInit(postToLoop);
+}
+
+KarereOnLoop::~KarereOnLoop()
+{
+    globalCleanup();
+    gKarereLoop = nullptr;
+}
+
+/** A connection over a Link. The connection completes, and frames and the
+ * close are delivered, asynchronously on the loop, as with a real socket */
+class LinkWebsocketsClient: public WebsocketsClientImpl
+{
+protected:
+    LinkWebsocketsIO& mIO;
+    std::shared_ptr<Link> mLink;
+    /** The callbacks of the link may run after this is deleted */
+    std::shared_ptr<bool> mAlive;
+    bool mConnected = false;
+
+public:
+    LinkWebsocketsClient(LinkWebsocketsIO& io, WebsocketsClient* client, std::shared_ptr<Link>&& link)
+        : WebsocketsClientImpl(&io.mMutex, client), mIO(io), mLink(std::move(link)),
+          mAlive(std::make_shared<bool>(true))
+    {
+        auto alive = mAlive;
+        mLink->onClientRecv = [this, alive](const std::string& frame)
+        {
+            if (!*alive)
+                return;
+            mIO.framesRecv++;
+            mIO.bytesRecv += frame.size();
+            // the clients get a writable buffer, as from libws
+            std::string data(frame);
+            wsHandleMsgCb(&data[0], data.size());
+        };
+        mLink->onClientClose = [this, alive]()
+        {
+            if (!*alive)
+                return;
+            mConnected = false;
+            static const char reason[] = "Link closed";
+            wsCloseCb(0, 0, reason, sizeof(reason) - 1); // deletes this
+        };
+        mIO.mLoop.post([this, alive]()
+        {
+            if (!*alive || !mLink->isOpen())
+                return;
+            mConnected = true;
+            wsConnectCb();
+        });
+    }
+    virtual ~LinkWebsocketsClient()
+    {
+        *mAlive = false;
+        mLink->close();
+    }
+    virtual bool wsSendMessage(char* msg, size_t len)
+    {
+        if (!mConnected)
+            return false;
+        mLink->sendToServer(std::string(msg, len));
+        return true;
+    }
+    virtual void wsDisconnect(bool immediate)
+    {
+        disconnecting = true;
+        mConnected = false;
+        // if not immediate, the close is reported by the link, as by libws.
+        // Otherwise, the caller deletes this
+        mLink->close();
+        if (immediate)
+            *mAlive = false;
+    }
+    virtual bool wsIsConnected() { return mConnected; }
+};
+
+LinkWebsocketsIO::LinkWebsocketsIO(EventLoop& loop, ::mega::MegaApi& sdk, Connector&& connector)
+    : WebsocketsIO(&mMutex, &sdk, nullptr), mLoop(loop), mMutex(true), mConnector(std::move(connector))
+{}
+
+bool LinkWebsocketsIO::wsResolveDNS(const char* /*hostname*/, std::function<void(int, std::vector<std::string>&, std::vector<std::string>&)> f)
+{
+    mLoop.post([f]()
+    {
+        std::vector<std::string> ipsv4(1, "127.0.0.1");
+        std::vector<std::string> ipsv6;
+        f(0, ipsv4, ipsv6);
+    });
+    return false;
+}
+
+WebsocketsClientImpl* LinkWebsocketsIO::wsConnect(const char* /*ip*/, const char* host,
+    int /*port*/, const char* /*path*/, bool /*ssl*/, WebsocketsClient* client)
+{
+    auto link = mConnector(host);
+    if (!link)
+        return nullptr;
+    connects++;
+    return new LinkWebsocketsClient(*this, client, std::move(link));
+}
+
+promise::Promise<std::pair<chatd::MsgCommand*, chatd::KeyCommand*>>
+PlainCrypto::msgEncrypt(chatd::Message* msg, const SetOfIds& recipients, chatd::MsgCommand* cmd)
+{
+    chatd::KeyCommand* keyCmd = nullptr;
+    if (msg->keyid == CHATD_KEYID_INVALID)
+    {
+        // as strongvelope, a new key is sent when the recipients change
+        if (mKeyid == CHATD_KEYID_INVALID || !(mKeyRecipients == recipients))
+        {
+            mKeyid = mNextLocalKeyid;
+            mNextLocalKeyid = (mNextLocalKeyid == CHATD_KEYID_MIN) ? CHATD_KEYID_MAX : mNextLocalKeyid - 1;
+            mKeyRecipients = recipients;
+            keyCmd = new chatd::KeyCommand(mChatid, mKeyid);
+            for (auto& userid: recipients)
+            {
+                char key[16];
+                memset(key, (int)(userid.val & 0xff), sizeof(key));
+                keyCmd->addKey(userid, key, sizeof(key));
+            }
+            if (onNewKey)
+                onNewKey();
+        }
+        msg->keyid = mKeyid;
+    }
+    cmd->setKeyId(chatd::isLocalKeyId(msg->keyid) ? CHATD_KEYID_UNCONFIRMED : msg->keyid);
+    cmd->append(msg->buf(), msg->dataSize());
+    cmd->updateMsgSize();
+    return std::make_pair(cmd, keyCmd);
+}
+
+promise::Promise<chatd::Message*> PlainCrypto::msgDecrypt(chatd::Message* src)
+{
+    if (src->type == chatd::Message::kMsgInvalid)
+        src->type = chatd::Message::kMsgNormal;
+    src->setEncrypted(chatd::Message::kNotEncrypted);
+    return src;
+}
+
+void PlainCrypto::onKeyConfirmed(chatd::KeyId localkeyid, chatd::KeyId keyid)
+{
+    if (mKeyid == localkeyid)
+        mKeyid = keyid;
+    if (onKeyConfirm)
+        onKeyConfirm();
+}
+
+void PlainCrypto::randomBytes(void* buf, size_t bufsize) const
+{
+    for (size_t i = 0; i < bufsize; i++)
+        static_cast<uint8_t*>(buf)[i] = (uint8_t)rand();
+}
+
+promise::Promise<std::shared_ptr<Buffer>>
+PlainCrypto::encryptChatTitle(const std::string& data, uint64_t /*extraUser*/)
+{
+    return std::make_shared<Buffer>(data.data(), data.size());
+}
+
+promise::Promise<std::string> PlainCrypto::decryptChatTitle(const Buffer& data)
+{
+    return std::string(data.buf(), data.dataSize());
+}
+
+void BenchApp::onPresenceChanged(Id userid, Presence pres, bool inProgress)
+{
+    if (!inProgress && onPresence)
+        onPresence(userid, pres);
+}
+
+void BenchApp::onPresenceConfigChanged(const presenced::Config& config, bool pending)
+{
+    if (onPresenceConfig)
+        onPresenceConfig(config, pending);
+}
+
+void BenchChatListener::init(chatd::Chat& chat, chatd::DbInterface*& dbIntf)
+{
+    dbIntf = new ChatdSqliteDb(chat, mClient.db, &mClient.mDbWriter);
+}
+
+// only its end is used, for the name of the db file
+static const char kBenchSid[] = "karere-benchmark-session-karere-benchmark-session-offline";
+
+BenchClient::BenchClient(::mega::MegaApi& sdk, WebsocketsIO& websocketsIO, IApp& app,
+    const std::string& appDir, Id myHandle)
+    : Client(sdk, &websocketsIO, app, appDir, 0), mStubServices(new StubChatServices)
+{
+    setServices(mStubServices);
+    // as initWithNewSession(), without the SDK
+    mSid = kBenchSid;
+    createDb();
+    mMyHandle = myHandle;
+    db.query("insert or replace into vars(name,value) values('my_handle', ?)", mMyHandle);
+    mMyIdentity = (static_cast<uint64_t>(rand()) << 32) | time(NULL);
+    mUserAttrCache.reset(new UserAttrCache(*this));
+    mDbWriter.start();
+    mChatdClient.reset(new chatd::Client(this, mMyHandle));
+}
+
+BenchClient::~BenchClient()
+{
+    mChatdClient->disconnect();
+    mPresencedClient.disconnect();
+    // chatd::Client unregisters from the attribute cache, which terminate() destroys
+    mChatdClient.reset();
+    terminate(true);
+}
+
+chatd::Chat& BenchClient::addChat(Id chatid, int shard, const std::string& url,
+    const SetOfIds& users, BenchChatListener& listener, PlainCrypto* crypto)
+{
+    assert(users.count(mMyHandle));
+    bool isGroup = users.size() > 2;
+    Id peer = Id::inval();
+    if (!isGroup)
+    {
+        for (auto& userid: users)
+        {
+            if (userid != mMyHandle)
+                peer = userid;
+        }
+    }
+    uint32_t ts = (uint32_t)time(nullptr);
+    db.query("insert or replace into chats(chatid, shard, peer, peer_priv, own_priv, ts_created, archived) "
+        "values(?,?,?,?,?,?,0)", chatid, shard, isGroup ? (uint64_t)-1 : peer.val,
+        (int)chatd::PRIV_FULL, (int)chatd::PRIV_FULL, ts);
+    mStubServices->setChatdUrl(chatid, url);
+    if (!crypto)
+        crypto = new PlainCrypto(chatid);
+    return mChatdClient->createChat(chatid, shard, url, &listener, users, crypto, ts, isGroup);
+}
+}
@@ -0,0 +1,153 @@
+#ifndef STANDIN_BENCHCLIENT_H
+#define STANDIN_BENCHCLIENT_H
+/**
+ * @file benchClient.h
+ * @brief Runs the chat core - karere::Client with its chatd::Client and
+ * presenced::Client - offline, on the event loop of the stand-ins.
+ *
+ * The websockets are in-process Links, the API requests are served by a
+ * StubChatServices and messages are sent in plaintext, but the protocol
+ * handling, the history buffers and the db are the ones of the app. The Mega
+ * SDK instance that karere::Client requires is never logged in.
+ *
+ * Needs the full karere library, so it is only built with it, see
+ * CMakeLists.txt.
+ */
+#include <stdint.h>
+#include <string>
+#include <memory>
+#include <functional>
+#include <megaapi_impl.h>
+#include "chatClient.h"
+#include "chatd.h"
+#include "chatdICrypto.h"
+#include "chatServices.h"
+#include "net/websocketsIO.h"
+#include "eventLoop.h"
+
+namespace standin
+{
+/** @brief Initializes the karere services, and runs the calls that karere
+ * marshals to the app thread on \c loop, which must be run by the thread
+ * that created it. Only one can exist at a time */
+class KarereOnLoop
+{
+public:
+    KarereOnLoop(EventLoop& loop);
+    ~KarereOnLoop();
+};
+
+/** @brief The websockets layer of the benchmarks: DNS lookups resolve to
+ * the loopback address, and connections are Links, opened by \c connector
+ * for the host of the url. The connector returns nullptr to refuse the
+ * connection */
+class LinkWebsocketsIO: public WebsocketsIO
+{
+public:
+    typedef std::function<std::shared_ptr<Link>(const std::string& host)> Connector;
+    /** Frames and bytes received by all connections */
+    uint64_t framesRecv = 0;
+    uint64_t bytesRecv = 0;
+    uint64_t connects = 0;
+
+protected:
+    EventLoop& mLoop;
+    ::mega::MegaMutex mMutex;
+    Connector mConnector;
+    virtual bool wsResolveDNS(const char *hostname, std::function<void(int, std::vector<std::string>&, std::vector<std::string>&)> f);
+    virtual WebsocketsClientImpl *wsConnect(const char *ip, const char *host,
+                                           int port, const char *path, bool ssl,
+                                           WebsocketsClient *client);
+    friend class LinkWebsocketsClient;
+
+public:
+    LinkWebsocketsIO(EventLoop& loop, ::mega::MegaApi& sdk, Connector&& connector);
+    virtual void addevents(::mega::Waiter*, int) {}
+};
+
+/** @brief Sends messages in plaintext. New keys are 16 bytes of the userid of
+ * each recipient, and received keys are ignored */
+class PlainCrypto: public chatd::ICrypto
+{
+public:
+    /** Called when a new key is sent and when it is confirmed */
+    std::function<void()> onNewKey;
+    std::function<void()> onKeyConfirm;
+
+protected:
+    karere::Id mChatid;
+    karere::SetOfIds mKeyRecipients;
+    chatd::KeyId mKeyid = CHATD_KEYID_INVALID;
+    chatd::KeyId mNextLocalKeyid = CHATD_KEYID_MAX;
+
+public:
+    PlainCrypto(karere::Id chatid): chatd::ICrypto(nullptr), mChatid(chatid) {}
+    virtual void setUsers(karere::SetOfIds*) {}
+    virtual promise::Promise<std::pair<chatd::MsgCommand*, chatd::KeyCommand*>>
+    msgEncrypt(chatd::Message* msg, const karere::SetOfIds& recipients, chatd::MsgCommand* cmd);
+    virtual promise::Promise<chatd::Message*> msgDecrypt(chatd::Message* src);
+    virtual void onKeyReceived(chatd::KeyId, karere::Id, karere::Id, const char*, uint16_t) {}
+    virtual void onKeyConfirmed(chatd::KeyId localkeyid, chatd::KeyId keyid);
+    virtual void onKeyRejected() { resetSendKey(); }
+    virtual void resetSendKey() { mKeyid = CHATD_KEYID_INVALID; }
+    virtual bool handleLegacyKeys(chatd::Message&) { return false; }
+    virtual void randomBytes(void* buf, size_t bufsize) const;
+    virtual promise::Promise<std::shared_ptr<Buffer>>
+    encryptChatTitle(const std::string& data, uint64_t extraUser=0);
+    virtual promise::Promise<std::string> decryptChatTitle(const Buffer& data);
+    virtual void onHistoryReload() {}
+};
+
+/** @brief An app without contact and chat list GUI, which only reports the
+ * presence events */
+class BenchApp: public karere::IApp
+{
+public:
+    std::function<void(karere::Id userid, karere::Presence pres)> onPresence;
+    /** Called with pending=false when presenced has sent our prefs */
+    std::function<void(const presenced::Config& config, bool pending)> onPresenceConfig;
+
+    virtual IContactListHandler* contactListHandler() { return nullptr; }
+    virtual IChatListHandler* chatListHandler() { return nullptr; }
+    virtual void onPresenceChanged(karere::Id userid, karere::Presence pres, bool inProgress);
+    virtual void onPresenceConfigChanged(const presenced::Config& config, bool pending);
+#ifndef KARERE_DISABLE_WEBRTC
+    virtual rtcModule::ICallHandler* onIncomingCall(rtcModule::ICall&, karere::AvFlags) { return nullptr; }
+#endif
+};
+
+/** @brief Stores the history of a chat in the karere db, through the
+ * DbWriter of the client, as ChatRoom does. Benchmarks override the other
+ * callbacks */
+class BenchChatListener: public chatd::Listener
+{
+protected:
+    karere::Client& mClient;
+public:
+    BenchChatListener(karere::Client& client): mClient(client) {}
+    virtual void init(chatd::Chat& chat, chatd::DbInterface*& dbIntf);
+    virtual void onOnlineStateChange(chatd::ChatState) {}
+};
+
+/** @brief A karere::Client initialized offline, as the user \c myHandle,
+ * with a new db in \c appDir. Chats are added with addChat() instead of
+ * being loaded from the SDK */
+class BenchClient: public karere::Client
+{
+public:
+    BenchClient(::mega::MegaApi& sdk, WebsocketsIO& websocketsIO, karere::IApp& app,
+                const std::string& appDir, karere::Id myHandle);
+    ~BenchClient();
+    chatd::Client& chatd() { return *mChatdClient; }
+    karere::StubChatServices& stubServices() { return *mStubServices; }
+    /** @brief Creates the chat in the db and in chatd::Client, served by the
+     * chatd at \c url. \c users must include our own user */
+    chatd::Chat& addChat(karere::Id chatid, int shard, const std::string& url,
+        const karere::SetOfIds& users, BenchChatListener& listener,
+        PlainCrypto* crypto = nullptr);
+
+protected:
+    karere::StubChatServices* mStubServices;
+};
+}
+#endif
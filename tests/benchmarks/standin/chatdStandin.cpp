@@ -0,0 +1,563 @@
+#include "chatdStandin.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <stdexcept>
+#include "chatdMsg.h"
+
+using namespace chatd;
+
+namespace standin
+{
+// chatd splits long histories in several frames
+enum { kMaxFrameSize = 64 * 1024 };
+
+ChatdStandin::ChatdStandin(EventLoop& loop, const ChatdConfig& config)
+    : mLoop(loop), mConfig(config), mRng(config.seed), mAlive(std::make_shared<bool>(true))
+{
+    uint32_t ts = now() - mConfig.msgsPerChat * 60;
+    for (unsigned i = 0; i < mConfig.chatCount; i++)
+    {
+        uint64_t chatid = 0x1000 + i;
+        Chat& chat = mChats[chatid];
+        chat.chatid = chatid;
+        chat.members.push_back(mConfig.myUserid);
+        while (chat.members.size() < mConfig.membersPerChat)
+            chat.members.push_back(0x100000 + mRng() % 10000);
+
+        // a single key, received by all members
+        uint32_t keyid = chat.nextKeyid++;
+        std::string blob;
+        for (auto userid: chat.members)
+        {
+            put<uint64_t>(blob, userid);
+            put<uint32_t>(blob, keyid);
+            put<uint16_t>(blob, 16);
+            blob.append(randomPayload(16));
+        }
+        chat.keys[keyid] = blob;
+        for (unsigned j = 0; j < mConfig.msgsPerChat; j++)
+        {
+            auto& msg = storeMsg(chat, chat.members[mRng() % chat.members.size()], keyid, randomPayload(mConfig.msgSize));
+            msg.ts = ts + j * 60;
+        }
+        if (!chat.msgs.empty())
+        {
+            chat.lastSeen = chat.msgs[chat.msgs.size() * 3 / 4].msgid;
+            chat.lastReceived = chat.msgs.back().msgid;
+        }
+    }
+    scheduleKeepalive();
+}
+
+ChatdStandin::~ChatdStandin()
+{
+    *mAlive = false;
+}
+
+uint32_t ChatdStandin::now() const
+{
+    return (uint32_t)time(nullptr);
+}
+
+std::string ChatdStandin::randomPayload(size_t size)
+{
+    std::string ret(size, 0);
+    for (auto& c: ret)
+        c = (char)mRng();
+    return ret;
+}
+
+ChatdStandin::StoredMsg& ChatdStandin::storeMsg(Chat& chat, uint64_t userid, uint32_t keyid, std::string&& data)
+{
+    chat.msgs.push_back(StoredMsg{mNextMsgid++, userid, now(), 0, keyid, std::move(data)});
+    return chat.msgs.back();
+}
+
+std::shared_ptr<Link> ChatdStandin::connect()
+{
+    auto conn = std::make_shared<Conn>();
+    conn->link = std::make_shared<Link>(mLoop, mConfig.link, (unsigned)mRng());
+    if (mConfig.disconnectEvery)
+        conn->disconnectAfter = 1 + mConfig.disconnectEvery / 2 + mRng() % mConfig.disconnectEvery;
+    // the user is authenticated by the connection url
+    conn->userid = mConfig.myUserid;
+    mConns.insert(conn);
+    mStats.connections++;
+    std::weak_ptr<Conn> wconn(conn);
+    auto alive = mAlive;
+    conn->link->onServerRecv = [this, wconn, alive](const std::string& frame)
+    {
+        auto conn = wconn.lock();
+        if (*alive && conn)
+            onFrame(conn, frame);
+    };
+    conn->link->onServerClose = [this, wconn, alive]()
+    {
+        auto conn = wconn.lock();
+        if (!*alive || !conn)
+            return;
+        mStats.disconnects++;
+        mConns.erase(conn);
+    };
+    return conn->link;
+}
+
+void ChatdStandin::disconnectAll()
+{
+    auto conns = mConns;
+    for (auto& conn: conns)
+        conn->link->close();
+}
+
+void ChatdStandin::scheduleKeepalive()
+{
+    if (!mConfig.keepaliveIntervalMs)
+        return;
+    auto alive = mAlive;
+    mLoop.scheduleMs(mConfig.keepaliveIntervalMs, [this, alive]()
+    {
+        if (!*alive)
+            return;
+        for (auto& conn: mConns)
+            send(*conn, std::string(1, (char)OP_KEEPALIVE));
+        scheduleKeepalive();
+    });
+}
+
+void ChatdStandin::send(Conn& conn, std::string&& frame)
+{
+    if (frame.empty() || !conn.link->isOpen())
+        return;
+    conn.link->sendToClient(std::move(frame));
+    if (conn.disconnectAfter && (++conn.framesSent >= conn.disconnectAfter))
+        conn.link->close();
+}
+
+void ChatdStandin::onFrame(const std::shared_ptr<Conn>& conn, const std::string& frame)
+{
+    // multiple commands can be sent in one frame
+    size_t pos = 0;
+    try
+    {
+        while (pos < frame.size() && conn->link->isOpen())
+        {
+            mStats.commands++;
+            execCommand(*conn, frame, pos);
+        }
+    }
+    catch (std::exception& e)
+    {
+        // chatd drops clients that send malformed commands
+        fprintf(stderr, "chatd stand-in: %s, dropping connection\n", e.what());
+        conn->link->close();
+    }
+}
+
+void ChatdStandin::execCommand(Conn& conn, const std::string& frame, size_t& pos)
+{
+    uint8_t opcode = get<uint8_t>(frame, pos);
+    switch (opcode)
+    {
+        case OP_KEEPALIVE:
+        case OP_KEEPALIVEAWAY:
+        {
+            mStats.keepalivesRecv++;
+            break;
+        }
+        case OP_JOIN:
+        {
+            uint64_t chatid = get<uint64_t>(frame, pos);
+            conn.userid = get<uint64_t>(frame, pos);
+            get<int8_t>(frame, pos); // priv
+            handleJoin(conn, chatid);
+            break;
+        }
+        case OP_HIST:
+        {
+            uint64_t chatid = get<uint64_t>(frame, pos);
+            int32_t count = get<int32_t>(frame, pos);
+            auto it = mChats.find(chatid);
+            if (it != mChats.end())
+                handleHist(conn, it->second, count);
+            break;
+        }
+        case OP_JOINRANGEHIST:
+        {
+            uint64_t chatid = get<uint64_t>(frame, pos);
+            uint64_t oldest = get<uint64_t>(frame, pos);
+            uint64_t newest = get<uint64_t>(frame, pos);
+            auto it = mChats.find(chatid);
+            if (it != mChats.end())
+                handleJoinRangeHist(conn, it->second, oldest, newest);
+            break;
+        }
+        case OP_NEWMSG:
+        case OP_MSGUPD:
+        case OP_MSGUPDX:
+        {
+            handleNewMsg(conn, opcode, frame, pos);
+            break;
+        }
+        case OP_NEWKEY:
+        {
+            uint64_t chatid = get<uint64_t>(frame, pos);
+            uint32_t keyxid = get<uint32_t>(frame, pos);
+            uint32_t len = get<uint32_t>(frame, pos);
+            if (pos + len > frame.size())
+                throw std::runtime_error("NEWKEY truncated");
+            std::string blob = frame.substr(pos, len);
+            pos += len;
+            auto it = mChats.find(chatid);
+            if (it != mChats.end())
+                handleNewKey(conn, it->second, keyxid, blob);
+            break;
+        }
+        case OP_SEEN:
+        case OP_RECEIVED:
+        {
+            uint64_t chatid = get<uint64_t>(frame, pos);
+            uint64_t msgid = get<uint64_t>(frame, pos);
+            auto it = mChats.find(chatid);
+            if (it == mChats.end())
+                break;
+            (opcode == OP_SEEN ? it->second.lastSeen : it->second.lastReceived) = msgid;
+            // other devices of the user are notified
+            for (auto& other: mConns)
+            {
+                if (other.get() == &conn || other->userid != conn.userid || !other->joined.count(chatid))
+                    continue;
+                std::string out(1, (char)opcode);
+                put(out, chatid);
+                put(out, msgid);
+                send(*other, std::move(out));
+            }
+            break;
+        }
+        case OP_BROADCAST:
+        {
+            uint64_t chatid = get<uint64_t>(frame, pos);
+            get<uint64_t>(frame, pos); // userid, replaced by the sender's
+            uint8_t type = get<uint8_t>(frame, pos);
+            for (auto& other: mConns)
+            {
+                if (other.get() == &conn || !other->joined.count(chatid))
+                    continue;
+                std::string out(1, (char)OP_BROADCAST);
+                put(out, chatid);
+                put(out, conn.userid);
+                put(out, type);
+                send(*other, std::move(out));
+            }
+            break;
+        }
+        case OP_CLIENTID:
+        {
+            get<uint64_t>(frame, pos); // seed
+            conn.clientid = mNextClientid++;
+            std::string out(1, (char)OP_CLIENTID);
+            put(out, conn.clientid);
+            send(conn, std::move(out));
+            break;
+        }
+        case OP_ECHO:
+        {
+            std::string out(1, (char)OP_ECHO);
+            put(out, get<uint8_t>(frame, pos));
+            send(conn, std::move(out));
+            break;
+        }
+        case OP_SYNC:
+        {
+            std::string out(1, (char)OP_SYNC);
+            put(out, get<uint64_t>(frame, pos));
+            send(conn, std::move(out));
+            break;
+        }
+        default:
+            throw std::runtime_error("Unsupported opcode " + std::to_string(opcode));
+    }
+}
+
+void ChatdStandin::handleJoin(Conn& conn, uint64_t chatid)
+{
+    auto it = mChats.find(chatid);
+    if (it == mChats.end() || std::find(it->second.members.begin(), it->second.members.end(), conn.userid) == it->second.members.end())
+    {
+        std::string out(1, (char)OP_REJECT);
+        put(out, chatid);
+        put<uint64_t>(out, 0);
+        put<uint8_t>(out, OP_JOIN);
+        put<uint8_t>(out, 0);
+        send(conn, std::move(out));
+        return;
+    }
+    conn.joined.insert(chatid);
+    conn.histCursor[chatid] = it->second.msgs.size();
+    std::string out;
+    for (auto userid: it->second.members)
+    {
+        out.push_back((char)OP_JOIN);
+        put(out, chatid);
+        put(out, userid);
+        put<int8_t>(out, (userid == mConfig.myUserid) ? PRIV_OPER : PRIV_FULL);
+    }
+    send(conn, std::move(out));
+}
+
+void ChatdStandin::appendMsg(std::string& frame, uint8_t opcode, uint64_t chatid, const StoredMsg& msg)
+{
+    frame.push_back((char)opcode);
+    put(frame, chatid);
+    put(frame, msg.userid);
+    put(frame, msg.msgid);
+    put(frame, msg.ts);
+    put(frame, msg.updated);
+    put(frame, msg.keyid);
+    put<uint32_t>(frame, (uint32_t)msg.data.size());
+    frame.append(msg.data);
+}
+
+void ChatdStandin::appendKeys(std::string& frame, const Chat& chat, uint32_t keyid)
+{
+    auto it = chat.keys.find(keyid);
+    if (it == chat.keys.end())
+        return;
+    frame.push_back((char)OP_NEWKEY);
+    put(frame, chat.chatid);
+    put(frame, keyid);
+    put<uint32_t>(frame, (uint32_t)it->second.size());
+    frame.append(it->second);
+}
+
+void ChatdStandin::handleHist(Conn& conn, Chat& chat, int32_t count)
+{
+    std::string out;
+    if (chat.lastSeen)
+    {
+        out.push_back((char)OP_SEEN);
+        put(out, chat.chatid);
+        put(out, chat.lastSeen);
+    }
+    if (chat.lastReceived)
+    {
+        out.push_back((char)OP_RECEIVED);
+        put(out, chat.chatid);
+        put(out, chat.lastReceived);
+    }
+    size_t& cursor = conn.histCursor[chat.chatid];
+    size_t end = cursor;
+    size_t start = (count < 0 && (size_t)-count < end) ? end + count : 0;
+    // the keys of the messages are sent before them
+    std::set<uint32_t> keyids;
+    for (size_t i = start; i < end; i++)
+        keyids.insert(chat.msgs[i].keyid);
+    for (auto keyid: keyids)
+        appendKeys(out, chat, keyid);
+    for (size_t i = end; i > start; i--)
+    {
+        appendMsg(out, OP_OLDMSG, chat.chatid, chat.msgs[i - 1]);
+        mStats.oldMsgsSent++;
+        if (out.size() >= kMaxFrameSize)
+            send(conn, std::move(out));
+    }
+    cursor = start;
+    out.push_back((char)OP_HISTDONE);
+    put(out, chat.chatid);
+    send(conn, std::move(out));
+}
+
+void ChatdStandin::handleJoinRangeHist(Conn& conn, Chat& chat, uint64_t oldest, uint64_t newest)
+{
+    handleJoin(conn, chat.chatid);
+    size_t newestIdx = chat.msgs.size();
+    size_t oldestIdx = chat.msgs.size();
+    for (size_t i = 0; i < chat.msgs.size(); i++)
+    {
+        if (chat.msgs[i].msgid == newest)
+            newestIdx = i;
+        if (chat.msgs[i].msgid == oldest)
+            oldestIdx = i;
+    }
+    std::string out;
+    if (newestIdx == chat.msgs.size())
+    {
+        // unknown range, the client must clear its history and fetch it again
+        out.push_back((char)OP_REJECT);
+        put(out, chat.chatid);
+        put<uint64_t>(out, 0);
+        put<uint8_t>(out, OP_RANGE);
+        put<uint8_t>(out, 1);
+        send(conn, std::move(out));
+        return;
+    }
+    conn.histCursor[chat.chatid] = oldestIdx;
+    std::set<uint32_t> keyids;
+    for (size_t i = newestIdx + 1; i < chat.msgs.size(); i++)
+        keyids.insert(chat.msgs[i].keyid);
+    for (auto keyid: keyids)
+        appendKeys(out, chat, keyid);
+    for (size_t i = newestIdx + 1; i < chat.msgs.size(); i++)
+    {
+        appendMsg(out, OP_NEWMSG, chat.chatid, chat.msgs[i]);
+        mStats.newMsgsSent++;
+        if (out.size() >= kMaxFrameSize)
+            send(conn, std::move(out));
+    }
+    out.push_back((char)OP_HISTDONE);
+    put(out, chat.chatid);
+    send(conn, std::move(out));
+}
+
+void ChatdStandin::handleNewMsg(Conn& conn, uint8_t opcode, const std::string& frame, size_t& pos)
+{
+    uint64_t chatid = get<uint64_t>(frame, pos);
+    get<uint64_t>(frame, pos); // userid, the server uses the one of the connection
+    uint64_t msgid = get<uint64_t>(frame, pos);
+    get<uint32_t>(frame, pos); // ts, the server uses its own
+    uint16_t updated = get<uint16_t>(frame, pos);
+    uint32_t keyid = get<uint32_t>(frame, pos);
+    uint32_t len = get<uint32_t>(frame, pos);
+    if (pos + len > frame.size())
+        throw std::runtime_error("NEWMSG truncated");
+    std::string data = frame.substr(pos, len);
+    pos += len;
+
+    auto it = mChats.find(chatid);
+    if (it == mChats.end() || !conn.joined.count(chatid))
+    {
+        std::string out(1, (char)OP_REJECT);
+        put(out, chatid);
+        put(out, msgid);
+        put(out, opcode);
+        put<uint8_t>(out, 0);
+        send(conn, std::move(out));
+        return;
+    }
+    Chat& chat = it->second;
+    if (opcode != OP_NEWMSG)
+    {
+        // MSGUPD refers to a msgid, MSGUPDX to the msgxid of a message that
+        // may not be confirmed yet
+        uint64_t target = msgid;
+        if (opcode == OP_MSGUPDX)
+        {
+            auto xit = chat.msgxids.find(msgid);
+            target = (xit != chat.msgxids.end()) ? xit->second : 0;
+        }
+        for (auto& msg: chat.msgs)
+        {
+            if (msg.msgid != target)
+                continue;
+            msg.updated = updated;
+            msg.data = std::move(data);
+            // the update is confirmed to the sender by echoing it
+            for (auto& other: mConns)
+            {
+                if (!other->joined.count(chatid))
+                    continue;
+                std::string out;
+                appendMsg(out, OP_MSGUPD, chatid, msg);
+                send(*other, std::move(out));
+            }
+            break;
+        }
+        return;
+    }
+
+    auto xit = chat.msgxids.find(msgid);
+    if (xit != chat.msgxids.end())
+    {
+        // resent after a reconnect, it was already written
+        mStats.msgsDeduplicated++;
+        std::string out(1, (char)OP_MSGID);
+        put(out, msgid);
+        put(out, xit->second);
+        send(conn, std::move(out));
+        return;
+    }
+    if (isLocalKeyId(keyid))
+    {
+        auto kit = conn.keyxids.find(keyid);
+        keyid = (kit != conn.keyxids.end()) ? kit->second : chat.nextKeyid - 1;
+    }
+    auto& msg = storeMsg(chat, conn.userid, keyid, std::move(data));
+    chat.msgxids[msgid] = msg.msgid;
+    mStats.msgsWritten++;
+
+    std::string out(1, (char)OP_NEWMSGID);
+    put(out, msgid);
+    put(out, msg.msgid);
+    send(conn, std::move(out));
+    for (auto& other: mConns)
+    {
+        if (other.get() == &conn || !other->joined.count(chatid))
+            continue;
+        std::string bcast;
+        appendMsg(bcast, OP_NEWMSG, chatid, msg);
+        mStats.newMsgsSent++;
+        send(*other, std::move(bcast));
+    }
+}
+
+void ChatdStandin::handleNewKey(Conn& conn, Chat& chat, uint32_t keyxid, const std::string& blob)
+{
+    uint32_t keyid = chat.nextKeyid++;
+    conn.keyxids[keyxid] = keyid;
+    // (userid.8 keylen.2 key)* -> (userid.8 keyid.4 keylen.2 key)*
+    std::string keys;
+    size_t pos = 0;
+    while (pos < blob.size())
+    {
+        put(keys, get<uint64_t>(blob, pos));
+        put(keys, keyid);
+        uint16_t keylen = get<uint16_t>(blob, pos);
+        if (pos + keylen > blob.size())
+            throw std::runtime_error("NEWKEY key truncated");
+        put(keys, keylen);
+        keys.append(blob, pos, keylen);
+        pos += keylen;
+    }
+    chat.keys[keyid] = keys;
+
+    std::string out(1, (char)OP_NEWKEYID);
+    put(out, chat.chatid);
+    put(out, keyxid);
+    put(out, keyid);
+    send(conn, std::move(out));
+    for (auto& other: mConns)
+    {
+        if (other.get() == &conn || !other->joined.count(chat.chatid))
+            continue;
+        std::string bcast;
+        appendKeys(bcast, chat, keyid);
+        send(*other, std::move(bcast));
+    }
+}
+
+void ChatdStandin::postMessages(uint64_t chatid, unsigned count)
+{
+    auto it = mChats.find(chatid);
+    if (it == mChats.end())
+        return;
+    Chat& chat = it->second;
+    for (unsigned i = 0; i < count; i++)
+    {
+        // from another member
+        uint64_t userid = (chat.members.size() > 1)
+            ? chat.members[1 + mRng() % (chat.members.size() - 1)]
+            : chat.members[0];
+        auto& msg = storeMsg(chat, userid, chat.nextKeyid - 1, randomPayload(mConfig.msgSize));
+        for (auto& conn: mConns)
+        {
+            if (!conn->joined.count(chatid))
+                continue;
+            std::string out;
+            appendMsg(out, OP_NEWMSG, chatid, msg);
+            mStats.newMsgsSent++;
+            send(*conn, std::move(out));
+        }
+    }
+}
+}
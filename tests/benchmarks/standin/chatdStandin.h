@@ -0,0 +1,136 @@
+#ifndef STANDIN_CHATDSTANDIN_H
+#define STANDIN_CHATDSTANDIN_H
+/**
+ * @file chatdStandin.h
+ * @brief In-process stand-in for a chatd shard, speaking the binary protocol
+ * of chatdMsg.h: JOIN, HIST/OLDMSG/HISTDONE, JOINRANGEHIST, NEWMSG/NEWMSGID
+ * (and MSGID for resent messages), MSGUPD(X), NEWKEY/NEWKEYID, SEEN,
+ * RECEIVED, KEEPALIVE, BROADCAST, CLIENTID, ECHO and SYNC.
+ *
+ * It holds a generated history of a configurable number of chats and
+ * messages, and can simulate other users posting messages and disconnects.
+ * Messages are opaque to it, they are not encrypted.
+ */
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include "eventLoop.h"
+
+namespace standin
+{
+struct ChatdConfig
+{
+    /** Number of chats, and of messages in the history of each of them */
+    unsigned chatCount = 100;
+    unsigned msgsPerChat = 200;
+    /** Size of the (fake) encrypted payload of the generated messages */
+    unsigned msgSize = 120;
+    /** Number of members of each chat, including the client's user */
+    unsigned membersPerChat = 5;
+    /** The user that the clients log in as */
+    uint64_t myUserid = 1;
+    /** The server closes a connection after sending this many frames on
+     * average, so that reconnects hit different stages of the protocol.
+     * 0 disables it */
+    unsigned disconnectEvery = 0;
+    /** Interval of the KEEPALIVEs sent by the server. 0 disables them */
+    unsigned keepaliveIntervalMs = 0;
+    LinkConfig link;
+    unsigned seed = 12345;
+};
+
+struct ChatdStats
+{
+    uint64_t connections = 0;
+    uint64_t disconnects = 0;
+    uint64_t commands = 0;
+    uint64_t msgsWritten = 0;
+    uint64_t msgsDeduplicated = 0;
+    uint64_t oldMsgsSent = 0;
+    uint64_t newMsgsSent = 0;
+    uint64_t keepalivesRecv = 0;
+};
+
+class ChatdStandin
+{
+public:
+    struct StoredMsg
+    {
+        uint64_t msgid;
+        uint64_t userid;
+        uint32_t ts;
+        uint16_t updated;
+        uint32_t keyid;
+        std::string data;
+    };
+    struct Chat
+    {
+        uint64_t chatid;
+        std::vector<uint64_t> members;
+        /** Oldest first */
+        std::vector<StoredMsg> msgs;
+        std::map<uint64_t, uint64_t> msgxids;
+        /** keyid -> key blob, as sent in NEWKEY: (userid.8 keyid.4 keylen.2 key)* */
+        std::map<uint32_t, std::string> keys;
+        uint32_t nextKeyid = 1;
+        uint64_t lastSeen = 0;
+        uint64_t lastReceived = 0;
+    };
+protected:
+    struct Conn
+    {
+        std::shared_ptr<Link> link;
+        uint64_t userid = 0;
+        unsigned framesSent = 0;
+        unsigned disconnectAfter = 0;
+        std::set<uint64_t> joined;
+        /** Per chat, index of the oldest message sent with OLDMSG */
+        std::map<uint64_t, size_t> histCursor;
+        std::map<uint32_t, uint32_t> keyxids;
+        uint32_t clientid = 0;
+    };
+    EventLoop& mLoop;
+    ChatdConfig mConfig;
+    std::map<uint64_t, Chat> mChats;
+    std::set<std::shared_ptr<Conn>> mConns;
+    ChatdStats mStats;
+    uint64_t mNextMsgid = 1;
+    uint32_t mNextClientid = 1;
+    std::mt19937 mRng;
+    std::shared_ptr<bool> mAlive;
+
+    uint32_t now() const;
+    std::string randomPayload(size_t size);
+    StoredMsg& storeMsg(Chat& chat, uint64_t userid, uint32_t keyid, std::string&& data);
+    void send(Conn& conn, std::string&& frame);
+    void onFrame(const std::shared_ptr<Conn>& conn, const std::string& frame);
+    void execCommand(Conn& conn, const std::string& frame, size_t& pos);
+    void handleJoin(Conn& conn, uint64_t chatid);
+    void handleHist(Conn& conn, Chat& chat, int32_t count);
+    void handleJoinRangeHist(Conn& conn, Chat& chat, uint64_t oldest, uint64_t newest);
+    void handleNewMsg(Conn& conn, uint8_t opcode, const std::string& frame, size_t& pos);
+    void handleNewKey(Conn& conn, Chat& chat, uint32_t keyxid, const std::string& blob);
+    void appendMsg(std::string& frame, uint8_t opcode, uint64_t chatid, const StoredMsg& msg);
+    void appendKeys(std::string& frame, const Chat& chat, uint32_t keyid);
+    void scheduleKeepalive();
+public:
+    ChatdStandin(EventLoop& loop, const ChatdConfig& config);
+    ~ChatdStandin();
+    /** @brief Opens a new connection to the server. The client must set the
+     * \c onClientRecv and \c onClientClose handlers of the link
+     */
+    std::shared_ptr<Link> connect();
+    /** @brief Closes all connections, as when the server is restarted */
+    void disconnectAll();
+    /** @brief Simulates \c count messages posted by other members of the chat,
+     * sent to all clients that have joined it */
+    void postMessages(uint64_t chatid, unsigned count);
+    const std::map<uint64_t, Chat>& chats() const { return mChats; }
+    const ChatdStats& stats() const { return mStats; }
+    const ChatdConfig& config() const { return mConfig; }
+};
+}
+#endif
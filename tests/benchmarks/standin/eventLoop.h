@@ -0,0 +1,234 @@
+#ifndef STANDIN_EVENTLOOP_H
+#define STANDIN_EVENTLOOP_H
+/**
+ * @file eventLoop.h
+ * @brief Single-threaded event loop and in-process websocket links, used by
+ * the chatd and presenced stand-in servers and the clients of the benchmarks.
+ *
+ * A Link carries whole frames (websocket messages) in both directions, in
+ * order, with a configurable latency and jitter. Frames are delivered by the
+ * event loop, in real time, so client processing time and network latency
+ * both show in the measured latencies.
+ *
+ * When the real karere client runs on the loop (see benchClient.h), calls are
+ * also posted to it from the karere services thread, i.e. expired timers.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <functional>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+namespace standin
+{
+typedef std::chrono::steady_clock Clock;
+
+/** @brief Appends a value to a frame, in the byte order of the host, as
+ * karere's Buffer does */
+template <class T>
+static inline void put(std::string& frame, T val)
+{
+    frame.append((const char*)&val, sizeof(val));
+}
+
+/** @brief Reads a value at \c pos, and advances \c pos past it */
+template <class T>
+static inline T get(const std::string& frame, size_t& pos)
+{
+    if (pos + sizeof(T) > frame.size())
+        throw std::runtime_error("Command truncated");
+    T val;
+    memcpy(&val, frame.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return val;
+}
+
+class EventLoop
+{
+protected:
+    struct Event
+    {
+        Clock::time_point when;
+        uint64_t seq;
+        std::function<void()> func;
+        bool operator>(const Event& other) const
+        {
+            return (when == other.when) ? (seq > other.seq) : (when > other.when);
+        }
+    };
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> mEvents;
+    uint64_t mSeq = 0;
+    /** Calls posted from other threads, moved to mEvents by the loop */
+    std::mutex mInboxMutex;
+    std::condition_variable mInboxCond;
+    std::vector<std::function<void()>> mInbox;
+    std::atomic<bool> mInboxPending{false};
+    std::atomic<bool> mExternal{false};
+    void takeInbox()
+    {
+        if (!mInboxPending)
+            return;
+        std::vector<std::function<void()>> inbox;
+        {
+            std::lock_guard<std::mutex> lock(mInboxMutex);
+            inbox.swap(mInbox);
+            mInboxPending = false;
+        }
+        for (auto& func: inbox)
+            post(std::move(func));
+    }
+    void waitInbox(Clock::time_point until)
+    {
+        std::unique_lock<std::mutex> lock(mInboxMutex);
+        mInboxCond.wait_until(lock, until, [this]() { return !mInbox.empty(); });
+    }
+public:
+    void post(std::function<void()>&& func) { schedule(Clock::now(), std::move(func)); }
+    void schedule(Clock::time_point when, std::function<void()>&& func)
+    {
+        mEvents.push(Event{when, mSeq++, std::move(func)});
+    }
+    void scheduleMs(unsigned ms, std::function<void()>&& func)
+    {
+        schedule(Clock::now() + std::chrono::milliseconds(ms), std::move(func));
+    }
+    /** @brief Posts a call from any thread. Once it is used, an idle loop is
+     * not considered done, as more calls may come */
+    void postFromThread(std::function<void()>&& func)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mInboxMutex);
+            mInbox.push_back(std::move(func));
+            mInboxPending = true;
+            mExternal = true;
+        }
+        mInboxCond.notify_one();
+    }
+    bool empty() const { return mEvents.empty(); }
+    /** @brief Runs events until \c done() returns true, the loop is idle (and
+     * postFromThread() has never been used) or \c timeoutMs elapses.
+     * @return The value of \c done() at exit
+     */
+    template <class F>
+    bool runUntil(F&& done, unsigned timeoutMs = 60000)
+    {
+        auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (!done())
+        {
+            takeInbox();
+            if (mEvents.empty() || mEvents.top().when > Clock::now())
+            {
+                if (!mExternal)
+                {
+                    if (mEvents.empty() || mEvents.top().when > deadline)
+                        return false;
+                    std::this_thread::sleep_until(mEvents.top().when);
+                    continue;
+                }
+                // other threads may post calls while waiting
+                if (Clock::now() >= deadline)
+                    return false;
+                waitInbox(mEvents.empty() ? deadline : std::min(mEvents.top().when, deadline));
+                continue;
+            }
+            // the handler may schedule more events, so pop it before calling it
+            auto func = std::move(const_cast<Event&>(mEvents.top()).func);
+            mEvents.pop();
+            func();
+        }
+        return true;
+    }
+};
+
+/** @brief Latency of a link, in milliseconds */
+struct LinkConfig
+{
+    unsigned latencyMs = 0;
+    unsigned jitterMs = 0;
+};
+
+/** @brief An in-process websocket connection. Frames sent after the link is
+ * closed are dropped, as are frames in transit when it is closed.
+ */
+class Link: public std::enable_shared_from_this<Link>
+{
+public:
+    typedef std::function<void(const std::string&)> RecvCb;
+    RecvCb onServerRecv;
+    RecvCb onClientRecv;
+    std::function<void()> onServerClose;
+    std::function<void()> onClientClose;
+    uint64_t framesToClient = 0;
+    uint64_t bytesToClient = 0;
+    uint64_t framesToServer = 0;
+    uint64_t bytesToServer = 0;
+protected:
+    EventLoop& mLoop;
+    LinkConfig mConfig;
+    std::mt19937 mRng;
+    bool mOpen = true;
+    // frames are delivered in order, even with jitter
+    Clock::time_point mLastToClient;
+    Clock::time_point mLastToServer;
+    Clock::time_point deliveryTime(Clock::time_point& last)
+    {
+        unsigned ms = mConfig.latencyMs + (mConfig.jitterMs ? (unsigned)(mRng() % (mConfig.jitterMs + 1)) : 0);
+        auto when = std::max(Clock::now() + std::chrono::milliseconds(ms), last);
+        last = when;
+        return when;
+    }
+    void deliver(Clock::time_point& last, std::string&& frame, RecvCb Link::*cb)
+    {
+        if (!mOpen)
+            return;
+        auto self = shared_from_this();
+        auto data = std::make_shared<std::string>(std::move(frame));
+        mLoop.schedule(deliveryTime(last), [self, cb, data]()
+        {
+            if (self->mOpen && (self.get()->*cb))
+                (self.get()->*cb)(*data);
+        });
+    }
+public:
+    Link(EventLoop& loop, const LinkConfig& config, unsigned seed)
+        : mLoop(loop), mConfig(config), mRng(seed) {}
+    bool isOpen() const { return mOpen; }
+    void sendToClient(std::string&& frame)
+    {
+        framesToClient++;
+        bytesToClient += frame.size();
+        deliver(mLastToClient, std::move(frame), &Link::onClientRecv);
+    }
+    void sendToServer(std::string&& frame)
+    {
+        framesToServer++;
+        bytesToServer += frame.size();
+        deliver(mLastToServer, std::move(frame), &Link::onServerRecv);
+    }
+    /** @brief Closes the link. Both sides are notified asynchronously */
+    void close()
+    {
+        if (!mOpen)
+            return;
+        mOpen = false;
+        auto self = shared_from_this();
+        mLoop.post([self]()
+        {
+            if (self->onServerClose)
+                self->onServerClose();
+            if (self->onClientClose)
+                self->onClientClose();
+        });
+    }
+};
+}
+#endif
@@ -0,0 +1,177 @@
+#include "presencedStandin.h"
+#include <stdio.h>
+
+namespace standin
+{
+// karere::Presence codes
+enum { kPresenceOffline = 1, kPresenceAway = 2, kPresenceOnline = 3, kPresenceBusy = 4 };
+
+PresencedStandin::PresencedStandin(EventLoop& loop, const PresencedConfig& config)
+    : mLoop(loop), mConfig(config), mRng(config.seed), mAlive(std::make_shared<bool>(true))
+{}
+
+PresencedStandin::~PresencedStandin()
+{
+    *mAlive = false;
+}
+
+uint8_t PresencedStandin::presenceOf(uint64_t peer)
+{
+    auto it = mPresence.find(peer);
+    if (it != mPresence.end())
+        return it->second;
+    uint8_t pres = kPresenceOffline + mRng() % 4;
+    mPresence[peer] = pres;
+    return pres;
+}
+
+std::shared_ptr<Link> PresencedStandin::connect()
+{
+    auto conn = std::make_shared<Conn>();
+    conn->link = std::make_shared<Link>(mLoop, mConfig.link, (unsigned)mRng());
+    if (mConfig.disconnectEvery)
+        conn->disconnectAfter = 1 + mConfig.disconnectEvery / 2 + mRng() % mConfig.disconnectEvery;
+    mConns.insert(conn);
+    mStats.connections++;
+    std::weak_ptr<Conn> wconn(conn);
+    auto alive = mAlive;
+    conn->link->onServerRecv = [this, wconn, alive](const std::string& frame)
+    {
+        auto conn = wconn.lock();
+        if (!*alive || !conn)
+            return;
+        try
+        {
+            onFrame(*conn, frame);
+        }
+        catch (std::exception& e)
+        {
+            fprintf(stderr, "presenced stand-in: %s, dropping connection\n", e.what());
+            conn->link->close();
+        }
+    };
+    conn->link->onServerClose = [this, wconn, alive]()
+    {
+        auto conn = wconn.lock();
+        if (!*alive || !conn)
+            return;
+        mStats.disconnects++;
+        mConns.erase(conn);
+    };
+    return conn->link;
+}
+
+void PresencedStandin::disconnectAll()
+{
+    auto conns = mConns;
+    for (auto& conn: conns)
+        conn->link->close();
+}
+
+void PresencedStandin::send(Conn& conn, std::string&& frame)
+{
+    if (frame.empty() || !conn.link->isOpen())
+        return;
+    conn.link->sendToClient(std::move(frame));
+    if (conn.disconnectAfter && (++conn.framesSent >= conn.disconnectAfter))
+        conn.link->close();
+}
+
+void PresencedStandin::onFrame(Conn& conn, const std::string& frame)
+{
+    size_t pos = 0;
+    while (pos < frame.size() && conn.link->isOpen())
+    {
+        uint8_t opcode = get<uint8_t>(frame, pos);
+        switch (opcode)
+        {
+            case PRESENCED_OP_KEEPALIVE:
+            {
+                // presenced answers immediately
+                mStats.keepalivesRecv++;
+                send(conn, std::string(1, (char)PRESENCED_OP_KEEPALIVE));
+                break;
+            }
+            case PRESENCED_OP_HELLO:
+            {
+                get<uint8_t>(frame, pos); // protocol version
+                get<uint8_t>(frame, pos); // capabilities
+                conn.helloReceived = true;
+                // the initial PREFS completes the login
+                std::string out(1, (char)PRESENCED_OP_PREFS);
+                put(out, mConfig.prefs);
+                send(conn, std::move(out));
+                break;
+            }
+            case PRESENCED_OP_USERACTIVE:
+            {
+                conn.active = (get<uint8_t>(frame, pos) != 0);
+                break;
+            }
+            case PRESENCED_OP_PREFS:
+            {
+                mConfig.prefs = get<uint16_t>(frame, pos);
+                // acked to the sender, and broadcast to the other clients
+                for (auto& other: mConns)
+                {
+                    std::string out(1, (char)PRESENCED_OP_PREFS);
+                    put(out, mConfig.prefs);
+                    send(*other, std::move(out));
+                }
+                break;
+            }
+            case PRESENCED_OP_ADDPEERS:
+            {
+                uint32_t count = get<uint32_t>(frame, pos);
+                std::string out;
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    uint64_t peer = get<uint64_t>(frame, pos);
+                    conn.peers.insert(peer);
+                    mStats.peersAdded++;
+                    out.push_back((char)PRESENCED_OP_PEERSTATUS);
+                    put(out, presenceOf(peer));
+                    put(out, peer);
+                    mStats.peerStatusSent++;
+                }
+                send(conn, std::move(out));
+                break;
+            }
+            case PRESENCED_OP_DELPEERS:
+            {
+                uint32_t count = get<uint32_t>(frame, pos);
+                for (uint32_t i = 0; i < count; i++)
+                    conn.peers.erase(get<uint64_t>(frame, pos));
+                break;
+            }
+            default:
+                throw std::runtime_error("Unsupported opcode " + std::to_string(opcode));
+        }
+    }
+}
+
+void PresencedStandin::presenceStorm(unsigned count)
+{
+    std::vector<uint64_t> peers;
+    for (auto& entry: mPresence)
+        peers.push_back(entry.first);
+    if (peers.empty())
+        return;
+    for (unsigned i = 0; i < count; i++)
+    {
+        uint64_t peer = peers[mRng() % peers.size()];
+        uint8_t pres = kPresenceOffline + mRng() % 4;
+        mPresence[peer] = pres;
+        for (auto& conn: mConns)
+        {
+            if (!conn->peers.count(peer))
+                continue;
+            std::string out(1, (char)PRESENCED_OP_PEERSTATUS);
+            put(out, pres);
+            put(out, peer);
+            mStats.peerStatusSent++;
+            send(*conn, std::move(out));
+        }
+    }
+}
+}
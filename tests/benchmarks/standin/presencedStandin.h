@@ -0,0 +1,85 @@
+#ifndef STANDIN_PRESENCEDSTANDIN_H
+#define STANDIN_PRESENCEDSTANDIN_H
+/**
+ * @file presencedStandin.h
+ * @brief In-process stand-in for presenced: HELLO, USERACTIVE, PREFS,
+ * ADDPEERS/DELPEERS -> PEERSTATUS and KEEPALIVE.
+ */
+#include <stdint.h>
+#include <string>
+#include <set>
+#include <map>
+#include <memory>
+#include "eventLoop.h"
+
+namespace standin
+{
+/** The presenced opcodes, as in presenced.h, which can't be included
+ * without the websockets layer */
+enum PresencedOpcode
+{
+    PRESENCED_OP_KEEPALIVE = 0,
+    PRESENCED_OP_HELLO = 1,
+    PRESENCED_OP_USERACTIVE = 3,
+    PRESENCED_OP_ADDPEERS = 4,
+    PRESENCED_OP_DELPEERS = 5,
+    PRESENCED_OP_PEERSTATUS = 6,
+    PRESENCED_OP_PREFS = 7
+};
+
+struct PresencedConfig
+{
+    /** The PREFS sent on login: online, with autoaway after 600 s */
+    uint16_t prefs = (600 << 4) | 0x08 | 0x03;
+    /** The server closes a connection after sending this many frames on
+     * average, so that reconnects hit different stages of the protocol.
+     * 0 disables it */
+    unsigned disconnectEvery = 0;
+    LinkConfig link;
+    unsigned seed = 12345;
+};
+
+struct PresencedStats
+{
+    uint64_t connections = 0;
+    uint64_t disconnects = 0;
+    uint64_t peersAdded = 0;
+    uint64_t peerStatusSent = 0;
+    uint64_t keepalivesRecv = 0;
+};
+
+class PresencedStandin
+{
+protected:
+    struct Conn
+    {
+        std::shared_ptr<Link> link;
+        bool helloReceived = false;
+        bool active = false;
+        unsigned framesSent = 0;
+        unsigned disconnectAfter = 0;
+        std::set<uint64_t> peers;
+    };
+    EventLoop& mLoop;
+    PresencedConfig mConfig;
+    std::set<std::shared_ptr<Conn>> mConns;
+    /** Presence of each peer, as sent in PEERSTATUS */
+    std::map<uint64_t, uint8_t> mPresence;
+    PresencedStats mStats;
+    std::mt19937 mRng;
+    std::shared_ptr<bool> mAlive;
+    uint8_t presenceOf(uint64_t peer);
+    void send(Conn& conn, std::string&& frame);
+    void onFrame(Conn& conn, const std::string& frame);
+public:
+    PresencedStandin(EventLoop& loop, const PresencedConfig& config);
+    ~PresencedStandin();
+    std::shared_ptr<Link> connect();
+    void disconnectAll();
+    /** @brief Changes the presence of \c count random subscribed peers, and
+     * sends a PEERSTATUS for each to the clients subscribed to them */
+    void presenceStorm(unsigned count);
+    const PresencedStats& stats() const { return mStats; }
+};
+}
+#endif
@@ -0,0 +1,110 @@
+/**
+ * @file statsPollBench.cpp
+ * @brief Number of GetStats polls per hour of a call with the fixed 1s period
+ * of the previous implementation and with the adaptive PollPolicy, for a
+ * stable and a lossy connection and for calls of different sizes. Also checks
+ * that the polls of all sessions of a call stay under the per-call cap, and
+ * reports the longest time that loss went unnoticed.
+ *
+ * Usage: statsPollBench [sessions=1,4,8] [lossPercent=20]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "statsPollPolicy.h"
+
+using namespace rtcModule::stats;
+
+struct Result
+{
+    uint64_t polls = 0;
+    /** Longest time between loss starting and a poll seeing it */
+    unsigned maxReactionMs = 0;
+};
+
+// Simulates one hour of a session. Each second of the connection is lossy with
+// probability lossPercent, in bursts of a few seconds
+static Result simulate(unsigned sessions, unsigned lossPercent, unsigned seed)
+{
+    const unsigned kDurationMs = 3600 * 1000;
+    PollPolicy::Config config;
+    config.minPeriodMs = 1000;
+    config.maxPeriodMs = 5000;
+    PollPolicy policy(config);
+    std::mt19937 rng(seed);
+    std::vector<bool> lossy(kDurationMs / 1000 + 1, false);
+    for (size_t sec = 0; sec < lossy.size(); sec++)
+    {
+        if (rng() % 100 < lossPercent / 3)
+        {
+            for (size_t i = sec; i < sec + 3 && i < lossy.size(); i++)
+                lossy[i] = true;
+        }
+    }
+
+    Result result;
+    unsigned prev = 0;
+    for (unsigned now = 0; now < kDurationMs; now += policy.nextDelay(sessions))
+    {
+        PollPolicy::Health health;
+        health.iceConnected = true;
+        health.rtt = 80 + rng() % 10;
+        health.avgRtt = 80;
+        health.txBps = health.txAvgBps = 1200;
+        health.rxBps = health.rxAvgBps = 1100;
+        // the poll sees the packets lost since the previous one
+        for (unsigned sec = prev / 1000; sec <= now / 1000; sec++)
+        {
+            if (lossy[sec])
+            {
+                health.packetsLost = 5;
+                unsigned start = (sec * 1000 > prev) ? sec * 1000 : prev;
+                if (now - start > result.maxReactionMs)
+                    result.maxReactionMs = now - start;
+                break;
+            }
+        }
+        prev = now;
+        policy.onPoll(health);
+        result.polls++;
+    }
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<unsigned> sessionCounts;
+    std::string sessionsArg = (argc > 1) ? argv[1] : "1,4,8";
+    for (char* tok = strtok(&sessionsArg[0], ","); tok; tok = strtok(nullptr, ","))
+        sessionCounts.push_back(strtoul(tok, nullptr, 10));
+    unsigned lossPercent = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 20;
+
+    bool ok = true;
+    for (unsigned sessions: sessionCounts)
+    {
+        for (unsigned loss: {0u, lossPercent})
+        {
+            uint64_t fixedPolls = 3600ull * sessions;
+            uint64_t polls = 0;
+            unsigned maxReactionMs = 0;
+            for (unsigned i = 0; i < sessions; i++)
+            {
+                Result result = simulate(sessions, loss, 1000 + i);
+                polls += result.polls;
+                if (result.maxReactionMs > maxReactionMs)
+                    maxReactionMs = result.maxReactionMs;
+            }
+            // all sessions together poll at most every callPollIntervalMs
+            bool capOk = polls <= 3600ull * 1000 / PollPolicy::Config().callPollIntervalMs + sessions;
+            ok &= capOk;
+            printf("%2u sessions, %2u%% lossy | fixed: %6llu polls/h | adaptive: %6llu polls/h"
+                   " (%5.1f%%), max reaction %4u ms | %s\n",
+                sessions, loss, (unsigned long long)fixedPolls, (unsigned long long)polls,
+                100.0 * polls / fixedPolls, maxReactionMs, capOk ? "ok" : "OVER CAP");
+        }
+    }
+    return ok ? 0 : 1;
+}
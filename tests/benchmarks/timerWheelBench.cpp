@@ -0,0 +1,258 @@
+/**
+ * @file timerWheelBench.cpp
+ * @brief Timer churn, as generated by the seen/echo/heartbeat timers: timers
+ * are set with random delays, most of them are canceled before they expire,
+ * and the rest expire. Measures the cost of set and cancel, the cost per
+ * expired timer, how late timers are called, and how many times the OS timer
+ * is (re)armed.
+ *
+ * If libevent is available, the same load is run with one libevent event per
+ * timer and a handle store under a recursive mutex, which is what
+ * karere::setTimer used to do (minus the post to the app thread per expired
+ * timer, so the baseline is optimistic).
+ *
+ * Usage: timerWheelBench [timerCount=100000] [cancelPercent=80] [maxDelayMs=200]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <ctime>
+#include "timerWheel.h"
+#include "histogram.h"
+#ifdef HAVE_LIBEVENT
+#include <event2/event.h>
+#include <unordered_map>
+#include <mutex>
+#endif
+
+using namespace karere;
+typedef LatencyHistogram::Clock Clock;
+
+struct Params
+{
+    size_t timerCount;
+    unsigned cancelPercent;
+    unsigned maxDelayMs;
+};
+
+struct Results
+{
+    double setNs = 0;
+    double cancelNs = 0;
+    double expireNsPerTimer = 0;
+    size_t fired = 0;
+    size_t batches = 0;
+    size_t arms = 0;
+    /** Timers called more than 1ms (the resolution) before their deadline */
+    size_t early = 0;
+    LatencyHistogram lateness;
+    void onFired(Clock::time_point due)
+    {
+        fired++;
+        auto late = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - due).count();
+        if (late < -1000)
+            early++;
+        lateness.record(late > 0 ? (uint64_t)late : 0);
+    }
+};
+
+static double nsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+// Same sequence of delays and cancellations for both implementations
+static void makeLoad(const Params& params, std::vector<unsigned>& delays, std::vector<size_t>& cancels)
+{
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<unsigned> delay(0, params.maxDelayMs);
+    for (size_t i = 0; i < params.timerCount; i++)
+        delays.push_back(delay(rng));
+
+    for (size_t i = 0; i < params.timerCount; i++)
+    {
+        if (rng() % 100 < params.cancelPercent)
+            cancels.push_back(i);
+    }
+    std::shuffle(cancels.begin(), cancels.end(), rng);
+}
+
+static void printResults(const char* label, const Results& res)
+{
+    printf("%-10s set %6.0f ns, cancel %6.0f ns, expire %6.0f ns/timer, %zu fired in %zu batches, "
+           "%zu OS timer arms, %zu early, lateness: avg %llu us, p99 %llu us, max %llu us\n",
+           label, res.setNs, res.cancelNs, res.expireNsPerTimer, res.fired, res.batches, res.arms, res.early,
+           (unsigned long long)res.lateness.avgUs(),
+           (unsigned long long)res.lateness.percentileUs(99),
+           (unsigned long long)res.lateness.maxUs());
+}
+
+struct BenchEntry: public TimerWheel::Entry
+{
+    Results& mResults;
+    Clock::time_point mDue;
+    BenchEntry(Results& results, unsigned delay)
+    : mResults(results), mDue(Clock::now() + std::chrono::milliseconds(delay)) {}
+    virtual void fire()
+    {
+        mResults.onFired(mDue);
+    }
+};
+
+static void benchWheel(const Params& params, const std::vector<unsigned>& delays,
+                       const std::vector<size_t>& cancels, Results& res)
+{
+    uint64_t armedAt = UINT64_MAX;
+    TimerWheel wheel([&armedAt, &res](uint64_t deadline)
+    {
+        armedAt = deadline;
+        res.arms++;
+    });
+
+    std::vector<megaHandle> handles;
+    handles.reserve(params.timerCount);
+    auto start = Clock::now();
+    for (auto delay: delays)
+        handles.push_back(wheel.add(new BenchEntry(res, delay), delay, false));
+    res.setNs = nsSince(start) / params.timerCount;
+
+    start = Clock::now();
+    for (auto i: cancels)
+        wheel.cancel(handles[i]);
+    res.cancelNs = cancels.empty() ? 0 : nsSince(start) / cancels.size();
+
+    // Simulates the OS timer, which would fire at the armed deadline
+    double expireNs = 0;
+    while (wheel.size())
+    {
+        uint64_t now = TimerWheel::steadyNowMs();
+        if (now < armedAt)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            continue;
+        }
+        auto expireStart = Clock::now();
+        wheel.expire(now);
+        expireNs += nsSince(expireStart);
+        res.batches++;
+    }
+    res.expireNsPerTimer = res.fired ? expireNs / res.fired : 0;
+}
+
+#ifdef HAVE_LIBEVENT
+struct EvTimers;
+struct EvTimer
+{
+    struct event* ev;
+    megaHandle handle;
+    EvTimers* owner;
+    Clock::time_point due;
+};
+
+struct EvTimers
+{
+    struct event_base* base;
+    std::unordered_map<megaHandle, EvTimer*> store;
+    std::recursive_mutex mutex;
+    megaHandle lastHandle = 0;
+    Results& res;
+    EvTimers(Results& aRes): base(event_base_new()), res(aRes) {}
+    ~EvTimers() { event_base_free(base); }
+    static void onTimer(evutil_socket_t, short, void* arg)
+    {
+        EvTimer* timer = static_cast<EvTimer*>(arg);
+        EvTimers& self = *timer->owner;
+        self.res.onFired(timer->due);
+        self.res.batches++;
+        self.mutex.lock();
+        self.store.erase(timer->handle);
+        self.mutex.unlock();
+        event_free(timer->ev);
+        delete timer;
+    }
+    megaHandle add(unsigned delay)
+    {
+        EvTimer* timer = new EvTimer;
+        timer->owner = this;
+        timer->due = Clock::now() + std::chrono::milliseconds(delay);
+        mutex.lock();
+        timer->handle = ++lastHandle;
+        store[timer->handle] = timer;
+        mutex.unlock();
+        timer->ev = event_new(base, -1, 0, &onTimer, timer);
+        struct timeval tv;
+        tv.tv_sec = delay / 1000;
+        tv.tv_usec = (delay % 1000) * 1000;
+        evtimer_add(timer->ev, &tv);
+        res.arms++;
+        return timer->handle;
+    }
+    void cancel(megaHandle handle)
+    {
+        mutex.lock();
+        auto it = store.find(handle);
+        EvTimer* timer = it->second;
+        store.erase(it);
+        mutex.unlock();
+        event_del(timer->ev);
+        event_free(timer->ev);
+        delete timer;
+    }
+};
+
+static void benchLibevent(const Params& params, const std::vector<unsigned>& delays,
+                          const std::vector<size_t>& cancels, Results& res)
+{
+    EvTimers timers(res);
+    std::vector<megaHandle> handles;
+    handles.reserve(params.timerCount);
+    auto start = Clock::now();
+    for (auto delay: delays)
+        handles.push_back(timers.add(delay));
+    res.setNs = nsSince(start) / params.timerCount;
+
+    start = Clock::now();
+    for (auto i: cancels)
+        timers.cancel(handles[i]);
+    res.cancelNs = cancels.empty() ? 0 : nsSince(start) / cancels.size();
+
+    // dispatch sleeps until the timers are due, so measure only the CPU time
+    std::clock_t cpuStart = std::clock();
+    event_base_dispatch(timers.base);
+    double expireNs = (double)(std::clock() - cpuStart) * 1e9 / CLOCKS_PER_SEC;
+    res.expireNsPerTimer = res.fired ? expireNs / res.fired : 0;
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    Params params;
+    params.timerCount = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 100000;
+    params.cancelPercent = (argc > 2) ? (unsigned)strtoul(argv[2], nullptr, 10) : 80;
+    params.maxDelayMs = (argc > 3) ? (unsigned)strtoul(argv[3], nullptr, 10) : 200;
+
+    std::vector<unsigned> delays;
+    std::vector<size_t> cancels;
+    makeLoad(params, delays, cancels);
+    printf("Timers: %zu, canceled: %zu, delays: 0-%u ms\n", params.timerCount, cancels.size(), params.maxDelayMs);
+
+    Results wheel;
+    benchWheel(params, delays, cancels, wheel);
+    printResults("wheel", wheel);
+    if (wheel.fired != params.timerCount - cancels.size() || wheel.early)
+    {
+        fprintf(stderr, "Timing wheel called %zu timers instead of %zu, %zu of them early\n",
+                wheel.fired, params.timerCount - cancels.size(), wheel.early);
+        return 1;
+    }
+
+#ifdef HAVE_LIBEVENT
+    Results libevent;
+    benchLibevent(params, delays, cancels, libevent);
+    printResults("libevent", libevent);
+#endif
+    return 0;
+}